@@ -44,6 +44,7 @@ typedef double pos_t;
 #define COST_FLOP_PC 215 // +-*: 206 AND/CMP:2 rsqrt:1
 #define COST_FLOP_EWALD 386 // +-*: 306 AND/CMP:3 div:2 rsqrt:1
 #define COST_FLOP_HLOOP 62 // +-*:46  AND/CMP:16 div: rsqrt:0
+#define COST_FLOP_EWALD_GRID 640 // +-*: 628 floor/CMP:12
 #define COST_FLOP_SOFT 15
 #define COST_FLOP_OPEN 97 // +-*:55  AND/CMP:42
 
@@ -125,6 +126,7 @@ struct pkdTimestepParameters {
     double dAccFac, dRhoFac, dPreFacRhoLoc;
     uint8_t uRungLo,uRungHi,uMaxRung;
     uint8_t bGravStep;
+    uint8_t bPotential; /* Potentials are needed for the energy */
     int iTimeStepCrit;
     int nPartRhoLoc;
     double nPartColl;
@@ -167,6 +169,11 @@ typedef struct {
 
     double dTime;
 
+    /* Selects the P-P kernel variant (see pkdGravEvalPP) */
+    int bPotential;
+    float fFourh2; /* Softening of every particle, or negative if it varies */
+    float fiSplit; /* 1/(2r_s) of the TreePM short-range kernel, or zero */
+
     double dFlopSingleCPU;
     double dFlopSingleGPU;
     double dFlopDoubleCPU;
@@ -0,0 +1,68 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cachestats.h"
+
+// Make sure that the communication structure is "trivial" so that it
+// can be moved around with "memcpy" which is required for MDL.
+static_assert(std::is_void<ServiceCacheStats::input>()  || std::is_trivial<ServiceCacheStats::input>());
+static_assert(std::is_void<ServiceCacheStats::output>() || std::is_trivial<ServiceCacheStats::output>());
+
+// Several IDs are shared by caches that are never open at the same time
+const char *ServiceCacheStats::name(int cid) {
+    static const char *names[CID_COUNT] = {
+	"particle", "cell", "group", "shrink", "bin", "shapes", "unused", "healpix",
+	"particle2", "cell2", "gridliny", "gridlinz"
+	};
+    return cid>=0 && cid<CID_COUNT ? names[cid] : "unknown";
+    }
+
+int ServiceCacheStats::Service(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    auto in  = static_cast<input*>(vin);
+    auto out = static_cast<output*>(vout);
+    assert(nIn == sizeof(input));
+    for(auto cid=0; cid<CID_COUNT; ++cid)
+	mdlCacheStatistics(pst->mdl,cid,&out->stats[cid],in->bReset);
+    if (mdlCore(pst->mdl)==0) mdlCacheRequestStatistics(pst->mdl,&out->nRequestLines,&out->nRequestMessages,in->bReset);
+    else out->nRequestLines = out->nRequestMessages = 0;
+    out->nThreads = 1;
+    return sizeof(output);
+    }
+
+int ServiceCacheStats::Combine(void *vout,void *vout2) {
+    auto out  = static_cast<output*>(vout);
+    auto out2 = static_cast<output*>(vout2);
+    for(auto cid=0; cid<CID_COUNT; ++cid) {
+	auto &a = out->stats[cid];
+	auto &b = out2->stats[cid];
+	a.nAccess += b.nAccess;
+	a.nMiss += b.nMiss;
+	a.nRemote += b.nRemote;
+	a.nPrefetch += b.nPrefetch;
+	a.nPrefetchHit += b.nPrefetchHit;
+	a.nBytesFetched += b.nBytesFetched;
+	a.nEvict += b.nEvict;
+	a.nT1 += b.nT1;
+	a.nT2 += b.nT2;
+	a.nB1 += b.nB1;
+	a.nB2 += b.nB2;
+	for(auto i=0; i<MDL_CACHE_LATENCY_BINS; ++i) a.nLatency[i] += b.nLatency[i];
+	}
+    out->nRequestLines += out2->nRequestLines;
+    out->nRequestMessages += out2->nRequestMessages;
+    out->nThreads += out2->nThreads;
+    return sizeof(output);
+    }
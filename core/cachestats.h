@@ -0,0 +1,38 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TraversePST.h"
+
+// Returns the cache statistics for every cache ID summed over all threads.
+// The ARC list sizes are also summed; divide by nThreads for a per-thread value.
+// Remote lines requested and the (batched) messages that carried them are per rank.
+class ServiceCacheStats : public TraverseCombinePST {
+public:
+    struct input {
+	int bReset;
+	};
+    struct output {
+	mdlCacheStats stats[CID_COUNT];
+	uint64_t nRequestLines, nRequestMessages;
+	int nThreads;
+	};
+    explicit ServiceCacheStats(PST pst)
+	: TraverseCombinePST(pst,PST_CACHESTATS,sizeof(input),sizeof(output),"CacheStats") {}
+    static const char *name(int cid);
+protected:
+    virtual int Service(PST pst,void *vin,int nIn,void *vout,int nOut);
+    virtual int Combine(void *vout,void *vout2);
+    };
@@ -24,6 +24,10 @@ GridInfo::GridInfo(MDL mdl,MDLFFT fft) {
     m_nz = fft->rgrid->nSlab;
     m_sy = fft->kgrid->sSlab;
     m_ny = fft->kgrid->nSlab;
+    m_syr = fft->rgrid->sPencil;
+    m_nyr = fft->rgrid->nPencil;
+    m_sxk = fft->kgrid->sPencil;
+    m_nxk = fft->kgrid->nPencil;
     m_iCore = mdlCore(mdl);
     m_nCore = mdlCores(mdl);
     }
@@ -40,24 +44,26 @@ void GridInfo::setupArray(real_t *dataFirst,real_array_t &rspace) {
     // - The x dimension is larger than the grid size: a1r()
     // - The z dimension is a slab on this processor: sz() -> ez()
     //   but it has dimensions 0 -> nz() to avoid overflowing index calculations
+    // - The y dimension is a pencil: syr() -> eyr() (all of it for slabs)
+    //   and is divided between the cores.
     // Note that we may end up with zero elements on some processors! nz()==0
-    auto ny = (n2()+m_nCore-1) / m_nCore;
+    auto ny = (nyr()+m_nCore-1) / m_nCore;
     auto sy = m_iCore * ny;
     auto ey = sy + ny;
-    if (sy >= n2()) sy = ey = 0;
-    else if (ey > n2()) ey = n2();
+    if (sy >= nyr()) sy = ey = 0;
+    else if (ey > nyr()) ey = nyr();
     ny = ey - sy;
     if (nz() && ny) {
         real_array_t rawr(
             dataFirst,
-            blitz::shape(a1r(),n2(),nz()), blitz::neverDeleteData,
+            blitz::shape(a1r(),nyr(),nz()), blitz::neverDeleteData,
             RegularArray());
         real_array_t rspace2=
             rawr(blitz::Range(0,n1r()-1),
                 blitz::Range(sy,ey-1),
                 blitz::Range(0,nz()-1));
         rspace.reference(rspace2);
-        rspace.reindexSelf(dimension_t(0,sy,sz())); // Correct "y" dimension
+        rspace.reindexSelf(dimension_t(0,syr()+sy,sz())); // Correct "y" dimension
         }
     // Create an empty array; note that the data pointer is NULL
     else {
@@ -76,23 +82,24 @@ void GridInfo::setupArray(complex_t *dataFirst,complex_array_t &kspace) {
     // - The z and y dimensions are transposed.
     // - The y dimension is a slab: sy() -> ey()
     //   but has dimensions 0 -> ny()
+    // - The x dimension is a pencil: sxk() -> exk() (all of it for slabs)
     auto nz = (n3()+m_nCore-1) / m_nCore;
     auto sz = m_iCore * nz;
     auto ez = sz + nz;
     if (sz >= n3()) sz = ez = 0;
     else if (ez > n3()) ez = n3();
     nz = ez - sz;
-    if (ny() && nz) {
+    if (ny() && nz && nxk()) {
         complex_array_t rawk( // Raw dimensions. May include holes
             dataFirst,
-            blitz::shape(a1k(),ny(),n3()), blitz::neverDeleteData,
+            blitz::shape(nxk(),ny(),n3()), blitz::neverDeleteData,
             TransposedArray());
         complex_array_t kspace2 = // Just the valid parts for our core
-            rawk(blitz::Range(0,n1k()-1),
+            rawk(blitz::Range(0,nxk()-1),
                 blitz::Range(0,ny()-1),
                 blitz::Range(sz,ez-1));
         kspace.reference(kspace2);
-        kspace.reindexSelf(dimension_t(0,sy(),sz)); // Correct "z" dimension
+        kspace.reindexSelf(dimension_t(sxk(),sy(),sz)); // Correct "x" and "z" dimensions
         }
     // Create an empty array; note that the data pointer is NULL
     else {
@@ -34,7 +34,9 @@
 #include "healpix.h"
 
 static const double twothird=2.0/3.0;
+static const double pi=3.141592653589793238462643383279502884197;
 static const double twopi=6.283185307179586476925286766559005768394;
+static const double halfpi=1.570796326794896619231321691639751442099;
 static const double inv_halfpi=0.6366197723675813430755350534900574;
 
 /*! Returns the remainder of the division \a v1/v2.
@@ -52,6 +54,17 @@ static double fmodulo (double v1, double v2)
 static hpint64 imodulo64 (hpint64 v1, hpint64 v2)
   { hpint64 v=v1%v2; return (v>=0) ? v : v+v2; }
 
+static hpint64 isqrt64(hpint64 v)
+  {
+  hpint64 res = sqrt(v+0.5);
+  if (v<((hpint64)(1)<<50)) return res;
+  if (res*res>v)
+    --res;
+  else if ((res+1)*(res+1)<=v)
+    ++res;
+  return res;
+  }
+
 hpint64 nside2npix64(hpint64 nside)
   { return 12*nside*nside; }
 
@@ -102,3 +115,55 @@ int64_t vec2pix_ring64(hpint64 nside, const double *vec)
   double sth=(fabs(cth)>0.99) ? sqrt(vec[0]*vec[0]+vec[1]*vec[1])/vlen : -5;
   return ang2pix_ring_z_phi64 (nside,cth,sth,atan2(vec[1],vec[0]));
   }
+
+static void pix2ang_ring_z_phi64 (hpint64 nside_, hpint64 pix,
+  double *z, double *s, double *phi)
+  {
+  hpint64 ncap_=nside_*(nside_-1)*2;
+  hpint64 npix_=12*nside_*nside_;
+  double fact2_ = 4./npix_;
+  *s=-5;
+  if (pix<ncap_) /* North Polar cap */
+    {
+    hpint64 iring = (1+isqrt64(1+2*pix))>>1; /* counted from North pole */
+    hpint64 iphi  = (pix+1) - 2*iring*(iring-1);
+
+    double tmp=(iring*iring)*fact2_;
+    *z = 1.0 - tmp;
+    if (*z>0.99) *s=sqrt(tmp*(2.-tmp));
+    *phi = (iphi-0.5) * halfpi/iring;
+    }
+  else if (pix<(npix_-ncap_)) /* Equatorial region */
+    {
+    double fact1_  = (nside_<<1)*fact2_;
+    hpint64 ip  = pix - ncap_;
+    hpint64 iring = ip/(4*nside_) + nside_; /* counted from North pole */
+    hpint64 iphi  = ip%(4*nside_) + 1;
+    /* 1 if iring+nside is odd, 1/2 otherwise */
+    double fodd = ((iring+nside_)&1) ? 1 : 0.5;
+
+    *z = (2*nside_-iring)*fact1_;
+    *phi = (iphi-fodd) * pi/(2*nside_);
+    }
+  else /* South Polar cap */
+    {
+    hpint64 ip = npix_ - pix;
+    hpint64 iring = (1+isqrt64(2*ip-1))>>1; /* counted from South pole */
+    hpint64 iphi  = 4*iring + 1 - (ip - 2*iring*(iring-1));
+
+    double tmp=(iring*iring)*fact2_;
+    *z = tmp - 1.0;
+    if (*z<-0.99) *s=sqrt(tmp*(2.-tmp));
+    *phi = (iphi-0.5) * halfpi/iring;
+    }
+  }
+
+void pix2vec_ring64(hpint64 nside, hpint64 ipix, double *vec)
+  {
+  double z, phi, stheta;
+  pix2ang_ring_z_phi64 (nside,ipix,&z,&stheta,&phi);
+  if (stheta<-2.) stheta=sqrt((1.-z)*(1.+z));
+  vec[0]=stheta*cos(phi);
+  vec[1]=stheta*sin(phi);
+  vec[2]=z;
+  }
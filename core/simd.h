@@ -384,6 +384,8 @@ inline vec<__m512,float> mask_mov(vec<__m512,float> const &src,mmask<__mmask16>
     { return _mm512_mask_mov_ps(src,k,a); }
 inline vec<__m512,float> maskz_mov(mmask<__mmask16> const &k,vec<__m512,float> const &a)
     { return _mm512_maskz_mov_ps(k,a); }
+/* Mask with the first n lanes set (partially filled last vector) */
+inline mmask<__mmask16> fmask_tail(int n) { return __mmask16((1u<<n)-1); }
 
 
 /**********************************************************************\
@@ -435,6 +437,7 @@ inline mmask<__mmask16> operator&(mmask<__mmask16> const &a,mmask<__mmask16> con
 inline mmask<__mmask16> operator|(mmask<__mmask16> const &a,mmask<__mmask16> const &b) { return _mm512_kor(a,b); }
 inline mmask<__mmask16> operator^(mmask<__mmask16> const &a,mmask<__mmask16> const &b) { return _mm512_kxor(a,b); }
 inline int testz(mmask<__mmask16> const &a) { return _mm512_kortestz(a,a); }
+inline int movemask(mmask<__mmask16> const &k) { return (int)(k); }
 
 /**********************************************************************\
 * AVX512 double precision
@@ -569,6 +572,9 @@ inline vec<__m256,float> mask_mov(vec<__m256,float> const &src,vec<__m256,float>
     { return _mm256_blendv_ps(src,a,p); }
 inline vec<__m256,float> maskz_mov(vec<__m256,float> const &p,vec<__m256,float> const &a) { return a & p; }
 inline int testz(vec<__m256,float> const &a) { return !_mm256_movemask_ps(a); }
+inline int movemask(vec<__m256,float> const &r2) { return _mm256_movemask_ps(r2); }
+inline vec<__m256,float> fmask_tail(int n)
+    { return _mm256_cmp_ps(_mm256_setr_ps(0,1,2,3,4,5,6,7),_mm256_set1_ps((float)n),_CMP_LT_OQ); }
 
 /**********************************************************************\
 * AVX 32-bit integer
@@ -708,6 +714,7 @@ inline int movemask(vec<__m128,float> const &r2) { return _mm_movemask_ps(r2); }
 inline vec<__m128,float> sqrt(vec<__m128,float> const &r2) { return _mm_sqrt_ps(r2); }
 inline int testz(vec<__m128,float> const &a) { return !_mm_movemask_ps(a); }
 inline vec<__m128,float> maskz_mov(vec<__m128,float> const &p,vec<__m128,float> const &a) { return a & p; }
+inline vec<__m128,float> fmask_tail(int n) { return _mm_cmplt_ps(_mm_setr_ps(0,1,2,3),_mm_set1_ps((float)n)); }
 inline vec<__m128,float> mask_mov(vec<__m128,float> const &src,vec<__m128,float> const &p,vec<__m128,float> const &a) {
 #ifdef __SSE4_1__
     return _mm_blendv_ps(src,a,p);
@@ -842,6 +849,7 @@ inline vec<float,float> maskz_mov(mmask<bool> const &p,vec<float,float> const &a
 inline vec<float,float> maskz_mov(bool const &p,vec<float,float> const &a) {
     return p ? a : vec<float,float>(0.0f); 
     }
+inline mmask<bool> fmask_tail(int n) { return n>0; }
 inline vec<float,float> mask_mov(vec<float,float> const &src,mmask<bool> const &p,vec<float,float> const &a) {
 	return p ? a : src;
     }
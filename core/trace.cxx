@@ -0,0 +1,61 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "trace.h"
+
+// Make sure that the communication structure is "trivial" so that it
+// can be moved around with "memcpy" which is required for MDL.
+static_assert(std::is_void<ServiceTrace::input>()  || std::is_trivial<ServiceTrace::input>());
+static_assert(std::is_void<ServiceTrace::output>() || std::is_trivial<ServiceTrace::output>());
+
+int ServiceTrace::Service(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    auto in  = static_cast<input*>(vin);
+    auto out = static_cast<output*>(vout);
+    auto mdl = static_cast<mdl::mdlClass *>(pst->mdl);
+    assert(nIn == sizeof(input));
+
+    if (in->achFile[0] && mdl->Tracing()) {
+	char achFile[PST_FILENAME_SIZE+16];
+	snprintf(achFile,sizeof(achFile),"%s.%d",in->achFile,mdl->Self());
+	FILE *fp = fopen(achFile,"w");
+	if (fp==NULL) {
+	    perror(achFile);
+	    abort();
+	    }
+	mdl->TraceWrite(fp);
+	fclose(fp);
+	}
+    for(auto i=0; i<MDL_PHASE_COUNT; ++i) {
+	out->dSum[i] = out->dMin[i] = out->dMax[i] = mdl->TracePhaseTime(i);
+	out->nCalls[i] = mdl->TracePhaseCount(i);
+	}
+    out->nThreads = 1;
+    mdl->TraceEnable(in->nEvents);
+    return sizeof(output);
+    }
+
+int ServiceTrace::Combine(void *vout,void *vout2) {
+    auto out  = static_cast<output*>(vout);
+    auto out2 = static_cast<output*>(vout2);
+    for(auto i=0; i<MDL_PHASE_COUNT; ++i) {
+	out->dSum[i] += out2->dSum[i];
+	out->dMin[i] = std::min(out->dMin[i],out2->dMin[i]);
+	out->dMax[i] = std::max(out->dMax[i],out2->dMax[i]);
+	out->nCalls[i] += out2->nCalls[i];
+	}
+    out->nThreads += out2->nThreads;
+    return sizeof(output);
+    }
@@ -0,0 +1,40 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "TraversePST.h"
+
+// Collects the per-phase timings from every thread, and optionally has each
+// thread write its timeline events to "achFile.<thread>". Tracing is then
+// (re)started with a fresh buffer, or turned off if nEvents is zero.
+class ServiceTrace : public TraverseCombinePST {
+public:
+    struct input {
+	int nEvents;
+	char achFile[PST_FILENAME_SIZE];
+	};
+    struct output {
+	double dSum[MDL_PHASE_COUNT];
+	double dMin[MDL_PHASE_COUNT];
+	double dMax[MDL_PHASE_COUNT];
+	uint64_t nCalls[MDL_PHASE_COUNT];
+	int nThreads;
+	};
+    explicit ServiceTrace(PST pst)
+	: TraverseCombinePST(pst,PST_TRACE,sizeof(input),sizeof(output),"Trace") {}
+protected:
+    virtual int Service(PST pst,void *vin,int nIn,void *vout,int nOut);
+    virtual int Combine(void *vout,void *vout2);
+    };
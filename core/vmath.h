@@ -282,4 +282,43 @@ i64v idx =
 
     return t;
     }
+
+/*
+** Single precision exp(x) for -32 <= x <= 0. The argument is scaled into
+** [-1,0], expanded about -1/2 and squared back up, so no integer vector
+** operations are needed. Relative error is a few 1e-6.
+*/
+static inline
+fvec expnegf(const fvec &x) {
+    fvec y = x*(1.0f/32.0f) + 0.5f;
+    fvec e = ((((((((
+	  2.7557319e-6f * y
+	+ 2.4801587e-5f) * y
+	+ 1.9841270e-4f) * y
+	+ 1.3888889e-3f) * y
+	+ 8.3333333e-3f) * y
+	+ 4.1666667e-2f) * y
+	+ 1.6666667e-1f) * y
+	+ 0.5f) * y
+	+ 1.0f) * y + 1.0f;
+    e *= fvec(0.60653066f); /* exp(-1/2) */
+    e *= e; e *= e; e *= e; e *= e; e *= e;
+    return e;
+    }
+
+/*
+** Single precision erfc(x) for x >= 0 (Abramowitz & Stegun 7.1.26, absolute
+** error below 1.5e-7). The exp(-x^2) value is passed in because it is needed
+** outside as well.
+*/
+static inline
+fvec erfcf(const fvec &x,const fvec &ex2) {
+    fvec t = fvec(1.0f) / (0.3275911f*x + 1.0f);
+    return ((((
+	  1.061405429f * t
+	- 1.453152027f) * t
+	+ 1.421413741f) * t
+	- 0.284496736f) * t
+	+ 0.254829592f) * t * ex2;
+    }
 #endif/*VMATH_H*/
@@ -0,0 +1,296 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "hilbertdd.h"
+#include "freestore.h"
+#include <cmath>
+
+/*
+** Domain decomposition along the Peano-Hilbert curve. Each PST node splits
+** the key range of its subtree at the key that balances the weight (the
+** measured work with PKD_MODEL_WORK, otherwise the number of particles) of
+** the lower and upper processors, and the particles are then moved with the
+** usual collect/swap rejects. Once a splitter exists it is only moved when
+** the split is out of balance by more than dTolerance, and then only as far
+** as is needed, so a rebalance only moves particles near the old splitters.
+*/
+
+namespace HilbertDD {
+
+constexpr int MAX_ITTR = 64;
+constexpr int NUM_SAFETY = 4;		/* slop space when filling up memory */
+constexpr int KEY_GALLOP_BITS = 20;	/* first step from an old splitter is this fraction of the key range */
+
+/*****************************************************************************\
+* ServiceHilbertDecomp
+\*****************************************************************************/
+
+static_assert(std::is_void<ServiceHilbertDecomp::input>()  || std::is_trivial<ServiceHilbertDecomp::input>());
+static_assert(std::is_void<ServiceHilbertDecomp::output>() || std::is_trivial<ServiceHilbertDecomp::output>());
+
+int ServiceHilbertDecomp::Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    auto mdl = static_cast<mdl::mdlClass *>(pst->mdl);
+    mdl::TraceScope trace(mdl,MDL_PHASE_DOMAIN);
+    auto in = static_cast<input*>(vin);
+    auto out = static_cast<output*>(vout);
+    assert(nIn == sizeof(input));
+    uint64_t iMinKey = in->iMinKey;
+    uint64_t iMaxKey = in->iMaxKey;
+    uint64_t iMidKey = KeySplit(pst,in->bnd,iMinKey,iMaxKey,in->dTolerance,in->fWorkDefault,in->bNewKeys);
+    /*
+    ** Now go on to the next levels with the key range of each half.
+    */
+    in->iMinKey = iMidKey;
+    auto rID = mdl->ReqService(pst->idUpper,PST_HILBERTDECOMP,in,nIn);
+    in->iMinKey = iMinKey;
+    in->iMaxKey = iMidKey-1;
+    Traverse(pst->pstLower,in,nIn,out,nOut);
+    output outUpper;
+    mdl->GetReply(rID,&outUpper);
+    /*
+    ** The domains are no longer boxes, so the PST bounds are those of the particles.
+    */
+    *out = out->combine(outUpper);
+    pst->bnd = *out;
+    return sizeof(output);
+    }
+
+int ServiceHilbertDecomp::Service(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    auto pkd = pst->plcl->pkd;
+    auto out = static_cast<output*>(vout);
+    pkdCalcBound(pkd,out); /* This also sets pkd->bnd for the tree build */
+    pst->bnd = *out;
+    return sizeof(output);
+    }
+
+uint64_t ServiceHilbertDecomp::KeySplit(PST pst,const Bound &bnd,uint64_t iMinKey,uint64_t iMaxKey,double dTolerance,double fWorkDefault,int bNewKeys) {
+    auto mdl = static_cast<mdl::mdlClass *>(pst->mdl);
+    ServiceKeyWeight::input inWt;
+    ServiceKeyWeight::output outWtLow,outWtHigh;
+    ServiceColKeyRejects::input inCol;
+    uint64_t nLowerStore,nUpperStore,nLow=0,nHigh=0;
+    uint64_t il,iu,im,iStep;
+    double fImbalance,fFirst;
+    int iRet,nOut,ittr;
+    int rID;
+
+    /*
+    ** First find out how much free storage there is available for particles
+    ** on the lower and upper subset of processors.
+    */
+    ServiceFreeStore::output outFree;
+    rID = mdl->ReqService(pst->idUpper,PST_FREESTORE,NULL,0);
+    Traverse(PST_FREESTORE,pst->pstLower,NULL,0,&outFree,sizeof(outFree));
+    nLowerStore = outFree;
+    mdl->GetReply(rID,&outFree);
+    nUpperStore = outFree;
+
+    /*
+    ** Weigh the split at iKey. The result is the excess weight per processor
+    ** of the lower half relative to the average; a half that would overflow
+    ** its store, or be left with fewer particles than processors, always
+    ** counts as too heavy or too light.
+    */
+    auto Weigh = [&](uint64_t iKey,int iTry) {
+	inWt.bnd = bnd;
+	inWt.fWorkDefault = fWorkDefault;
+	inWt.iKeySplit = iKey;
+	inWt.ittr = iTry;
+	inWt.iSplitSide = 1;
+	rID = mdl->ReqService(pst->idUpper,PST_KEYWEIGHT,&inWt,sizeof(inWt));
+	inWt.iSplitSide = 0;
+	Traverse(PST_KEYWEIGHT,pst->pstLower,&inWt,sizeof(inWt),&outWtLow,sizeof(outWtLow));
+	mdl->GetReply(rID,&outWtHigh);
+	nLow = outWtLow.nLow + outWtHigh.nLow;
+	nHigh = outWtLow.nHigh + outWtHigh.nHigh;
+	double fLow = outWtLow.fLow + outWtHigh.fLow;
+	double fHigh = outWtLow.fHigh + outWtHigh.fHigh;
+	if (nLow + NUM_SAFETY*pst->nLower > nLowerStore || nHigh < (uint64_t)pst->nUpper) return HUGE_VAL;
+	if (nHigh + NUM_SAFETY*pst->nUpper > nUpperStore || nLow < (uint64_t)pst->nLower) return -HUGE_VAL;
+	if (fLow + fHigh <= 0.0) return 0.0;
+	return (fLow/pst->nLower - fHigh/pst->nUpper) * pst->nLeaves / (fLow + fHigh);
+	};
+
+    il = iMinKey;
+    iu = iMaxKey;
+    im = pst->iKeySplit;
+    if (bNewKeys || im <= il || im >= iu) {
+	/*
+	** No usable splitter from before: bisect the whole key range.
+	*/
+	im = il + (iu-il)/2;
+	dTolerance = 0.0;
+	iStep = 0;
+	}
+    else iStep = std::max<uint64_t>((iu-il) >> KEY_GALLOP_BITS,1);
+
+    /*
+    ** Starting from the old splitter we take doubling steps in the direction
+    ** that restores the balance until it tips over, then bisect. We stop as
+    ** soon as the split is within the tolerance, so it moves no further than needed.
+    */
+    ittr = 0;
+    fFirst = fImbalance = Weigh(im,ittr);
+    while (std::fabs(fImbalance) > dTolerance && ittr < MAX_ITTR) {
+	if (fImbalance > 0) iu = im;
+	else il = im;
+	if (iu - il <= 1) break;
+	if (iStep && (fImbalance > 0) == (fFirst > 0)) {
+	    if (fImbalance > 0) im = (iu - il > iStep) ? iu - iStep : il + (iu-il)/2;
+	    else im = (iu - il > iStep) ? il + iStep : il + (iu-il)/2;
+	    iStep *= 2;
+	    }
+	else {
+	    iStep = 0;
+	    im = il + (iu-il)/2;
+	    }
+	fImbalance = Weigh(im,++ittr);
+	}
+    mdlprintf(pst->mdl, "id: %d (%d) Chose key split: %" PRIx64 " (%" PRIx64 ",%" PRIx64 ") Low %" PRIu64 " High %" PRIu64 " imbalance %g ittr=%d\n",
+	      pst->idSelf, pst->iLvl, im, iMinKey, iMaxKey, nLow, nHigh, fImbalance, ittr);
+    mdlassert(pst->mdl,nLow <= nLowerStore);
+    mdlassert(pst->mdl,nHigh <= nUpperStore);
+    mdlassert(pst->mdl,nLow >= (uint64_t)pst->nLower);
+    mdlassert(pst->mdl,nHigh >= (uint64_t)pst->nUpper);
+    pst->iKeySplit = im;
+
+    /*
+    ** Collect rejects.
+    */
+    auto pLowerRej = std::make_unique<OldDD::ServiceColRejects::output[]>(pst->nLower);
+    auto pUpperRej = std::make_unique<OldDD::ServiceColRejects::output[]>(pst->nUpper);
+    auto pidSwap = std::make_unique<int[]>(mdl->Threads());
+    inCol.bnd = bnd;
+    inCol.iKeySplit = pst->iKeySplit;
+    inCol.iSplitSide = 1;
+    rID = mdl->ReqService(pst->idUpper,PST_COLKEYREJECTS,&inCol,sizeof(inCol));
+    inCol.iSplitSide = 0;
+    nOut = Traverse(PST_COLKEYREJECTS,pst->pstLower,&inCol,sizeof(inCol),pLowerRej.get(),
+		    mdl->Threads()*sizeof(OldDD::ServiceColRejects::output));
+    mdlassert(pst->mdl,nOut/sizeof(OldDD::ServiceColRejects::output) == pst->nLower);
+    nOut = mdl->GetReply(rID,pUpperRej.get());
+    mdlassert(pst->mdl,nOut/sizeof(OldDD::ServiceColRejects::output) == pst->nUpper);
+    while (1) {
+	iRet = RejMatch(pst,pst->nLower,pLowerRej.get(),pst->nUpper,pUpperRej.get(),pidSwap.get());
+	if (!iRet) break;
+	rID = mdl->ReqService(pst->idUpper,PST_SWAPREJECTS,pidSwap.get(),
+			      mdl->Threads()*sizeof(int));
+	nOut = Traverse(PST_SWAPREJECTS,pst->pstLower,pidSwap.get(),mdl->Threads()*sizeof(int),
+			pLowerRej.get(),mdl->Threads()*sizeof(OldDD::ServiceSwapRejects::output));
+	mdlassert(pst->mdl,nOut/sizeof(OldDD::ServiceSwapRejects::output) == pst->nLower);
+	nOut = mdl->GetReply(rID,pUpperRej.get());
+	mdlassert(pst->mdl,nOut/sizeof(OldDD::ServiceSwapRejects::output) == pst->nUpper);
+	}
+    return pst->iKeySplit;
+    }
+
+/*****************************************************************************\
+* ServiceKeyWeight
+\*****************************************************************************/
+
+static_assert(std::is_void<ServiceKeyWeight::input>()  || std::is_trivial<ServiceKeyWeight::input>());
+static_assert(std::is_void<ServiceKeyWeight::output>() || std::is_trivial<ServiceKeyWeight::output>());
+
+int ServiceKeyWeight::Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    auto mdl = static_cast<mdl::mdlClass *>(pst->mdl);
+    auto in = static_cast<input*>(vin);
+    auto out = static_cast<output*>(vout);
+    auto rID = mdl->ReqService(pst->idUpper,PST_KEYWEIGHT,in,nIn);
+    Traverse(pst->pstLower,in,nIn,out,nOut);
+    output outWt;
+    mdl->GetReply(rID,&outWt);
+    out->nLow += outWt.nLow;
+    out->nHigh += outWt.nHigh;
+    out->fLow += outWt.fLow;
+    out->fHigh += outWt.fHigh;
+    return sizeof(output);
+    }
+
+int ServiceKeyWeight::Service(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    mdl::TraceScope trace(static_cast<mdl::mdlClass *>(pst->mdl),MDL_PHASE_DOMAIN);
+    auto plcl = pst->plcl;
+    auto pkd = plcl->pkd;
+    auto in = static_cast<input*>(vin);
+    auto out = static_cast<output*>(vout);
+
+    if (in->ittr == 0) {
+	/*
+	** Initialize.
+	*/
+	plcl->iKeySplit = in->iKeySplit;
+	plcl->iWtFrom = 0;
+	plcl->iWtTo = pkdLocal(pkd)-1;
+	plcl->fWtLow = 0.0;
+	plcl->fWtHigh = 0.0;
+	}
+    else {
+	/*
+	** Update the Weight Sums and use smaller weight region.
+	*/
+	if (in->iKeySplit < plcl->iKeySplit) {
+	    plcl->fWtHigh += plcl->fHigh;
+	    if (in->iSplitSide) plcl->iWtFrom = plcl->iPart;
+	    else plcl->iWtTo = plcl->iPart-1;
+	    }
+	else {
+	    plcl->fWtLow += plcl->fLow;
+	    if (in->iSplitSide) plcl->iWtTo = plcl->iPart-1;
+	    else plcl->iWtFrom = plcl->iPart;
+	    }
+	plcl->iKeySplit = in->iKeySplit;
+	}
+    int nLow,nHigh;
+    double fLow,fHigh;
+    plcl->iPart = pkdKeyWeight(pkd,&in->bnd,in->iKeySplit,in->iSplitSide,
+			       plcl->iWtFrom,plcl->iWtTo,in->fWorkDefault,&nLow,&nHigh,&fLow,&fHigh);
+    out->nLow = nLow;
+    out->nHigh = nHigh;
+    out->fLow = fLow + plcl->fWtLow;
+    out->fHigh = fHigh + plcl->fWtHigh;
+    plcl->fLow = fLow;
+    plcl->fHigh = fHigh;
+    return sizeof(output);
+    }
+
+/*****************************************************************************\
+* ServiceColKeyRejects
+\*****************************************************************************/
+
+static_assert(std::is_void<ServiceColKeyRejects::input>()  || std::is_trivial<ServiceColKeyRejects::input>());
+static_assert(std::is_void<ServiceColKeyRejects::output>() || std::is_trivial<ServiceColKeyRejects::output>());
+
+int ServiceColKeyRejects::Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    auto mdl = static_cast<mdl::mdlClass *>(pst->mdl);
+    auto pOutRej = static_cast<output*>(vout);
+    auto rID = mdl->ReqService(pst->idUpper,PST_COLKEYREJECTS,vin,nIn);
+    auto nLower = Traverse(pst->pstLower,vin,nIn,pOutRej,nOut);
+    auto iUpper = nLower/sizeof(output);
+    int nUpper;
+    nUpper = mdl->GetReply(rID,pOutRej+iUpper);
+    return nLower + nUpper;
+    }
+
+int ServiceColKeyRejects::Service(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    auto pkd = pst->plcl->pkd;
+    auto in = static_cast<input*>(vin);
+    auto pOutRej = static_cast<output*>(vout);
+    pOutRej->nRejects = pkdColKeyRejects(pkd,&in->bnd,in->iKeySplit,in->iSplitSide);
+    pOutRej->nSpace = pkdSwapSpace(pkd);
+    pOutRej->id = pst->idSelf;
+    pOutRej->nLocal = pkdLocal(pkd);
+    return sizeof(output);
+    }
+} // namespace HilbertDD
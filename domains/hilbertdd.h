@@ -0,0 +1,80 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HILBERTDD_H
+#define HILBERTDD_H
+#include "olddd.h"
+
+namespace HilbertDD {
+class ServiceHilbertDecomp : public OldDD::ServiceDomain {
+public:
+    struct input {
+	Bound bnd;		/* Box of the keys; the same at every level */
+	uint64_t iMinKey;
+	uint64_t iMaxKey;
+	double dTolerance;
+	double fWorkDefault;	/* Weight of a particle without measured work */
+	int bNewKeys;		/* The key box changed so the old splitters are meaningless */
+	};
+    typedef Bound output;	/* Bounds of the particles in the subtree */
+    explicit ServiceHilbertDecomp(PST pst)
+	: ServiceDomain(pst,PST_HILBERTDECOMP,sizeof(input),sizeof(output),"HilbertDecomp") {}
+protected:
+    virtual int Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) override;
+    virtual int Service(PST pst,void *vin,int nIn,void *vout,int nOut) override;
+private:
+    uint64_t KeySplit(PST pst,const Bound &bnd,uint64_t iMinKey,uint64_t iMaxKey,double dTolerance,double fWorkDefault,int bNewKeys);
+    };
+
+class ServiceKeyWeight : public TraversePST {
+public:
+    struct input {
+	Bound bnd;
+	uint64_t iKeySplit;
+	int iSplitSide;
+	int ittr;
+	double fWorkDefault;
+	};
+    struct output {
+	uint64_t nLow;
+	uint64_t nHigh;
+	double fLow;
+	double fHigh;
+	};
+    explicit ServiceKeyWeight(PST pst)
+	: TraversePST(pst,PST_KEYWEIGHT,sizeof(input),sizeof(output),"KeyWeight") {}
+protected:
+    virtual int Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) override;
+    virtual int Service(PST pst,void *vin,int nIn,void *vout,int nOut) override;
+    };
+
+class ServiceColKeyRejects : public TraversePST {
+public:
+    struct input {
+	Bound bnd;
+	uint64_t iKeySplit;
+	int iSplitSide;
+	};
+    typedef OldDD::ServiceColRejects::output output;
+    explicit ServiceColKeyRejects(PST pst)
+	: TraversePST(pst,PST_COLKEYREJECTS,sizeof(input),mdlThreads(pst->mdl)*sizeof(output),"ColKeyRejects") {}
+protected:
+    virtual int Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) override;
+    virtual int Service(PST pst,void *vin,int nIn,void *vout,int nOut) override;
+    };
+} // namespace HilbertDD
+
+#endif
@@ -32,6 +32,7 @@ static_assert(std::is_void<ServiceDomainDecomp::output>() || std::is_trivial<Ser
 
 int ServiceDomainDecomp::Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) {
     auto mdl = static_cast<mdl::mdlClass *>(pst->mdl);
+    mdl::TraceScope trace(mdl,MDL_PHASE_DOMAIN);
     auto in = static_cast<input *>(vin);
     static_assert(std::is_void<output>());
     assert(nIn == sizeof(input));
@@ -87,7 +88,7 @@ int ServiceDomainDecomp::Recurse(PST pst,void *vin,int nIn,void *vout,int nOut)
 	}
 
     mdlPrintTimer(pst->mdl,"TIME Mass Check done in pstDomainDecomp",&t);
-    RootSplit(pst,d,in->bDoRootFind,in->bDoSplitDimFind);
+    RootSplit(pst,d,in->bDoRootFind,in->bDoSplitDimFind,in->fWorkDefault);
     mdlPrintTimer(pst->mdl,"TIME RootSplit done in pstDomainDecomp",&t);
 
     mdlPrintTimer(pst->mdl,"TIME Mass Check done in pstDomainDecomp",&t);
@@ -155,7 +156,7 @@ int ServiceDomainDecomp::Service(PST pst,void *vin,int nIn,void *vout,int nOut)
     return 0;
     }
 
-void ServiceDomainDecomp::RootSplit(PST pst,int iSplitDim,int bDoRootFind,int bDoSplitDimFind) {
+void ServiceDomainDecomp::RootSplit(PST pst,int iSplitDim,int bDoRootFind,int bDoSplitDimFind,double fWorkDefault) {
     auto mdl = static_cast<mdl::mdlClass *>(pst->mdl);
     int NUM_SAFETY = 4;			/* slop space when filling up memory */
     uint64_t nSafeTot;			/* total slop space we have to play with */
@@ -227,6 +228,7 @@ void ServiceDomainDecomp::RootSplit(PST pst,int iSplitDim,int bDoRootFind,int bD
 	 * First find total number of active particles.
 	 */
 	ServiceWeight::input inWt;
+	inWt.fWorkDefault = fWorkDefault;
 	inWt.iSplitDim = d;
 	inWt.fSplit = fmm;
 	inWt.ittr = 0;
@@ -279,7 +281,13 @@ void ServiceDomainDecomp::RootSplit(PST pst,int iSplitDim,int bDoRootFind,int bD
 	    if (nLow == 1 && nHigh == 1) /* break on trivial case */
 		break;
 	    if (pFlag) {			/* split on work */
-		if (fLow/pst->nLower > fHigh/pst->nUpper) fu = fm;
+		/*
+		** Measured work can pile many light particles onto one side;
+		** never hand a side more active particles than it can store.
+		*/
+		if (nLow > nLowerStore-NUM_SAFETY*pst->nLower) fu = fm;
+		else if (nHigh > nUpperStore-NUM_SAFETY*pst->nUpper) fl = fm;
+		else if (fLow/pst->nLower > fHigh/pst->nUpper) fu = fm;
 		else if (fLow/pst->nLower < fHigh/pst->nUpper) fl = fm;
 		else break;
 		}
@@ -792,6 +800,7 @@ int ServiceSwapRejects::Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) {
     }
 
 int ServiceSwapRejects::Service(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    mdl::TraceScope trace(static_cast<mdl::mdlClass *>(pst->mdl),MDL_PHASE_DOMAIN);
     auto pkd = pst->plcl->pkd;
     auto pidSwap = static_cast<input*>(vin);
     auto pOutRej = static_cast<output*>(vout);
@@ -1018,6 +1027,7 @@ int ServiceWeight::Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) {
     }
 
 int ServiceWeight::Service(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    mdl::TraceScope trace(static_cast<mdl::mdlClass *>(pst->mdl),MDL_PHASE_DOMAIN);
     auto plcl = pst->plcl;
     auto pkd = plcl->pkd;
     auto in = static_cast<input*>(vin);
@@ -1071,7 +1081,7 @@ int ServiceWeight::Service(PST pst,void *vin,int nIn,void *vout,int nOut) {
     int nLow,nHigh;
     double fLow,fHigh;
     plcl->iPart = pkdWeight(pkd,in->iSplitDim,fSplit,iSplitSide,
-			    plcl->iWtFrom,plcl->iWtTo,
+			    plcl->iWtFrom,plcl->iWtTo,in->fWorkDefault,
 			    &nLow,&nHigh,&fLow,&fHigh);
     out->nLow = nLow;
     out->nHigh = nHigh;
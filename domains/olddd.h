@@ -14,6 +14,8 @@
  *  You should have received a copy of the GNU General Public License
  *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
  */
+#ifndef OLDDD_H
+#define OLDDD_H
 #include "TraversePST.h"
 
 namespace OldDD {
@@ -65,6 +67,9 @@ public:
     explicit ServiceDomain(PST node_pst,int service_id,
 	int nInBytes, const char *service_name="")
 	: TraversePST(node_pst,service_id, nInBytes, service_name) {}
+    explicit ServiceDomain(PST node_pst,int service_id,
+	int nInBytes, int nOutBytes, const char *service_name="")
+	: TraversePST(node_pst,service_id, nInBytes, nOutBytes, service_name) {}
 protected:
     int RejMatch(PST pst,int n1,ServiceColRejects::output *p1,int n2,ServiceColRejects::output *p2,int *pidSwap);
 };
@@ -78,6 +83,7 @@ public:
 	int bDoSplitDimFind;
 	uint64_t nActive;
 	uint64_t nTotal;
+	double fWorkDefault;	/* Weight of a particle without measured work */
 	};
     typedef void output;
     explicit ServiceDomainDecomp(PST pst)
@@ -86,7 +92,7 @@ protected:
     virtual int Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) override;
     virtual int Service(PST pst,void *vin,int nIn,void *vout,int nOut) override;
 private:
-    void RootSplit(PST pst,int iSplitDim,int bDoRootFind,int bDoSplitDimFind);
+    void RootSplit(PST pst,int iSplitDim,int bDoRootFind,int bDoSplitDimFind,double fWorkDefault);
     };
 
 class ServiceDomainOrder : public ServiceDomain {
@@ -133,6 +139,7 @@ public:
 	int iSplitSide;
 	int ittr;
 	int pFlag;
+	double fWorkDefault;
 	};
     struct output {
 	uint64_t nLow;
@@ -184,4 +191,6 @@ protected:
     virtual int Recurse(PST pst,void *vin,int nIn,void *vout,int nOut) override;
     virtual int Service(PST pst,void *vin,int nIn,void *vout,int nOut) override;
     };
-} // namespace OldDD
\ No newline at end of file
+} // namespace OldDD
+
+#endif
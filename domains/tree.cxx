@@ -974,6 +974,7 @@ void pkdTreeBuild(PKD pkd,int nBucket, int nGroup, uint32_t uRoot,uint32_t uTemp
     ** For more information look a pkdDumpTrees and the Initialize*() routines above.
     */
 
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
     if (uTemp==0) BuildTemp(pkd,uRoot,nBucket,nGroup,HUGE_VAL);
     else  BuildFromTemplate(pkd,uRoot,nBucket,nGroup,uTemp);
     Create(pkd,uRoot,ddHonHLimit);
@@ -999,6 +1000,7 @@ void pkdTreeBuild(PKD pkd,int nBucket, int nGroup, uint32_t uRoot,uint32_t uTemp
 void pkdGroupOrder(PKD pkd,uint32_t *iGrpOffset) {
     uint32_t i,gid,iTree;
     uint32_t *iGrpEnd = &iGrpOffset[pkd->nGroups]; /* tricky because the 0th element is not used! */
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
 
     /* Count the number of particles in each group */
     for (i=0;i<=pkd->nGroups;++i) iGrpOffset[i] = 0;
@@ -27,6 +27,7 @@
 #endif
 #include <math.h>
 #include <assert.h>
+#include <algorithm>
 #include "ewald.h"
 #include "pkd.h"
 #include "pkd.h"
@@ -126,8 +127,10 @@ double evalEwaldSIMD( PKD pkd,ewaldSIMD *ews,
     }
 #endif
 
-extern "C"
-double pkdParticleEwald(PKD pkd,double *r, float *pa, float *pPot,double *pdFlopSingle, double *pdFlopDouble) {
+/*
+** The exact Ewald correction: real space replicas plus the h-loop.
+*/
+static double particleEwaldExact(PKD pkd,double *r, float *pa, float *pPot,double *pdFlopSingle, double *pdFlopDouble) {
     struct EwaldVariables &ew = pkd->ew;
     EwaldTable *ewt = &pkd->ewt;
     const MOMC & restrict mom = ew.mom;
@@ -331,8 +334,153 @@ double pkdParticleEwald(PKD pkd,double *r, float *pa, float *pPot,double *pdFlop
     return dFlopDouble + dFlopSingle;
     }
 
+/*
+** Lagrange weights for the nodes at -1, 0, 1 and 2 (in cells) for 0 <= t < 1.
+*/
+static inline void cubicWeights(double t,float w[4]) {
+    double tp1 = t + 1.0, tm1 = t - 1.0, tm2 = t - 2.0;
+    w[0] = -t*tm1*tm2*(1.0/6.0);
+    w[1] = 0.5*tp1*tm1*tm2;
+    w[2] = -0.5*tp1*t*tm2;
+    w[3] = tp1*t*tm1*(1.0/6.0);
+    }
+
+/*
+** Tricubic interpolation of the Ewald table. Returns false if the
+** position is outside of the table (the caller uses the exact sum).
+** The four values of a node are adjacent so the inner loop is a
+** single vector multiply-add.
+*/
+static bool interpolateEwald(PKD pkd,const double *r,float *pa,float *pPot) {
+    const struct EwaldGrid &ewg = pkd->ewg;
+    const int n = ewg.nGrid + 3;
+    float w[3][4], sum[4] = {0,0,0,0};
+    int i[3];
+
+    for (int j=0; j<3; ++j) {
+	double u = (r[j] - pkd->ew.r[j] - ewg.dLower[j]) * ewg.fInvCell;
+	double f = floor(u);
+	if (f < 0.0 || f >= ewg.nGrid) return false;
+	i[j] = d2i(f);
+	cubicWeights(u-f,w[j]);
+	}
+    for (int ix=0; ix<4; ++ix) {
+	for (int iy=0; iy<4; ++iy) {
+	    const float *p = ewg.pTable + 4*((size_t(i[0]+ix)*n + i[1]+iy)*n + i[2]);
+	    float wxy = w[0][ix]*w[1][iy];
+	    for (int iz=0; iz<4; ++iz) {
+		float wt = wxy*w[2][iz];
+		for (int k=0; k<4; ++k) sum[k] += wt*p[4*iz+k];
+		}
+	    }
+	}
+    *pPot += sum[0];
+    pa[0] += sum[1];
+    pa[1] += sum[2];
+    pa[2] += sum[3];
+    return true;
+    }
+
+extern "C"
+double pkdParticleEwald(PKD pkd,double *r, float *pa, float *pPot,double *pdFlopSingle, double *pdFlopDouble) {
+    if (pkd->ewg.bValid && interpolateEwald(pkd,r,pa,pPot)) {
+	*pdFlopSingle += COST_FLOP_EWALD_GRID;
+	return COST_FLOP_EWALD_GRID;
+	}
+    return particleEwaldExact(pkd,r,pa,pPot,pdFlopSingle,pdFlopDouble);
+    }
+
+/* Radical inverse of i in the given base (Halton sequence) */
+static double halton(int i,int base) {
+    double f = 1.0, v = 0.0;
+    for ( ; i>0; i/=base) {
+	f /= base;
+	v += f * (i % base);
+	}
+    return v;
+    }
+
+/*
+** Build the Ewald table from the exact sum. It covers the offsets from
+** the expansion centre (ew.r) of every position in the periodic box and
+** includes the complete root multipole. Each thread fills an equal share
+** of the nodes. The table is then checked against the exact sum at a
+** fixed set of points; if the error is larger than dTol (relative to
+** M/L^2 for the acceleration and M/L for the potential) it is not used.
+*/
+static void ewaldGridInit(PKD pkd,int nGrid,double dTol) {
+    struct EwaldVariables &ew = pkd->ew;
+    struct EwaldGrid &ewg = pkd->ewg;
+    const int nCheck = 64;
+    int nCores = mdlCores(pkd->mdl);
+    int iCore = mdlCore(pkd->mdl);
+    double dFlopSingle=0, dFlopDouble=0;
+
+    if (nGrid != ewg.nGrid) {
+	if (ewg.pTable) {
+	    mdlThreadBarrier(pkd->mdl);
+	    mdlFreeArray(pkd->mdl,ewg.pTable);
+	    ewg.pTable = NULL;
+	    }
+	ewg.nGrid = nGrid;
+	ewg.nNodes = 0;
+	if (nGrid > 0) {
+	    size_t n = nGrid + 3;
+	    size_t nSlice = (n*n*n + nCores - 1) / nCores;
+	    auto pSlice = static_cast<float *>(mdlMallocArray(pkd->mdl,4*nSlice,sizeof(float),0));
+	    ewg.pTable = pSlice - 4*nSlice*iCore;
+	    ewg.nNodes = nSlice * nCores;
+	    }
+	}
+    ewg.bValid = 0;
+    if (nGrid <= 0) return;
+
+    const size_t n = nGrid + 3;
+    const size_t nSlice = ewg.nNodes / nCores;
+    const size_t iEnd = std::min(n*n*n,nSlice*(iCore+1));
+    const double h = ew.Lbox / nGrid;
+    ewg.fInvCell = 1.0 / h;
+    for (int j=0; j<3; ++j) ewg.dLower[j] = -0.5*ew.Lbox - ew.r[j];
+
+    for (size_t i=nSlice*iCore; i<iEnd; ++i) {
+	double r[3];
+	r[0] = ew.r[0] + ewg.dLower[0] + h*(int(i / (n*n)) - 1);
+	r[1] = ew.r[1] + ewg.dLower[1] + h*(int(i / n % n) - 1);
+	r[2] = ew.r[2] + ewg.dLower[2] + h*(int(i % n) - 1);
+	float *p = ewg.pTable + 4*i;
+	p[0] = p[1] = p[2] = p[3] = 0.0f;
+	particleEwaldExact(pkd,r,p+1,p,&dFlopSingle,&dFlopDouble);
+	}
+    mdlThreadBarrier(pkd->mdl);
+
+    /* Every thread checks the same points, so all reach the same verdict */
+    double fScaleA = ew.mom.m > 0.0 ? ew.Lbox*ew.Lbox/ew.mom.m : 1.0;
+    double fScaleP = ew.mom.m > 0.0 ? ew.Lbox/ew.mom.m : 1.0;
+    ewg.dError = 0.0;
+    ewg.bValid = 1;
+    for (int i=1; i<=nCheck; ++i) {
+	double r[3];
+	float ae[3] = {0,0,0}, ag[3] = {0,0,0}, pe = 0, pg = 0;
+	r[0] = ew.r[0] + ewg.dLower[0] + ew.Lbox*halton(i,2);
+	r[1] = ew.r[1] + ewg.dLower[1] + ew.Lbox*halton(i,3);
+	r[2] = ew.r[2] + ewg.dLower[2] + ew.Lbox*halton(i,5);
+	particleEwaldExact(pkd,r,ae,&pe,&dFlopSingle,&dFlopDouble);
+	if (!interpolateEwald(pkd,r,ag,&pg)) continue;
+	for (int j=0; j<3; ++j) ewg.dError = std::max(ewg.dError,fabs(ag[j]-ae[j])*fScaleA);
+	ewg.dError = std::max(ewg.dError,fabs(pg-pe)*fScaleP);
+	}
+    if (ewg.dError > dTol) {
+	ewg.bValid = 0;
+	if (pkd->idSelf==0 && !ewg.bWarned) {
+	    fprintf(stderr,"WARNING: Ewald table with nEwaldGrid=%d has error %g > dEwaldGridTol=%g; using the exact sum\n",
+		nGrid,ewg.dError,dTol);
+	    ewg.bWarned = 1;
+	    }
+	}
+    }
+
 extern "C"
-void pkdEwaldInit(PKD pkd,int nReps,double fEwCut,double fhCut) {
+void pkdEwaldInit(PKD pkd,int nReps,double fEwCut,double fhCut,int nGrid,double dGridTol) {
     struct EwaldVariables * const ew = &pkd->ew;
     EwaldTable * const ewt = &pkd->ewt;
     const MOMC * restrict mom = &ew->mom;
@@ -510,6 +658,7 @@ void pkdEwaldInit(PKD pkd,int nReps,double fEwCut,double fhCut) {
 	ewt->hSfac.f[i] = 0;
 	++i;
 	}
+    ewaldGridInit(pkd,nGrid,dGridTol);
 #ifdef USE_CL
     clEwaldInit(pkd->mdl->clCtx,ew,ewt);
     mdlThreadBarrier(pkd->mdl);
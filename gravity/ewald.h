@@ -24,7 +24,7 @@
 extern "C" {
 #endif
 double pkdParticleEwald(PKD pkd, double *r, float *pa, float *pPot,double *pdFlopSingle, double *pdFlopDouble);
-void pkdEwaldInit(PKD pkd,int nReps,double fEwCut,double fhCut);
+void pkdEwaldInit(PKD pkd,int nReps,double fEwCut,double fhCut,int nGrid,double dGridTol);
 #ifdef __cplusplus
     }
 #endif
@@ -0,0 +1,68 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FORCESPLIT_H
+#define FORCESPLIT_H
+#ifndef CUDA_DEVICE
+#define CUDA_DEVICE
+#endif
+
+/*
+** The P-P and P-C kernels take a force split policy. For the kernel
+** 1/r the n-th radial derivative is G_n = (2n-1)!!/r^(2n+1); factors()
+** returns the ratio s_n of the split kernel's G_n to this for n=0..nOrder.
+** The default is the full Newtonian force and costs nothing.
+*/
+struct NoForceSplit {
+    static const bool bActive = false;
+    CUDA_DEVICE NoForceSplit() {}
+    CUDA_DEVICE explicit NoForceSplit(float fiSplit) {}
+    template<class F>
+    CUDA_DEVICE void factors(const F &r,F *s,int nOrder) const {}
+    };
+
+#ifndef __CUDACC__
+#include "core/vmath.h"
+/*
+** Short-range part of the TreePM split, erfc(r/2r_s)/r. With y = r/2r_s:
+**   s_0 = erfc(y)
+**   s_n = s_(n-1) + 2^n y^(2n-1) exp(-y^2) / (sqrt(pi) (2n-1)!!)
+** so s_1 = erfc(y) + 2y/sqrt(pi) exp(-y^2) is the usual P-P force factor.
+** Beyond y^2 = 32 everything is below float precision and is set to zero.
+*/
+struct PMForceSplit {
+    static const bool bActive = true;
+    fvec fiSplit; /* 1/(2r_s) */
+    explicit PMForceSplit(float fiSplit) : fiSplit(fiSplit) {}
+    void factors(const fvec &r,fvec *s,int nOrder) const {
+	fvec y = r * fiSplit;
+	fvec y2 = y * y;
+	fmask inside = y2 < 32.0f;
+	y2 = min(y2,fvec(32.0f));
+	y = min(y,fvec(5.656854f));
+	fvec ex2 = expnegf(-y2);
+	fvec c = 1.128379167f * y * ex2; /* 2/sqrt(pi) */
+	s[0] = maskz_mov(inside,erfcf(y,ex2));
+	for(int n=1; n<=nOrder; ++n) {
+	    s[n] = s[n-1] + maskz_mov(inside,c);
+	    c *= y2 * (2.0f / (2*n+1));
+	    }
+	}
+    };
+#endif
+
+#endif
@@ -27,6 +27,7 @@
 #include <stddef.h>
 #include <assert.h>
 #include <time.h>
+#include <algorithm>
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
@@ -74,6 +75,45 @@ static inline float rsqrtf(float v) {
     dir = 1/sqrt(d2);\
     }
 
+/*
+** Light cone for a bucket of freshly kicked particles. The periodic
+** replicas that the bucket can reach during the drift are found first
+** from the box swept by its particles, so that the per-particle test
+** only has to consider those (usually none, or just one).
+*/
+static void processLightCone(PKD pkd,workParticle *wp) {
+    const struct pkdLightconeParameters *lc = wp->lc;
+    double rLo[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL};
+    double rHi[3] = {-HUGE_VAL,-HUGE_VAL,-HUGE_VAL};
+    double dKickDelta = 0.0;
+    LCREPLICAS rep;
+    int i,j;
+
+    for( i=0; i<wp->nP; i++ ) {
+	PARTICLE *p = wp->pPart[i];
+	const vel_t *v = pkdVel(pkd,p);
+	double dt = lc->dtLCDrift[p->uRung];
+	double r[3];
+	pkdGetPos1(pkd,p,r);
+	for (j=0;j<3;++j) {
+	    if (r[j] < -0.5) r[j] += 1.0;
+	    else if (r[j] >= 0.5) r[j] -= 1.0;
+	    double r1 = r[j] + dt*v[j];
+	    rLo[j] = std::min(rLo[j],std::min(r[j],r1));
+	    rHi[j] = std::max(rHi[j],std::max(r[j],r1));
+	    }
+	dKickDelta = std::max(dKickDelta,lc->dtLCKick[p->uRung]);
+	}
+    pkdLightConeReplicas(pkd,&rep,rLo,rHi,lc->dLookbackFac,dKickDelta,lc->dBoxSize);
+    if (rep.nBox == 0) return;
+    for( i=0; i<wp->nP; i++ ) {
+	PARTICLE *p = wp->pPart[i];
+	pkdProcessLightCone(pkd,p,wp->pInfoOut[i].fPot,lc->dLookbackFac,lc->dLookbackFacLCP,
+	    lc->dtLCDrift[p->uRung],lc->dtLCKick[p->uRung],
+	    lc->dBoxSize,lc->bLightConeParticles,&rep);
+	}
+    }
+
 /*
 ** This is called after work has been done for this particle group.
 ** If everyone has finished, then the particle is updated.
@@ -215,19 +255,17 @@ void pkdParticleWorkDone(workParticle *wp) {
 		    v[0] += wp->kick->dtOpen[p->uRung]*wp->pInfoOut[i].a[0];
 		    v[1] += wp->kick->dtOpen[p->uRung]*wp->pInfoOut[i].a[1];
 		    v[2] += wp->kick->dtOpen[p->uRung]*wp->pInfoOut[i].a[2];		    
-		    /*
-		    ** On KickOpen we also always check for intersection with the lightcone
-		    ** surface over the entire next timestep of the particle (not a half
-		    ** timestep as is usual for kicking (we are drifting afterall).
-		    */
-		    if (wp->lc->dLookbackFac > 0) {
-			pkdProcessLightCone(pkd,p,wp->pInfoOut[i].fPot,wp->lc->dLookbackFac,wp->lc->dLookbackFacLCP,
-				wp->lc->dtLCDrift[p->uRung],wp->lc->dtLCKick[p->uRung],
-				wp->lc->dBoxSize,wp->lc->bLightConeParticles);
-			}
 		    }
 		}
 	    }
+	/*
+	** On KickOpen we also always check for intersection with the lightcone
+	** surface over the entire next timestep of the particle (not a half
+	** timestep as is usual for kicking (we are drifting afterall).
+	*/
+	if (pkd->oFieldOffset[oVelocity] && wp->kick && wp->kick->bKickOpen && wp->lc->dLookbackFac > 0) {
+	    processLightCone(pkd,wp);
+	    }
 	delete [] wp->pPart;
 	delete [] wp->iPart;
 	delete [] wp->pInfoIn;
@@ -252,7 +290,7 @@ int CPUdoWorkPP(void *vpp) {
     pOut->fPot = 0.0;
     pOut->dirsum = 0.0;
     pOut->normsum = 0.0;
-    pkdGravEvalPP(pPart,nBlocks,nInLast,blk,pOut);
+    pkdGravEvalPP(pPart,nBlocks,nInLast,blk,pOut,wp->ts->bGravStep,wp->bPotential,wp->fFourh2,wp->fiSplit);
     wp->dFlopSingleCPU += COST_FLOP_PP*(tile->lstTile.nBlocks*ILP_PART_PER_BLK  + tile->lstTile.nInLast);
     if ( ++pp->i == pp->work->nP ) return 0;
     else return 1;
@@ -281,7 +319,8 @@ static void queuePP( PKD pkd, workParticle *wp, ILP ilp, int bGravStep ) {
     ILPTILE tile;
     ILP_LOOP(ilp,tile) {
 #ifdef USE_CUDA
-	if (CudaClientQueuePP(pkd->cudaClient,wp,tile,bGravStep)) continue;
+	/* The GPU kernels have no short-range (TreePM) variant */
+	if (wp->fiSplit==0.0f && CudaClientQueuePP(pkd->cudaClient,wp,tile,bGravStep)) continue;
 #endif
         auto pp = new workPP;
 	assert(pp!=NULL);
@@ -293,7 +332,7 @@ static void queuePP( PKD pkd, workParticle *wp, ILP ilp, int bGravStep ) {
 	pp->i = 0;
 	tile->lstTile.nRefs++;
 	wp->nRefs++;
-	mdlAddWork(pkd->mdl,pp,NULL,NULL,CPUdoWorkPP,doneWorkPP);
+	mdlAddWork(pkd->mdl,pp,NULL,NULL,CPUdoWorkPP,doneWorkPP,MDL_PHASE_PP);
 	}
     }
 
@@ -313,7 +352,7 @@ int CPUdoWorkPC(void *vpc) {
     pOut->fPot = 0.0;
     pOut->dirsum = 0.0;
     pOut->normsum = 0.0;
-    pkdGravEvalPC(pPart,nBlocks,nInLast,blk,pOut);
+    pkdGravEvalPC(pPart,nBlocks,nInLast,blk,pOut,wp->fiSplit);
     wp->dFlopSingleCPU += COST_FLOP_PC*(tile->lstTile.nBlocks*ILC_PART_PER_BLK  + tile->lstTile.nInLast);
     if ( ++pc->i == pc->work->nP ) return 0;
     else return 1;
@@ -345,7 +384,7 @@ static void queuePC( PKD pkd,  workParticle *wp, ILC ilc, int bGravStep ) {
 
     ILC_LOOP(ilc,tile) {
 #ifdef USE_CUDA
-        if (CudaClientQueuePC(pkd->cudaClient,wp,tile,bGravStep)) continue;
+        if (wp->fiSplit==0.0f && CudaClientQueuePC(pkd->cudaClient,wp,tile,bGravStep)) continue;
 #endif
 	pc = new workPC;
 	assert(pc!=NULL);
@@ -357,14 +396,16 @@ static void queuePC( PKD pkd,  workParticle *wp, ILC ilc, int bGravStep ) {
 	pc->i = 0;
 	tile->lstTile.nRefs++;
 	wp->nRefs++;
-	mdlAddWork(pkd->mdl,pc,NULL,NULL,CPUdoWorkPC,doneWorkPC);
+	mdlAddWork(pkd->mdl,pc,NULL,NULL,CPUdoWorkPC,doneWorkPC,MDL_PHASE_PC);
 	}
     }
 
 static void queueEwald( PKD pkd, workParticle *wp ) {
+    mdl::TraceScope trace(static_cast<mdl::mdlClass *>(pkd->mdl),MDL_PHASE_EWALD);
     int i;
 #ifdef USE_CUDA
-    int nQueued = CudaClientQueueEwald(pkd->cudaClient,wp);
+    /* Interpolating the Ewald table is cheaper than sending the particles */
+    int nQueued = pkd->ewg.bValid ? 0 : CudaClientQueueEwald(pkd->cudaClient,wp);
 #else
     int nQueued = 0;
 #endif
@@ -381,6 +422,24 @@ static void queueEwald( PKD pkd, workParticle *wp ) {
     pkdParticleWorkDone(wp);
     }
 
+/*
+** Returns 4h^2 if every particle has the same softening, otherwise -1.
+** The P-P kernel can then use a constant instead of the value in the list.
+*/
+static float uniformFourh2(PKD pkd) {
+    float fSoft;
+    int i;
+    if ( pkd->fSoftFix >= 0.0 ) fSoft = pkd->fSoftFix;
+    else if ( pkd->oFieldOffset[oSoft] || pkd->nClasses < 1 ) return -1.0f;
+    else {
+	fSoft = pkd->pClass[0].fSoft;
+	for(i=1; i<pkd->nClasses; ++i) if (pkd->pClass[i].fSoft != fSoft) return -1.0f;
+	}
+    fSoft *= pkd->fSoftFac;
+    if ( fSoft > pkd->fSoftMax ) fSoft = pkd->fSoftMax;
+    return 4*fSoft*fSoft;
+    }
+
 /*
 ** This version of grav.c does all the operations inline, including
 ** v_sqrt's and such.
@@ -437,6 +496,14 @@ int pkdGravInteract(PKD pkd,
     wp->lc = lc;
     wp->kick = kick;
 
+    /* The potential is also needed to store it, for group minima and in the lightcone */
+    wp->bPotential = ts->bPotential || pkd->oFieldOffset[oPotential] || pkd->ga != NULL || lc->dLookbackFac > 0;
+    wp->fFourh2 = uniformFourh2(pkd);
+    wp->fiSplit = pkd->fiPMSplit;
+
+    /* Every particle of the bucket sees the same lists; this is its work for the domain decomposition */
+    const float fWork = ilpCount(ilp)*COST_FLOP_PP + ilcCount(ilc)*COST_FLOP_PC + (bEwald ? COST_FLOP_EWALD : 0);
+
     for (i=pkdn->pLower;i<=pkdn->pUpper;++i) {
 	p = pkdParticle(pkd,i);
 	if (!pkdIsRungRange(p,ts->uRungLo,ts->uRungHi)) continue;
@@ -448,6 +515,7 @@ int pkdGravInteract(PKD pkd,
 	nP = wp->nP++;
 	wp->pPart[nP] = p;
 	wp->iPart[nP] = i;
+	pkdSetWork(pkd,p,fWork);
 	wp->pInfoIn[nP].r[0]  = (float)(r[0] - ilp->cx);
 	wp->pInfoIn[nP].r[1]  = (float)(r[1] - ilp->cy);
 	wp->pInfoIn[nP].r[2]  = (float)(r[2] - ilp->cz);
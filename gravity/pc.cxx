@@ -26,8 +26,8 @@
 #include "pkd.h"
 #include "pc.h"
 
-extern "C"
-void pkdGravEvalPC(PINFOIN *pPart, int nBlocks, int nInLast, ILC_BLK *blk,  PINFOOUT *pOut ) {
+template<class S>
+static void evalPC(PINFOIN *pPart, int nBlocks, int nInLast, ILC_BLK *blk,  PINFOOUT *pOut, float fiSplit ) {
     fvec x,y,z;
     fvec adotai;
     fvec tx,ty,tz;
@@ -49,13 +49,14 @@ void pkdGravEvalPC(PINFOIN *pPart, int nBlocks, int nInLast, ILC_BLK *blk,  PINF
     float *a =pPart->a;
     float a2 = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
     fvec imaga = a2 > 0.0f ? 1.0f / sqrtf(a2) : 0.0f;
+    const S split(fiSplit);
 
-    /* Pad the last value if necessary */
-    for( j = nInLast; j&fvec::mask(); j++) {
-	blk[nBlocks].dx.f[j] = blk[nBlocks].dy.f[j] = blk[nBlocks].dz.f[j] = 1e18f;
-	blk[nBlocks].m.f[j] = 0.0f;
-	blk[nBlocks].u.f[j] = 0.0f;
-	}
+    /*
+    ** The unused lanes of a partially filled last vector are replaced in
+    ** registers by distant, empty cells rather than padding the list.
+    */
+    int nTail = nInLast & fvec::mask();
+    fmask keep = fmask_tail(nTail);
 
     ax = 0.0;
     ay = 0.0;
@@ -98,8 +99,26 @@ void pkdGravEvalPC(PINFOIN *pPart, int nBlocks, int nInLast, ILC_BLK *blk,  PINF
 #endif
             fvec Im = blk->m.p[j];
             fvec Iu = blk->u.p[j];
+	    if (nTail && nLeft==0 && j==n-1) {
+		Idx = mask_mov(fvec(1e18f),keep,Idx);
+		Idy = mask_mov(fvec(1e18f),keep,Idy);
+		Idz = mask_mov(fvec(1e18f),keep,Idz);
+		Im = maskz_mov(keep,Im);
+		Iu = maskz_mov(keep,Iu);
+		Ixxxx = maskz_mov(keep,Ixxxx); Ixxxy = maskz_mov(keep,Ixxxy); Ixxxz = maskz_mov(keep,Ixxxz);
+		Ixxyz = maskz_mov(keep,Ixxyz); Ixxyy = maskz_mov(keep,Ixxyy); Iyyyz = maskz_mov(keep,Iyyyz);
+		Ixyyz = maskz_mov(keep,Ixyyz); Ixyyy = maskz_mov(keep,Ixyyy); Iyyyy = maskz_mov(keep,Iyyyy);
+		Ixxx = maskz_mov(keep,Ixxx); Ixyy = maskz_mov(keep,Ixyy); Ixxy = maskz_mov(keep,Ixxy);
+		Iyyy = maskz_mov(keep,Iyyy); Ixxz = maskz_mov(keep,Ixxz); Iyyz = maskz_mov(keep,Iyyz);
+		Ixyz = maskz_mov(keep,Ixyz);
+		Ixx = maskz_mov(keep,Ixx); Ixy = maskz_mov(keep,Ixy); Ixz = maskz_mov(keep,Ixz);
+		Iyy = maskz_mov(keep,Iyy); Iyz = maskz_mov(keep,Iyz);
+#ifdef USE_DIAPOLE
+		Ix = maskz_mov(keep,Ix); Iy = maskz_mov(keep,Iy); Iz = maskz_mov(keep,Iz);
+#endif
+		}
 
-	    EvalPC<fvec,fmask,true>(
+	    EvalPC<fvec,fmask,true,S>(
 		fx, fy, fz, pSmooth2,
 		Idx, Idy, Idz, Im, Iu,
 		Ixxxx, Ixxxy, Ixxxz, Ixxyz, Ixxyy, Iyyyz, Ixyyz, Ixyyy, Iyyyy,
@@ -109,7 +128,7 @@ void pkdGravEvalPC(PINFOIN *pPart, int nBlocks, int nInLast, ILC_BLK *blk,  PINF
 #endif
 		tax, tay, taz, tpot,
 		Pax, Pay, Paz,imaga,
-		ir, norm);
+		ir, norm, split);
 
 	    dirsum += ir;
 	    normsum += norm;
@@ -127,4 +146,13 @@ void pkdGravEvalPC(PINFOIN *pPart, int nBlocks, int nInLast, ILC_BLK *blk,  PINF
     pOut->dirsum += hadd(dirsum);
     pOut->normsum += hadd(normsum);
     }
+
+/*
+** A non-zero fiSplit, 1/(2r_s), selects the TreePM short-range kernel.
+*/
+extern "C"
+void pkdGravEvalPC(PINFOIN *pPart, int nBlocks, int nInLast, ILC_BLK *blk,  PINFOOUT *pOut, float fiSplit ) {
+    if (fiSplit > 0.0f) evalPC<PMForceSplit>(pPart,nBlocks,nInLast,blk,pOut,fiSplit);
+    else evalPC<NoForceSplit>(pPart,nBlocks,nInLast,blk,pOut,fiSplit);
+    }
 #endif/*USE_SIMD_PC*/
@@ -18,7 +18,8 @@
 #ifndef CUDA_DEVICE
 #define CUDA_DEVICE
 #endif
-template<class F,class M,bool bGravStep>
+#include "forcesplit.h"
+template<class F,class M,bool bGravStep,class S=NoForceSplit>
 CUDA_DEVICE void EvalPC(
 	const F &Pdx, const F &Pdy, const F &Pdz, const F &Psmooth2, // Particle
 	const F &Idx, const F &Idy, const F &Idz, const F &Im, const F &Iu, // Interaction(s)
@@ -29,7 +30,8 @@ CUDA_DEVICE void EvalPC(
 	const F &Ix, const F &Iy, const F &Iz,
 #endif
 	F &ax, F &ay, F &az, F &pot,     // Results
-	const F &Pax, const F &Pay, const F &Paz,const F &imaga,F &ir, F &norm) {
+	const F &Pax, const F &Pay, const F &Paz,const F &imaga,F &ir, F &norm,
+	const S &split=S()) {
     const F onethird = 1.0f/3.0f;
     F dx = Idx + Pdx;
     F dy = Idy + Pdy;
@@ -79,15 +81,37 @@ CUDA_DEVICE void EvalPC(
     xz = g2*(-(Ixx + Iyy)*z + Ixz*x + Iyz*y);
     g2 = 0.5f*(xx*x + xy*y + xz*z);
     F g0 = dir * Im;
-    pot = -(g0 + g2 + g3 + g4);
-    g0 += 5.0f*g2 + 7.0f*g3 + 9.0f*g4;
+    /*
+    ** With a force split each order n is scaled by s_n, except for the
+    ** radial part of the force which comes from the next derivative.
+    */
+    F s[6];
+    if (S::bActive) {
+	split.factors(d2*dir,s,5);
+	pot = -(s[0]*g0 + s[2]*g2 + s[3]*g3 + s[4]*g4);
+	g0 = s[1]*g0 + 5.0f*s[3]*g2 + 7.0f*s[4]*g3 + 9.0f*s[5]*g4;
+	xx *= s[2]; xy *= s[2]; xz *= s[2];
+	xxx *= s[3]; xxy *= s[3]; xxz *= s[3];
+	tx *= s[4]; ty *= s[4]; tz *= s[4];
+	}
+    else {
+	pot = -(g0 + g2 + g3 + g4);
+	g0 += 5.0f*g2 + 7.0f*g3 + 9.0f*g4;
+	}
 #ifdef USE_DIAPOLE
     yy = g1*Ix;
     yz = g1*Iy;
     zz = g1*Iz;
     g1 = yy*x + yz*y + zz*z;
-    pot -= g1;
-    g0 += 3.0f*g1; 
+    if (S::bActive) {
+	pot -= s[1]*g1;
+	g0 += 3.0f*s[2]*g1;
+	yy *= s[1]; yz *= s[1]; zz *= s[1];
+	}
+    else {
+	pot -= g1;
+	g0 += 3.0f*g1;
+	}
 #else
     yy = 0.0f;
     yz = 0.0f;
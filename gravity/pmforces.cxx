@@ -238,6 +238,78 @@ int pstSetLinGrid(PST pst,void *vin,int nIn,void *vout,int nOut) {
     return 0;
     }
 
+/********************************************************************************\
+*
+* TreePM long-range force
+*
+\********************************************************************************/
+
+/*
+** Grid 0 holds the mass assigned with pkdAssignMass. Replace it with the
+** long-range force, the Fourier filtered complement of the erfc short-range
+** kernel, in grids 0, 1 and 2 (x, y, z) where pkdLinearKick expects it.
+** Both the assignment and the interpolation windows are deconvolved.
+*/
+extern "C"
+void pkdSetPMGrid(PKD pkd, double dSplit, int iAssignment) {
+    auto fft = pkd->fft;
+    int nGrid = fft->rgrid->n1;
+    int iNyquist = nGrid / 2;
+    GridInfo G(pkd->mdl,fft);
+    AssignmentWindow W(nGrid,iAssignment);
+    auto data = reinterpret_cast<real_t *>(mdlSetArray(pkd->mdl,0,0,pkd->pLite));
+    complex_array_t KX, KY, KZ;
+    G.setupArray(data,KX);
+    G.setupArray(data + fft->rgrid->nLocal,KY);
+    G.setupArray(data + 2*fft->rgrid->nLocal,KZ);
+
+    mdlFFT(pkd->mdl,fft,data);
+
+    /* Mass per cell to density, and the FFT normalization, give 1/L^3 */
+    const double L = pkd->fPeriod[0];
+    const double dk = 2*M_PI / L;
+    const double dNormalization = 4*M_PI / (L*L*L);
+    const double rs2 = dSplit*dSplit;
+    for( auto index=KX.begin(); index!=KX.end(); ++index ) {
+	auto pos = index.position();
+	int ix = pos[0]; // Range: (-iNyquist,iNyquist]
+	int iy = pos[1]>iNyquist ? pos[1] - nGrid : pos[1];
+	int iz = pos[2]>iNyquist ? pos[2] - nGrid : pos[2];
+	double k2 = dk*dk * (ix*ix + iy*iy + iz*iz);
+	if (k2 == 0.0) { // No force from the mean density
+	    *index = KY(pos) = KZ(pos) = 0;
+	    continue;
+	    }
+	double win = W[ix] * W[abs(iy)] * W[abs(iz)];
+	/* F(k) = -ik phi(k) with phi(k) = -4 pi rho(k) exp(-k^2 r_s^2) / k^2 */
+	complex_t f = *index * complex_t(0,dNormalization * exp(-k2*rs2) / k2 * win*win);
+	/* The derivative at the Nyquist frequency is not defined; drop it. */
+	KY(pos) = iy==iNyquist ? complex_t(0) : f * real_t(dk*iy);
+	KZ(pos) = iz==iNyquist ? complex_t(0) : f * real_t(dk*iz);
+	*index  = ix==iNyquist ? complex_t(0) : f * real_t(dk*ix);
+	}
+
+    mdlIFFT(pkd->mdl,fft,reinterpret_cast<FFTW3(complex) *>(data));
+    mdlIFFT(pkd->mdl,fft,reinterpret_cast<FFTW3(complex) *>(data + fft->rgrid->nLocal));
+    mdlIFFT(pkd->mdl,fft,reinterpret_cast<FFTW3(complex) *>(data + 2*fft->rgrid->nLocal));
+    }
+
+extern "C"
+int pstSetPMGrid(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    LCL *plcl = pst->plcl;
+    struct inSetPMGrid *in = reinterpret_cast<struct inSetPMGrid *>(vin);
+    assert (nIn==sizeof(struct inSetPMGrid) );
+    if (pstNotCore(pst)) {
+        int rID = mdlReqService(pst->mdl, pst->idUpper, PST_SETPMGRID, vin, nIn);
+        pstSetPMGrid(pst->pstLower, vin, nIn, NULL, 0);
+        mdlGetReply(pst->mdl,rID,NULL,NULL);
+    }
+    else {
+        pkdSetPMGrid(plcl->pkd, in->dSplit, in->iAssignment);
+    }
+    return 0;
+    }
+
 typedef blitz::Array<float,3> force_array_t;
 typedef blitz::TinyVector<int,3> shape_t;
 typedef blitz::TinyVector<double,3> position_t;
@@ -288,7 +360,7 @@ static void fetch_forces(PKD pkd,int cid,int nGrid,force_array_t &forces, const
 	}
     }
 
-void pkdLinearKick(PKD pkd,vel_t dtOpen,vel_t dtClose, int iAssignment=4) {
+void pkdLinearKick(PKD pkd,vel_t dtOpen,vel_t dtClose, int bAccel, int iAssignment=4) {
     const std::size_t maxSize = 100000; // We would like this to remain in L2 cache
     std::vector<float> dataX, dataY, dataZ;
     dataX.reserve(maxSize);
@@ -336,13 +408,24 @@ void pkdLinearKick(PKD pkd,vel_t dtOpen,vel_t dtClose, int iAssignment=4) {
 	    fetch_forces(pkd,CID_GridLinFz,nGrid,forcesZ,ilower);
 	    for( int i=kdn->pLower; i<=kdn->pUpper; ++i) { // All particles in this tree cell
 		auto p = pkdParticle(pkd,i);
-		auto v = pkdVel(pkd,p);
 		position_t dr; pkdGetPos1(pkd,p,dr.data()); // Centered on 0 with period fPeriod
 		float3_t r(dr);
 		r = (r * ifPeriod + 0.5) * nGrid - flower; // Scale and shift to fit in subcube
-		v[0] += (dtOpen + dtClose) * force_interpolate(forcesX, r.data(), iAssignment);
-		v[1] += (dtOpen + dtClose) * force_interpolate(forcesY, r.data(), iAssignment);
-		v[2] += (dtOpen + dtClose) * force_interpolate(forcesZ, r.data(), iAssignment);
+		float3_t f(force_interpolate(forcesX, r.data(), iAssignment),
+		    force_interpolate(forcesY, r.data(), iAssignment),
+		    force_interpolate(forcesZ, r.data(), iAssignment));
+		if (bAccel) {
+		    auto a = pkdAccel(pkd,p);
+		    a[0] += f[0];
+		    a[1] += f[1];
+		    a[2] += f[2];
+		    }
+		else {
+		    auto v = pkdVel(pkd,p);
+		    v[0] += (dtOpen + dtClose) * f[0];
+		    v[1] += (dtOpen + dtClose) * f[1];
+		    v[2] += (dtOpen + dtClose) * f[2];
+		    }
 		}
 	    }
 	}
@@ -363,7 +446,7 @@ int pstLinearKick(PST pst,void *vin,int nIn,void *vout,int nOut) {
 	mdlGetReply(pst->mdl,rID,NULL,NULL);
 	}
     else {
-	pkdLinearKick(plcl->pkd,in->dtOpen,in->dtClose);
+	pkdLinearKick(plcl->pkd,in->dtOpen,in->dtClose,in->bAccel);
 	}
     return 0;
     }
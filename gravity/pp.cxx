@@ -26,53 +26,57 @@
 #include "pkd.h"
 #include "pp.h"
 
-extern "C"
-void pkdGravEvalPP(PINFOIN *pPart, int nBlocks, int nInLast, ILP_BLK *blk,  PINFOOUT *pOut ) {
+/*
+** The P-P kernel is instantiated for each combination of options so that the
+** common case (no gravstep, fixed softening) does none of the extra work:
+**   bGravStep  - accumulate dirsum/normsum for the gravitational timestep
+**   bPotential - accumulate the potential
+**   bFixedSoft - every particle has the same softening, so fourh2 is not loaded
+**   S          - force split policy, PMForceSplit for the TreePM short-range force
+*/
+template<bool bGravStep,bool bPotential,bool bFixedSoft,class S>
+static void evalPP(PINFOIN *pPart, int nBlocks, int nInLast, ILP_BLK *blk,  PINFOOUT *pOut, float fFourh2, float fiSplit ) {
     fvec t1, t2, t3, pot;
     fvec pax, pay, paz, pfx, pfy, pfz;
     fvec piax, piay, piaz;
-    fvec ppot /*,pmass,p4soft2*/;
+    fvec ppot, pfourh2;
     fvec pimaga,psmooth2,pirsum,pnorms;
 
-    float ax,ay,az,fPot,dirsum,normsum;
-    float dimaga;
-
     float fx = pPart->r[0];
     float fy = pPart->r[1];
     float fz = pPart->r[2];
-    float fsmooth2 = pPart->fSmooth2;
     float *a = pPart->a;
     int nLeft, j;
 
-    dimaga = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
-    if (dimaga > 0) {
-	dimaga = 1.0f/sqrtf(dimaga);
-	}
-    pimaga = dimaga;
-
-
-    /*
-    ** This is a little trick to speed up the calculation. By setting
-    ** unused entries in the list to have a zero mass, the resulting
-    ** forces are zero. Setting the distance to a large value avoids
-    ** softening the non-existent forces which is slightly faster.
-    */
-    for( j = nInLast; j&fvec::mask(); j++) {
-	blk[nBlocks].dx.f[j] = blk[nBlocks].dy.f[j] = blk[nBlocks].dz.f[j] = 1e18f;
-	blk[nBlocks].m.f[j] = 0.0f;
-	blk[nBlocks].fourh2.f[j] = 1e-18f;
+    if (bGravStep) {
+	float dimaga = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
+	if (dimaga > 0) {
+	    dimaga = 1.0f/sqrtf(dimaga);
+	    }
+	pimaga = dimaga;
+	piax    = a[0];
+	piay    = a[1];
+	piaz    = a[2];
+	psmooth2= pPart->fSmooth2;
 	}
+    else pimaga = piax = piay = piaz = psmooth2 = 0.0f;
 
-    piax    = a[0];
-    piay    = a[1];
-    piaz    = a[2];
     pfx     = fx;
     pfy     = fy;
     pfz     = fz;
-    psmooth2= fsmooth2;
+    pfourh2 = fFourh2;
+    const S split(fiSplit);
 
     pax = pay = paz = ppot = pirsum = pnorms = 0.0;
 
+    /*
+    ** The last vector of the last block may be partially filled. Rather than
+    ** padding the list in memory, the unused lanes are replaced in registers by
+    ** distant massless particles so that they contribute nothing.
+    */
+    int nTail = nInLast & fvec::mask();
+    fmask keep = fmask_tail(nTail);
+
     for( nLeft=nBlocks; nLeft >= 0; --nLeft,++blk ) {
 	int n = (nLeft ? ILP_PART_PER_BLK : nInLast+fvec::mask()) >> SIMD_BITS;
 	for (j=0; j<n; ++j) {
@@ -80,30 +84,59 @@ void pkdGravEvalPP(PINFOIN *pPart, int nBlocks, int nInLast, ILP_BLK *blk,  PINF
 	    fvec Idy = blk->dy.p[j];
 	    fvec Idz = blk->dz.p[j];
 	    fvec Im = blk->m.p[j];
-	    fvec fourh2 = blk->fourh2.p[j];
+	    fvec fourh2 = bFixedSoft ? pfourh2 : fvec(blk->fourh2.p[j]);
 	    fvec pir,norm;
-	    EvalPP<fvec,fmask,true>(pfx,pfy,pfz,psmooth2,Idx,Idy,Idz,fourh2,Im,t1,t2,t3,pot,
-	    	piax,piay,piaz,pimaga,pir,norm);
-	    pirsum += pir;
-	    pnorms += norm;
-	    ppot += pot;
+	    if (nTail && nLeft==0 && j==n-1) {
+		Idx = mask_mov(fvec(1e18f),keep,Idx);
+		Idy = mask_mov(fvec(1e18f),keep,Idy);
+		Idz = mask_mov(fvec(1e18f),keep,Idz);
+		Im = maskz_mov(keep,Im);
+		fourh2 = maskz_mov(keep,fourh2);
+		}
+	    EvalPP<fvec,fmask,bGravStep,bPotential,S>(pfx,pfy,pfz,psmooth2,Idx,Idy,Idz,fourh2,Im,t1,t2,t3,pot,
+	    	piax,piay,piaz,pimaga,pir,norm,split);
+	    if (bGravStep) {
+		pirsum += pir;
+		pnorms += norm;
+		}
+	    if (bPotential) ppot += pot;
 	    pax += t1;
 	    pay += t2;
 	    paz += t3;
 	    }
 	}
-    ax = hadd(pax);
-    ay = hadd(pay);
-    az = hadd(paz);
-    fPot = hadd(ppot);
-    dirsum = hadd(pirsum);
-    normsum = hadd(pnorms);
 
-    pOut->a[0] += ax;
-    pOut->a[1] += ay;
-    pOut->a[2] += az;
-    pOut->fPot += fPot;
-    pOut->dirsum += dirsum;
-    pOut->normsum += normsum;
-}
+    pOut->a[0] += hadd(pax);
+    pOut->a[1] += hadd(pay);
+    pOut->a[2] += hadd(paz);
+    if (bPotential) pOut->fPot += hadd(ppot);
+    if (bGravStep) {
+	pOut->dirsum += hadd(pirsum);
+	pOut->normsum += hadd(pnorms);
+	}
+    }
+
+/*
+** Select the kernel variant. A negative fFourh2 means that the softening
+** varies from particle to particle and must be read from the list.
+** A non-zero fiSplit, 1/(2r_s), selects the TreePM short-range kernel.
+*/
+extern "C"
+void pkdGravEvalPP(PINFOIN *pPart, int nBlocks, int nInLast, ILP_BLK *blk,  PINFOOUT *pOut,
+    int bGravStep, int bPotential, float fFourh2, float fiSplit ) {
+    typedef void (*evalPPfcn)(PINFOIN *, int, int, ILP_BLK *, PINFOOUT *, float, float);
+    typedef NoForceSplit N;
+    typedef PMForceSplit P;
+    static const evalPPfcn kernels[2][2][2][2] = {
+	{ { { evalPP<false,false,false,N>, evalPP<false,false,true,N> },
+	    { evalPP<false,true, false,N>, evalPP<false,true, true,N> } },
+	  { { evalPP<true, false,false,N>, evalPP<true, false,true,N> },
+	    { evalPP<true, true, false,N>, evalPP<true, true, true,N> } } },
+	{ { { evalPP<false,false,false,P>, evalPP<false,false,true,P> },
+	    { evalPP<false,true, false,P>, evalPP<false,true, true,P> } },
+	  { { evalPP<true, false,false,P>, evalPP<true, false,true,P> },
+	    { evalPP<true, true, false,P>, evalPP<true, true, true,P> } } },
+	};
+    kernels[fiSplit>0.0f][bGravStep!=0][bPotential!=0][fFourh2>=0.0f](pPart,nBlocks,nInLast,blk,pOut,fFourh2,fiSplit);
+    }
 #endif/*USE_SIMD_PP*/
@@ -18,12 +18,14 @@
 #ifndef CUDA_DEVICE
 #define CUDA_DEVICE
 #endif
-template<class F,class M,bool bGravStep>
+#include "forcesplit.h"
+template<class F,class M,bool bGravStep,bool bPotential=true,class S=NoForceSplit>
 CUDA_DEVICE void EvalPP(
 	const F &Pdx, const F &Pdy, const F &Pdz, const F &Psmooth2,     // Particle
 	const F &Idx, const F &Idy, const F &Idz, const F &fourh2, const F &Im, // Interaction(s)
 	F &ax, F &ay, F &az, F &pot,         // results
-	const F &Pax, const F &Pay, const F &Paz,const F &imaga, F &ir, F &norm) {
+	const F &Pax, const F &Pay, const F &Paz,const F &imaga, F &ir, F &norm,
+	const S &split=S()) {
     static const float minSoftening = 1e-18f;
     F dx = Idx + Pdx;
     F dy = Idy + Pdy;
@@ -44,11 +46,16 @@ CUDA_DEVICE void EvalPP(
 	dir *= 1.0f + td2*(0.5f + td2*(3.0f/8.0f + td2*(45.0f/32.0f)));
 	dir2 *= 1.0f + td2*(1.5f + td2*(135.0f/16.0f));
 	}
+    F s[2];
+    if (S::bActive) {
+	split.factors(d2*rsqrt(max(minSoftening,d2)),s,1);
+	dir2 *= s[1];
+	}
     dir2 *= -Im;
     ax = dx * dir2;
     ay = dy * dir2;
     az = dz * dir2;
-    pot = -Im*dir;
+    if (bPotential) pot = S::bActive ? -Im*dir*s[0] : -Im*dir;
 
     /* Calculations for determining the timestep. */
     if (bGravStep) {
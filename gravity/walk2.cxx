@@ -33,6 +33,7 @@
 #include <math.h>
 #include <assert.h>
 #include <string.h>
+#include <unordered_map>
 #include "pkd.h"
 #include "walk.h"
 #include "gravity/grav.h"
@@ -152,6 +153,39 @@ static void iOpenOutcomeCL(PKD pkd,KDN *k,CL cl,CLTILE tile,float dThetaMin) {
     }
 #endif
 
+/*
+** With the TreePM force split the tree only supplies the short-range force.
+** Cells which are everywhere beyond the cutoff from k are dropped. Local
+** expansions assume the full 1/r kernel, so instead of being accepted as one
+** a cell stays on the checklist or, once k is a group, becomes a P-C (or for
+** a single particle a P-P) interaction.
+*/
+static void iOpenShortRangeCL(PKD pkd,KDN *k,CL cl,CLTILE tile) {
+    BND kbnd = pkdNodeGetBnd(pkd,k);
+    CL_BLK *blk = tile->blk;
+    int i, j, n, nLeft;
+    for(nLeft=tile->lstTile.nBlocks; nLeft>=0; --nLeft,blk++) {
+	n = nLeft ? cl->lst.nPerBlock : tile->lstTile.nInLast;
+	for(i=0; i<n; ++i) {
+	    if (blk->iOpen.i[i] == 10) continue;
+	    const float c[3] = { blk->xCenter.f[i] + blk->xOffset.f[i],
+				 blk->yCenter.f[i] + blk->yOffset.f[i],
+				 blk->zCenter.f[i] + blk->zOffset.f[i] };
+	    const float m[3] = { blk->xMax.f[i], blk->yMax.f[i], blk->zMax.f[i] };
+	    float minbnd2 = 0.0f;
+	    for(j=0; j<3; ++j) {
+		float d = fabsf(c[j] - kbnd.fCenter[j]) - m[j] - kbnd.fMax[j];
+		if (d > 0) minbnd2 += d*d;
+		}
+	    if (minbnd2 > pkd->fPMCut2) blk->iOpen.i[i] = 10;
+	    else if (blk->iOpen.i[i] == 8) {
+		if (!k->bGroup) blk->iOpen.i[i] = 0;
+		else blk->iOpen.i[i] = blk->iCell.i[i] < 0 ? 1 : 4;
+		}
+	    }
+	}
+    }
+
 static void addChild(PKD pkd, int iCache, CL cl, int iChild, int id, float *fOffset) {
     int idLower, iLower, idUpper, iUpper;
     float cOpen;
@@ -164,13 +198,51 @@ static void addChild(PKD pkd, int iCache, CL cl, int iChild, int id, float *fOff
     clAppend(cl,iCache,id,iChild,idLower,iLower,idUpper,iUpper,nc,cOpen,
 	pkdNodeMom(pkd,c)->m,4.0f*c->fSoft2,c_r,fOffset,cbnd.fCenter,cbnd.fMax);
     }
+/*
+** The walk below a bucket group can be handed to an idle thread as an MDL task
+** (see mdlAddTask). It needs the state of the walk at the top of the group:
+** the checklist and the local expansion. We only do this when the interaction
+** lists are empty there (they are, unless P-P or P-C interactions were added
+** above the group) so they don't have to be copied.
+*/
+struct walkTask {
+    PKD pkd;		/* Owner of the group */
+    int iCell, iRoot, iRoot2;
+    CL cl;
+    LOCR L;
+    float dirLsum, normLsum;
+    struct pkdKickParameters *kick;
+    struct pkdLightconeParameters *lc;
+    struct pkdTimestepParameters *ts;
+    double dTime, dThetaMin;
+    int bEwald;
+    };
+
+/*
+** The task context of a thread: it walks tasks of another thread with a copy
+** of that thread's PKD that has our lists and caches, and our own accumulators
+** (energies, flops, rung counts) which are added to ours at the end.
+*/
+struct walkThread {
+    PKD pkd;
+    std::unordered_map<PKD,PKD> views;
+    int nActive;
+    double dFlop, dPartSum, dCellSum;
+    };
+
+static int doWalkTask(void *vtask,void *vwt);
+static int doneWalkTask(void *vtask);
+
 /*
 ** Returns total number of active particles for which gravity was calculated.
+** With a task we walk only its group and leave the work to the caller; with a
+** walkThread the groups may become tasks.
 */
 static int processCheckList(PKD pkd, SMX smx, SMF smf, int iRoot, int iRoot2, 
     struct pkdKickParameters *kick,struct pkdLightconeParameters *lc,struct pkdTimestepParameters *ts,
     double dTime,int bEwald,
-    double dThetaMin, double *pdFlop, double *pdPartSum,double *pdCellSum) {
+    double dThetaMin, double *pdFlop, double *pdPartSum,double *pdCellSum,
+    walkThread *wt=NULL, const walkTask *task=NULL) {
     KDN *k,*c;
     int id,iCell,iSib,iCheckCell,iCheckLower;
     PARTICLE *p;
@@ -204,8 +276,9 @@ static int processCheckList(PKD pkd, SMX smx, SMF smf, int iRoot, int iRoot2,
     float imaga;
 #endif
     double dFlop;
+    walkTask *pSpare = NULL;
 
-    pkd->dFlop = 0.0; /* Flops are accumulated here! */
+    if (!task) pkd->dFlop = 0.0; /* Flops are accumulated here! */
     iStack = -1;
 
     /*
@@ -225,6 +298,15 @@ static int processCheckList(PKD pkd, SMX smx, SMF smf, int iRoot, int iRoot2,
     ** Make iCell point to the root of the tree again.
     */
     k = pkdTreeNode(pkd,iCell = iRoot);
+    if (task) {
+	k = pkdTreeNode(pkd,iCell = task->iCell);
+	L = task->L;
+	dirLsum = task->dirLsum;
+	normLsum = task->normLsum;
+	ilpClear(pkd->ilp);
+	ilcClear(pkd->ilc);
+	clClone(pkd->cl,task->cl);
+	}
     pkdNodeGetPos(pkd,k,k_r);
     while (1) {
 #ifdef ILP_ILC_CAN_BE_NON_EMPTY
@@ -303,6 +385,25 @@ static int processCheckList(PKD pkd, SMX smx, SMF smf, int iRoot, int iRoot2,
 #endif
 	while (1) {
 	    /*
+	    ** Give this group to an idle thread if one wants it. The task takes
+	    ** our checklist and we continue with an empty one.
+	    */
+	    if (wt && k->bGroup && ilpCount(pkd->ilp)==0 && ilcCount(pkd->ilc)==0) {
+		if (!pSpare) {
+		    pSpare = new walkTask;
+		    clInitialize(&pSpare->cl,&pkd->clFreeList);
+		    }
+		clTemp = pSpare->cl;
+		*pSpare = {pkd,iCell,iRoot,iRoot2,pkd->cl,L,dirLsum,normLsum,kick,lc,ts,dTime,dThetaMin,bEwald};
+		pkd->cl = clTemp;
+		if (mdlAddTask(pkd->mdl,pSpare,doWalkTask,doneWalkTask,MDL_PHASE_WALK)) {
+		    pSpare = NULL;
+		    goto nextCell;
+		    }
+		pkd->cl = pSpare->cl;
+		pSpare->cl = clTemp;
+		}
+	    /*
 	    ** Process the Checklist.
 	    */
 #ifdef USE_SIMD_FMM
@@ -330,6 +431,25 @@ static int processCheckList(PKD pkd, SMX smx, SMF smf, int iRoot, int iRoot2,
 #else
 		    iOpenOutcomeCL(pkd,k,pkd->cl,cltile,dThetaMin);
 #endif
+		    if (pkd->fPMCut2 > 0.0f) iOpenShortRangeCL(pkd,k,pkd->cl,cltile);
+		    }
+		/*
+		** Request the remote children of every cell we are about to open, so
+		** the fetches in addChild below find them in flight (or arrived).
+		*/
+		CL_LOOP(pkd->cl,cltile) {
+		    CL_BLK *blk = cltile->blk;
+		    int nLeft;
+		    for(nLeft=cltile->lstTile.nBlocks; nLeft>=0; --nLeft,blk++) {
+			int n = nLeft ? pkd->cl->lst.nPerBlock : cltile->lstTile.nInLast;
+			for (jTile=0;jTile<n;++jTile) {
+			    if (blk->iOpen.i[jTile] != 3) continue;
+			    if (blk->idLower.i[jTile] != pkd->idSelf)
+				mdlPrefetch(pkd->mdl,blk->iCache.i[jTile],blk->iLower.i[jTile],blk->idLower.i[jTile]);
+			    if (blk->idUpper.i[jTile] != pkd->idSelf)
+				mdlPrefetch(pkd->mdl,blk->iCache.i[jTile],blk->iUpper.i[jTile],blk->idUpper.i[jTile]);
+			    }
+			}
 		    }
 		clClear(pkd->clNew);
 		CL_LOOP(pkd->cl,cltile) {
@@ -438,8 +558,7 @@ static int processCheckList(PKD pkd, SMX smx, SMF smf, int iRoot, int iRoot2,
 			    case 3:
 				/*
 				** Open the cell.
-				** We could do a prefetch here for non-local
-				** cells.
+				** Remote children were prefetched above.
 				*/
 				iCheckCell = blk->iCell.i[jTile];                 assert(iCheckCell >= 0);
 				iCheckLower = blk->iLower.i[jTile];               assert(iCheckLower > 0);
@@ -544,7 +663,8 @@ static int processCheckList(PKD pkd, SMX smx, SMF smf, int iRoot, int iRoot2,
 				break;
 			    case 10:
 				/*
-				** This checkcell is removed from the checklist since it has zero/negative mass.
+				** This checkcell is removed from the checklist since it has zero/negative mass,
+				** or is beyond the cutoff of the short-range force.
 				*/
 				break;		
 			    default:
@@ -690,6 +810,7 @@ static int processCheckList(PKD pkd, SMX smx, SMF smf, int iRoot, int iRoot2,
 	    nTotActive += nActive;
 	    }
 	/* Get the next cell to process from the stack */
+    nextCell:
 	if (iStack == -1) goto doneCheckList;
 	k = pkdTreeNode(pkd,iCell = pkd->S[iStack].iNodeIndex);
 	pkdNodeGetPos(pkd,k,k_r);
@@ -713,14 +834,121 @@ static int processCheckList(PKD pkd, SMX smx, SMF smf, int iRoot, int iRoot2,
 	--iStack;
 	}
 doneCheckList:
+    if (pSpare) {
+	clDestroy(pSpare->cl);
+	delete pSpare;
+	}
 #ifdef USE_CUDA
     CudaClientFlush(pkd->cudaClient);
 #endif
+    if (task) return(nTotActive); /* The thread running the task completes the work */
+    /*
+    ** Our lists are free now so we can run tasks: ours, until they are done,
+    ** and those of other threads (see pkdGravWalk).
+    */
+    if (wt) mdlSetTaskContext(pkd->mdl,wt);
     mdlCompleteAllWork(pkd->mdl);
     *pdFlop += pkd->dFlop; /* Accumulate work flops (notably Ewald) */
     return(nTotActive);
     }
 
+/*
+** Our own tasks we walk with our PKD. For another thread we make a copy of
+** its PKD (once per walk). The fields of the copy are of three kinds:
+**  - ours, because the walk writes them: mdl, S (and nMaxStack), ilp, ilc,
+**    ill, cl, clNew and cudaClient;
+**  - accumulators (nRung, dFlop*, dEnergy*) that start at zero and are added
+**    to ours in doneWalkThread;
+**  - everything else is the owner's: the particles, tree, field offsets and
+**    walk parameters. These are not changed by anyone during the walk, except
+**    the forces and rungs of the particles of the group, which only the
+**    thread walking it writes.
+** Walks that write other owner state can not be tasks: groups (ga, minPot),
+** the light cone buffers and the smooth context of the time step criterion.
+*/
+static PKD walkView(walkThread *wt,PKD pkdOwner) {
+    PKD pkd = wt->pkd;
+    if (pkdOwner == pkd) return pkd;
+    PKD &view = wt->views[pkdOwner];
+    if (view == NULL) {
+	view = new struct pkdContext(*pkdOwner);
+	view->mdl = pkd->mdl;
+	view->nMaxStack = pkd->nMaxStack;
+	view->S = pkd->S;
+	view->ilp = pkd->ilp;
+	view->ilc = pkd->ilc;
+	view->ill = pkd->ill;
+#ifdef USE_CUDA
+	view->cudaClient = pkd->cudaClient;
+#endif
+	for (auto i=0; i<=IRUNGMAX; ++i) view->nRung[i] = 0;
+	view->dFlop = 0.0;
+	view->dFlopSingleCPU = view->dFlopDoubleCPU = 0.0;
+	view->dFlopSingleGPU = view->dFlopDoubleGPU = 0.0;
+	view->dEnergyU = view->dEnergyT = view->dEnergyW = 0.0;
+	view->dEnergyF[0] = view->dEnergyF[1] = view->dEnergyF[2] = 0.0;
+	view->dEnergyL[0] = view->dEnergyL[1] = view->dEnergyL[2] = 0.0;
+	}
+    /* The walk swaps the checklists around */
+    view->cl = pkd->cl;
+    view->clNew = pkd->clNew;
+    assert(view->ilp != pkdOwner->ilp && view->ilc != pkdOwner->ilc && view->S != pkdOwner->S);
+    return view;
+    }
+
+static int doWalkTask(void *vtask,void *vwt) {
+    auto task = static_cast<walkTask *>(vtask);
+    auto wt = static_cast<walkThread *>(vwt);
+    PKD pkd = walkView(wt,task->pkd);
+    SMF smf = {};
+    /* See walkView: these would write state of the owner */
+    assert(task->pkd->ga == NULL);
+    assert(task->lc->dLookbackFac <= 0);
+    assert(!task->ts->bGravStep);
+
+    wt->nActive += processCheckList(pkd,NULL,smf,task->iRoot,task->iRoot2,task->kick,task->lc,task->ts,
+	task->dTime,task->bEwald,task->dThetaMin,&wt->dFlop,&wt->dPartSum,&wt->dCellSum,NULL,task);
+    wt->pkd->cl = pkd->cl;
+    wt->pkd->clNew = pkd->clNew;
+    return 0;
+    }
+
+static int doneWalkTask(void *vtask) {
+    auto task = static_cast<walkTask *>(vtask);
+    clDestroy(task->cl);
+    delete task;
+    return 0;
+    }
+
+/*
+** Add what we did for other threads to our totals.
+*/
+static void doneWalkThread(walkThread *wt,int *pnActive,double *pdFlop,double *pdPartSum,double *pdCellSum) {
+    PKD pkd = wt->pkd;
+    *pnActive += wt->nActive;
+    *pdFlop += wt->dFlop;
+    *pdPartSum += wt->dPartSum;
+    *pdCellSum += wt->dCellSum;
+    for (auto &v : wt->views) {
+	PKD view = v.second;
+	for (auto i=0; i<=IRUNGMAX; ++i) pkd->nRung[i] += view->nRung[i];
+	*pdFlop += view->dFlop;
+	pkd->dFlopSingleCPU += view->dFlopSingleCPU;
+	pkd->dFlopDoubleCPU += view->dFlopDoubleCPU;
+	pkd->dFlopSingleGPU += view->dFlopSingleGPU;
+	pkd->dFlopDoubleGPU += view->dFlopDoubleGPU;
+	pkd->dEnergyU += view->dEnergyU;
+	pkd->dEnergyT += view->dEnergyT;
+	pkd->dEnergyW += view->dEnergyW;
+	for (auto j=0; j<3; ++j) {
+	    pkd->dEnergyF[j] += view->dEnergyF[j];
+	    pkd->dEnergyL[j] += view->dEnergyL[j];
+	    }
+	delete view;
+	}
+    wt->views.clear();
+    }
+
 static void doneGravWalk(PKD pkd,SMX smx,SMF *smf) {
     if (smx) {
 	smSmoothFinish(smx);
@@ -804,6 +1032,7 @@ int pkdGravWalk(PKD pkd,struct pkdKickParameters *kick,struct pkdLightconeParame
     double dTime,int nReps,int bEwald,int nGroup,
     int iLocalRoot1, int iLocalRoot2,int iVARoot,
     double dThetaMin,double *pdFlop,double *pdPartSum,double *pdCellSum) {
+    mdl::TraceScope trace(static_cast<mdl::mdlClass *>(pkd->mdl),MDL_PHASE_WALK);
     int id;
     float fOffset[3];
     int ix,iy,iz,bRep;
@@ -811,6 +1040,14 @@ int pkdGravWalk(PKD pkd,struct pkdKickParameters *kick,struct pkdLightconeParame
     SMX smx;
     SMF smf;
     int iTop1, iTop2;
+    /*
+    ** Idle threads take bucket groups from the others, except when the result
+    ** goes to per-thread state other than the particles and the totals: the
+    ** light cone, group potential minima and the densities for the gravity
+    ** step. This decision must be the same for every thread.
+    */
+    bool bTasks = !ts->bGravStep && lc->dLookbackFac <= 0;
+    walkThread wt = {pkd,{},0,0.0,0.0,0.0};
 
     initGravWalk(pkd,dTime,dThetaMin,nReps?1:0,ts->bGravStep,ts->nPartRhoLoc,ts->iTimeStepCrit,&smx,&smf);
 
@@ -852,7 +1089,19 @@ int pkdGravWalk(PKD pkd,struct pkdKickParameters *kick,struct pkdLightconeParame
 		}
 	    }
 	nActive += processCheckList(pkd, smx, smf, iLocalRoot1, iLocalRoot2, kick,lc,ts,
-	    dTime,bEwald, dThetaMin, pdFlop, pdPartSum, pdCellSum);
+	    dTime,bEwald, dThetaMin, pdFlop, pdPartSum, pdCellSum,
+	    bTasks && pkd->ga == NULL ? &wt : NULL);
+	}
+    /*
+    ** Help the other threads on this node until all of them are done walking,
+    ** then finish the work that their groups gave us.
+    */
+    if (bTasks) {
+	mdlSetTaskContext(pkd->mdl,&wt);
+	mdlThreadBarrier(pkd->mdl);
+	mdlSetTaskContext(pkd->mdl,NULL);
+	mdlCompleteAllWork(pkd->mdl);
+	doneWalkThread(&wt,&nActive,pdFlop,pdPartSum,pdCellSum);
 	}
 #if 0
     /*
@@ -26,6 +26,8 @@
 #include "pkd.h"
 #include "group.h"
 
+#define FOF_NOT_CONTAINED 0x80000000u
+
 
 static inline int getCell(PKD pkd,int iCell,int id,float *pcOpen,KDN **pc) {
     KDN *c;
@@ -42,71 +44,135 @@ static inline int getCell(PKD pkd,int iCell,int id,float *pcOpen,KDN **pc) {
     }
 
 
-uint32_t pkdFofGatherLocal(PKD pkd,int *S,double fBall2,double r[3],uint32_t iGroup,
-    uint32_t iTail,uint32_t *Fifo,int *pbCurrFofContained,
-    const Bound::coord fMinFofContained,const Bound::coord fMaxFofContained) {
+/*
+** Union-find over the local particles. A larger root is always hung below the
+** smaller one, so the root of a set is its lowest particle index and groups
+** end up numbered in the order of their first particle.
+*/
+static inline uint32_t fofFind(uint32_t *P,uint32_t i) {
+    while (P[i] != i) {
+	P[i] = P[P[i]];   /* path halving */
+	i = P[i];
+	}
+    return i;
+    }
+
+static inline void fofUnion(uint32_t *P,uint32_t i,uint32_t j) {
+    i = fofFind(P,i);
+    j = fofFind(P,j);
+    if (i < j) P[j] = i;
+    else if (j < i) P[i] = j;
+    }
+
+/*
+** Minimum and maximum squared distance between any two points of two cells.
+*/
+static inline void fofCellDist2(const Bound &a,const Bound &b,double &min2,double &max2) {
+    min2 = max2 = 0.0;
+    for (auto j=0;j<3;++j) {
+	double d = fabs(a.fCenter[j] - b.fCenter[j]);
+	double dMin = d - a.fMax[j] - b.fMax[j];
+	double dMax = d + a.fMax[j] + b.fMax[j];
+	if (dMin > 0) min2 += dMin*dMin;
+	max2 += dMax*dMax;
+	}
+    }
+
+/*
+** A cell is compact if all of its particles are within the linking length of
+** each other; they then all belong to the same group.
+*/
+static inline int fofCompact(const Bound &bnd,double fTau2) {
+    return 4.0*(bnd.fMax[0]*bnd.fMax[0] + bnd.fMax[1]*bnd.fMax[1] + bnd.fMax[2]*bnd.fMax[2]) <= fTau2;
+    }
+
+/*
+** Link all particles of the largest compact cells with a single pass over
+** their particles. Nothing below a compact cell needs to be considered again.
+*/
+static void fofLinkCompact(PKD pkd,int *S,double fTau2,uint32_t *P) {
+    KDN *kdn;
+    int sp = 0;
+    int iCell,pj;
+
+    kdn = pkdTreeNode(pkd,iCell = ROOT);
+    while (1) {
+	Bound bnd = pkdNodeGetBnd(pkd,kdn);
+	if (fofCompact(bnd,fTau2)) {
+	    for (pj=kdn->pLower+1;pj<=kdn->pUpper;++pj) P[pj] = kdn->pLower;
+	    }
+	else if (kdn->iLower) {
+	    kdn = pkdTreeNode(pkd,iCell = kdn->iLower);
+	    S[sp++] = iCell+1;
+	    continue;
+	    }
+	if (sp) kdn = pkdTreeNode(pkd,iCell = S[--sp]);
+	else break;
+	}
+    }
+
+/*
+** Link the particles of bucket k with all particles of the local tree that
+** follow it in memory order (those before it were linked from their own bucket).
+** Whole cells are linked at once when every pair is within the linking length,
+** and cells already known to be in the same group as a compact bucket are skipped.
+*/
+static void fofLinkBucket(PKD pkd,int *S,double fTau2,uint32_t *P,KDN *k,
+			  double *xi,double *yi,double *zi) {
     KDN *kdn;
     PARTICLE *p;
-    double p_r[3];
-    double min2,dx,dy,dz,fDist2;
+    double xj,yj,zj,min2,max2,dx,dy,dz;
     int sp = 0;
-    int iCell,pj,pEnd,j;
-    uint32_t iPartGroup;
+    int iCell,pi,pj,npi,pjStart;
 
+    Bound bndK = pkdNodeGetBnd(pkd,k);
+    const int bCompactK = fofCompact(bndK,fTau2);
+    for (pi=k->pLower,npi=0;pi<=k->pUpper;++pi,++npi) {
+	p = pkdParticle(pkd,pi);
+	pkdGetPos3(pkd,p,xi[npi],yi[npi],zi[npi]);
+	}
     kdn = pkdTreeNode(pkd,iCell = ROOT);
     while (1) {
-        Bound bnd = pkdNodeGetBnd(pkd, kdn);
-        min2 = bnd.mindist(r);
-	if (min2 > fBall2) {
+	if (kdn->pUpper < k->pLower) goto NoIntersect;
+	{
+	Bound bnd = pkdNodeGetBnd(pkd,kdn);
+	fofCellDist2(bndK,bnd,min2,max2);
+	if (min2 > fTau2) goto NoIntersect;
+	const int bCompact = fofCompact(bnd,fTau2);
+	if (bCompactK && bCompact && fofFind(P,k->pLower) == fofFind(P,kdn->pLower)) goto NoIntersect;
+	if (max2 <= fTau2) {
+	    /*
+	    ** Every particle of this cell links to every particle of the bucket.
+	    */
+	    if (!bCompactK) for (pi=k->pLower+1;pi<=k->pUpper;++pi) fofUnion(P,k->pLower,pi);
+	    if (bCompact) fofUnion(P,k->pLower,kdn->pLower);
+	    else for (pj=kdn->pLower;pj<=kdn->pUpper;++pj) fofUnion(P,k->pLower,pj);
 	    goto NoIntersect;
 	    }
-	/*
-	** We have an intersection to test.
-	*/
 	if (kdn->iLower) {
 	    kdn = pkdTreeNode(pkd,iCell = kdn->iLower);
 	    S[sp++] = iCell+1;
 	    continue;
 	    }
-	pEnd = kdn->pUpper;
-	for (pj=kdn->pLower;pj<=pEnd;++pj) {
+	}
+	pjStart = kdn->pLower > k->pLower ? kdn->pLower : k->pLower + 1;
+	for (pj=pjStart;pj<=kdn->pUpper;++pj) {
 	    p = pkdParticle(pkd,pj);
-	    iPartGroup = pkdGetGroup(pkd,p);
-	    if (iPartGroup) continue;		    
-	    pkdGetPos1(pkd,p,p_r);
-	    dx = r[0] - p_r[0];
-	    dy = r[1] - p_r[1];
-	    dz = r[2] - p_r[2];
-	    fDist2 = dx*dx + dy*dy + dz*dz;
-	    if (fDist2 <= fBall2) {
-		/*
-		**  Mark particle and add it to the do-fifo
-		*/
-		pkdSetGroup(pkd,p,iGroup);
-		Fifo[iTail++] = pj;
-		if (*pbCurrFofContained) {
-		    for (j=0;j<3;++j) {
-			if (p_r[j] < fMinFofContained[j]) {
-			    *pbCurrFofContained = 0;
-			    break;
-			    }
-			else if (p_r[j] > fMaxFofContained[j]) {
-			    *pbCurrFofContained = 0;
-			    break;
-			    }
-			}
-		    }
+	    pkdGetPos3(pkd,p,xj,yj,zj);
+	    for (pi=k->pLower,npi=0;pi<=k->pUpper && pi<pj;++pi,++npi) {
+		dx = xj - xi[npi];
+		dy = yj - yi[npi];
+		dz = zj - zi[npi];
+		if (dx*dx + dy*dy + dz*dz <= fTau2) fofUnion(P,pi,pj);
 		}
 	    }
     NoIntersect:
 	if (sp) kdn = pkdTreeNode(pkd,iCell = S[--sp]);
 	else break;
 	}
-    return(iTail);
     }
 
 
-
 static void iOpenRemoteFof(PKD pkd,KDN *k,CL cl,CLTILE tile,float dTau2) {
     float dx,minbnd2,kOpen;
     CL_BLK *blk;
@@ -445,11 +511,11 @@ void pkdNewFof(PKD pkd,double dTau2,int nMinMembers,int bPeriodic,int nReplicas,
     uint32_t iGroup;
     int pn,i,j;
     KDN *kdnSelf;
-    uint32_t iHead;
-    uint32_t iTail;
+    uint32_t iNewGroup;
     const uint32_t uGroupMax = (pkd->bNoParticleOrder)?IGROUPMAX:0xffffffff;
-    uint32_t *Fifo;
-    int bCurrFofContained;
+    uint32_t *P, *nMembers;
+    KDN *kdn;
+    int iCell,sp = 0;
 
     assert(pkd->oFieldOffset[oGroup] || pkd->bNoParticleOrder); /* Validate memory model */
     auto S = new int[1024]; assert(S);
@@ -535,74 +601,76 @@ void pkdNewFof(PKD pkd,double dTau2,int nMinMembers,int bPeriodic,int nReplicas,
     auto fMinFofContained = bndSelf.lower() + sqrt(dTau2);
     auto fMaxFofContained = bndSelf.upper() - sqrt(dTau2);
     /*
-    ** Clear the group numbers!
+    ** Link the local particles with a union-find. The parent array *just* fits
+    ** into ephemeral storage of 4 bytes/particle.
     */
+    assert(pkd->nEphemeralBytes >= 4);
+    P = (uint32_t *)(pkd->pLite);
+    for (pn=0;pn<pkd->nLocal;++pn) P[pn] = pn;
+    fofLinkCompact(pkd,S,dTau2,P);
+    auto xi = std::make_unique<double[]>(nBucket);
+    auto yi = std::make_unique<double[]>(nBucket);
+    auto zi = std::make_unique<double[]>(nBucket);
+    kdn = pkdTreeNode(pkd,iCell = ROOT);
+    while (1) {
+	if (kdn->iLower) {
+	    kdn = pkdTreeNode(pkd,iCell = kdn->iLower);
+	    S[sp++] = iCell+1;
+	    continue;
+	    }
+	assert(kdn->pUpper - kdn->pLower < nBucket);
+	fofLinkBucket(pkd,S+sp,dTau2,P,kdn,xi.get(),yi.get(),zi.get());
+	if (sp) kdn = pkdTreeNode(pkd,iCell = S[--sp]);
+	else break;
+	}
+    /*
+    ** Number the groups in the order of their root (lowest) particle.
+    */
+    iGroup = 1;
     for (pn=0;pn<pkd->nLocal;++pn) {
 	p = pkdParticle(pkd,pn);
-	pkdSetGroup(pkd,p,0);
+	uint32_t iRoot = fofFind(P,pn);
+	if (iRoot == (uint32_t)pn) {
+	    assert(iGroup < uGroupMax);
+	    pkdSetGroup(pkd,p,iGroup++);
+	    }
+	else pkdSetGroup(pkd,p,pkdGetGroup(pkd,pkdParticle(pkd,iRoot)));
 	}
     /*
-    ** The following *just* fits into ephemeral storage of 4 bytes/particle.
+    ** The parent array is no longer needed: count the members of each group and
+    ** flag (high bit) those which reach outside of the contained region.
     */
-    assert(pkd->nEphemeralBytes >= 4);
-    Fifo = (uint32_t *)(pkd->pLite);
-    iGroup = 1;
+    nMembers = P;
+    P = NULL;
+    for (i=0;i<(int)iGroup;++i) nMembers[i] = 0;
     for (pn=0;pn<pkd->nLocal;++pn) {
 	p = pkdParticle(pkd,pn);
-	if (pkdGetGroup(pkd,p)) continue;
-	/*
-	** Mark particle and add it to the do-fifo
-	*/
-	iHead = iTail = 0;
-	Fifo[iTail++] = pn;
-	assert(iGroup < uGroupMax);
-	pkdSetGroup(pkd,p,iGroup);
-	bCurrFofContained = 1;
+	uint32_t g = pkdGetGroup(pkd,p);
+	++nMembers[g];
 	pkdGetPos1(pkd,p,p_r);
 	for (j=0;j<3;++j) {
-	    if (p_r[j] < fMinFofContained[j]) {
-		bCurrFofContained = 0;
-		break;
-		}
-	    else if (p_r[j] > fMaxFofContained[j]) {
-		bCurrFofContained = 0;
+	    if (p_r[j] < fMinFofContained[j] || p_r[j] > fMaxFofContained[j]) {
+		nMembers[g] |= FOF_NOT_CONTAINED;
 		break;
 		}
 	    }
-	while (iHead < iTail) {
-	    p = pkdParticle(pkd,Fifo[iHead++]);
-	    pkdGetPos1(pkd,p,p_r);
-	    iTail = pkdFofGatherLocal(pkd,S,dTau2,p_r,iGroup,iTail,Fifo,
-		&bCurrFofContained,fMinFofContained,fMaxFofContained);
-	    }
-	assert(iTail <= pkd->nLocal);
-	/*
-	** Now check if this fof group is contained and has fewer than nMinFof particles.
-	*/
-	if (bCurrFofContained && iTail < nMinMembers) {
-	    /*
-	    ** In this case mark the group particles as belonging to a removed group.
-	    */
-	    for (iHead=0;iHead<iTail;++iHead) {
-		p = pkdParticle(pkd,Fifo[iHead]);
-		pkdSetGroup(pkd,p,uGroupMax);
-		}
-	    }
-	else {
-	    ++iGroup;
-	    }
 	}
     /*
-    ** Clear group ids for removed small groups.
+    ** Remove contained groups with fewer than nMinMembers particles and renumber the rest.
     */
+    iNewGroup = 1;
+    for (i=1;i<(int)iGroup;++i) {
+	if (nMembers[i] < (uint32_t)nMinMembers) nMembers[i] = 0;
+	else nMembers[i] = iNewGroup++;
+	}
     for (pn=0;pn<pkd->nLocal;++pn) {
 	p = pkdParticle(pkd,pn);
-	if (pkdGetGroup(pkd,p) == uGroupMax) pkdSetGroup(pkd,p,0);
+	pkdSetGroup(pkd,p,nMembers[pkdGetGroup(pkd,p)]);
 	}
-    pkd->nLocalGroups = iGroup-1;
+    nMembers = NULL;  /* done with the counts, can use the storage for other stuff now */
+    pkd->nLocalGroups = iNewGroup-1;
     pkd->nGroups = pkd->nLocalGroups + 1;
     delete [] S;  /* this stack is no longer needed */
-    Fifo = NULL;  /* done with the Fifo, can use the storage for other stuff now */
     /*
     ** Create initial group table. The assert below is a very minimal requirement as it doesn't account for remote
     ** links (tmpFofRemote). However, we check this again everytime we add a new remote link.
@@ -670,6 +738,15 @@ static void combNames(void *vctx, void *v1, const void *v2) {
     }
 
 
+static inline bool fofNameLess(const remoteID &a,const remoteID &b) {
+    return a.iPid < b.iPid || (a.iPid == b.iPid && a.iIndex < b.iIndex);
+    }
+
+/*
+** Global merge, one round. Every domain resolves the names of its own groups
+** and of its links to remote groups; nothing is gathered on one thread. The
+** master repeats the rounds until no name changes anywhere.
+*/
 int pkdFofPhases(PKD pkd) {
     MDL mdl = pkd->mdl;
     int bMadeProgress=0;
@@ -678,22 +755,48 @@ int pkdFofPhases(PKD pkd) {
     struct smGroupArray *pRemote;
 
     /*
-    ** Phase 1: fetch remote names.
+    ** Phase 1: fetch remote names. Each name is also replaced by the name of the
+    ** group that it refers to (pointer jumping), as is the current name of each
+    ** local group. This halves the length of the name chains in every round, so
+    ** the number of rounds grows with the log of the group extent in domains
+    ** rather than linearly.
     */
+    auto jump = std::make_unique<remoteID[]>(pkd->nGroups);
     mdlROcache(mdl,CID_GROUP,NULL,pkd->ga,sizeof(struct smGroupArray),pkd->nGroups);
     for (iRemote=1;iRemote<pkd->iRemoteGroup;++iRemote) {
 	iIndex = pkd->tmpFofRemote[iRemote].key.iIndex;
 	assert(iIndex > 0);
 	iPid = pkd->tmpFofRemote[iRemote].key.iPid;
 	pRemote = static_cast<struct smGroupArray*>(mdlFetch(mdl,CID_GROUP,iIndex,iPid));
+	name = pRemote->id;
+	if (name.iPid != iPid || name.iIndex != iIndex) {
+	    pRemote = static_cast<struct smGroupArray*>(mdlFetch(mdl,CID_GROUP,name.iIndex,name.iPid));
+	    if (fofNameLess(pRemote->id,name)) {
+		name = pRemote->id;
+		bMadeProgress = 1; /* the key group itself still has to catch up */
+		}
+	    }
 	/*
 	** Now update the name in the local table of remote group links.
 	*/
-	assert(pRemote->id.iIndex > 0);
-	pkd->tmpFofRemote[iRemote].name.iIndex = pRemote->id.iIndex;
-	pkd->tmpFofRemote[iRemote].name.iPid = pRemote->id.iPid;
+	assert(name.iIndex > 0);
+	pkd->tmpFofRemote[iRemote].name.iIndex = name.iIndex;
+	pkd->tmpFofRemote[iRemote].name.iPid = name.iPid;
+	}
+    for(i=1;i<pkd->nGroups;++i) {
+	jump[i] = pkd->ga[i].id;
+	if (jump[i].iPid != pkd->idSelf || jump[i].iIndex != i) {
+	    pRemote = static_cast<struct smGroupArray*>(mdlFetch(mdl,CID_GROUP,jump[i].iIndex,jump[i].iPid));
+	    if (fofNameLess(pRemote->id,jump[i])) jump[i] = pRemote->id;
+	    }
 	}
     mdlFinishCache(mdl,CID_GROUP);
+    for(i=1;i<pkd->nGroups;++i) {
+	if (fofNameLess(jump[i],pkd->ga[i].id)) {
+	    pkd->ga[i].id = jump[i];
+	    bMadeProgress = 1;
+	    }
+	}
     /*
     ** Phase 2: update to unique names.
     */
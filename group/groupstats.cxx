@@ -130,6 +130,28 @@ static void combTinyGroup(void *vpkd, void *v1, const void *v2) {
     if (g2->rMax > g1->rMax) g1->rMax = g2->rMax;
     }
 
+static void initGroupMoments(void *vpkd, void *v) {
+    TinyGroupTable * g = (TinyGroupTable *)v;
+    int j;
+
+    initTinyGroup(vpkd,v);
+    for (j=0;j<3;j++) g->angular[j] = 0.0;
+    for (j=0;j<6;j++) g->inertia[j] = 0.0;
+    }
+
+/*
+** Combine the averages (rcom, vcom, v2) weighted by mass, and the sums.
+*/
+static void combGroupMoments(void *vpkd, void *v1, const void *v2) {
+    TinyGroupTable *g1 = (TinyGroupTable *)v1;
+    const TinyGroupTable *g2 = (const TinyGroupTable *)v2;
+    int j;
+
+    if (g2->fMass > 0) combTinyGroup(vpkd,v1,v2);
+    for (j=0;j<3;j++) g1->angular[j] += g2->angular[j];
+    for (j=0;j<6;j++) g1->inertia[j] += g2->inertia[j];
+    }
+
 static void initTinyRmax(void *vpkd, void *v) {
     TinyGroupTable * g = (TinyGroupTable *)v;
 
@@ -175,31 +197,6 @@ static void combShrink(void *vpkd, void *v1, const void *v2) {
     }
 
 
-static void initAngular(void *vpkd, void *v) {
-    TinyGroupTable * g = (TinyGroupTable *)v;
-    int j;
-
-    for (j=0;j<3;j++) {
-	g->angular[j] = 0.0;
-	}
-    for (j=0;j<6;j++) {
-	g->inertia[j] = 0.0;
-	}
-    }
-
-static void combAngular(void *vpkd, void *v1, const void *v2) {
-    TinyGroupTable *g1 = (TinyGroupTable *)v1;
-    const TinyGroupTable *g2 = (const TinyGroupTable *)v2;
-    int j;
-
-    for (j=0;j<3;j++) {
-	g1->angular[j] += g2->angular[j];
-	}
-    for (j=0;j<6;j++) {
-	g1->inertia[j] += g2->inertia[j];
-	}
-    }
-
 typedef struct {
     float fMass;
     float dr;
@@ -401,7 +398,6 @@ void pkdCalculateGroupStats(PKD pkd,int bPeriodic,double *dPeriod,double rEnviro
     int i,j,gid,n;
     vel_t *v;
     int nLocalGroups;
-    double *dAccumulate;
     MassRadius *mr,*mrFree,*rootFunction;
     remoteID *S;
     uint32_t *iGrpOffset,*iGrpEnd;
@@ -412,9 +408,11 @@ void pkdCalculateGroupStats(PKD pkd,int bPeriodic,double *dPeriod,double rEnviro
     int bShrink;
     double f2;
 
-    assert(pkd->nGroups*(sizeof(*pkd->ga)+sizeof(*pkd->tinyGroupTable)+sizeof(ShrinkStruct)) < 1ul*pkd->nEphemeralBytes*pkd->nStore);
+    assert(pkd->nGroups*(sizeof(*pkd->ga)+sizeof(*pkd->tinyGroupTable)+3*sizeof(uint32_t)+sizeof(ShrinkStruct)) < 1ul*pkd->nEphemeralBytes*pkd->nStore);
     pkd->tinyGroupTable = (TinyGroupTable *)(&pkd->ga[pkd->nGroups]);
-    dAccumulate = (double *)(&pkd->tinyGroupTable[pkd->nGroups]);
+    iGrpOffset = (uint32_t *)(&pkd->tinyGroupTable[pkd->nGroups]);
+    mrIndex = (int *)(&iGrpOffset[2*pkd->nGroups]);    /* this stores the ending index of each group in the mr below */
+    mr = (MassRadius *)(&mrIndex[pkd->nGroups]);  /* we must be careful how much of this we use! */
     /*
     ** Initialize the table.
     */
@@ -437,39 +435,10 @@ void pkdCalculateGroupStats(PKD pkd,int bPeriodic,double *dPeriod,double rEnviro
 		}
 	    }
 	pkd->tinyGroupTable[gid].rMax = 0;
-	dAccumulate[4*gid] = 0;
-	dAccumulate[4*gid+1] = 0;
-	dAccumulate[4*gid+2] = 0;
-	dAccumulate[4*gid+3] = 0;
 	}
     /*
     ** First determine the minimum potential particle for each group.
     ** This will be the reference position for the group as well.
-    ** In this first pass we also sum up the v2 and vcom locally.
-    */
-    for (i=0;i<pkd->nLocal;++i) {
-	p = pkdParticle(pkd,i);
-	gid = pkdGetGroup(pkd,p);
-	fMass = pkdMass(pkd,p);
-	if (!gid) continue;
-	v = pkdVel(pkd,p);
-	v2 = 0;
-	for (j=0;j<3;++j) {
-	    dAccumulate[4*gid+j] += fMass*v[j];
-	    v2 += v[j]*v[j];
-	    }
-	dAccumulate[4*gid+3] += fMass*v2;
-	}
-    for (gid=1;gid<pkd->nGroups;++gid) {
-	for (j=0;j<3;++j) {
-	    pkd->tinyGroupTable[gid].vcom[j] = dAccumulate[4*gid+j];
-	    dAccumulate[4*gid+j] = 0;
-	    }
-	pkd->tinyGroupTable[gid].sigma = dAccumulate[4*gid+3];
-	dAccumulate[4*gid+3] = 0;
-	}
-    /*
-    ** Now look at remote group particle to see if we have a lower potential.
     ** Note that we only expose the local groups to the cache! This allows us 
     ** to make any desired update to the remote group entries of the table.
     */
@@ -503,67 +472,98 @@ void pkdCalculateGroupStats(PKD pkd,int bPeriodic,double *dPeriod,double rEnviro
 	}
     mdlFinishCache(mdl,CID_GROUP);
     /*
-    ** Now find rcom and rMax and total mass locally.
+    ** Scoop environment mass (note the full tree must be present).
+    ** At the very least we need to have masses in the cells, either as part of the FMOMR structure
+    ** or a seperate mass field! This only needs the reference position, and it must be done
+    ** before we put the particles in group order below.
+    */
+    S = (remoteID *)(&pkd->tinyGroupTable[pkd->nGroups]);
+    mdlROcache(mdl,CID_PARTICLE,NULL,pkdParticleBase(pkd),pkdParticleSize(pkd),pkdLocal(pkd));
+    diVol0 = 3.0/4.0*M_1_PI*pow(rEnvironment[0],-3);
+    diVol1 = 3.0/4.0*M_1_PI*pow(rEnvironment[1],-3);
+    for (gid=1;gid<=nLocalGroups;++gid) {
+	for (j=0;j<3;++j) r[j] = pkd->tinyGroupTable[gid].rPot[j];
+	if (rEnvironment[0] > 0.0) {
+	    pkd->tinyGroupTable[gid].fEnvironDensity0 = 
+		pkdGatherMass(pkd,S,rEnvironment[0],r,bPeriodic,dPeriod)*diVol0;
+	    }
+	else pkd->tinyGroupTable[gid].fEnvironDensity0 = 0.0;
+	if (rEnvironment[1] > 0.0) {
+	    pkd->tinyGroupTable[gid].fEnvironDensity1 = 
+		pkdGatherMass(pkd,S,rEnvironment[1],r,bPeriodic,dPeriod)*diVol1;
+	    }
+	else pkd->tinyGroupTable[gid].fEnvironDensity1 = 0.0; 
+	}
+    mdlFinishCache(mdl,CID_PARTICLE);
+    /*
+    ** Now reorder the particles into group order. The moments and the half mass
+    ** radii below then only touch the members of one group at a time.
+    ** Note that we must not access tree cells until the next tree build! 
+    */
+    mdlFinishCache(mdl,CID_CELL);
+    pkdGroupOrder(pkd,iGrpOffset);
+    iGrpEnd = &iGrpOffset[pkd->nGroups];
+    iGrpEnd[0] = 0;
+    /*
+    ** A single sweep gives the mass, the centre of mass and velocity, the mean v2,
+    ** rMax, the angular momentum and the moment of inertia of our part of each group,
+    ** all relative to the minimum potential position. These are kept as mass weighted
+    ** averages (sums for angular and inertia) so that one combine gives the totals.
     */
     for (j=0;j<3;++j) dHalf[j] = bPeriodic ? 0.5 * dPeriod[j] : FLOAT_MAXVAL;
-    for (i=0;i<pkd->nLocal;++i) {
-	p = pkdParticle(pkd,i);
-	gid = pkdGetGroup(pkd,p);
-	fMass = pkdMass(pkd,p);
-	dAccumulate[4*gid+3] += fMass;
-	if (gid > 0) {
+    for (gid=1;gid<pkd->nGroups;++gid) {
+	TinyGroupTable *g = &pkd->tinyGroupTable[gid];
+	double M = 0, mr[3] = {0,0,0}, mv[3] = {0,0,0}, mv2 = 0, L[3] = {0,0,0}, I[6] = {0,0,0,0,0,0};
+	float r2Max = 0;
+	for (i=iGrpEnd[gid-1];i<iGrpEnd[gid];++i) {
+	    p = pkdParticle(pkd,i);
+	    fMass = pkdMass(pkd,p);
+	    v = pkdVel(pkd,p);
 	    r2 = 0.0;
+	    v2 = 0.0;
 	    for (j=0;j<3;++j) {
-		r[j] =  pkdPos(pkd,p,j) - pkd->tinyGroupTable[gid].rPot[j];
+		r[j] =  pkdPos(pkd,p,j) - g->rPot[j];
 		if      (r[j] < -dHalf[j]) r[j] += dPeriod[j];
 		else if (r[j] > +dHalf[j]) r[j] -= dPeriod[j];
-		dAccumulate[4*gid+j] += fMass*r[j];
+		mr[j] += fMass*r[j];
+		mv[j] += fMass*v[j];
 		r2 += r[j]*r[j];
+		v2 += v[j]*v[j];
 		}
-	    rMax = sqrtf(r2);
-	    if (rMax > pkd->tinyGroupTable[gid].rMax) pkd->tinyGroupTable[gid].rMax = rMax;
-	    }
-	}
-    for (gid=1;gid<pkd->nGroups;++gid) {
+	    M += fMass;
+	    mv2 += fMass*v2;
+	    if (r2 > r2Max) r2Max = r2;
+	    L[0] += fMass*(r[1]*v[2] - r[2]*v[1]);
+	    L[1] += fMass*(r[2]*v[0] - r[0]*v[2]);
+	    L[2] += fMass*(r[0]*v[1] - r[1]*v[0]);
+	    I[0] += fMass*r[0]*r[0];
+	    I[1] += fMass*r[0]*r[1];
+	    I[2] += fMass*r[0]*r[2];
+	    I[3] += fMass*r[1]*r[1];
+	    I[4] += fMass*r[1]*r[2];
+	    I[5] += fMass*r[2]*r[2];
+	    }
+	g->fMass = M;
+	g->rMax = sqrtf(r2Max);
+	g->sigma = M > 0 ? mv2/M : 0;  /* "sigma" is actually still v^2 */
 	for (j=0;j<3;++j) {
-	    pkd->tinyGroupTable[gid].rcom[j] = dAccumulate[4*gid+j]/dAccumulate[4*gid+3];
-	    pkd->tinyGroupTable[gid].vcom[j] /= dAccumulate[4*gid+3];
-	    dAccumulate[4*gid+j] = 0;
+	    g->rcom[j] = M > 0 ? mr[j]/M : 0;
+	    g->vcom[j] = M > 0 ? mv[j]/M : 0;
+	    g->angular[j] = L[j];
 	    }
-	pkd->tinyGroupTable[gid].sigma /= dAccumulate[4*gid+3];  /* "sigma" is actually still v^2 */
-	pkd->tinyGroupTable[gid].fMass = dAccumulate[4*gid+3];
-	dAccumulate[4*gid+3] = 0;  /* if we still need masses later we should not clear this field */
+	for (j=0;j<6;++j) g->inertia[j] = I[j];
 	}
     /* 
-    ** Now accumulate totals globally
+    ** Now accumulate totals globally. Groups entirely on this domain are already done.
     */
     mdlCOcache(mdl,CID_GROUP,NULL,pkd->tinyGroupTable,sizeof(TinyGroupTable),nLocalGroups+1,
-	NULL,initTinyGroup,combTinyGroup);
+	NULL,initGroupMoments,combGroupMoments);
     for(gid=1+nLocalGroups;gid<pkd->nGroups;++gid) {
 	auto g = static_cast<TinyGroupTable*>(mdlVirtualFetch(mdl,CID_GROUP,pkd->ga[gid].id.iIndex,pkd->ga[gid].id.iPid));
-	g->fMass += pkd->tinyGroupTable[gid].fMass;
-	for (j=0;j<3;j++) {
-	    g->rcom[j] += pkd->tinyGroupTable[gid].rcom[j];
-	    g->vcom[j] += pkd->tinyGroupTable[gid].vcom[j];
-	    g->sigma += pkd->tinyGroupTable[gid].sigma;
-	    }
-	if (pkd->tinyGroupTable[gid].rMax > g->rMax) g->rMax = pkd->tinyGroupTable[gid].rMax;
-	}
-    mdlFinishCache(mdl,CID_GROUP);
-    mdlROcache(mdl,CID_GROUP,NULL,pkd->tinyGroupTable,sizeof(TinyGroupTable),nLocalGroups+1);
-    for(gid=1+nLocalGroups;gid<pkd->nGroups;++gid) {
-	auto g = static_cast<TinyGroupTable*>(mdlFetch(mdl,CID_GROUP,pkd->ga[gid].id.iIndex,pkd->ga[gid].id.iPid));
-	pkd->tinyGroupTable[gid].fMass = g->fMass;
-	for (j=0;j<3;j++) {
-	    pkd->tinyGroupTable[gid].rcom[j] = g->rcom[j];
-	    pkd->tinyGroupTable[gid].vcom[j] = g->vcom[j];
-	    pkd->tinyGroupTable[gid].sigma = g->sigma;
-	    }
-	pkd->tinyGroupTable[gid].rMax = g->rMax;
+	combGroupMoments(pkd,g,&pkd->tinyGroupTable[gid]);
 	}
     mdlFinishCache(mdl,CID_GROUP);
-
-    for(gid=1;gid<pkd->nGroups;++gid) {
+    for(gid=1;gid<=nLocalGroups;++gid) {
 	v2 = 0;
 	for (j=0;j<3;j++) {
             /*
@@ -579,6 +579,27 @@ void pkdCalculateGroupStats(PKD pkd,int bPeriodic,double *dPeriod,double rEnviro
 	pkd->tinyGroupTable[gid].sigma -= v2;
 	pkd->tinyGroupTable[gid].sigma = sqrtf(pkd->tinyGroupTable[gid].sigma);
 	}
+    /*
+    ** Fetch remote group properties.
+    */
+    mdlROcache(mdl,CID_GROUP,NULL,pkd->tinyGroupTable,sizeof(TinyGroupTable),nLocalGroups+1);
+    for(gid=1+nLocalGroups;gid<pkd->nGroups;++gid) {
+	auto g = static_cast<TinyGroupTable*>(mdlFetch(mdl,CID_GROUP,pkd->ga[gid].id.iIndex,pkd->ga[gid].id.iPid));
+	pkd->tinyGroupTable[gid].fMass = g->fMass;
+	for (j=0;j<3;++j) {
+	    pkd->tinyGroupTable[gid].rcom[j] = g->rcom[j];
+	    pkd->tinyGroupTable[gid].vcom[j] = g->vcom[j];
+	    pkd->tinyGroupTable[gid].angular[j] = g->angular[j];
+	    }
+	for (j=0;j<6;++j) {
+	    pkd->tinyGroupTable[gid].inertia[j] = g->inertia[j];
+	    }
+	pkd->tinyGroupTable[gid].sigma = g->sigma;
+	pkd->tinyGroupTable[gid].rMax = g->rMax;
+	pkd->tinyGroupTable[gid].fEnvironDensity0 = g->fEnvironDensity0;
+	pkd->tinyGroupTable[gid].fEnvironDensity1 = g->fEnvironDensity1;	
+	}
+    mdlFinishCache(mdl,CID_GROUP);
     if (bDoShrinkingSphere) {
 	/*
 	** Set the center of each group to be the center of mass, at least initially...
@@ -629,7 +650,7 @@ void pkdCalculateGroupStats(PKD pkd,int bPeriodic,double *dPeriod,double rEnviro
 	    }
 	mdlFinishCache(mdl,CID_GROUP);
 
-	shrink = (ShrinkStruct *)dAccumulate; /* overlay the shrink structure on the accumulators */
+	shrink = (ShrinkStruct *)mr; /* overlay the shrink structure on the mass radius table */
 	for (gid=0;gid<pkd->nGroups;++gid) shrink[gid].nEnclosed = pkd->ga[gid].nTotal; /* all particles in the group */
 
 	/*
@@ -722,152 +743,26 @@ void pkdCalculateGroupStats(PKD pkd,int bPeriodic,double *dPeriod,double rEnviro
 		}
 	    }
 	shrink = NULL; /* make sure we can't use it anymore by accident */
-	} /* end of if (doShrinkingSphere) */ 
-    /*
-    ** Calculate angular momentum about the center of the group.
-    */
-    for (i=0;i<pkd->nLocal;++i) {
-	p = pkdParticle(pkd,i);
-	gid = pkdGetGroup(pkd,p);
-	if (gid > 0) {
-	    fMass = pkdMass(pkd,p);
-	    v = pkdVel(pkd,p);
-	    for (j=0;j<3;++j) {
-		r[j] =  pkdPos(pkd,p,j) - pkd->tinyGroupTable[gid].rPot[j];
-		if      (r[j] < -dHalf[j]) r[j] += dPeriod[j];
-		else if (r[j] > +dHalf[j]) r[j] -= dPeriod[j];
-		r[j] -= pkd->tinyGroupTable[gid].rcen[j];
-		}
-	    dAccumulate[4*gid+0] += fMass*(r[1]*v[2] - r[2]*v[1]);
-	    dAccumulate[4*gid+1] += fMass*(r[2]*v[0] - r[0]*v[2]);
-	    dAccumulate[4*gid+2] += fMass*(r[0]*v[1] - r[1]*v[0]);
-	    }
-	}
-    for (gid=1;gid<pkd->nGroups;++gid) {
-	for (j=0;j<3;++j) {
-	    pkd->tinyGroupTable[gid].angular[j] = dAccumulate[4*gid+j];
-	    dAccumulate[4*gid+j] = 0;
-	    }
-	}
-    /*
-    ** Calculate the moment of inertia (we do this in 2 stages to save accumulator memory.
-    */
-    for (i=0;i<pkd->nLocal;++i) {
-	p = pkdParticle(pkd,i);
-	gid = pkdGetGroup(pkd,p);
-	if (gid > 0) {
-	    fMass = pkdMass(pkd,p);
-	    for (j=0;j<3;++j) {
-		r[j] =  pkdPos(pkd,p,j) - pkd->tinyGroupTable[gid].rPot[j];
-		if      (r[j] < -dHalf[j]) r[j] += dPeriod[j];
-		else if (r[j] > +dHalf[j]) r[j] -= dPeriod[j];
-		r[j] -= pkd->tinyGroupTable[gid].rcen[j];
-		}
-	    dAccumulate[4*gid+0] += fMass*r[0]*r[0];
-	    dAccumulate[4*gid+1] += fMass*r[0]*r[1];
-	    dAccumulate[4*gid+2] += fMass*r[0]*r[2];
-	    }
-	}
-    for (gid=1;gid<pkd->nGroups;++gid) {
-	for (j=0;j<3;++j) {
-	    pkd->tinyGroupTable[gid].inertia[j] = dAccumulate[4*gid+j];
-	    dAccumulate[4*gid+j] = 0;
-	    }
-	}
-    for (i=0;i<pkd->nLocal;++i) {
-	p = pkdParticle(pkd,i);
-	gid = pkdGetGroup(pkd,p);
-	if (gid > 0) {
-	    fMass = pkdMass(pkd,p);
-	    for (j=1;j<3;++j) {  /* careful, this loop skips r[0]! */
-		r[j] =  pkdPos(pkd,p,j) - pkd->tinyGroupTable[gid].rPot[j];
-		if      (r[j] < -dHalf[j]) r[j] += dPeriod[j];
-		else if (r[j] > +dHalf[j]) r[j] -= dPeriod[j];
-		r[j] -= pkd->tinyGroupTable[gid].rcen[j];
-		}
-	    dAccumulate[4*gid+0] += fMass*r[1]*r[1];
-	    dAccumulate[4*gid+1] += fMass*r[1]*r[2];
-	    dAccumulate[4*gid+2] += fMass*r[2]*r[2];
-	    }
-	}
-    for (gid=1;gid<pkd->nGroups;++gid) {
-	for (j=0;j<3;++j) {
-	    pkd->tinyGroupTable[gid].inertia[j+3] = dAccumulate[4*gid+j];
-	    dAccumulate[4*gid+j] = 0;
-	    }
-	}
-    /* 
-    ** Now accumulate angular momentum globally
-    */
-    mdlCOcache(mdl,CID_GROUP,NULL,pkd->tinyGroupTable,sizeof(TinyGroupTable),nLocalGroups+1,
-	NULL,initAngular,combAngular);
-    for(gid=1+nLocalGroups;gid<pkd->nGroups;++gid) {
-	auto g = static_cast<TinyGroupTable*>(mdlVirtualFetch(mdl,CID_GROUP,pkd->ga[gid].id.iIndex,pkd->ga[gid].id.iPid));
-	for (j=0;j<3;j++) {
-	    g->angular[j] += pkd->tinyGroupTable[gid].angular[j];
-	    }
-	for (j=0;j<6;++j) {
-	    g->inertia[j] += pkd->tinyGroupTable[gid].inertia[j];
-	    }
-	}
-    mdlFinishCache(mdl,CID_GROUP);
-    /*
-    ** Scoop environment mass (note the full tree must be present).
-    ** At the very least we need to have masses in the cells, either as part of the FMOMR structure
-    ** or a seperate mass field!
-    */
-    S = (remoteID *)(&pkd->tinyGroupTable[pkd->nGroups]);
-    mdlROcache(mdl,CID_PARTICLE,NULL,pkdParticleBase(pkd),pkdParticleSize(pkd),pkdLocal(pkd));
-    diVol0 = 3.0/4.0*M_1_PI*pow(rEnvironment[0],-3);
-    diVol1 = 3.0/4.0*M_1_PI*pow(rEnvironment[1],-3);
-    for (gid=1;gid<=nLocalGroups;++gid) {
-	for (j=0;j<3;++j) r[j] = pkd->tinyGroupTable[gid].rPot[j];
-	if (rEnvironment[0] > 0.0) {
-	    pkd->tinyGroupTable[gid].fEnvironDensity0 = 
-		pkdGatherMass(pkd,S,rEnvironment[0],r,bPeriodic,dPeriod)*diVol0;
-	    }
-	else pkd->tinyGroupTable[gid].fEnvironDensity0 = 0.0;
-	if (rEnvironment[1] > 0.0) {
-	    pkd->tinyGroupTable[gid].fEnvironDensity1 = 
-		pkdGatherMass(pkd,S,rEnvironment[1],r,bPeriodic,dPeriod)*diVol1;
-	    }
-	else pkd->tinyGroupTable[gid].fEnvironDensity1 = 0.0; 
-	}
-    mdlFinishCache(mdl,CID_PARTICLE);
-    /*
-    ** Fetch remote group properties (we probably only need rMax to be fetched here).
-    */
-    mdlROcache(mdl,CID_GROUP,NULL,pkd->tinyGroupTable,sizeof(TinyGroupTable),nLocalGroups+1);
-    for(gid=1+nLocalGroups;gid<pkd->nGroups;++gid) {
-	auto g = static_cast<TinyGroupTable*>(mdlFetch(mdl,CID_GROUP,pkd->ga[gid].id.iIndex,pkd->ga[gid].id.iPid));
-	pkd->tinyGroupTable[gid].fMass = g->fMass;
-	for (j=0;j<3;++j) {
-	    pkd->tinyGroupTable[gid].rcom[j] = g->rcom[j];
-	    pkd->tinyGroupTable[gid].vcom[j] = g->vcom[j];
-	    pkd->tinyGroupTable[gid].angular[j] = g->angular[j];
-	    }
-	for (j=0;j<6;++j) {
-	    pkd->tinyGroupTable[gid].inertia[j] = g->inertia[j];
+	/*
+	** The angular momentum and inertia were found about rPot; move them to the new center.
+	*/
+	for (gid=1;gid<pkd->nGroups;++gid) {
+	    TinyGroupTable *g = &pkd->tinyGroupTable[gid];
+	    const float *c = g->rcen, *x = g->rcom, *u = g->vcom;
+	    fMass = g->fMass;
+	    g->angular[0] -= fMass*(c[1]*u[2] - c[2]*u[1]);
+	    g->angular[1] -= fMass*(c[2]*u[0] - c[0]*u[2]);
+	    g->angular[2] -= fMass*(c[0]*u[1] - c[1]*u[0]);
+	    g->inertia[0] -= fMass*(2*c[0]*x[0] - c[0]*c[0]);
+	    g->inertia[1] -= fMass*(c[0]*x[1] + x[0]*c[1] - c[0]*c[1]);
+	    g->inertia[2] -= fMass*(c[0]*x[2] + x[0]*c[2] - c[0]*c[2]);
+	    g->inertia[3] -= fMass*(2*c[1]*x[1] - c[1]*c[1]);
+	    g->inertia[4] -= fMass*(c[1]*x[2] + x[1]*c[2] - c[1]*c[2]);
+	    g->inertia[5] -= fMass*(2*c[2]*x[2] - c[2]*c[2]);
 	    }
-	pkd->tinyGroupTable[gid].sigma = g->sigma;
-	pkd->tinyGroupTable[gid].rMax = g->rMax;
-	pkd->tinyGroupTable[gid].fEnvironDensity0 = g->fEnvironDensity0;
-	pkd->tinyGroupTable[gid].fEnvironDensity1 = g->fEnvironDensity1;	
-	}
-    mdlFinishCache(mdl,CID_GROUP);
-    /*
-    ** Now find the half mass radii of the groups.
-    ** Start by reordering particles into group order.
-    ** Note that we must not access tree cells until the next tree build! 
-    */
-    mdlFinishCache(mdl,CID_CELL);
-    iGrpOffset = (uint32_t *)(&pkd->tinyGroupTable[pkd->nGroups]);
-    mrIndex = (int *)(&iGrpOffset[2*pkd->nGroups]);    /* this stores the ending index of each group in the mr below */
-    mr = (MassRadius *)(&mrIndex[pkd->nGroups]);  /* we must be careful how much of this we use! */
-    pkdGroupOrder(pkd,iGrpOffset);
-    iGrpEnd = &iGrpOffset[pkd->nGroups];
-    iGrpEnd[0] = 0;
+	} /* end of if (doShrinkingSphere) */ 
     /*
+    ** Now find the half mass radii of the groups (the particles are in group order).
     ** First do all purely local groups. We can do these one at a time without 
     ** worrying about remote particles. We should use the bounds determined by 
     ** fof previously.
@@ -0,0 +1,318 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#else
+#include "pkd_config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "mergertree.h"
+#include "group.h"
+
+/*
+** On-the-fly merger trees.
+**
+** After the statistics of a group finding step have been computed, the most
+** bound members of every group (the tracers) are tagged with the catalog index
+** of their group, i.e., the position of the group in the .fofstats/.hopstats
+** file. The tag has its own particle field (PKD_MODEL_MERGER), so the group
+** ids are left alone and the tags travel with the particles through the
+** following steps.
+**
+** At the start of the next group finding step each domain harvests its tagged
+** particles into a table sorted by particle ID. Once the new groups are known, every grouped particle looks
+** itself up in this table; a hit means that the progenitor of the tracer
+** contributes to the descendant group of the particle. The counts are
+** accumulated per group, pushed to the domain owning the group through the
+** combiner cache, and the owner emits one MERGEREDGE per progenitor.
+*/
+
+#define MERGER_MAX_PROGENITORS 8 /* Progenitors kept per descendant */
+#define MERGER_TAG_OFFSET 1      /* Tag of a tracer is its catalog index plus this, 0 is no tracer */
+
+struct mergerSlots {
+    int64_t iProgenitor[MERGER_MAX_PROGENITORS];
+    int32_t nShared[MERGER_MAX_PROGENITORS];
+    };
+
+/*
+** Add n shared tracers of iProgenitor. When all slots are taken the weakest
+** progenitor is dropped if it is weaker than the new one.
+*/
+static void mergerAddSlot(mergerSlots *s,int64_t iProgenitor,int32_t n) {
+    int i, iMin = 0;
+    for (i=0;i<MERGER_MAX_PROGENITORS;++i) {
+	if (s->nShared[i] == 0) {
+	    s->iProgenitor[i] = iProgenitor;
+	    s->nShared[i] = n;
+	    return;
+	    }
+	if (s->iProgenitor[i] == iProgenitor) {
+	    s->nShared[i] += n;
+	    return;
+	    }
+	if (s->nShared[i] < s->nShared[iMin]) iMin = i;
+	}
+    if (n > s->nShared[iMin]) {
+	s->iProgenitor[iMin] = iProgenitor;
+	s->nShared[iMin] = n;
+	}
+    }
+
+static void initMergerSlots(void *vpkd, void *v) {
+    memset(v,0,sizeof(mergerSlots));
+    }
+static void combMergerSlots(void *vctx, void *v1, const void *v2) {
+    mergerSlots *s1 = (mergerSlots *)v1;
+    const mergerSlots *s2 = (const mergerSlots *)v2;
+    for (auto i=0;i<MERGER_MAX_PROGENITORS && s2->nShared[i];++i)
+	mergerAddSlot(s1,s2->iProgenitor[i],s2->nShared[i]);
+    }
+
+static inline uint64_t mergerParticleID(PKD pkd,PARTICLE *p) {
+    if (pkd->oFieldOffset[oParticleID]) return *pkdParticleID(pkd,p);
+    assert(!pkd->bNoParticleOrder);
+    return p->iOrder;
+    }
+
+static bool mergerLessID(const MERGERTRACER &a,const MERGERTRACER &b) {
+    return a.iID < b.iID;
+    }
+
+/*
+** Collect the tracers tagged at the previous group finding step.
+*/
+uint64_t pkdMergerHarvest(PKD pkd) {
+    PARTICLE *p;
+    int i,n;
+
+    if (!pkd->bMergerTagged) return 0;
+    pkd->bMergerTagged = 0;
+    free(pkd->mergerHarvest);
+    pkd->mergerHarvest = NULL;
+    for (i=n=0;i<pkd->nLocal;++i) {
+	if (pkdGetMergerTag(pkd,pkdParticle(pkd,i)) >= MERGER_TAG_OFFSET) ++n;
+	}
+    pkd->nMergerHarvest = n;
+    if (n == 0) return 0;
+    pkd->mergerHarvest = (MERGERTRACER *)malloc(n*sizeof(MERGERTRACER));
+    assert(pkd->mergerHarvest != NULL);
+    for (i=n=0;i<pkd->nLocal;++i) {
+	p = pkdParticle(pkd,i);
+	int32_t iTag = pkdGetMergerTag(pkd,p);
+	if (iTag < MERGER_TAG_OFFSET) continue;
+	pkd->mergerHarvest[n].iID = mergerParticleID(pkd,p);
+	pkd->mergerHarvest[n].iGroup = iTag - MERGER_TAG_OFFSET;
+	++n;
+	}
+    std::sort(pkd->mergerHarvest,pkd->mergerHarvest+n,mergerLessID);
+    return n;
+    }
+
+/*
+** Number of groups owned by this domain; the master turns these into the
+** offsets of each domain's groups in the catalog.
+*/
+uint64_t pkdMergerCountGroups(PKD pkd) {
+    struct smGroupArray *ga = pkd->ga;
+    uint64_t nLocalGroups = 0;
+    assert(ga != NULL);
+    for (auto gid=1;gid<pkd->nGroups;++gid)
+	if (ga[gid].id.iPid == pkd->idSelf) ++nLocalGroups;
+    return nLocalGroups;
+    }
+
+/*
+** Link the groups just found to the groups of the previous step and choose
+** the new tracers. Must be called while pkd->ga is valid, i.e., before the
+** group statistics. Returns the number of edges emitted by this domain.
+*/
+uint64_t pkdMergerLink(PKD pkd,int nTracers,const uint64_t *iGroupOffset) {
+    MDL mdl = pkd->mdl;
+    struct smGroupArray *ga = pkd->ga;
+    PARTICLE *p;
+    int i,j,gid,nLocalGroups;
+
+    assert(ga != NULL);
+    nLocalGroups = pkdGroupCounts(pkd,pkd->nGroups,ga);
+    const int64_t iFirst = iGroupOffset[pkd->idSelf];
+
+    /*
+    ** Count the tracers of each progenitor found in our part of each group.
+    */
+    std::vector<mergerSlots> slots(pkd->nGroups);
+    for (auto &s : slots) initMergerSlots(pkd,&s);
+    if (pkd->nMergerHarvest) {
+	const MERGERTRACER *pBegin = pkd->mergerHarvest, *pEnd = pBegin + pkd->nMergerHarvest;
+	for (i=0;i<pkd->nLocal;++i) {
+	    p = pkdParticle(pkd,i);
+	    gid = pkdGetGroup(pkd,p);
+	    if (gid == 0) continue;
+	    MERGERTRACER key;
+	    key.iID = mergerParticleID(pkd,p);
+	    auto t = std::lower_bound(pBegin,pEnd,key,mergerLessID);
+	    if (t != pEnd && t->iID == key.iID) mergerAddSlot(&slots[gid],t->iGroup,1);
+	    }
+	}
+    free(pkd->mergerHarvest);
+    pkd->mergerHarvest = NULL;
+    pkd->nMergerHarvest = 0;
+
+    /*
+    ** Send the counts of groups owned elsewhere to the owner.
+    */
+    mdlCOcache(mdl,CID_GROUP,NULL,slots.data(),sizeof(mergerSlots),pkd->nGroups,
+	NULL,initMergerSlots,combMergerSlots);
+    for (gid=1+nLocalGroups;gid<pkd->nGroups;++gid) {
+	assert(ga[gid].id.iPid != pkd->idSelf);
+	if (slots[gid].nShared[0] == 0) continue;
+	auto s = static_cast<mergerSlots*>(mdlVirtualFetch(mdl,CID_GROUP,ga[gid].id.iIndex,ga[gid].id.iPid));
+	combMergerSlots(pkd,s,&slots[gid]);
+	}
+    mdlFinishCache(mdl,CID_GROUP);
+
+    /*
+    ** Emit the edges of our own groups, strongest progenitor first.
+    */
+    std::vector<MERGEREDGE> edges;
+    for (gid=1;gid<=nLocalGroups;++gid) {
+	mergerSlots &s = slots[gid];
+	int n = 0;
+	while (n<MERGER_MAX_PROGENITORS && s.nShared[n]) ++n;
+	int iEdge = edges.size();
+	for (j=0;j<n;++j) {
+	    MERGEREDGE e;
+	    e.iProgenitor = s.iProgenitor[j];
+	    e.iDescendant = iFirst + gid - 1;
+	    e.nShared = s.nShared[j];
+	    e.nDescendant = ga[gid].nTotal;
+	    edges.push_back(e);
+	    }
+	std::sort(edges.begin()+iEdge,edges.end(),
+	    [](const MERGEREDGE &a,const MERGEREDGE &b) {return a.nShared > b.nShared;});
+	}
+    free(pkd->mergerEdges);
+    pkd->mergerEdges = NULL;
+    pkd->nMergerEdges = edges.size();
+    if (pkd->nMergerEdges) {
+	pkd->mergerEdges = (MERGEREDGE *)malloc(pkd->nMergerEdges*sizeof(MERGEREDGE));
+	assert(pkd->mergerEdges != NULL);
+	std::copy(edges.begin(),edges.end(),pkd->mergerEdges);
+	}
+
+    /*
+    ** The catalog index of groups owned by a remote domain is only known
+    ** through ga, so find it now for all of our groups.
+    */
+    std::vector<int64_t> iCatalog(pkd->nGroups,0);
+    for (gid=1;gid<=nLocalGroups;++gid) iCatalog[gid] = iFirst + gid - 1;
+    mdlROcache(mdl,CID_GROUP,NULL,iCatalog.data(),sizeof(int64_t),pkd->nGroups);
+    for (gid=1+nLocalGroups;gid<pkd->nGroups;++gid) {
+	auto c = static_cast<const int64_t*>(mdlFetch(mdl,CID_GROUP,ga[gid].id.iIndex,ga[gid].id.iPid));
+	iCatalog[gid] = *c;
+	}
+    mdlFinishCache(mdl,CID_GROUP);
+
+    /*
+    ** Select the tracers: the most bound of our members of each group. A group
+    ** split over several domains gets tracers from each domain in proportion
+    ** to the members it has there. Without a potential we fall back to the
+    ** density, and without that to an arbitrary choice.
+    */
+    struct mergerCandidate {
+	int gid, i;
+	float fScore;
+	bool operator<(const mergerCandidate &b) const {
+	    return gid < b.gid || (gid == b.gid && fScore < b.fScore);
+	    }
+	};
+    std::vector<mergerCandidate> cand;
+    const bool bPotential = pkd->bSoA ? pkd->pSoaPot != NULL : pkd->oFieldOffset[oPotential] != 0;
+    const bool bDensity = pkd->oFieldOffset[oDensity] != 0;
+    for (i=0;i<pkd->nLocal;++i) {
+	p = pkdParticle(pkd,i);
+	gid = pkdGetGroup(pkd,p);
+	if (gid == 0) continue;
+	mergerCandidate c;
+	c.gid = gid;
+	c.i = i;
+	c.fScore = bPotential ? *pkdPot(pkd,p) : bDensity ? -pkdDensity(pkd,p) : 0.0f;
+	cand.push_back(c);
+	}
+    std::sort(cand.begin(),cand.end());
+    const int64_t iTagMax = INT32_MAX - MERGER_TAG_OFFSET;
+    std::vector<MERGERTRACER> select;
+    for (auto c=cand.begin();c!=cand.end();) {
+	auto cEnd = c;
+	while (cEnd!=cand.end() && cEnd->gid == c->gid) ++cEnd;
+	uint64_t nMine = cEnd - c, nTotal = ga[c->gid].nTotal;
+	uint64_t n = std::max<uint64_t>(1,(nTracers*nMine + nTotal - 1) / nTotal);
+	if (iCatalog[c->gid] <= iTagMax) {
+	    for (auto t=c;t!=cEnd && n;++t,--n) {
+		MERGERTRACER s;
+		s.iID = mergerParticleID(pkd,pkdParticle(pkd,t->i));
+		s.iGroup = iCatalog[c->gid];
+		select.push_back(s);
+		}
+	    }
+	c = cEnd;
+	}
+    free(pkd->mergerSelect);
+    pkd->mergerSelect = NULL;
+    pkd->nMergerSelect = select.size();
+    if (pkd->nMergerSelect) {
+	pkd->mergerSelect = (MERGERTRACER *)malloc(pkd->nMergerSelect*sizeof(MERGERTRACER));
+	assert(pkd->mergerSelect != NULL);
+	std::copy(select.begin(),select.end(),pkd->mergerSelect);
+	std::sort(pkd->mergerSelect,pkd->mergerSelect+pkd->nMergerSelect,mergerLessID);
+	}
+    return pkd->nMergerEdges;
+    }
+
+/*
+** Tag the tracers chosen by pkdMergerLink and clear the tag of every other
+** particle. The statistics put the particles in group order, so the tracers
+** are found by ID.
+*/
+uint64_t pkdMergerTag(PKD pkd) {
+    PARTICLE *p;
+    int i;
+    uint64_t nTagged = 0;
+
+    const MERGERTRACER *pBegin = pkd->mergerSelect, *pEnd = pBegin + pkd->nMergerSelect;
+    for (i=0;i<pkd->nLocal;++i) {
+	p = pkdParticle(pkd,i);
+	pkdSetMergerTag(pkd,p,0);
+	if (pkd->nMergerSelect == 0) continue;
+	MERGERTRACER key;
+	key.iID = mergerParticleID(pkd,p);
+	auto t = std::lower_bound(pBegin,pEnd,key,mergerLessID);
+	if (t != pEnd && t->iID == key.iID) {
+	    pkdSetMergerTag(pkd,p,t->iGroup + MERGER_TAG_OFFSET);
+	    ++nTagged;
+	    }
+	}
+    free(pkd->mergerSelect);
+    pkd->mergerSelect = NULL;
+    pkd->nMergerSelect = 0;
+    pkd->bMergerTagged = 1;
+    return nTagged;
+    }
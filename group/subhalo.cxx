@@ -0,0 +1,530 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#else
+#include "pkd_config.h"
+#endif
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include "subhalo.h"
+#include "group.h"
+
+/*
+** Hierarchical substructure inside the HOP groups.
+**
+** For each group we build a small kd-tree over its members once. It is used
+** for the neighbour search and then again, with the cell masses recomputed
+** for the particles still in play, for every unbinding iteration of every
+** candidate. The candidates are the density peaks of the group: members are
+** visited in order of decreasing density and attached to the candidate of
+** their two nearest denser neighbours; when those belong to different
+** candidates we are at a saddle point, both candidates are recorded, and they
+** are merged. Merging always appends the smaller chain after the larger one,
+** so every recorded candidate ends up as a contiguous range of the final
+** member order and the candidates form a properly nested hierarchy.
+*/
+
+#define SUB_BUCKET 8
+#define SUB_MAX_REMOVE 0.25 /* Largest fraction of a candidate unbound in one iteration */
+
+struct subNode {
+    double fCenter[3], fMax[3];
+    double fMass, mr[3];    /* Mass and mass weighted position of the active members */
+    int iLower, iParent;
+    int pLower, pUpper;     /* Range in subGroup::perm */
+    };
+
+struct subCandidate {
+    int iStart, nLen;       /* Members subGroup::ord[iStart..iStart+nLen-1] */
+    int bBound, nBound, nOwn, nChild;
+    int iParent, iOut;
+    double fMass, minPot, rPot[3], rcom[3], vcom[3];
+    };
+
+struct subGroup {
+    int n;
+    double rRef[3];
+    std::vector<double> r, v;
+    std::vector<float> m, fSoft, fDensity;
+    std::vector<int> perm, leaf, ngb, ord, owner, S;
+    std::vector<char> bActive;
+    std::vector<subNode> node;
+    std::vector<subCandidate> cand;
+    };
+
+static inline double subMinDist2(const subNode &c,const double *x) {
+    double d2 = 0.0;
+    for (auto j=0;j<3;++j) {
+	double d = fabs(x[j] - c.fCenter[j]) - c.fMax[j];
+	if (d > 0) d2 += d*d;
+	}
+    return d2;
+    }
+
+static void subBuildTree(subGroup &g) {
+    g.perm.resize(g.n);
+    std::iota(g.perm.begin(),g.perm.end(),0);
+    g.leaf.resize(g.n);
+    g.node.clear();
+    g.node.emplace_back();
+    g.node[0].pLower = 0;
+    g.node[0].pUpper = g.n - 1;
+    g.node[0].iParent = -1;
+    g.S.clear();
+    g.S.push_back(0);
+    while (!g.S.empty()) {
+	int iCell = g.S.back();
+	g.S.pop_back();
+	subNode &c = g.node[iCell];
+	double lo[3] = {HUGE_VAL,HUGE_VAL,HUGE_VAL}, hi[3] = {-HUGE_VAL,-HUGE_VAL,-HUGE_VAL};
+	for (auto i=c.pLower;i<=c.pUpper;++i) {
+	    const double *x = &g.r[3*g.perm[i]];
+	    for (auto j=0;j<3;++j) {
+		if (x[j] < lo[j]) lo[j] = x[j];
+		if (x[j] > hi[j]) hi[j] = x[j];
+		}
+	    }
+	for (auto j=0;j<3;++j) {
+	    c.fCenter[j] = 0.5*(hi[j] + lo[j]);
+	    c.fMax[j] = 0.5*(hi[j] - lo[j]);
+	    }
+	const int pLower = c.pLower, pUpper = c.pUpper;
+	if (pUpper - pLower + 1 <= SUB_BUCKET) {
+	    for (auto i=pLower;i<=pUpper;++i) g.leaf[g.perm[i]] = iCell;
+	    continue;
+	    }
+	int d = (c.fMax[0]>c.fMax[2]) ? (c.fMax[0]>c.fMax[1]?0:1) : (c.fMax[2]>c.fMax[1]?2:1);
+	double fSplit = c.fCenter[d];
+	int i = pLower, j = pUpper;
+	while (i <= j) {
+	    if (g.r[3*g.perm[i]+d] < fSplit) ++i;
+	    else std::swap(g.perm[i],g.perm[j--]);
+	    }
+	if (i == pLower || i > pUpper) i = (pLower + pUpper + 1) / 2; /* coincident particles */
+	int iLower = g.node.size();
+	g.node[iCell].iLower = iLower;  /* c is invalid after the emplace_back below */
+	g.node.emplace_back();
+	g.node.emplace_back();
+	g.node[iLower].pLower = pLower;
+	g.node[iLower].pUpper = i - 1;
+	g.node[iLower+1].pLower = i;
+	g.node[iLower+1].pUpper = pUpper;
+	g.node[iLower].iParent = g.node[iLower+1].iParent = iCell;
+	g.S.push_back(iLower);
+	g.S.push_back(iLower+1);
+	}
+    }
+
+/*
+** For each member find the two nearest of its nNeighbors nearest neighbours
+** which come before it in the density order.
+*/
+static void subNeighbors(subGroup &g,int nNeighbors,const std::vector<int> &rank) {
+    std::vector<std::pair<double,int>> heap;
+    const int k = std::min(nNeighbors,g.n-1);
+
+    g.ngb.assign(2*g.n,-1);
+    if (k <= 0) return;
+    for (auto i=0;i<g.n;++i) {
+	const double *x = &g.r[3*i];
+	heap.clear();
+	g.S.clear();
+	g.S.push_back(0);
+	while (!g.S.empty()) {
+	    const subNode &c = g.node[g.S.back()];
+	    g.S.pop_back();
+	    if ((int)heap.size() == k && subMinDist2(c,x) >= heap.front().first) continue;
+	    if (c.iLower) {
+		g.S.push_back(c.iLower);
+		g.S.push_back(c.iLower+1);
+		continue;
+		}
+	    for (auto pj=c.pLower;pj<=c.pUpper;++pj) {
+		int j = g.perm[pj];
+		if (j == i) continue;
+		double dx = g.r[3*j+0] - x[0];
+		double dy = g.r[3*j+1] - x[1];
+		double dz = g.r[3*j+2] - x[2];
+		double d2 = dx*dx + dy*dy + dz*dz;
+		if ((int)heap.size() < k) {
+		    heap.emplace_back(d2,j);
+		    std::push_heap(heap.begin(),heap.end());
+		    }
+		else if (d2 < heap.front().first) {
+		    std::pop_heap(heap.begin(),heap.end());
+		    heap.back() = std::make_pair(d2,j);
+		    std::push_heap(heap.begin(),heap.end());
+		    }
+		}
+	    }
+	std::sort_heap(heap.begin(),heap.end());
+	int nDenser = 0;
+	for (auto &h : heap) {
+	    if (rank[h.second] < rank[i]) {
+		g.ngb[2*i + nDenser++] = h.second;
+		if (nDenser == 2) break;
+		}
+	    }
+	}
+    }
+
+/*
+** Grow the density peaks and record every candidate that reaches a saddle
+** point with at least nMinMembers members.
+*/
+static void subCandidates(subGroup &g,const std::vector<int> &order,int nMinMembers) {
+    std::vector<int> head, tail, len, next(g.n,-1), label(g.n,-1), pos(g.n);
+    std::vector<std::pair<int,int>> rec;
+    auto record = [&](int c) { if (len[c] >= nMinMembers) rec.emplace_back(head[c],len[c]); };
+
+    for (auto m : order) {
+	int a = g.ngb[2*m]   >= 0 ? label[g.ngb[2*m]]   : -1;
+	int b = g.ngb[2*m+1] >= 0 ? label[g.ngb[2*m+1]] : -1;
+	if (a < 0) std::swap(a,b);
+	if (a < 0) { /* A new density peak */
+	    label[m] = head.size();
+	    head.push_back(m);
+	    tail.push_back(m);
+	    len.push_back(1);
+	    continue;
+	    }
+	if (b >= 0 && b != a) { /* A saddle point */
+	    record(a);
+	    record(b);
+	    if (len[a] < len[b]) std::swap(a,b);
+	    for (auto i=head[b];i>=0;i=next[i]) label[i] = a;
+	    next[tail[a]] = head[b];
+	    tail[a] = tail[b];
+	    len[a] += len[b];
+	    len[b] = 0;
+	    }
+	next[tail[a]] = m;
+	tail[a] = m;
+	++len[a];
+	label[m] = a;
+	}
+    /*
+    ** Lay out the surviving chains; disconnected pieces of the group are also candidates.
+    */
+    g.ord.clear();
+    for (auto c=0;c<(int)head.size();++c) {
+	if (len[c] == 0) continue;
+	if (len[c] >= nMinMembers && len[c] < g.n) record(c);
+	for (auto i=head[c];i>=0;i=next[i]) {
+	    pos[i] = g.ord.size();
+	    g.ord.push_back(i);
+	    }
+	}
+    assert((int)g.ord.size() == g.n);
+    g.cand.clear();
+    subCandidate whole = {};
+    whole.iStart = 0;
+    whole.nLen = g.n;
+    g.cand.push_back(whole);
+    for (auto &r : rec) {
+	subCandidate s = {};
+	s.iStart = pos[r.first];
+	s.nLen = r.second;
+	g.cand.push_back(s);
+	}
+    std::sort(g.cand.begin(),g.cand.end(),[](const subCandidate &a,const subCandidate &b) {
+	return a.iStart < b.iStart || (a.iStart == b.iStart && a.nLen > b.nLen); });
+    g.cand.erase(std::unique(g.cand.begin(),g.cand.end(),[](const subCandidate &a,const subCandidate &b) {
+	return a.iStart == b.iStart && a.nLen == b.nLen; }),g.cand.end());
+    }
+
+/*
+** Put the mass of the active members into the tree. The paths of all of the
+** candidate members are cleared first, which also removes anything left over
+** from the previous iteration or candidate.
+*/
+static void subClearTree(subGroup &g,const int *pMember,int nMember) {
+    for (auto k=0;k<nMember;++k) {
+	for (auto c=g.leaf[pMember[k]];c>=0;c=g.node[c].iParent) {
+	    g.node[c].fMass = 0.0;
+	    g.node[c].mr[0] = g.node[c].mr[1] = g.node[c].mr[2] = 0.0;
+	    }
+	}
+    }
+
+static void subAddTree(subGroup &g,const std::vector<int> &act) {
+    for (auto i : act) {
+	const double *x = &g.r[3*i];
+	for (auto c=g.leaf[i];c>=0;c=g.node[c].iParent) {
+	    g.node[c].fMass += g.m[i];
+	    for (auto j=0;j<3;++j) g.node[c].mr[j] += g.m[i]*x[j];
+	    }
+	}
+    }
+
+static double subPotential(subGroup &g,int i,double dTheta2) {
+    const double *x = &g.r[3*i];
+    const double fSoft2 = g.fSoft[i]*g.fSoft[i];
+    double phi = 0.0;
+
+    g.S.clear();
+    g.S.push_back(0);
+    while (!g.S.empty()) {
+	const subNode &c = g.node[g.S.back()];
+	g.S.pop_back();
+	if (c.fMass == 0.0) continue;
+	if (c.iLower == 0) {
+	    for (auto pj=c.pLower;pj<=c.pUpper;++pj) {
+		int j = g.perm[pj];
+		if (j == i || !g.bActive[j]) continue;
+		double dx = g.r[3*j+0] - x[0];
+		double dy = g.r[3*j+1] - x[1];
+		double dz = g.r[3*j+2] - x[2];
+		phi -= g.m[j] / sqrt(dx*dx + dy*dy + dz*dz + fSoft2);
+		}
+	    continue;
+	    }
+	double dx = c.mr[0]/c.fMass - x[0];
+	double dy = c.mr[1]/c.fMass - x[1];
+	double dz = c.mr[2]/c.fMass - x[2];
+	double d2 = dx*dx + dy*dy + dz*dz;
+	double fSize = 2.0*std::max({c.fMax[0],c.fMax[1],c.fMax[2]});
+	if (fSize*fSize < dTheta2*d2 && subMinDist2(c,x) > 0.0) {
+	    phi -= c.fMass / sqrt(d2 + fSoft2);
+	    continue;
+	    }
+	g.S.push_back(c.iLower);
+	g.S.push_back(c.iLower+1);
+	}
+    return phi;
+    }
+
+/*
+** Iteratively remove the unbound members of a candidate. Each iteration
+** removes at most SUB_MAX_REMOVE of the members (the least bound first) as the
+** potential changes as members are removed. The energy is the same as in
+** pkdHopUnbind. On return act holds the bound members.
+*/
+static void subUnbind(subGroup &g,subCandidate &s,std::vector<int> &act,
+		      double a,double dTheta2,int nMinMembers) {
+    const int *pMember = &g.ord[s.iStart];
+    std::vector<std::pair<double,int>> E;
+    std::vector<double> phi;
+    double vcom[3];
+
+    act.assign(pMember,pMember+s.nLen);
+    s.bBound = 0;
+    while ((int)act.size() >= nMinMembers) {
+	subClearTree(g,pMember,s.nLen);
+	subAddTree(g,act);
+	s.fMass = g.node[0].fMass;
+	for (auto j=0;j<3;++j) vcom[j] = 0.0;
+	for (auto i : act) {
+	    g.bActive[i] = 1;
+	    for (auto j=0;j<3;++j) vcom[j] += g.m[i]*g.v[3*i+j];
+	    }
+	for (auto j=0;j<3;++j) vcom[j] /= s.fMass;
+	E.clear();
+	phi.clear();
+	int nUnbound = 0;
+	for (auto i : act) {
+	    double dv2 = 0.0;
+	    for (auto j=0;j<3;++j) {
+		double dv = g.v[3*i+j] - vcom[j];
+		dv2 += dv*dv;
+		}
+	    phi.push_back(subPotential(g,i,dTheta2));
+	    E.emplace_back(0.5*a*a*dv2 + phi.back()/a,i);
+	    if (E.back().first >= 0.0) ++nUnbound;
+	    }
+	for (auto i : act) g.bActive[i] = 0;
+	if (nUnbound == 0) {
+	    s.bBound = 1;
+	    s.nBound = act.size();
+	    s.minPot = HUGE_VAL;
+	    for (auto k=0;k<(int)act.size();++k) {
+		if (phi[k] < s.minPot) {
+		    s.minPot = phi[k];
+		    for (auto j=0;j<3;++j) s.rPot[j] = g.rRef[j] + g.r[3*act[k]+j];
+		    }
+		}
+	    for (auto j=0;j<3;++j) {
+		s.rcom[j] = g.rRef[j] + g.node[0].mr[j]/s.fMass;
+		s.vcom[j] = vcom[j];
+		}
+	    break;
+	    }
+	int nRemove = std::min(nUnbound,std::max(1,(int)(SUB_MAX_REMOVE*act.size())));
+	std::nth_element(E.begin(),E.end()-nRemove,E.end());
+	act.clear();
+	for (auto k=0;k<(int)E.size()-nRemove;++k) act.push_back(E[k].second);
+	}
+    subClearTree(g,pMember,s.nLen);
+    }
+
+/*
+** Unbind the candidates of one group, smallest first, and append the bound
+** ones to the subhalo table in depth first order. A member belongs to the
+** smallest bound subhalo that contains it. A bound candidate which owns no
+** members and has a single bound child duplicates that child and is dropped.
+*/
+static void subFindGroup(PKD pkd,subGroup &g,int gid,std::vector<SUBHALO> &table,
+			 int nNeighbors,int nMinMembers,double a,double dTheta2) {
+    std::vector<int> order(g.n), rank(g.n), bySize, act, stack;
+
+    std::iota(order.begin(),order.end(),0);
+    std::sort(order.begin(),order.end(),[&g](int i,int j) {
+	return g.fDensity[i] > g.fDensity[j] || (g.fDensity[i] == g.fDensity[j] && i < j); });
+    for (auto k=0;k<g.n;++k) rank[order[k]] = k;
+
+    subBuildTree(g);
+    subNeighbors(g,nNeighbors,rank);
+    subCandidates(g,order,nMinMembers);
+
+    g.owner.assign(g.n,-1);
+    g.bActive.assign(g.n,0);
+    for (auto &n : g.node) n.fMass = 0.0;
+    bySize.resize(g.cand.size());
+    std::iota(bySize.begin(),bySize.end(),0);
+    std::stable_sort(bySize.begin(),bySize.end(),[&g](int i,int j) { return g.cand[i].nLen < g.cand[j].nLen; });
+    for (auto c : bySize) {
+	subCandidate &s = g.cand[c];
+	subUnbind(g,s,act,a,dTheta2,nMinMembers);
+	if (!s.bBound) continue;
+	for (auto i : act) {
+	    if (g.owner[i] < 0) {
+		g.owner[i] = c;
+		++s.nOwn;
+		}
+	    }
+	}
+    /*
+    ** The candidates are sorted by start and then decreasing length, so a
+    ** stack of the enclosing bound candidates gives the parent of each.
+    */
+    for (auto c=0;c<(int)g.cand.size();++c) {
+	subCandidate &s = g.cand[c];
+	s.iParent = -1;
+	if (!s.bBound) continue;
+	while (!stack.empty() && s.iStart >= g.cand[stack.back()].iStart + g.cand[stack.back()].nLen) stack.pop_back();
+	if (!stack.empty()) {
+	    s.iParent = stack.back();
+	    ++g.cand[s.iParent].nChild;
+	    }
+	stack.push_back(c);
+	}
+    for (auto c=0;c<(int)g.cand.size();++c) {
+	subCandidate &s = g.cand[c];
+	if (!s.bBound) continue;
+	while (s.iParent >= 0 && !g.cand[s.iParent].bBound) s.iParent = g.cand[s.iParent].iParent;
+	if (s.nOwn == 0 && s.nChild <= 1) {
+	    s.bBound = 0; /* Dropped: children have been resolved above as they follow us */
+	    continue;
+	    }
+	SUBHALO h;
+	s.iOut = table.size();
+	h.iPid = pkd->idSelf;
+	h.iGroup = gid;
+	h.iParent = s.iParent >= 0 ? g.cand[s.iParent].iOut : -1;
+	h.iLevel = s.iParent >= 0 ? table[h.iParent].iLevel + 1 : 0;
+	h.nBound = s.nBound;
+	h.nOwn = s.nOwn;
+	h.fMass = s.fMass;
+	h.minPot = s.minPot;
+	for (auto j=0;j<3;++j) {
+	    h.rPot[j] = s.rPot[j];
+	    h.rcom[j] = s.rcom[j];
+	    h.vcom[j] = s.vcom[j];
+	    }
+	table.push_back(h);
+	}
+    }
+
+void pkdHopSubhalosFinish(PKD pkd) {
+    free(pkd->subhaloTable);
+    pkd->subhaloTable = NULL;
+    pkd->nSubhalos = 0;
+    }
+
+/*
+** Find the subhalos of all groups that are entirely on this domain. This must
+** run while pkd->ga is still valid, that is after pkdHopFinishUp and before the
+** group statistics. The groups of this domain that span several domains are
+** counted in pnSkipped.
+*/
+uint64_t pkdHopSubhalos(PKD pkd,double dTime,int nNeighbors,int nMinMembers,double dTheta,
+    int bPeriodic,double *dPeriod,uint64_t *pnSkipped) {
+    struct smGroupArray *ga = pkd->ga;
+    const double a = csmTime2Exp(pkd->csm,dTime);
+    PARTICLE *p;
+    int i,j,k,gid,nLocalGroups;
+    subGroup g;
+    std::vector<SUBHALO> table;
+
+    assert(ga != NULL);
+    pkdHopSubhalosFinish(pkd);
+    nLocalGroups = pkdGroupCounts(pkd,pkd->nGroups,ga);
+    /*
+    ** Sort the local members by group.
+    */
+    std::vector<int> iStart(pkd->nGroups+1,0), iMember(pkd->nLocal);
+    for (i=0;i<pkd->nLocal;++i) ++iStart[pkdGetGroup(pkd,pkdParticle(pkd,i))+1];
+    for (gid=0;gid<pkd->nGroups;++gid) iStart[gid+1] += iStart[gid];
+    std::vector<int> iNext(iStart.begin(),iStart.end()-1);
+    for (i=0;i<pkd->nLocal;++i) iMember[iNext[pkdGetGroup(pkd,pkdParticle(pkd,i))]++] = i;
+
+    *pnSkipped = 0;
+    for (gid=1;gid<=nLocalGroups;++gid) {
+	g.n = iStart[gid+1] - iStart[gid];
+	if ((uint32_t)g.n != ga[gid].nTotal) { /* Not entirely local */
+	    if (ga[gid].nTotal >= (uint32_t)nMinMembers) ++*pnSkipped;
+	    continue;
+	    }
+	if (g.n < nMinMembers) continue;
+	g.r.resize(3*g.n);
+	g.v.resize(3*g.n);
+	g.m.resize(g.n);
+	g.fSoft.resize(g.n);
+	g.fDensity.resize(g.n);
+	p = pkdParticle(pkd,iMember[iStart[gid]]);
+	for (j=0;j<3;++j) g.rRef[j] = pkdPos(pkd,p,j);
+	for (k=0;k<g.n;++k) {
+	    p = pkdParticle(pkd,iMember[iStart[gid]+k]);
+	    vel_t *v = pkdVel(pkd,p);
+	    for (j=0;j<3;++j) {
+		double x = pkdPos(pkd,p,j) - g.rRef[j];
+		if (bPeriodic) {
+		    if (x > 0.5*dPeriod[j]) x -= dPeriod[j];
+		    else if (x < -0.5*dPeriod[j]) x += dPeriod[j];
+		    }
+		g.r[3*k+j] = x;
+		g.v[3*k+j] = v[j];
+		}
+	    g.m[k] = pkdMass(pkd,p);
+	    g.fSoft[k] = pkdSoft(pkd,p);
+	    g.fDensity[k] = pkdDensity(pkd,p);
+	    }
+	subFindGroup(pkd,g,gid,table,nNeighbors,nMinMembers,a,dTheta*dTheta);
+	}
+    pkd->nSubhalos = table.size();
+    if (pkd->nSubhalos) {
+	pkd->subhaloTable = (SUBHALO *)malloc(pkd->nSubhalos*sizeof(SUBHALO));
+	assert(pkd->subhaloTable != NULL);
+	std::copy(table.begin(),table.end(),pkd->subhaloTable);
+	}
+    return pkd->nSubhalos;
+    }
@@ -39,11 +39,11 @@ static basicParticleArray getOutputArray(PKD pkd,GridInfo &G,real_array_t &R) {
     if (blitz::product(R.shape())) {
 	basicParticleArray fullOutput(
             reinterpret_cast<basicParticle *>(pData),
-            blitz::shape(G.n1r(),G.n2(),G.nz()), blitz::neverDeleteData,
+            blitz::shape(G.n1r(),G.nyr(),G.nz()), blitz::neverDeleteData,
             RegularArray(G.sz()));
 	basicParticleArray output = fullOutput(
 	    blitz::Range::all(),
-	    blitz::Range(R.base(1),R.base(1)+R.extent(1)-1),
+	    blitz::Range(R.base(1)-G.syr(),R.base(1)-G.syr()+R.extent(1)-1),
 	    blitz::Range(G.sz(),G.ez()-1));
 	output.reindexSelf(dimension_t(0,R.base(1),G.sz()));
 	return output;
@@ -463,6 +463,8 @@ int pltMoveIC(PST pst,void *vin,int nIn,void *vout,int nOut) {
 	    else p->uNewRung = 0;
 	    float *pPot = pkdPot(pkd,p);
 	    if (pPot) pPot = 0;
+	    pkdSetWork(pkd,p,0.0f);
+	    pkdSetMergerTag(pkd,p,0);
 	    }
 	pkd->nLocal = pkd->nActive = in->nMove;
 	}
@@ -497,12 +499,12 @@ int pstMoveIC(PST pst,void *vin,int nIn,void *vout,int nOut) {
 	assert(fft != NULL);
 
 	uint64_t nPerNode = (uint64_t)mdl->Cores() * pkd->nStore;
-	uint64_t nLocal = (int64_t)fft->rgrid->rn[myProc] * in->nGrid*in->nGrid;
+	uint64_t nLocal = (int64_t)fft->rgrid->rn[myProc] * fft->rgrid->pn[myProc] * in->nGrid;
 
 	/* Calculate how many slots are free (under) and how many need to be sent (over) before my rank */
 	iUnderBeg = iOverBeg = 0;
 	for(iProc=0; iProc<myProc; ++iProc) {
-	    uint64_t nOnNode = fft->rgrid->rn[iProc] * in->nGrid*in->nGrid;
+	    uint64_t nOnNode = (uint64_t)fft->rgrid->rn[iProc] * fft->rgrid->pn[iProc] * in->nGrid;
 	    if (nOnNode>nPerNode) iOverBeg += nOnNode - nPerNode;
 	    else iUnderBeg += nPerNode - nOnNode;
 	    }
@@ -517,7 +519,7 @@ int pstMoveIC(PST pst,void *vin,int nIn,void *vout,int nOut) {
 	    iOverEnd = iOverBeg + nLocal - nPerNode;
 	    for(iProc=0; iProc<mdl->Procs(); ++iProc) {
 		rcount[iProc] = rdisps[iProc] = 0; // We cannot receive anything
-		uint64_t nOnNode = fft->rgrid->rn[iProc] * in->nGrid*in->nGrid;
+		uint64_t nOnNode = (uint64_t)fft->rgrid->rn[iProc] * fft->rgrid->pn[iProc] * in->nGrid;
 		if (nOnNode<nPerNode) {
 		    iUnderEnd = iUnderBeg + nPerNode - nOnNode;
 		    /* The transfer condition */
@@ -541,7 +543,7 @@ int pstMoveIC(PST pst,void *vin,int nIn,void *vout,int nOut) {
 	    iUnderEnd = iUnderBeg + nPerNode - nLocal;
 	    for(iProc=0; iProc<mdl->Procs(); ++iProc) {
 		scount[iProc] = sdisps[iProc] = 0; // We have nothing to send
-		uint64_t nOnNode = fft->rgrid->rn[iProc] * in->nGrid*in->nGrid;
+		uint64_t nOnNode = (uint64_t)fft->rgrid->rn[iProc] * fft->rgrid->pn[iProc] * in->nGrid;
 		if (nOnNode>nPerNode) {
 		    iOverEnd = iOverBeg + nOnNode - nPerNode;
 		    if (iOverEnd>iUnderBeg && iOverBeg<iUnderEnd) {
@@ -639,13 +641,14 @@ int pstGenerateIC(PST pst,void *vin,int nIn,void *vout,int nOut) {
 	pltGenerateIC(pst,&tin,sizeof(tin),vout,nOut);
 
 	int myProc = mdlProc(pst->mdl);
-	uint64_t nLocal = (int64_t)fft->rgrid->rn[myProc] * in->nGrid*in->nGrid;
+	uint64_t nLocal = (int64_t)fft->rgrid->rn[myProc] * fft->rgrid->pn[myProc] * in->nGrid;
 
 	/* Expand the particles by adding an iOrder */
 	assert(sizeof(expandParticle) >= sizeof(basicParticle));
 	overlayedParticle  * pbBase = (overlayedParticle *)pkdParticleBase(pkd);
 	int iz = fft->rgrid->rs[myProc] + fft->rgrid->rn[myProc];
-	int iy=0, ix=0;
+	int sy = fft->rgrid->ps[myProc], ey = sy + fft->rgrid->pn[myProc];
+	int iy=sy, ix=0;
 	float inGrid = 1.0 / in->nGrid;
 	for(i=nLocal-1; i>=0; --i) {
 	    basicParticle  *b = &pbBase->b + i;
@@ -654,9 +657,9 @@ int pstGenerateIC(PST pst,void *vin,int nIn,void *vout,int nOut) {
 	    if (ix>0) --ix;
 	    else {
 		ix = in->nGrid-1;
-		if (iy>0) --iy;
+		if (iy>sy) --iy;
 		else {
-		    iy = in->nGrid-1;
+		    iy = ey-1;
 		    --iz;
 		    assert(iz>=0);
 		    }
@@ -685,7 +688,7 @@ int pstGenerateIC(PST pst,void *vin,int nIn,void *vout,int nOut) {
 		p->iz = iz;
 		}
 	    }
-	assert(ix==0 && iy==0 && iz==fft->rgrid->rs[myProc]);
+	assert(ix==0 && iy==sy && iz==fft->rgrid->rs[myProc]);
 	/* Now we need to move excess particles between nodes so nStore is obeyed. */
 	pkd->fft = fft; /* This is freed in pstMoveIC() */
 	}
@@ -120,8 +120,14 @@ void NoiseGenerator::update(complex_vector_t &pencil,complex_vector_t &noise,int
 */
 void NoiseGenerator::FillNoise(complex_array_t &K,int nGrid,double *mean,double *csq) {
     const int iNyquist = nGrid / 2;
-    complex_vector_t noise(K.domain()[0]);
-    complex_slice_t pencils = K(0,K.domain()[1],K.domain()[2]);
+    // The random stream is sequential along x so we always generate the whole pencil,
+    // even if a pencil decomposition gives us only part of x.
+    complex_vector_t fullNoise(blitz::Range(0,iNyquist)), noise;
+    if (K.size()) {
+	noise.reference(fullNoise(K.domain()[0]));
+	noise.reindexSelf(blitz::TinyVector<int,1>(K.lbound(0)));
+	}
+    complex_slice_t pencils = K(K.domain()[0].first(),K.domain()[1],K.domain()[2]);
     if (mean) *mean = 0.0;
     if (csq) *csq = 0.0;
     // Iterate over each pencil of our part of the array, generate white noise and call update().
@@ -130,7 +136,7 @@ void NoiseGenerator::FillNoise(complex_array_t &K,int nGrid,double *mean,double
 	auto j = pindex.position()[0];
 	auto k = pindex.position()[1];
 	complex_vector_t pencil = K(blitz::Range::all(),j,k);
-	pencilNoise(noise, nGrid, j, k);
+	pencilNoise(fullNoise, nGrid, j, k);
 	if (mean) {
 	    auto s = sum(noise);
 	    *mean += std::real(s) + std::imag(s);
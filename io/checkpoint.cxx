@@ -0,0 +1,463 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+** Checkpoint files. Each thread writes its own file containing a small header
+** that describes the fields of the particle, followed by blocks of particles.
+** Within a block every field is stored separately: the bytes are optionally
+** delta encoded (integer positions, particle IDs), byte shuffled so that
+** similar bytes are adjacent, and then compressed. Every block carries the
+** CRC32 of the original data.
+**
+** Because fields are described by name (PKD_FIELD) rather than by offset, a
+** checkpoint can be restored with a different memory model, and because a
+** file can be read in arbitrary particle ranges, onto a different number of
+** threads (the domain decomposition then redistributes the particles).
+**
+** Files without the header (the old raw dump of the particle store) can still
+** be restored onto the same number of threads with the same memory model.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#else
+#include "pkd_config.h"
+#endif
+#include "pkd.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <vector>
+#include <array>
+#include <sys/stat.h>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#define CHK_MAGIC "PKDCHKPT"
+#define CHK_VERSION 1
+#define CHK_FIELD_PARTICLE MAX_PKD_FIELD /* The PARTICLE (or UPARTICLE) header */
+#define CHK_BLOCK_PARTICLES (64*1024)
+#define CHK_IO_BUFFER_SIZE (1024*1024)
+
+#define CHK_FILTER_SHUFFLE 1
+#define CHK_FILTER_DELTA32 2
+#define CHK_FILTER_DELTA64 4
+
+#define CHK_CODEC_NONE    0
+#define CHK_CODEC_DEFLATE 1
+
+struct chkHeader {
+    char     achMagic[8];
+    uint32_t iVersion;
+    uint32_t nFields;
+    uint64_t nParticles;
+    uint32_t nBlockParticles;
+    uint32_t bIntegerPosition;
+    uint32_t bNoParticleOrder;
+    uint32_t iCRC;  /* Header (with iCRC=0) and field table */
+    };
+
+struct chkField {
+    int32_t  iField;
+    uint32_t nBytes;
+    uint32_t mFilter;
+    int32_t  iOffset; /* Informational: offset in the writer's particle */
+    };
+
+struct chkBlock {
+    uint32_t iField;
+    uint32_t iCodec;
+    uint64_t nRawBytes;
+    uint64_t nStoredBytes;
+    uint32_t iCRC;  /* Of the original (unfiltered) data */
+    uint32_t iPad;
+    };
+
+static uint32_t crc32Update(uint32_t crc,const void *vData,size_t n) {
+    // Built once on first use; initialization of a local static is thread-safe
+    static const std::array<uint32_t,256> table = [] {
+	std::array<uint32_t,256> t;
+	for(uint32_t i=0; i<256; ++i) {
+	    uint32_t c = i;
+	    for(int k=0; k<8; ++k) c = (c&1) ? 0xedb88320u ^ (c>>1) : c>>1;
+	    t[i] = c;
+	    }
+	return t;
+	}();
+    auto p = static_cast<const uint8_t *>(vData);
+    crc = ~crc;
+    while(n--) crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+    }
+
+static size_t fieldSize(PKD pkd,int iField) {
+    switch(iField) {
+    case CHK_FIELD_PARTICLE: return pkd->bNoParticleOrder ? sizeof(UPARTICLE) : sizeof(PARTICLE);
+    case oPosition:     return pkd->bIntegerPosition ? 3*sizeof(int32_t) : 3*sizeof(double);
+    case oVelocity:     return 3*sizeof(vel_t);
+    case oAcceleration: return 3*sizeof(float);
+    case oPotential:
+    case oGroup:
+    case oMass:
+    case oSoft:
+    case oDensity:
+    case oBall:         return sizeof(float);
+    case oSph:          return sizeof(SPHFIELDS);
+    case oStar:         return sizeof(STARFIELDS);
+    case oRelaxation:   return sizeof(double);
+    case oVelSmooth:    return sizeof(VELSMOOTH);
+    case oParticleID:   return sizeof(uint64_t);
+    case oMergerTag:    return sizeof(int32_t);
+    default:            return 0;
+	}
+    }
+
+static char *fieldData(PKD pkd,PARTICLE *p,int iField) {
+    switch(iField) {
+    case CHK_FIELD_PARTICLE: return reinterpret_cast<char *>(p);
+    case oVelocity:     return reinterpret_cast<char *>(pkdVel(pkd,p));
+    case oAcceleration: return reinterpret_cast<char *>(pkdAccel(pkd,p));
+    case oPotential:    return reinterpret_cast<char *>(pkdPot(pkd,p));
+    default:            return reinterpret_cast<char *>(pkdField(p,pkd->oFieldOffset[iField]));
+	}
+    }
+
+/* The fields present in this particle store, in the order they are written */
+static std::vector<chkField> localFields(PKD pkd) {
+    std::vector<chkField> fields;
+    chkField f;
+    f.iField = CHK_FIELD_PARTICLE;
+    f.nBytes = fieldSize(pkd,CHK_FIELD_PARTICLE);
+    f.mFilter = CHK_FILTER_SHUFFLE;
+    f.iOffset = 0;
+    fields.push_back(f);
+    for(int i=0; i<MAX_PKD_FIELD; ++i) {
+	if (!pkd->oFieldOffset[i] || fieldSize(pkd,i)==0) continue;
+	f.iField = i;
+	f.nBytes = fieldSize(pkd,i);
+	f.mFilter = CHK_FILTER_SHUFFLE;
+	if (i==oPosition && pkd->bIntegerPosition) f.mFilter |= CHK_FILTER_DELTA32;
+	else if (i==oParticleID) f.mFilter |= CHK_FILTER_DELTA64;
+	f.iOffset = pkd->oFieldOffset[i];
+	fields.push_back(f);
+	}
+    return fields;
+    }
+
+/*
+** Filters. Delta encoding works component by component along the particles,
+** and the shuffle transposes n elements of nBytes into nBytes planes.
+*/
+template<typename T>
+static void deltaEncode(char *pData,size_t n,size_t nBytes) {
+    size_t k = nBytes / sizeof(T);
+    T *v = reinterpret_cast<T *>(pData);
+    for(size_t i=n-1; i>0; --i)
+	for(size_t c=0; c<k; ++c) v[i*k+c] -= v[(i-1)*k+c];
+    }
+
+template<typename T>
+static void deltaDecode(char *pData,size_t n,size_t nBytes) {
+    size_t k = nBytes / sizeof(T);
+    T *v = reinterpret_cast<T *>(pData);
+    for(size_t i=1; i<n; ++i)
+	for(size_t c=0; c<k; ++c) v[i*k+c] += v[(i-1)*k+c];
+    }
+
+static void shuffle(char *pOut,const char *pIn,size_t n,size_t nBytes) {
+    for(size_t i=0; i<n; ++i)
+	for(size_t b=0; b<nBytes; ++b) pOut[b*n+i] = pIn[i*nBytes+b];
+    }
+
+static void unshuffle(char *pOut,const char *pIn,size_t n,size_t nBytes) {
+    for(size_t i=0; i<n; ++i)
+	for(size_t b=0; b<nBytes; ++b) pOut[i*nBytes+b] = pIn[b*n+i];
+    }
+
+static void encodeField(const chkField &f,std::vector<char> &raw,std::vector<char> &work,size_t n) {
+    if (n>1 && (f.mFilter&CHK_FILTER_DELTA32)) deltaEncode<uint32_t>(raw.data(),n,f.nBytes);
+    if (n>1 && (f.mFilter&CHK_FILTER_DELTA64)) deltaEncode<uint64_t>(raw.data(),n,f.nBytes);
+    if (f.mFilter&CHK_FILTER_SHUFFLE) shuffle(work.data(),raw.data(),n,f.nBytes);
+    else memcpy(work.data(),raw.data(),n*f.nBytes);
+    }
+
+static void decodeField(const chkField &f,std::vector<char> &raw,std::vector<char> &work,size_t n) {
+    if (f.mFilter&CHK_FILTER_SHUFFLE) unshuffle(raw.data(),work.data(),n,f.nBytes);
+    else memcpy(raw.data(),work.data(),n*f.nBytes);
+    if (n>1 && (f.mFilter&CHK_FILTER_DELTA32)) deltaDecode<uint32_t>(raw.data(),n,f.nBytes);
+    if (n>1 && (f.mFilter&CHK_FILTER_DELTA64)) deltaDecode<uint64_t>(raw.data(),n,f.nBytes);
+    }
+
+void pkdCheckpoint(PKD pkd,const char *fname,int iCompress) {
+    auto fields = localFields(pkd);
+    chkHeader hdr;
+    memcpy(hdr.achMagic,CHK_MAGIC,sizeof(hdr.achMagic));
+    hdr.iVersion = CHK_VERSION;
+    hdr.nFields = fields.size();
+    hdr.nParticles = pkd->nLocal;
+    hdr.nBlockParticles = CHK_BLOCK_PARTICLES;
+    hdr.bIntegerPosition = pkd->bIntegerPosition;
+    hdr.bNoParticleOrder = pkd->bNoParticleOrder;
+    hdr.iCRC = 0;
+    hdr.iCRC = crc32Update(crc32Update(0,&hdr,sizeof(hdr)),fields.data(),fields.size()*sizeof(chkField));
+
+    asyncFileInfo info;
+    io_init(&info, IO_MAX_ASYNC_COUNT, CHK_IO_BUFFER_SIZE, IO_AIO|IO_LIBAIO|IO_URING);
+    if (io_create(&info, fname) < 0) { perror(fname); abort(); }
+    io_write(&info, &hdr, sizeof(hdr));
+    io_write(&info, fields.data(), fields.size()*sizeof(chkField));
+
+    size_t nMaxBytes = 0;
+    for(auto &f : fields) if (f.nBytes > nMaxBytes) nMaxBytes = f.nBytes;
+    std::vector<char> raw(CHK_BLOCK_PARTICLES*nMaxBytes), work(raw.size()), packed;
+#ifdef HAVE_LIBZ
+    if (iCompress > 0) packed.resize(compressBound(raw.size()));
+#else
+    iCompress = 0;
+#endif
+    for(uint64_t iFirst=0; iFirst<hdr.nParticles; iFirst += CHK_BLOCK_PARTICLES) {
+	size_t n = hdr.nParticles - iFirst;
+	if (n > CHK_BLOCK_PARTICLES) n = CHK_BLOCK_PARTICLES;
+	for(auto &f : fields) {
+	    chkBlock blk;
+	    for(size_t i=0; i<n; ++i)
+		memcpy(raw.data() + i*f.nBytes,fieldData(pkd,pkdParticle(pkd,iFirst+i),f.iField),f.nBytes);
+	    blk.iField = f.iField;
+	    blk.nRawBytes = n*f.nBytes;
+	    blk.iCRC = crc32Update(0,raw.data(),blk.nRawBytes);
+	    blk.iPad = 0;
+	    encodeField(f,raw,work,n);
+	    const char *pStored = work.data();
+	    blk.iCodec = CHK_CODEC_NONE;
+	    blk.nStoredBytes = blk.nRawBytes;
+#ifdef HAVE_LIBZ
+	    if (iCompress > 0) {
+		uLongf nPacked = packed.size();
+		if (compress2(reinterpret_cast<Bytef *>(packed.data()),&nPacked,
+			reinterpret_cast<const Bytef *>(work.data()),blk.nRawBytes,
+			iCompress > 9 ? 9 : iCompress) == Z_OK && nPacked < blk.nRawBytes) {
+		    blk.iCodec = CHK_CODEC_DEFLATE;
+		    blk.nStoredBytes = nPacked;
+		    pStored = packed.data();
+		    }
+		}
+#endif
+	    io_write(&info, &blk, sizeof(blk));
+	    io_write(&info, const_cast<char *>(pStored), blk.nStoredBytes);
+	    }
+	}
+    io_close(&info);
+    io_free(&info);
+    }
+
+static bool isCheckpoint(const chkHeader &hdr,const char *fname) {
+    if (memcmp(hdr.achMagic,CHK_MAGIC,sizeof(hdr.achMagic)) != 0) return false;
+    if (hdr.iVersion != CHK_VERSION) {
+	fprintf(stderr,"ERROR: %s: unsupported checkpoint version %" PRIu32 "\n",fname,hdr.iVersion);
+	abort();
+	}
+    return true;
+    }
+
+/*
+** Returns true and fills in the header and field table if this is a
+** checkpoint in the current format.
+*/
+static bool readHeader(asyncFileInfo *info,const char *fname,chkHeader &hdr,std::vector<chkField> &fields) {
+    if (info->nFileSize < (off_t)sizeof(hdr)) return false;
+    io_read(info,&hdr,sizeof(hdr));
+    if (!isCheckpoint(hdr,fname)) return false;
+    fields.resize(hdr.nFields);
+    io_read(info,fields.data(),fields.size()*sizeof(chkField));
+    uint32_t iCRC = hdr.iCRC;
+    hdr.iCRC = 0;
+    if (crc32Update(crc32Update(0,&hdr,sizeof(hdr)),fields.data(),fields.size()*sizeof(chkField)) != iCRC) {
+	fprintf(stderr,"ERROR: %s: checkpoint header is corrupt\n",fname);
+	abort();
+	}
+    hdr.iCRC = iCRC;
+    return true;
+    }
+
+uint64_t pkdCheckpointCount(PKD pkd,const char *fname) {
+    chkHeader hdr;
+    FILE *fp = fopen(fname,"rb");
+    if (fp==NULL) { perror(fname); abort(); }
+    uint64_t nParticles;
+    if (fread(&hdr,sizeof(hdr),1,fp) == 1 && isCheckpoint(hdr,fname)) nParticles = hdr.nParticles;
+    else {
+	struct stat s;
+	if ( fstat(fileno(fp),&s) != 0 ) { perror(fname); abort(); }
+	nParticles = s.st_size / (pkdParticleSize(pkd) + pkd->nSoaBytes);
+	}
+    fclose(fp);
+    return nParticles;
+    }
+
+/* The merger tracers tagged before the checkpoint are harvested at the next FoF */
+static void restoreMergerTags(PKD pkd,uint64_t iBase) {
+    if (!pkd->oFieldOffset[oMergerTag]) return;
+    for(uint64_t i=iBase; i<(uint64_t)pkd->nLocal; ++i) {
+	if (pkdGetMergerTag(pkd,pkdParticle(pkd,i))) {
+	    pkd->bMergerTagged = 1;
+	    break;
+	    }
+	}
+    }
+
+/* The old format: the raw particle store followed by any separate field arrays */
+static void restoreRaw(PKD pkd,FILE *fp,const char *fname,uint64_t iBegin,uint64_t iEnd) {
+    struct stat s;
+    if ( fstat(fileno(fp),&s) != 0 ) { perror(fname); abort(); }
+    uint64_t nParticles = s.st_size / (pkdParticleSize(pkd) + pkd->nSoaBytes);
+    if (nParticles * (pkdParticleSize(pkd) + pkd->nSoaBytes) != (uint64_t)s.st_size
+	    || iBegin != 0 || iEnd != nParticles || pkd->nLocal != 0) {
+	fprintf(stderr,"ERROR: %s: raw checkpoints must be restored with the same threads and memory model\n",fname);
+	abort();
+	}
+    if (fread(pkdParticleBase(pkd),pkdParticleSize(pkd),nParticles,fp) != nParticles
+	    || (pkd->pSoaVel && fread(pkd->pSoaVel,3*sizeof(vel_t),nParticles,fp) != nParticles)
+	    || (pkd->pSoaAccel && fread(pkd->pSoaAccel,3*sizeof(float),nParticles,fp) != nParticles)
+	    || (pkd->pSoaPot && fread(pkd->pSoaPot,sizeof(float),nParticles,fp) != nParticles)) {
+	perror(fname);
+	abort();
+	}
+    pkd->nLocal = nParticles;
+    restoreMergerTags(pkd,0);
+    }
+
+/*
+** Position is the one field whose representation can legitimately differ
+** between the writer and the reader (bMemIntegerPosition).
+*/
+static void scatterPosition(PKD pkd,PARTICLE *p,const char *pData,int bIntegerPosition) {
+    for(int d=0; d<3; ++d) {
+	double r;
+	if (bIntegerPosition) {
+	    int32_t ir;
+	    memcpy(&ir,pData + d*sizeof(int32_t),sizeof(ir));
+	    r = pkdIntPosToDbl(pkd,ir);
+	    }
+	else memcpy(&r,pData + d*sizeof(double),sizeof(r));
+	pkdSetPos(pkd,p,d,r);
+	}
+    }
+
+/*
+** Append particles [iBegin,iEnd) of a checkpoint file to the local particles.
+** Fields that were not written are left zero, and fields that this memory
+** model does not have are skipped. The file is read ahead asynchronously so
+** decoding and placing a block overlaps with reading the next ones.
+*/
+void pkdRestore(PKD pkd,const char *fname,uint64_t iBegin,uint64_t iEnd) {
+    chkHeader hdr;
+    std::vector<chkField> fields;
+    asyncFileInfo info;
+    io_init(&info, IO_MAX_ASYNC_COUNT, CHK_IO_BUFFER_SIZE, IO_AIO|IO_LIBAIO|IO_URING);
+    if (io_open(&info, fname) < 0) { perror(fname); abort(); }
+    if (!readHeader(&info,fname,hdr,fields)) {
+	io_close(&info);
+	io_free(&info);
+	FILE *fp = fopen(fname,"rb");
+	if (fp==NULL) { perror(fname); abort(); }
+	restoreRaw(pkd,fp,fname,iBegin,iEnd);
+	fclose(fp);
+	return;
+	}
+    if (hdr.bNoParticleOrder != (uint32_t)pkd->bNoParticleOrder) {
+	fprintf(stderr,"ERROR: %s: checkpoint and memory model disagree on bMemUnordered\n",fname);
+	abort();
+	}
+    assert(iBegin <= iEnd && iEnd <= hdr.nParticles);
+    uint64_t iBase = pkd->nLocal;
+    if (iBase + (iEnd-iBegin) > (uint64_t)pkdFreeStore(pkd)) {
+	fprintf(stderr,"ERROR: %s: %" PRIu64 " particles do not fit in the particle store (%d)\n",
+	    fname,iBase + (iEnd-iBegin),pkdFreeStore(pkd));
+	abort();
+	}
+    std::vector<char> zero(pkd->nSoaBytes,0);
+    for(uint64_t i=iBase; i<iBase + (iEnd-iBegin); ++i) {
+	memset(pkdParticle(pkd,i),0,pkdParticleSize(pkd));
+	if (pkd->bSoA) pkdSoaLoad(pkd,i,zero.data());
+	}
+
+    size_t nMaxBytes = 0;
+    for(auto &f : fields) if (f.nBytes > nMaxBytes) nMaxBytes = f.nBytes;
+    std::vector<char> raw(hdr.nBlockParticles*nMaxBytes), work(raw.size()), packed(raw.size());
+    for(uint64_t iFirst=0; iFirst<iEnd; iFirst += hdr.nBlockParticles) {
+	size_t n = hdr.nParticles - iFirst;
+	if (n > hdr.nBlockParticles) n = hdr.nBlockParticles;
+	bool bSkip = iFirst + n <= iBegin;
+	for(auto &f : fields) {
+	    chkBlock blk;
+	    io_read(&info,&blk,sizeof(blk));
+	    assert(blk.iField == (uint32_t)f.iField && blk.nRawBytes == n*f.nBytes);
+	    bool bPosition = f.iField==oPosition && f.nBytes != fieldSize(pkd,oPosition);
+	    bool bPresent = f.iField==CHK_FIELD_PARTICLE
+		|| (f.iField<MAX_PKD_FIELD && pkd->oFieldOffset[f.iField] && (bPosition || f.nBytes==fieldSize(pkd,f.iField)));
+	    assert(blk.nStoredBytes <= packed.size());
+	    if (bSkip || !bPresent) {
+		io_read(&info,packed.data(),blk.nStoredBytes);
+		continue;
+		}
+	    if (blk.iCodec == CHK_CODEC_NONE) io_read(&info,work.data(),blk.nStoredBytes);
+	    else if (blk.iCodec == CHK_CODEC_DEFLATE) {
+		io_read(&info,packed.data(),blk.nStoredBytes);
+#ifdef HAVE_LIBZ
+		uLongf nUnpacked = blk.nRawBytes;
+		if (uncompress(reinterpret_cast<Bytef *>(work.data()),&nUnpacked,
+			reinterpret_cast<const Bytef *>(packed.data()),blk.nStoredBytes) != Z_OK
+			|| nUnpacked != blk.nRawBytes) {
+		    fprintf(stderr,"ERROR: %s: cannot decompress block at particle %" PRIu64 "\n",fname,iFirst);
+		    abort();
+		    }
+#else
+		fprintf(stderr,"ERROR: %s: compressed checkpoint but zlib support is not compiled in\n",fname);
+		abort();
+#endif
+		}
+	    else {
+		fprintf(stderr,"ERROR: %s: unknown codec %" PRIu32 "\n",fname,blk.iCodec);
+		abort();
+		}
+	    decodeField(f,raw,work,n);
+	    if (crc32Update(0,raw.data(),blk.nRawBytes) != blk.iCRC) {
+		fprintf(stderr,"ERROR: %s: checksum mismatch in block at particle %" PRIu64 "\n",fname,iFirst);
+		abort();
+		}
+	    uint64_t i0 = iFirst < iBegin ? iBegin : iFirst;
+	    uint64_t i1 = iFirst + n > iEnd ? iEnd : iFirst + n;
+	    for(uint64_t i=i0; i<i1; ++i) {
+		PARTICLE *p = pkdParticle(pkd,iBase + i - iBegin);
+		const char *pData = raw.data() + (i-iFirst)*f.nBytes;
+		if (bPosition) scatterPosition(pkd,p,pData,hdr.bIntegerPosition);
+		else memcpy(fieldData(pkd,p,f.iField),pData,f.nBytes);
+		}
+	    }
+	}
+    io_close(&info);
+    io_free(&info);
+    pkd->nLocal = iBase + (iEnd-iBegin);
+    /* Neighbor lists are pointers and do not survive a restart */
+    if (pkd->oFieldOffset[oSph]) {
+	for(uint64_t i=iBase; i<(uint64_t)pkd->nLocal; ++i)
+	    *pkd_pNeighborList(pkd,pkdParticle(pkd,i)) = NULL;
+	}
+    restoreMergerTags(pkd,iBase);
+    }
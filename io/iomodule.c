@@ -57,13 +57,16 @@ typedef int ssize_t;
 #define O_DIRECT 0
 #endif
 
+#define IO_ASYNC_METHODS (IO_AIO|IO_LIBAIO|IO_URING)
+
 // Call this function to initialize the direct I/O context.
-// The buffer size must be a multiple of the page size, or zero
+// The buffer size must be a multiple of the page size (it is rounded up), or zero
 // in which case the reader or writer must provide buffers that are
 // properly aligned and will persist until the I/O completes.
+// The methods are tried in order: io_uring, POSIX AIO, libaio, then regular I/O.
 void io_init(asyncFileInfo *info, size_t nBuffers,size_t nBufferSize,int method) {
     info->method = IO_REGULAR; // Default, but maybe we can do better
-#if defined(HAVE_LIBAIO) || defined(HAVE_AIO_H)
+#if defined(IO_HAVE_ASYNC)
     int i;
 #ifdef HAVE_UNISTD_H
     info->nPageSize = sysconf(_SC_PAGESIZE);
@@ -71,12 +74,24 @@ void io_init(asyncFileInfo *info, size_t nBuffers,size_t nBufferSize,int method)
     info->nPageSize = 4096; /* A conservative guess */
 #endif
     if (nBuffers > IO_MAX_ASYNC_COUNT) nBuffers = IO_MAX_ASYNC_COUNT;
-    info->nBufferSize = nBufferSize;
+    info->nBufferSize = (nBufferSize+info->nPageSize-1) & ~(size_t)(info->nPageSize-1);
     info->nBuffers = nBuffers;
     info->iBuffer = 0;
     info->nPending = 0;
     info->bWrite = 0;
+    for(i=0; i<info->nBuffers; ++i) info->bReady[i] = 1;
 
+#ifdef HAVE_LIBURING
+    if ((method & IO_URING) && info->method==IO_REGULAR) {
+        /* This fails on older kernels or where io_uring is disabled; fall back quietly */
+        if (io_uring_queue_init(info->nBuffers, &info->io.uring.ring, 0) == 0) {
+            info->method = IO_URING;
+            info->io.uring.bFixedBuffers = 0;
+            info->io.uring.bFixedFile = 0;
+            info->io.uring.nUnsubmitted = 0;
+            }
+        }
+#endif
 #ifdef HAVE_AIO_H
     if ((method & IO_AIO) && info->method==IO_REGULAR) {
         info->method = IO_AIO;
@@ -100,7 +115,7 @@ void io_init(asyncFileInfo *info, size_t nBuffers,size_t nBufferSize,int method)
         if (rc<0) { perror("io_setup"); abort(); }
         }
 #endif
-    if (info->method&(IO_AIO|IO_LIBAIO)) {
+    if (info->method&IO_ASYNC_METHODS) {
         for(i=0; i<info->nBuffers; ++i) {
 	    void *vBuffer;
             if (info->nBufferSize>0) {
@@ -111,58 +126,84 @@ void io_init(asyncFileInfo *info, size_t nBuffers,size_t nBufferSize,int method)
 	    info->pBuffer[i] = vBuffer;
 	    }
         }
+#ifdef HAVE_LIBURING
+    /* Registering can fail if RLIMIT_MEMLOCK is small; unregistered buffers still work */
+    if (info->method==IO_URING && info->nBufferSize>0) {
+        for(i=0; i<info->nBuffers; ++i) {
+            info->io.uring.iov[i].iov_base = info->pBuffer[i];
+            info->io.uring.iov[i].iov_len = info->nBufferSize;
+            }
+        info->io.uring.bFixedBuffers =
+            io_uring_register_buffers(&info->io.uring.ring,info->io.uring.iov,info->nBuffers) == 0;
+        }
+#endif
 #endif
     }
 
 void io_free(asyncFileInfo *info) {
-#if defined(HAVE_LIBAIO) || defined(HAVE_AIO_H)
-    if (info->nBufferSize>0 && (info->method&(IO_AIO|IO_LIBAIO))) {
+#if defined(IO_HAVE_ASYNC)
+    if (info->nBufferSize>0 && (info->method&IO_ASYNC_METHODS)) {
         int i;
+#ifdef HAVE_LIBURING
+        if (info->method==IO_URING && info->io.uring.bFixedBuffers)
+            io_uring_unregister_buffers(&info->io.uring.ring);
+#endif
         for(i=0; i<info->nBuffers; ++i) {
             free(info->pBuffer[i]);
             }
         }
+#ifdef HAVE_LIBURING
+    if (info->method==IO_URING) io_uring_queue_exit(&info->io.uring.ring);
+#endif
 #endif
     }
 
-int io_create(asyncFileInfo *info, const char *pathname) {
-    int flags = O_CREAT|O_WRONLY|O_TRUNC;
-#if defined(HAVE_LIBAIO) || defined(HAVE_AIO_H)
-    if (info->method&(IO_AIO|IO_LIBAIO)) flags |= O_DIRECT;
-#endif
-    info->fd = open(pathname,flags,FILE_PROTECTION);
-    info->iBuffer = 0; // Start in buffer zero
-    info->iByte = 0; // Nothing in the buffer
-    info->iFilePosition = 0;
-    info->bWrite = 1;
-    return info->fd;
+#ifdef HAVE_LIBURING
+/* A registered file saves the kernel a file table lookup on every request */
+static void register_file(asyncFileInfo *info) {
+    if (info->method==IO_URING && info->fd>=0)
+        info->io.uring.bFixedFile = io_uring_register_files(&info->io.uring.ring,&info->fd,1) == 0;
     }
 
-int io_open(asyncFileInfo *info, const char *pathname) {
-    int flags = O_RDONLY;
-#if defined(HAVE_LIBAIO) || defined(HAVE_AIO_H)
-    if (info->method&(IO_AIO|IO_LIBAIO)) flags |= O_DIRECT;
-#endif
-    info->fd = open(pathname,flags,FILE_PROTECTION);
-    info->iBuffer = 0; // Start in buffer zero
-    info->iByte = 0; // Nothing in the buffer
-    info->iFilePosition = 0;
-    info->bWrite = 0;
-    return info->fd;
+static void uring_submit(asyncFileInfo *info) {
+    int rc = io_uring_submit(&info->io.uring.ring);
+    if (rc<0) { errno = -rc; perror("io_uring_submit"); abort(); }
+    info->io.uring.nUnsubmitted = 0;
     }
+#endif
 
-#if defined(HAVE_LIBAIO) || defined(HAVE_AIO_H)
-static void queue_dio(asyncFileInfo *info,int i,int bWrite) {
-    size_t nBytes = info->iByte;
+#if defined(IO_HAVE_ASYNC)
+static void queue_dio(asyncFileInfo *info,int i,size_t nBytes,int bWrite) {
     size_t nTransfer;
     int rc;
 
     ++info->nPending;
     assert(info->nPending <= info->nBuffers);
+    info->bReady[i] = 0;
 
     /* Align buffer size for direct I/O. File will be truncated before closing if writing */
     nTransfer = (nBytes+info->nPageSize-1) & ~(info->nPageSize-1);
     info->nExpected[i] = bWrite ? nTransfer : nBytes; // We need to ask for a page size, but could *read* less
+#ifdef HAVE_LIBURING
+    if (info->method == IO_URING) {
+        /* There are as many submission entries as buffers, so this cannot fail */
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&info->io.uring.ring);
+        int fd = info->io.uring.bFixedFile ? 0 : info->fd;
+        assert(sqe!=NULL);
+        if (info->io.uring.bFixedBuffers) {
+            if (bWrite) io_uring_prep_write_fixed(sqe,fd,info->pBuffer[i],nTransfer,info->iFilePosition,i);
+            else        io_uring_prep_read_fixed(sqe,fd,info->pBuffer[i],nTransfer,info->iFilePosition,i);
+            }
+        else {
+            if (bWrite) io_uring_prep_write(sqe,fd,info->pBuffer[i],nTransfer,info->iFilePosition);
+            else        io_uring_prep_read(sqe,fd,info->pBuffer[i],nTransfer,info->iFilePosition);
+            }
+        if (info->io.uring.bFixedFile) io_uring_sqe_set_flags(sqe,IOSQE_FIXED_FILE);
+        io_uring_sqe_set_data(sqe,(void *)(intptr_t)i);
+        /* Submit in batches; wait_complete() submits anything left over */
+        if (++info->io.uring.nUnsubmitted*2 >= info->nBuffers) uring_submit(info);
+        }
+#endif
 #ifdef HAVE_AIO_H
     if (info->method == IO_AIO) {
         info->io.aio.pcb[i] = info->io.aio.cb + i;
@@ -188,6 +229,29 @@ static void queue_dio(asyncFileInfo *info,int i,int bWrite) {
     }
 
 static int wait_complete(asyncFileInfo *info, int nWait) {
+#ifdef HAVE_LIBURING
+    if (info->method == IO_URING) {
+        struct io_uring_cqe *cqe;
+        int iWait = -1, rc;
+        if (info->io.uring.nUnsubmitted) uring_submit(info);
+        while(nWait--) {
+            rc = io_uring_wait_cqe(&info->io.uring.ring,&cqe);
+            if (rc<0) { errno = -rc; perror("io_uring_wait_cqe"); abort(); }
+            iWait = (int)(intptr_t)io_uring_cqe_get_data(cqe);
+            if (cqe->res<0 || (size_t)cqe->res != info->nExpected[iWait]) {
+                char szError[100];
+                errno = cqe->res<0 ? -cqe->res : 0;
+                sprintf(szError,"nBytesExpected=%" PRIu64 " res=%d\n",(uint64_t)info->nExpected[iWait],cqe->res);
+                perror(szError);
+                abort();
+                }
+            io_uring_cqe_seen(&info->io.uring.ring,cqe);
+            info->bReady[iWait] = 1;
+            --info->nPending;
+            }
+        return iWait;
+        }
+#endif
 #ifdef HAVE_AIO_H
     if (info->method == IO_AIO) {
         int iWait, rc, i;
@@ -209,6 +273,7 @@ static int wait_complete(asyncFileInfo *info, int nWait) {
                         perror(szError);
                         abort();
                         }
+                        info->bReady[i] = 1;
                         --info->nPending;
                         --nWait;
                         }
@@ -225,26 +290,102 @@ static int wait_complete(asyncFileInfo *info, int nWait) {
 #endif
 #ifdef HAVE_LIBAIO
     if (info->method == IO_LIBAIO) {
+        int i;
         int nEvent = io_getevents(info->io.libaio.ctx,nWait,nWait,info->io.libaio.events,NULL);
         if (nEvent!=nWait) { perror("aio_getevents"); abort(); }
+        for(i=0; i<nEvent; ++i) info->bReady[info->io.libaio.events[i].obj - info->io.libaio.cb] = 1;
         info->nPending -= nWait;
         return info->io.libaio.events[0].obj - info->io.libaio.cb;
         }
 #endif
     assert(0);
     }
+
+/*
+** Direct I/O needs page aligned memory and file offsets. A caller supplied
+** buffer that is not aligned is transferred synchronously with O_DIRECT off,
+** and O_DIRECT is turned back on afterwards for the transfers that follow.
+*/
+static int is_aligned(asyncFileInfo *info,const void *buf) {
+    return (((uintptr_t)buf | (uintptr_t)info->iFilePosition) & (info->nPageSize-1)) == 0;
+    }
+
+static void io_unaligned(asyncFileInfo *info, void *buf, size_t count) {
+    ssize_t n;
+    int flags;
+    if (info->nPending) wait_complete(info,info->nPending);
+    info->iBuffer = 0;
+    flags = fcntl(info->fd,F_GETFL);
+    if (flags>=0 && (flags&O_DIRECT)) fcntl(info->fd,F_SETFL,flags&~O_DIRECT);
+    if (info->bWrite) n = pwrite(info->fd,buf,count,info->iFilePosition);
+    else n = pread(info->fd,buf,count,info->iFilePosition);
+    if (n != count) { perror(info->bWrite ? "pwrite" : "pread"); abort(); }
+    if (flags>=0 && (flags&O_DIRECT)) fcntl(info->fd,F_SETFL,flags);
+    info->iFilePosition += count;
+    }
+
+/* Queue the next part of the file into buffer i, or mark it empty at the end */
+static void read_ahead(asyncFileInfo *info,int i) {
+    off_t nRemaining = info->nFileSize - info->iFilePosition;
+    off_t nBufferSize = info->nBufferSize;
+    if (nRemaining <= 0) info->nExpected[i] = 0;
+    else queue_dio(info,i,nRemaining < nBufferSize ? nRemaining : nBufferSize,0);
+    }
+#endif
+
+int io_create(asyncFileInfo *info, const char *pathname) {
+    int flags = O_CREAT|O_WRONLY|O_TRUNC;
+#if defined(IO_HAVE_ASYNC)
+    if (info->method&IO_ASYNC_METHODS) flags |= O_DIRECT;
+#endif
+    info->fd = open(pathname,flags,FILE_PROTECTION);
+    info->iBuffer = 0; // Start in buffer zero
+    info->iByte = 0; // Nothing in the buffer
+    info->iFilePosition = 0;
+    info->nFileSize = 0;
+    info->bWrite = 1;
+#ifdef HAVE_LIBURING
+    register_file(info);
 #endif
+    return info->fd;
+    }
+
+// With internal buffers, reading starts immediately in the background. Each
+// io_read() then copies from a completed buffer and queues the next part of
+// the file, so the caller's processing overlaps with the I/O.
+int io_open(asyncFileInfo *info, const char *pathname) {
+    int flags = O_RDONLY;
+    struct stat s;
+#if defined(IO_HAVE_ASYNC)
+    if (info->method&IO_ASYNC_METHODS) flags |= O_DIRECT;
+#endif
+    info->fd = open(pathname,flags,FILE_PROTECTION);
+    info->iBuffer = 0; // Start in buffer zero
+    info->iByte = 0; // Nothing in the buffer
+    info->iFilePosition = 0;
+    info->nFileSize = (info->fd>=0 && fstat(info->fd,&s)==0) ? s.st_size : 0;
+    info->bWrite = 0;
+#if defined(IO_HAVE_ASYNC)
+#ifdef HAVE_LIBURING
+    register_file(info);
+#endif
+    if (info->fd>=0 && info->nBufferSize>0 && (info->method&IO_ASYNC_METHODS)) {
+        int i;
+        for(i=0; i<info->nBuffers; ++i) read_ahead(info,i);
+        }
+#endif
+    return info->fd;
+    }
 
 void io_write(asyncFileInfo *info, void *buf, size_t count) {
-#if defined(HAVE_LIBAIO) || defined(HAVE_AIO_H)
-    if (info->method&(IO_AIO|IO_LIBAIO)) {
+#if defined(IO_HAVE_ASYNC)
+    if (info->method&IO_ASYNC_METHODS) {
         // It is the responsibility of the caller to provide a buffer that
-        // is properly aligned, and that will persist for the duration of the I/O.
+        // will persist for the duration of the I/O.
         if (info->nBufferSize==0) {
+            if (!is_aligned(info,buf)) { io_unaligned(info,buf,count); return; }
             info->pBuffer[info->iBuffer] = buf;
-            info->iByte = count;
-            queue_dio(info,info->iBuffer,info->bWrite);
-            info->iByte = 0;
+            queue_dio(info,info->iBuffer,count,info->bWrite);
             if (info->nPending < info->nBuffers) info->iBuffer = info->nPending;
             else info->iBuffer = wait_complete(info,1);
             return;
@@ -258,7 +399,7 @@ void io_write(asyncFileInfo *info, void *buf, size_t count) {
             count -= nBytes;
             info->iByte += nBytes;
             if (info->iByte == info->nBufferSize) {
-                queue_dio(info,info->iBuffer,info->bWrite);
+                queue_dio(info,info->iBuffer,info->iByte,info->bWrite);
                 info->iByte = 0;
                 if (info->nPending < info->nBuffers) info->iBuffer = info->nPending;
                 else info->iBuffer = wait_complete(info,1);
@@ -272,15 +413,33 @@ void io_write(asyncFileInfo *info, void *buf, size_t count) {
     }
 
 void io_read(asyncFileInfo *info, void *buf, size_t count) {
-#if defined(HAVE_LIBAIO) || defined(HAVE_AIO_H)
-    if (info->method&(IO_AIO|IO_LIBAIO)) {
-        assert(info->nBufferSize==0);
-        if (info->nPending < info->nBuffers) info->iBuffer = info->nPending;
-        else info->iBuffer = wait_complete(info,1);
-        info->pBuffer[info->iBuffer] = buf;
-        info->iByte = count;
-        queue_dio(info,info->iBuffer,0);
-        info->iByte = 0;
+#if defined(IO_HAVE_ASYNC)
+    if (info->method&IO_ASYNC_METHODS) {
+        if (info->nBufferSize==0) {
+            if (!is_aligned(info,buf)) { io_unaligned(info,buf,count); return; }
+            if (info->nPending < info->nBuffers) info->iBuffer = info->nPending;
+            else info->iBuffer = wait_complete(info,1);
+            info->pBuffer[info->iBuffer] = buf;
+            queue_dio(info,info->iBuffer,count,0);
+            return;
+            }
+        char *pBuf = buf;
+        while(count) {
+            int i = info->iBuffer;
+            while(!info->bReady[i]) wait_complete(info,1);
+            size_t nBytes = info->nExpected[i] - info->iByte;
+            if (nBytes==0) { fprintf(stderr,"io_read: read past the end of the file\n"); abort(); }
+            if (count < nBytes) nBytes = count;
+            memcpy(pBuf,info->pBuffer[i] + info->iByte,nBytes);
+            pBuf += nBytes;
+            count -= nBytes;
+            info->iByte += nBytes;
+            if (info->iByte == info->nExpected[i]) {
+                read_ahead(info,i);
+                info->iBuffer = (i+1) % info->nBuffers;
+                info->iByte = 0;
+                }
+            }
         return;
         }
 #endif
@@ -289,12 +448,18 @@ void io_read(asyncFileInfo *info, void *buf, size_t count) {
     }
 
 void io_close(asyncFileInfo *info) {
-#if defined(HAVE_LIBAIO) || defined(HAVE_AIO_H)
-    if (info->method&(IO_AIO|IO_LIBAIO)) {
-        if (info->iByte) queue_dio(info,info->iBuffer,info->bWrite);
+#if defined(IO_HAVE_ASYNC)
+    if (info->method&IO_ASYNC_METHODS) {
+        if (info->bWrite && info->iByte) queue_dio(info,info->iBuffer,info->iByte,info->bWrite);
         if (info->nPending) wait_complete(info,info->nPending);
         assert(info->nPending==0);
         if (info->bWrite && ftruncate(info->fd, info->iFilePosition)) perror("ftruncate");
+#ifdef HAVE_LIBURING
+        if (info->method==IO_URING && info->io.uring.bFixedFile) {
+            io_uring_unregister_files(&info->io.uring.ring);
+            info->io.uring.bFixedFile = 0;
+            }
+#endif
         }
 #endif
     close(info->fd);
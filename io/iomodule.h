@@ -30,10 +30,25 @@
 #if defined(HAVE_AIO_H)
 #include <aio.h>
 #endif
+#if defined(HAVE_LIBURING)
+#include <liburing.h>
+#endif
+#if defined(HAVE_LIBAIO) || defined(HAVE_AIO_H) || defined(HAVE_LIBURING)
+#define IO_HAVE_ASYNC 1
+#endif
 #define IO_MAX_ASYNC_COUNT 8
 typedef struct {
-#if defined(HAVE_LIBAIO) || defined(HAVE_AIO_H)
+#if defined(IO_HAVE_ASYNC)
     union {
+#if defined(HAVE_LIBURING)
+        struct {
+            struct io_uring ring;
+            struct iovec iov[IO_MAX_ASYNC_COUNT];
+            int bFixedBuffers;  /* Buffers are registered with the ring */
+            int bFixedFile;     /* The file descriptor is registered (index 0) */
+            int nUnsubmitted;   /* Prepared but not yet submitted */
+        } uring;
+#endif
 #if defined(HAVE_LIBAIO)
         struct {
             struct iocb cb[IO_MAX_ASYNC_COUNT];
@@ -51,7 +66,9 @@ typedef struct {
 #endif
     char *pBuffer[IO_MAX_ASYNC_COUNT];
     size_t nExpected[IO_MAX_ASYNC_COUNT];
+    char bReady[IO_MAX_ASYNC_COUNT]; /* Buffer is not part of a pending request */
     off_t iFilePosition;   /* File position */
+    off_t nFileSize;       /* Size of the file being read */
     size_t nBufferSize;    /* Total size of the buffer */
     size_t iByte;          /* Index into current buffer */
     int nBuffers;          /* Total number of buffers */
@@ -66,6 +83,7 @@ typedef struct {
 #define IO_REGULAR 0
 #define IO_AIO     1
 #define IO_LIBAIO  2
+#define IO_URING   4
 
 #ifdef __cplusplus
 extern "C" {
@@ -0,0 +1,247 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#else
+#include "pkd_config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pkd.h"
+#include "lcshard.h"
+#include "core/healpix.h"
+
+#define FILE_PROTECTION (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)
+
+struct lcShardKey {
+    uint64_t key;
+    uint32_t i;
+    };
+
+#define LCSHARD_SHELL_BITS 20
+
+static int cmpShardKey(const void *va,const void *vb) {
+    const struct lcShardKey *a = va, *b = vb;
+    if (a->key < b->key) return -1;
+    if (a->key > b->key) return 1;
+    return (a->i > b->i) - (a->i < b->i);
+    }
+
+static void *growArray(void *p,size_t *pnMax,size_t n,size_t size) {
+    if (n > *pnMax) {
+	*pnMax = n + n/2;
+	p = realloc(p,*pnMax * size);
+	assert(p != NULL);
+	}
+    return p;
+    }
+
+void lcShardInitialize(LCSHARD *lcs) {
+    lcs->nSide = 0;
+    lcs->fdIndex = -1;
+    lcs->iOffset = 0;
+    lcs->pKeys = NULL;
+    lcs->pBuffer = NULL;
+    lcs->pIndex = NULL;
+    lcs->nKeysMax = lcs->nBufferMax = lcs->nIndexMax = 0;
+    }
+
+void lcShardFinish(LCSHARD *lcs) {
+    free(lcs->pKeys);
+    free(lcs->pBuffer);
+    free(lcs->pIndex);
+    lcShardInitialize(lcs);
+    }
+
+void lcShardOpen(LCSHARD *lcs,const char *indexname,int nSide,double dShellWidth,double dQuantum) {
+    assert(dQuantum > 0.0);
+    lcs->nSide = nSide;
+    lcs->dShellWidth = dShellWidth;
+    lcs->dQuantum = dQuantum;
+    lcs->iOffset = 0;
+    LCSHARDINDEXHEADER hdr;
+    lcs->fdIndex = open(indexname,O_CREAT|O_WRONLY|O_TRUNC,FILE_PROTECTION);
+    if (lcs->fdIndex < 0) { perror(indexname); abort(); }
+    memset(&hdr,0,sizeof(hdr));
+    hdr.iMagic = LCSHARD_MAGIC;
+    hdr.iScheme = LCSHARD_RING;
+    hdr.nSide = nSide;
+    hdr.dShellWidth = dShellWidth;
+    hdr.dQuantum = dQuantum;
+    if (write(lcs->fdIndex,&hdr,sizeof(hdr)) != sizeof(hdr)) {
+	perror("Wrong size writing light cone index header");
+	abort();
+	}
+    }
+
+void lcShardClose(LCSHARD *lcs) {
+    if (lcs->fdIndex >= 0) close(lcs->fdIndex);
+    lcs->fdIndex = -1;
+    lcs->nSide = 0;
+    }
+
+/*
+** Append one block (particles pLC[pKeys[0..n-1].i]) to the buffer at iByte.
+** Returns the new end of the buffer.
+*/
+static size_t encodeBlock(LCSHARD *lcs,LIGHTCONEP *pLC,const struct lcShardKey *pKeys,int n,
+			  int64_t iPixel,int32_t iShell,size_t iByte,LCSHARDINDEX *pIndex) {
+    LCSHARDHEADER hdr;
+    int64_t qMin[3], qMax[3];
+    double rMin=HUGE_VAL, rMax=0.0, u[3];
+    uint64_t *pWords, word;
+    float *pf;
+    int i, j, nUsed, nBitsTotal;
+    size_t nWords, nBytes;
+
+    pix2vec_ring64(lcs->nSide,iPixel,u);
+    for (i=0; i<n; ++i) {
+	const float *r = pLC[pKeys[i].i].pos;
+	double mr = sqrt((double)r[0]*r[0] + (double)r[1]*r[1] + (double)r[2]*r[2]);
+	if (mr < rMin) rMin = mr;
+	if (mr > rMax) rMax = mr;
+	}
+    hdr.iPixel = iPixel;
+    hdr.iShell = iShell;
+    hdr.nParticles = n;
+    hdr.dQuantum = lcs->dQuantum;
+    for (j=0; j<3; ++j) {
+	hdr.rCentre[j] = u[j] * 0.5 * (rMin + rMax);
+	qMin[j] = INT64_MAX;
+	qMax[j] = INT64_MIN;
+	}
+    for (i=0; i<n; ++i) {
+	const float *r = pLC[pKeys[i].i].pos;
+	for (j=0; j<3; ++j) {
+	    int64_t q = llround((r[j] - hdr.rCentre[j]) / lcs->dQuantum);
+	    if (q < qMin[j]) qMin[j] = q;
+	    if (q > qMax[j]) qMax[j] = q;
+	    }
+	}
+    nBitsTotal = 0;
+    for (j=0; j<3; ++j) {
+	uint64_t range = qMax[j] - qMin[j];
+	assert(qMin[j] >= INT32_MIN && qMax[j] <= INT32_MAX);
+	hdr.iMin[j] = (int32_t)qMin[j];
+	for (hdr.nBits[j]=0; range; range >>= 1) ++hdr.nBits[j];
+	nBitsTotal += hdr.nBits[j];
+	}
+#ifdef POTENTIAL_IN_LIGHTCONE
+    hdr.bPotential = 1;
+#else
+    hdr.bPotential = 0;
+#endif
+    nWords = ((size_t)n * nBitsTotal + 63) / 64;
+    nBytes = nWords*sizeof(uint64_t) + (3 + hdr.bPotential)*sizeof(float)*n;
+    nBytes = (nBytes + 7) & ~(size_t)7; /* Keep the next header aligned */
+    hdr.nBytes = nBytes;
+
+    lcs->pBuffer = growArray(lcs->pBuffer,&lcs->nBufferMax,iByte + sizeof(hdr) + nBytes,1);
+    memcpy(lcs->pBuffer + iByte,&hdr,sizeof(hdr));
+    pWords = (uint64_t *)(lcs->pBuffer + iByte + sizeof(hdr));
+
+    /* Pack the quantized positions */
+    word = 0;
+    nUsed = 0;
+    for (i=0; i<n; ++i) {
+	const float *r = pLC[pKeys[i].i].pos;
+	for (j=0; j<3; ++j) {
+	    int b = hdr.nBits[j];
+	    if (b == 0) continue;
+	    uint64_t q = llround((r[j] - hdr.rCentre[j]) / lcs->dQuantum) - qMin[j];
+	    word |= q << nUsed;
+	    if (nUsed + b >= 64) {
+		*pWords++ = word;
+		word = nUsed ? q >> (64 - nUsed) : 0;
+		nUsed = nUsed + b - 64;
+		}
+	    else nUsed += b;
+	    }
+	}
+    if (nUsed) *pWords++ = word;
+
+    pf = (float *)pWords;
+    for (i=0; i<n; ++i) {
+	const float *v = pLC[pKeys[i].i].vel;
+	*pf++ = v[0];
+	*pf++ = v[1];
+	*pf++ = v[2];
+	}
+#ifdef POTENTIAL_IN_LIGHTCONE
+    for (i=0; i<n; ++i) *pf++ = pLC[pKeys[i].i].pot;
+#endif
+    while ((char *)pf < lcs->pBuffer + iByte + sizeof(hdr) + nBytes) *pf++ = 0.0f;
+
+    pIndex->iPixel = iPixel;
+    pIndex->iShell = iShell;
+    pIndex->nParticles = n;
+    pIndex->iOffset = lcs->iOffset + iByte;
+    pIndex->nBytes = sizeof(hdr) + nBytes;
+    return iByte + sizeof(hdr) + nBytes;
+    }
+
+/*
+** Write the buffered light cone particles as one block per pixel and shell.
+*/
+void lcShardWrite(LCSHARD *lcs,asyncFileInfo *afi,struct partLightCone *pLC,int n) {
+    size_t iByte, nBlocks, nWrite;
+    int i, iStart;
+
+    if (n == 0) return;
+    lcs->pKeys = growArray(lcs->pKeys,&lcs->nKeysMax,n,sizeof(*lcs->pKeys));
+    for (i=0; i<n; ++i) {
+	double r[3] = {pLC[i].pos[0],pLC[i].pos[1],pLC[i].pos[2]};
+	uint64_t iPixel = vec2pix_ring64(lcs->nSide,r);
+	uint64_t iShell = 0;
+	if (lcs->dShellWidth > 0.0) {
+	    iShell = floor(sqrt(r[0]*r[0] + r[1]*r[1] + r[2]*r[2]) / lcs->dShellWidth);
+	    assert(iShell < (1<<LCSHARD_SHELL_BITS));
+	    }
+	lcs->pKeys[i].key = (iPixel << LCSHARD_SHELL_BITS) | iShell;
+	lcs->pKeys[i].i = i;
+	}
+    qsort(lcs->pKeys,n,sizeof(*lcs->pKeys),cmpShardKey);
+
+    iByte = 0;
+    nBlocks = 0;
+    for (iStart=0,i=1; i<=n; ++i) {
+	if (i==n || lcs->pKeys[i].key != lcs->pKeys[iStart].key) {
+	    uint64_t key = lcs->pKeys[iStart].key;
+	    lcs->pIndex = growArray(lcs->pIndex,&lcs->nIndexMax,nBlocks+1,sizeof(*lcs->pIndex));
+	    iByte = encodeBlock(lcs,pLC,lcs->pKeys+iStart,i-iStart,
+		key >> LCSHARD_SHELL_BITS,key & ((1<<LCSHARD_SHELL_BITS)-1),
+		iByte,lcs->pIndex+nBlocks);
+	    ++nBlocks;
+	    iStart = i;
+	    }
+	}
+    io_write(afi,lcs->pBuffer,iByte);
+    lcs->iOffset += iByte;
+    nWrite = nBlocks * sizeof(*lcs->pIndex);
+    if (write(lcs->fdIndex,lcs->pIndex,nWrite) != nWrite) {
+	perror("Wrong size writing light cone index");
+	abort();
+	}
+    }
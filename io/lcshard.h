@@ -0,0 +1,105 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LCSHARD_H
+#define LCSHARD_H
+#include <stdint.h>
+#include <stddef.h>
+#include "io/iomodule.h"
+
+/*
+** Sharded light cone particle output.
+**
+** Instead of a stream of LIGHTCONEP records, the particles of each buffer
+** flush are binned by coarse HEALPix pixel (ring ordering) and radial shell
+** and written as independent blocks. A block is an LCSHARDHEADER followed
+** by nBytes of payload:
+**
+**   positions: for each particle, x, y and z as unsigned integers of
+**              nBits[0], nBits[1] and nBits[2] bits, packed LSB first
+**              into 64-bit words. A coordinate is
+**              rCentre[j] + (iMin[j] + q) * dQuantum, where rCentre is
+**              the pixel centre at the mean radius of the block.
+**   vel[3]:    float, nParticles of them.
+**   pot:       float, nParticles of them, only if bPotential.
+**   padding:   to a multiple of 8 bytes (included in nBytes).
+**
+** The index file starts with an LCSHARDINDEXHEADER giving the pixelization
+** (nSide and scheme) and the shell width, then holds one LCSHARDINDEX per
+** block so a reader can seek directly to the pixels and shells that it needs.
+*/
+typedef struct {
+    int64_t iPixel;
+    int32_t iShell;
+    uint32_t nParticles;
+    double rCentre[3];
+    double dQuantum;
+    int32_t iMin[3];
+    uint8_t nBits[3];
+    uint8_t bPotential;
+    uint64_t nBytes;
+    } LCSHARDHEADER;
+
+typedef struct {
+    int64_t iPixel;
+    int32_t iShell;
+    uint32_t nParticles;
+    uint64_t iOffset;   /* Of the header in the particle file */
+    uint64_t nBytes;    /* Including the header */
+    } LCSHARDINDEX;
+
+#define LCSHARD_MAGIC   0x3149434c /* "LCI1" */
+#define LCSHARD_RING    0          /* HEALPix ring ordering */
+#define LCSHARD_NESTED  1          /* HEALPix nested ordering */
+
+typedef struct {
+    uint32_t iMagic;    /* LCSHARD_MAGIC */
+    int32_t iScheme;    /* LCSHARD_RING or LCSHARD_NESTED */
+    int64_t nSide;      /* HEALPix nside of iPixel */
+    double dShellWidth; /* Radial width of a shell; 0 for a single shell */
+    double dQuantum;    /* Position resolution */
+    } LCSHARDINDEXHEADER;
+
+struct partLightCone;
+struct lcShardKey;
+
+typedef struct {
+    int nSide;          /* HEALPix nside of the shards; 0 for plain output */
+    double dShellWidth; /* Radial width of a shell; 0 for a single shell */
+    double dQuantum;    /* Position resolution */
+    int fdIndex;
+    uint64_t iOffset;   /* Bytes written to the particle file */
+    struct lcShardKey *pKeys;
+    char *pBuffer;
+    size_t nKeysMax, nBufferMax;
+    LCSHARDINDEX *pIndex;
+    size_t nIndexMax;
+    } LCSHARD;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void lcShardInitialize(LCSHARD *lcs);
+void lcShardFinish(LCSHARD *lcs);
+void lcShardOpen(LCSHARD *lcs,const char *indexname,int nSide,double dShellWidth,double dQuantum);
+void lcShardWrite(LCSHARD *lcs,asyncFileInfo *afi,struct partLightCone *pLC,int n);
+void lcShardClose(LCSHARD *lcs);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
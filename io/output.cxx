@@ -51,12 +51,40 @@ static int packGroupStats(void *vctx, int *id, size_t nSize, void *vBuff) {
     return n*sizeof(TinyGroupTable);
     }
 
+/*
+** Subhalo hierarchy
+*/
+static int packSubhalos(void *vctx, int *id, size_t nSize, void *vBuff) {
+    struct packCtx *ctx = (struct packCtx *)vctx;
+    int nLeft = ctx->pkd->nSubhalos - ctx->iIndex;
+    int n = nSize / sizeof(SUBHALO);
+    if ( n > nLeft ) n = nLeft;
+    memcpy(vBuff,ctx->pkd->subhaloTable + ctx->iIndex, n*sizeof(SUBHALO) );
+    ctx->iIndex += n;
+    return n*sizeof(SUBHALO);
+    }
+
+/*
+** Merger tree edges
+*/
+static int packMergerEdges(void *vctx, int *id, size_t nSize, void *vBuff) {
+    struct packCtx *ctx = (struct packCtx *)vctx;
+    int nLeft = ctx->pkd->nMergerEdges - ctx->iIndex;
+    int n = nSize / sizeof(MERGEREDGE);
+    if ( n > nLeft ) n = nLeft;
+    memcpy(vBuff,ctx->pkd->mergerEdges + ctx->iIndex, n*sizeof(MERGEREDGE) );
+    ctx->iIndex += n;
+    return n*sizeof(MERGEREDGE);
+    }
+
 static int packGridK(void *vctx, int *id, size_t nSize, void *vBuff) {
     struct packCtx *ctx = (struct packCtx *)vctx;
     PKD pkd = ctx->pkd;
     if (mdlCore(pkd->mdl) == 0) {
 	auto fftData = reinterpret_cast<COMPLEX *>(pkd->pLite) + ctx->iGrid * pkd->fft->kgrid->nLocal;
-	size_t nLocal = 1ul * pkd->fft->kgrid->a1 * pkd->fft->kgrid->n2 * pkd->fft->kgrid->nSlab;
+	// The output files are concatenated so each processor must have complete slabs
+	assert(mdlGridRowLength(pkd->fft->kgrid) == pkd->fft->kgrid->a1);
+	size_t nLocal = mdlGridLocalCount(pkd->fft->kgrid);
 	size_t nLeft = nLocal - ctx->iIndex;
 	size_t n = nSize / sizeof(*fftData);
 	if ( n > nLeft ) n = nLeft;
@@ -73,7 +101,8 @@ static int packGridR(void *vctx, int *id, size_t nSize, void *vBuff) {
     if (mdlCore(pkd->mdl) == 0) {
 	auto fftData = reinterpret_cast<float *>(pkd->pLite) + ctx->iGrid * pkd->fft->rgrid->nLocal;
 	auto pOutput = reinterpret_cast<float *>(vBuff);
-	size_t nLocal = 1ul * pkd->fft->rgrid->a1 * pkd->fft->rgrid->n2 * pkd->fft->rgrid->nSlab;
+	assert(mdlGridRows(pkd->fft->rgrid) == pkd->fft->rgrid->n2); // Complete slabs, as above
+	size_t nLocal = mdlGridLocalCount(pkd->fft->rgrid);
 	size_t n = nSize / sizeof(*fftData);
 	size_t iOutput = 0;
 	while(ctx->iIndex < nLocal && iOutput + pkd->fft->rgrid->n1 <= n ) {
@@ -100,6 +129,12 @@ void pkdOutputSend(PKD pkd, outType eOutputType, int iPartner, int iGrid) {
     case OUT_TINY_GROUP:
 	pack = packGroupStats;
 	break;
+    case OUT_SUBHALO:
+	pack = packSubhalos;
+	break;
+    case OUT_MERGER_EDGE:
+	pack = packMergerEdges;
+	break;
     case OUT_KGRID:
 	pack = packGridK;
 	break;
@@ -145,7 +180,7 @@ void pkdOutput(PKD pkd, outType eOutputType, int iProcessor,int nProcessor,
     char achOutFile[256];
     strcpy(achOutFile,fname);
     sprintf(achOutFile+strlen(achOutFile),".%d",iProcessor);
-    io_init(&info,4,1024*1024,IO_AIO|IO_LIBAIO);
+    io_init(&info,4,1024*1024,IO_AIO|IO_LIBAIO|IO_URING);
     if (io_create(&info,achOutFile) < 0) { perror(fname); abort(); }
 
     switch(eOutputType) {
@@ -153,6 +188,14 @@ void pkdOutput(PKD pkd, outType eOutputType, int iProcessor,int nProcessor,
 	io_write(&info,pkd->tinyGroupTable+1,sizeof(TinyGroupTable)*pkd->nLocalGroups);
 	unpack = unpackWrite;
 	break;
+    case OUT_SUBHALO:
+	io_write(&info,pkd->subhaloTable,sizeof(SUBHALO)*pkd->nSubhalos);
+	unpack = unpackWrite;
+	break;
+    case OUT_MERGER_EDGE:
+	io_write(&info,pkd->mergerEdges,sizeof(MERGEREDGE)*pkd->nMergerEdges);
+	unpack = unpackWrite;
+	break;
     case OUT_KGRID:
 	localWrite(pkd,unpackWrite,&info,packGridK,iGrid);
 	unpack = unpackWrite;
@@ -21,6 +21,8 @@
 
 typedef enum {
     OUT_TINY_GROUP,
+    OUT_SUBHALO,
+    OUT_MERGER_EDGE,
     OUT_KGRID,
     OUT_RGRID,
     } outType;
@@ -28,39 +28,23 @@
 
 extern "C" void addToLightCone(PKD pkd,double *r,float fPot,PARTICLE *p,int bParticleOutput);
 
-#define NBOX 184
-
 extern "C"
 void pkdProcessLightCone(PKD pkd,PARTICLE *p,float fPot,double dLookbackFac,double dLookbackFacLCP,
-			double dDriftDelta,double dKickDelta,double dBoxSize,int bLightConeParticles) {
+			double dDriftDelta,double dKickDelta,double dBoxSize,int bLightConeParticles,
+			const LCREPLICAS *rep) {
     const double dLightSpeed = dLightSpeedSim(dBoxSize);
     const double mrLCP = dLightSpeed*dLookbackFacLCP;
-
-    int nBox = NBOX; /* Check all 184 by default */
     double dxStart;
 
+    /*
+    ** Only the part of the light cone inside the outer layer of replicas
+    ** can be produced. The replicas to check were chosen for the bucket
+    ** by pkdLightConeReplicas (and padded to a multiple of the SIMD width).
+    */
+    if (rep->nBox == 0 || dLookbackFac < 0) return;
     dxStart = (dLookbackFac*dLightSpeed - 3.0)/(dKickDelta*dLightSpeed);
     if (dxStart > 1) return;
-    else if (dxStart < 0) {
-	dxStart = (dLookbackFac*dLightSpeed - 2.0)/(dKickDelta*dLightSpeed);
-	if (dxStart >= 0) dxStart = 0;
-	else {
-	    /*
-	    ** Check only 64!
-	    */
-	    nBox = 64;
-	    dxStart = (dLookbackFac*dLightSpeed - 1.0)/(dKickDelta*dLightSpeed);
-	    if (dxStart >= 0) dxStart = 0;
-	    else {
-		/*
-		** Check only 8!
-		*/
-		nBox = 8;
-		if (dLookbackFac >= 0) dxStart = 0;
-		else return;   /* Nothing to check */
-		}
-	    }
-	}
+    else if (dxStart < 0) dxStart = 0;
 
     const vel_t *v = pkdVel(pkd,p);
     double r0[3],r1[3];
@@ -129,8 +113,7 @@ void pkdProcessLightCone(PKD pkd,PARTICLE *p,float fPot,double dLookbackFac,doub
 
     dvec xStart = dxStart;
 
-    assert(nBox%dvec::width() == 0);
-    nBox /= dvec::width();
+    int nBox = (rep->nBox + dvec::width() - 1) / dvec::width();
     int k;
     for (k=0;k<4;++k) {
 	double dtApprox, dt;
@@ -160,9 +143,9 @@ void pkdProcessLightCone(PKD pkd,PARTICLE *p,float fPot,double dLookbackFac,doub
 	for (j=0;j<3;++j) r1[j] = r0[j] + dt*v[j];
 	for(int iOct=0; iOct<nBox; ++iOct) {
 	    dvec off0, off1, off2;
-	    off0.load(pkd->lcOffset0+iOct*4);
-	    off1.load(pkd->lcOffset1+iOct*4);
-	    off2.load(pkd->lcOffset2+iOct*4);
+	    off0.load(rep->lcOffset0+iOct*dvec::width());
+	    off1.load(rep->lcOffset1+iOct*dvec::width());
+	    off2.load(rep->lcOffset2+iOct*dvec::width());
 	    dvec vrx0 = off0 + r0[0];
 	    dvec vry0 = off1 + r0[1];
 	    dvec vrz0 = off2 + r0[2];
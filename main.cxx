@@ -38,6 +38,8 @@
 #include "core/setadd.h"
 #include "core/swapall.h"
 #include "core/hostname.h"
+#include "core/trace.h"
+#include "core/cachestats.h"
 #include "core/initcosmology.h"
 #include "core/calcroot.h"
 #include "core/select.h"
@@ -49,7 +51,9 @@
 #include "domains/dumptrees.h"
 #include "domains/enforceperiodic.h"
 #include "domains/freestore.h"
+#include "domains/measuredwork.h"
 #include "domains/olddd.h"
+#include "domains/hilbertdd.h"
 
 #include "gravity/setsoft.h"
 #include "gravity/activerung.h"
@@ -85,6 +89,8 @@ void *worker_init(MDL vmdl) {
     mdl->AddService(std::make_unique<ServiceSetAdd>(pst));
     mdl->AddService(std::make_unique<ServiceSwapAll>(pst));
     mdl->AddService(std::make_unique<ServiceHostname>(pst));
+    mdl->AddService(std::make_unique<ServiceTrace>(pst));
+    mdl->AddService(std::make_unique<ServiceCacheStats>(pst));
     mdl->AddService(std::make_unique<ServiceInitCosmology>(pst));
     mdl->AddService(std::make_unique<ServiceCalcRoot>(pst));
     mdl->AddService(std::make_unique<ServiceCountSelected>(pst));
@@ -104,6 +110,7 @@ void *worker_init(MDL vmdl) {
     mdl->AddService(std::make_unique<ServiceDumpTrees>(pst));
     mdl->AddService(std::make_unique<ServiceEnforcePeriodic>(pst));
     mdl->AddService(std::make_unique<ServiceFreeStore>(pst));
+    mdl->AddService(std::make_unique<ServiceMeasuredWork>(pst));
     mdl->AddService(std::make_unique<ServiceSetSoft>(pst));
     mdl->AddService(std::make_unique<ServiceActiveRung>(pst));
     mdl->AddService(std::make_unique<ServiceCountRungs>(pst));
@@ -117,6 +124,9 @@ void *worker_init(MDL vmdl) {
     mdl->AddService(std::make_unique<OldDD::ServiceWeight>(pst));
     mdl->AddService(std::make_unique<OldDD::ServiceWeightWrap>(pst));
     mdl->AddService(std::make_unique<OldDD::ServiceOrdWeight>(pst));
+    mdl->AddService(std::make_unique<HilbertDD::ServiceHilbertDecomp>(pst));
+    mdl->AddService(std::make_unique<HilbertDD::ServiceKeyWeight>(pst));
+    mdl->AddService(std::make_unique<HilbertDD::ServiceColKeyRejects>(pst));
     return pst;
     }
 
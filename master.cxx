@@ -75,13 +75,17 @@ using namespace fmt::literals; // Gives us ""_a and ""_format literals
 #include "core/setadd.h"
 #include "core/swapall.h"
 #include "core/hostname.h"
+#include "core/trace.h"
+#include "core/cachestats.h"
 #include "core/calcroot.h"
 #include "core/select.h"
 
 #include "domains/distribtoptree.h"
 #include "domains/distribroot.h"
 #include "domains/dumptrees.h"
+#include "domains/measuredwork.h"
 #include "domains/olddd.h"
+#include "domains/hilbertdd.h"
 
 #include "gravity/setsoft.h"
 #include "gravity/activerung.h"
@@ -199,6 +203,8 @@ uint64_t MSR::getMemoryModel() {
     if (param.bMemIntegerPosition) mMemoryModel |= PKD_MODEL_INTEGER_POS;
     if (param.bMemUnordered)    mMemoryModel |= PKD_MODEL_UNORDERED;
     if (param.bMemParticleID)   mMemoryModel |= PKD_MODEL_PARTICLE_ID;
+    if (param.bDomainWork)      mMemoryModel |= PKD_MODEL_WORK;
+    if (param.bMergerTree)      mMemoryModel |= PKD_MODEL_MERGER;
     if (param.bTraceRelaxation) mMemoryModel |= PKD_MODEL_RELAXATION;
     if (param.bMemAcceleration || param.bDoAccOutput) mMemoryModel |= PKD_MODEL_ACCELERATION;
     if (param.bMemVelocity)     mMemoryModel |= PKD_MODEL_VELOCITY;
@@ -218,6 +224,22 @@ uint64_t MSR::getMemoryModel() {
     if (param.bMemNodeBnd)          mMemoryModel |= PKD_MODEL_NODE_BND;
     if (param.bMemNodeVBnd)         mMemoryModel |= PKD_MODEL_NODE_VBND;
 
+    /*
+    ** The separate arrays only exist for particles on this node, so features
+    ** that read velocities or potentials of remote particles (or send raw
+    ** particles to another node for writing) need the packed layout.
+    */
+    if (param.bMemSoA) {
+	if (param.bFindGroups || param.bFindHopGroups || param.bDoGas || param.bMemVelSmooth
+		|| (param.bGravStep && param.iTimeStepCrit == 1)
+		|| !param.bParaWrite || (param.nParaWrite > 1 && param.nParaWrite < nThreads)) {
+	    if (param.bVWarnings)
+		printf("WARNING: bMemSoA is not supported with group finding, gas, velocity smoothing,\n"
+		       "         iTimeStepCrit=1 or serial writing; using the packed particle layout\n");
+	    }
+	else mMemoryModel |= PKD_MODEL_SOA;
+	}
+
     return mMemoryModel;
     }
 
@@ -231,6 +253,7 @@ void MSR::InitializePStore(uint64_t *nSpecies,uint64_t mMemoryModel) {
     ps.nTreeBitsHi = param.nTreeBitsHi;
     ps.iCacheSize  = param.iCacheSize;
     ps.iWorkQueueSize  = param.iWorkQueueSize;
+    ps.iCacheWindow  = param.iCacheWindow;
     ps.iCUDAQueueSize  = param.iCUDAQueueSize;
     ps.fPeriod[0] = param.dxPeriod;
     ps.fPeriod[1] = param.dyPeriod;
@@ -240,12 +263,12 @@ void MSR::InitializePStore(uint64_t *nSpecies,uint64_t mMemoryModel) {
     ps.bLightConeParticles  = param.bLightConeParticles;    
 
 #define SHOW(m) ((ps.mMemoryModel&PKD_MODEL_##m)?" " #m:"")
-       printf("Memory Models:%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n", 
+       printf("Memory Models:%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n", 
 	   param.bMemIntegerPosition ? " INTEGER_POSITION" : " DOUBLE_POSITION",
 	   SHOW(UNORDERED),SHOW(VELOCITY),SHOW(ACCELERATION),SHOW(POTENTIAL),
 	   SHOW(GROUPS),SHOW(RELAXATION),SHOW(MASS),SHOW(DENSITY),
 	   SHOW(BALL),SHOW(SOFTENING),SHOW(VELSMOOTH),SHOW(SPH),
-	   SHOW(STAR),SHOW(PARTICLE_ID));
+	   SHOW(STAR),SHOW(PARTICLE_ID),SHOW(SOA));
 #undef SHOW
     ps.nMinEphemeral = 0;
     ps.nMinTotalStore = 0;
@@ -258,6 +281,7 @@ void MSR::InitializePStore(uint64_t *nSpecies,uint64_t mMemoryModel) {
     if (param.bGravStep      && ps.nEphemeralBytes < 8) ps.nEphemeralBytes = 8;
     if (param.bDoGas         && ps.nEphemeralBytes < 8) ps.nEphemeralBytes = 8;
     if (param.bDoDensity     && ps.nEphemeralBytes < 12) ps.nEphemeralBytes = 12;
+    if (param.bSmoothCache   && ps.nEphemeralBytes < 8*param.nSmooth) ps.nEphemeralBytes = 8*param.nSmooth;
 #ifdef MDL_FFTW
     if (param.nGridPk>0) {
 	struct inGetFFTMaxSizes inFFTSizes;
@@ -316,10 +340,7 @@ void MSR::Restart(int n, const char *baseName, int iStep, int nSteps, double dTi
     auto sec = MSR::Time();
 
     if (mdlThreads(mdl) != n) {
-	fprintf(stderr,"ERROR: You must restart a checkpoint with the same number of threads\n");
-	fprintf(stderr,"       nThreads=%d, nCheckpointThreads=%d\n",mdlThreads(mdl),n);
-	fprintf(stderr,"       RESTART WITH %d THREADS\n",n);
-	Exit(1);
+	printf("Restoring a checkpoint written by %d threads onto %d threads\n",n,mdlThreads(mdl));
 	}
 
     bVDetails = getParameterBoolean("bVDetails");
@@ -338,6 +359,7 @@ void MSR::Restart(int n, const char *baseName, int iStep, int nSteps, double dTi
 
     struct inRestore restore;
     restore.nProcessors = param.bParaRead==0?1:(param.nParaRead<=1 ? nThreads:param.nParaRead);
+    restore.nCheckpointThreads = n;
     strcpy(restore.achInFile,baseName);
     pstRestore(pst,&restore,sizeof(restore),NULL,0);
     pstSetClasses(pst,aCheckpointClasses,nCheckpointClasses*sizeof(PARTCLASS),NULL,0);
@@ -348,9 +370,13 @@ void MSR::Restart(int n, const char *baseName, int iStep, int nSteps, double dTi
     double dExp = csmTime2Exp(csm,dTime);
     msrprintf("Checkpoint Restart Complete @ a=%g, Wallclock: %f secs\n\n",dExp,dsec);
 
-    /* We can indicate that the DD was already done at rung 0 */
-    iLastRungRT = 0;
-    iLastRungDD = 0;
+    /* We can indicate that the DD was already done at rung 0, unless the
+    ** particles were read onto a different number of threads.
+    */
+    if (mdlThreads(mdl) == n) {
+	iLastRungRT = 0;
+	iLastRungDD = 0;
+	}
 
     InitCosmology();
     if (prmSpecified(prm,"dSoft")) SetSoft(Soft());
@@ -420,6 +446,7 @@ void MSR::Checkpoint(int iStep,int nSteps,double dTime,double dDelta) {
     assert(filename.size() < sizeof(in.achOutFile));
     strcpy(in.achOutFile,filename.c_str());
     in.nProcessors = param.bParaWrite==0?1:(param.nParaWrite<=1 ? nThreads:param.nParaWrite);
+    in.iCompress = param.iCheckpointCompress;
     if (csm->val.bComove) {
 	double dExp = csmTime2Exp(csm,dTime);
 	msrprintf("Writing checkpoint for Step: %d Time:%g Redshift:%g\n",
@@ -458,6 +485,7 @@ void MSR::Initialize() {
     iRungDT = 0;
     iLastRungRT = -1;
     iLastRungDD = -1;  /* Domain decomposition is not done */
+    bKeysValid = false;
     nRung.resize(MAX_RUNG+1,0);
     csmInitialize(&csm);
     /*
@@ -624,6 +652,21 @@ void MSR::Initialize() {
     param.dEwhCut = 2.8;
     prmAddParam(prm,"dEwhCut",2,&param.dEwhCut,sizeof(double),"ewh",
 		"<dEwhCut> = 2.8");
+    param.nEwaldGrid = 0;
+    prmAddParam(prm,"nEwaldGrid",1,&param.nEwaldGrid,sizeof(int),"ewgrid",
+		"<cells per box length of the Ewald correction table, 0 for exact sum> = 0");
+    param.dEwaldGridTol = 1e-4;
+    prmAddParam(prm,"dEwaldGridTol",2,&param.dEwaldGridTol,sizeof(double),"ewgridtol",
+		"<maximum Ewald table error relative to M/L^2> = 1e-4");
+    param.nGridPM = 0;
+    prmAddParam(prm,"nGridPM",1,&param.nGridPM,sizeof(int),"pmgrid",
+		"<TreePM grid size for the long-range force, replaces Ewald, 0=disabled> = 0");
+    param.dPMSmooth = 1.25;
+    prmAddParam(prm,"dPMSmooth",2,&param.dPMSmooth,sizeof(double),"pms",
+		"<TreePM force split scale r_s in grid cells> = 1.25");
+    param.dPMCut = 4.5;
+    prmAddParam(prm,"dPMCut",2,&param.dPMCut,sizeof(double),"pmcut",
+		"<TreePM short-range force cutoff in units of r_s> = 4.5");
     param.dTheta = 0.7;
     param.dTheta2 = param.dTheta;
     param.dTheta20 = param.dTheta;
@@ -729,18 +772,30 @@ void MSR::Initialize() {
     param.iWorkQueueSize = 0;
     prmAddParam(prm,"iWorkQueueSize",1,&param.iWorkQueueSize,sizeof(int),"wqs",
 		"<size of the MDL work queue> = 0");
+    param.iCacheWindow = 0;
+    prmAddParam(prm,"iCacheWindow",1,&param.iCacheWindow,sizeof(int),"cw",
+		"<microseconds to hold remote cache requests for batching> = 0");
     param.iCUDAQueueSize = 8;
     prmAddParam(prm,"iCUDAQueueSize",1,&param.iCUDAQueueSize,sizeof(int),"cqs",
 		"<size of the CUDA work queue> = 8");
     param.nSmooth = 64;
     prmAddParam(prm,"nSmooth",1,&param.nSmooth,sizeof(int),"s",
 		"<number of particles to smooth over> = 64");
+    param.bSmoothCache = 0;
+    prmAddParam(prm,"bSmoothCache",0,&param.bSmoothCache,sizeof(int),"smcache",
+		"keep neighbor lists for consecutive smooths with the same nSmooth = -smcache");
     param.bStandard = 1;
     prmAddParam(prm,"bStandard",0,&param.bStandard,sizeof(int),"std",
 		"output in standard TIPSY binary format = -std");
     param.iCompress = 0;
     prmAddParam(prm,"iCompress",1,&param.iCompress,sizeof(int),NULL,
 		"compression format, 0=none, 1=gzip, 2=bzip2");
+    param.iCheckpointCompress = 1;
+    prmAddParam(prm,"iCheckpointCompress",1,&param.iCheckpointCompress,sizeof(int),"chkz",
+		"<checkpoint compression level, 0=none, 1-9=zlib> = 1");
+    param.nTraceEvents = 0;
+    prmAddParam(prm,"nTraceEvents",1,&param.nTraceEvents,sizeof(int),"trace",
+		"<timeline events kept per thread and step, 0=no trace> = 0");
     param.bHDF5 = 0;
     prmAddParam(prm,"bHDF5",0,&param.bHDF5,sizeof(int),"hdf5",
 		"output in HDF5 format = -hdf5");
@@ -760,6 +815,18 @@ void MSR::Initialize() {
     param.bLightConeParticles = 0;
     prmAddParam(prm,"bLightConeParticles",0,&param.bLightConeParticles,sizeof(int),"lcp",
 		"output light cone particles = -lcp");
+    param.nSideLightConeShard = 0;
+    prmAddParam(prm,"nSideLightConeShard",1,&param.nSideLightConeShard,sizeof(int),"lcshard",
+		"<HEALPix nside of the light cone particle blocks, 0 for a plain stream> = 0");
+    param.dLightConeShellWidth = 0.0;
+    prmAddParam(prm,"dLightConeShellWidth",2,&param.dLightConeShellWidth,sizeof(double),"lcshell",
+		"<radial width of the light cone particle blocks in box lengths, 0 for one shell> = 0");
+    param.dLightConeQuantum = 1e-6;
+    prmAddParam(prm,"dLightConeQuantum",2,&param.dLightConeQuantum,sizeof(double),"lcquantum",
+		"<position resolution of light cone particle blocks in box lengths> = 1e-6");
+    param.achLightConeShells[0] = 0;
+    prmAddParam(prm,"achLightConeShells",3,param.achLightConeShells,256,"lcshells",
+		"<HEALPix map shells as \"rInner rOuter nside,...\" in box lengths, empty for one map per step> = \"\"");
     param.bInFileLC = 0;
     prmAddParam(prm,"bInFileLC",0,&param.bInFileLC,sizeof(int),"lcin",
 		"input light cone data = -lcin");
@@ -788,6 +855,16 @@ void MSR::Initialize() {
     prmAddParam(prm,"dFracNoDomainDimChoice",2,&param.dFracNoDomainDimChoice,
 		sizeof(double),"fnddc",
 		"<Fraction of Active Particles for no DD dimension choice> = 0.1");
+    param.bDomainWork = 0;
+    prmAddParam(prm,"bDomainWork",0,&param.bDomainWork,sizeof(int),"ddwork",
+		"<balance domains by the measured gravity work of each particle> = -ddwork");
+    param.bDomainHilbert = 0;
+    prmAddParam(prm,"bDomainHilbert",0,&param.bDomainHilbert,sizeof(int),"ddhilbert",
+		"<decompose domains along the Peano-Hilbert curve> = -ddhilbert");
+    param.dDomainTolerance = 0.02;
+    prmAddParam(prm,"dDomainTolerance",2,&param.dDomainTolerance,
+		sizeof(double),"ddtol",
+		"<Peano-Hilbert splitters only move once a domain is this far out of balance> = 0.02");
     param.bDoGravity = 1;
     prmAddParam(prm,"bDoGravity",0,&param.bDoGravity,sizeof(int),"g",
 		"enable/disable interparticle gravity = +g");
@@ -808,6 +885,18 @@ void MSR::Initialize() {
     param.dHopTau = -4.0;
     prmAddParam(prm,"dHopTau",2,&param.dHopTau,sizeof(double),"hoptau",
 		"<linking length for Gasshopper (negative for multiples of softening)> = -4.0");
+    param.bHopSubhalos = 0;
+    prmAddParam(prm,"bHopSubhalos",0,&param.bHopSubhalos,sizeof(int),"hopsub",
+		"<find the subhalo hierarchy of Grasshopper groups> = -hopsub");
+    param.nHopSubNeighbors = 20;
+    prmAddParam(prm,"nHopSubNeighbors",1,&param.nHopSubNeighbors,sizeof(int),"nhopsubngb",
+		"<neighbours used to find density peaks of subhalos> = 20");
+    param.bMergerTree = 0;
+    prmAddParam(prm,"bMergerTree",0,&param.bMergerTree,sizeof(int),"mergertree",
+		"<link groups to their progenitors at the previous group finding step> = -mergertree");
+    param.nMergerTracers = 10;
+    prmAddParam(prm,"nMergerTracers",1,&param.nMergerTracers,sizeof(int),"nmergertracers",
+		"<most bound particles tracked per group for the merger tree> = 10");
     param.nMinMembers = 10;
     prmAddParam(prm,"nMinMembers",1,&param.nMinMembers,sizeof(int),
 		"nMinMembers","<minimum number of group members> = 10");
@@ -922,6 +1011,9 @@ void MSR::Initialize() {
     param.bMemVelSmooth = 0;
     prmAddParam(prm,"bMemVelSmooth",0,&param.bMemVelSmooth,
 		sizeof(int),"Mvs","<Particles support velocity smoothing> = -Mvs");
+    param.bMemSoA = 0;
+    prmAddParam(prm,"bMemSoA",0,&param.bMemSoA,
+		sizeof(int),"soa","<Velocity, acceleration and potential are stored in separate arrays> = -soa");
     param.bMemNodeMoment = 0;
     prmAddParam(prm,"bMemNodeMoment",0,&param.bMemNodeMoment,
 		sizeof(int),"MNm","<Tree nodes support multipole moments> = 0");
@@ -1166,6 +1258,8 @@ void msrLogParams(MSR &msr,FILE *fp) {
     fprintf(fp," nParaWrite: %d",param.nParaWrite);
     fprintf(fp," bStandard: %d",param.bStandard);
     fprintf(fp," iCompress: %d",param.iCompress);
+    fprintf(fp," iCheckpointCompress: %d",param.iCheckpointCompress);
+    fprintf(fp," nTraceEvents: %d",param.nTraceEvents);
     fprintf(fp," bHDF5: %d",param.bHDF5);
     fprintf(fp," nBucket: %d",param.nBucket);
     fprintf(fp," nGroup: %d",param.nGroup);
@@ -1176,6 +1270,11 @@ void msrLogParams(MSR &msr,FILE *fp) {
     fprintf(fp," nReplicas: %d",param.nReplicas);
     fprintf(fp,"\n# dEwCut: %f",param.dEwCut);
     fprintf(fp," dEwhCut: %f",param.dEwhCut);
+    fprintf(fp," nEwaldGrid: %d",param.nEwaldGrid);
+    fprintf(fp," dEwaldGridTol: %g",param.dEwaldGridTol);
+    fprintf(fp," nGridPM: %d",param.nGridPM);
+    fprintf(fp," dPMSmooth: %g",param.dPMSmooth);
+    fprintf(fp," dPMCut: %g",param.dPMCut);
     fprintf(fp,"\n# iStartStep: %d",param.iStartStep);
     fprintf(fp," nSteps: %d",param.nSteps);
     fprintf(fp," nSmooth: %d",param.nSmooth);
@@ -1184,6 +1283,7 @@ void msrLogParams(MSR &msr,FILE *fp) {
     fprintf(fp," nTreeBitsHi: %d",param.nTreeBitsHi);
     fprintf(fp," iCacheSize: %d",param.iCacheSize);
     fprintf(fp," iWorkQueueSize: %d",param.iWorkQueueSize);
+    fprintf(fp," iCacheWindow: %d",param.iCacheWindow);
     fprintf(fp," iCUDAQueueSize: %d",param.iCUDAQueueSize);
     if (prmSpecified(prm,"dSoft"))
 	fprintf(fp," dSoft: %g",param.dSoft);
@@ -1214,6 +1314,9 @@ void msrLogParams(MSR &msr,FILE *fp) {
     fprintf(fp,"dFracNoDomainDecomp: %g",param.dFracNoDomainDecomp);
     fprintf(fp," dFracNoDomainRootFind: %g",param.dFracNoDomainRootFind);
     fprintf(fp," dFracNoDomainDimChoice: %g",param.dFracNoDomainDimChoice);
+    fprintf(fp," bDomainWork: %d",param.bDomainWork);
+    fprintf(fp," bDomainHilbert: %d",param.bDomainHilbert);
+    fprintf(fp," dDomainTolerance: %g",param.dDomainTolerance);
     fprintf(fp,"\n# nTruncateRung: %d",param.nTruncateRung);
 
     fprintf(fp,"\n# SPH: bDoGas: %d",param.bDoGas);	
@@ -1262,6 +1365,10 @@ void msrLogParams(MSR &msr,FILE *fp) {
     /* -- */
     fprintf(fp,"\n# Group Find: bFindHopGroups: %d",param.bFindHopGroups);
     fprintf(fp," dHopTau: %g",param.dHopTau);
+    fprintf(fp," bHopSubhalos: %d",param.bHopSubhalos);
+    fprintf(fp," nHopSubNeighbors: %d",param.nHopSubNeighbors);
+    fprintf(fp," bMergerTree: %d",param.bMergerTree);
+    fprintf(fp," nMergerTracers: %d",param.nMergerTracers);
     /* -- */
     fprintf(fp,"\n# Group Find: bFindGroups: %d",param.bFindGroups);
     fprintf(fp," dTau: %g",param.dTau);
@@ -1699,6 +1806,18 @@ void MSR::SetSoft(double dSoft) {
     }
 
 
+/*
+** The weight of a particle that has no measured work yet. This is the mean
+** measured work over all particles, computed once per decomposition so that
+** every domain and every step of the root finder agree on it.
+*/
+double MSR::WorkDefault() {
+    if (!param.bDomainWork) return 1.0;
+    ServiceMeasuredWork::output out;
+    mdl->RunService(PST_MEASUREDWORK,&out);
+    return out.nMeasured ? out.fWork / out.nMeasured : 1.0;
+    }
+
 void MSR::DomainDecompOld(int iRung) {
     OldDD::ServiceDomainDecomp::input in;
     uint64_t nActive;
@@ -1911,6 +2030,7 @@ void MSR::DomainDecompOld(int iRung) {
 	iLastRungRT,nActive);
     msrprintf("Domain Decomposition... \n");
     sec = MSR::Time();
+    in.fWorkDefault = WorkDefault();
 
     mdl->RunService(PST_DOMAINDECOMP,sizeof(in),&in);
     dsec = MSR::Time() - sec;
@@ -1921,8 +2041,82 @@ void MSR::DomainDecompOld(int iRung) {
 	}
     }
 
+/*
+** Peano-Hilbert domain decomposition. All particles are balanced at once
+** (by their measured work with -ddwork), and after the first decomposition
+** the splitters only move when a domain is out of balance by more than
+** dDomainTolerance, so usually only particles near them migrate.
+*/
+void MSR::DomainDecompHilbert(int iRung) {
+    HilbertDD::ServiceHilbertDecomp::input in;
+    HilbertDD::ServiceHilbertDecomp::output bnd;
+    const uint64_t nDD = d2u64(N*param.dFracNoDomainDecomp);
+    uint64_t nActive;
+    double sec,dsec;
+    int i;
+
+    if (iRung >= 0) {
+	nActive = 0;
+	for (i=iCurrMaxRung;i>=iRung;--i) nActive += nRung[i];
+	if (iLastRungDD >= 0 && nActive <= nDD) {
+	    if (param.bVRungStat) {
+		printf("Skipping Domain Decomposition (nActive = %" PRIu64 "/%" PRIu64 ", iRung:%d)\n",
+		    nActive,N,iRung);
+		}
+	    return;  /* do absolutely nothing! */
+	    }
+	}
+    else nActive = N;
+    iLastRungRT = iLastRungDD = 0;
+
+    if (param.bPeriodic &&
+	param.dxPeriod < FLOAT_MAXVAL &&
+	param.dyPeriod < FLOAT_MAXVAL &&
+	param.dzPeriod < FLOAT_MAXVAL) {
+	Bound::coord offset(0.5*param.dxPeriod,0.5*param.dyPeriod,0.5*param.dzPeriod);
+	in.bnd = Bound(fCenter-offset,fCenter+offset);
+	mdl->RunService(PST_ENFORCEPERIODIC,sizeof(in.bnd),&in.bnd);
+	in.bNewKeys = 0;
+	}
+    else {
+	/*
+	** The keys, and so the old splitters, are only meaningful in the same
+	** box. Keep it while the particles stay inside; otherwise take a new
+	** one with some room to grow and find the splitters from scratch.
+	*/
+	Bound bnd;
+	mdl->RunService(PST_COMBINEBOUND,&bnd);
+	bool bInside = bKeysValid;
+	for (auto d=0; d<3 && bInside; ++d)
+	    bInside = bnd.lower(d) >= bndKeys.lower(d) && bnd.upper(d) <= bndKeys.upper(d);
+	if (!bInside) {
+	    Bound::coord margin = 0.05 * bnd.width();
+	    bndKeys = Bound(bnd.lower()-margin,bnd.upper()+margin);
+	    bKeysValid = true;
+	    }
+	in.bnd = bndKeys;
+	in.bNewKeys = !bInside;
+	}
+    in.iMinKey = 0;
+    in.iMaxKey = PEANO_HILBERT_KEY_MAX;
+    in.dTolerance = param.dDomainTolerance;
+    in.fWorkDefault = WorkDefault();
+#ifdef FAST_GAS
+    if (param.bDoGas) {
+	pstFastGasCleanup(pst,NULL,0,NULL,0);
+	}
+#endif
+    msrprintf("Peano-Hilbert Domain Decomposition: nActive (Rung %d) %" PRIu64 "\n",
+	iRung,nActive);
+    sec = MSR::Time();
+    mdl->RunService(PST_HILBERTDECOMP,sizeof(in),&in,&bnd);
+    dsec = MSR::Time() - sec;
+    printf("Domain Decomposition complete, Wallclock: %f secs\n\n",dsec);
+    }
+
 void MSR::DomainDecomp(int iRung) {
-    DomainDecompOld(iRung);
+    if (param.bDomainHilbert) DomainDecompHilbert(iRung);
+    else DomainDecompOld(iRung);
     }
 
 /*
@@ -2298,6 +2492,7 @@ void MSR::Smooth(double dTime,double dDelta,int iSmoothType,int bSymmetric,int n
     in.bPeriodic = param.bPeriodic;
     in.bSymmetric = bSymmetric;
     in.iSmoothType = iSmoothType;
+    in.bNeighborCache = param.bSmoothCache;
     SmoothSetSMF(&(in.smf), dTime, dDelta);
     if (param.bVStep) {
 	double sec,dsec;
@@ -2321,6 +2516,7 @@ void MSR::FastGasPhase1(double dTime,double dDelta,int iSmoothType) {
     in.bPeriodic = param.bPeriodic;
     in.bSymmetric = 0;
     in.iSmoothType = iSmoothType;
+    in.bNeighborCache = 0;
     SmoothSetSMF(&(in.smf), dTime, dDelta);
     if (param.bVStep) {
 	double sec,dsec;
@@ -2343,6 +2539,7 @@ void MSR::FastGasPhase2(double dTime,double dDelta,int iSmoothType) {
     in.bPeriodic = param.bPeriodic;
     in.bSymmetric = 0;
     in.iSmoothType = iSmoothType;
+    in.bNeighborCache = 0;
     SmoothSetSMF(&(in.smf), dTime, dDelta);
     if (param.bVStep) {
 	double sec,dsec;
@@ -2365,6 +2562,7 @@ void MSR::ReSmooth(double dTime,double dDelta,int iSmoothType,int bSymmetric) {
     in.bPeriodic = param.bPeriodic;
     in.bSymmetric = bSymmetric;
     in.iSmoothType = iSmoothType;
+    in.bNeighborCache = 0;
     SmoothSetSMF(&(in.smf), dTime, dDelta);
     if (param.bVStep) {
 	double sec,dsec;
@@ -2461,6 +2659,103 @@ void MSR::MemStatus() {
 	}
     }
 
+/*
+** Timeline trace. With a negative step this just starts tracing. Otherwise
+** the events since the last call are written as a Chrome trace (viewable
+** with Perfetto or chrome://tracing) and the phase times are summarized.
+*/
+void MSR::Trace(int iStep) {
+    ServiceTrace::input in;
+    ServiceTrace::output out;
+    std::string filename;
+
+    if (param.nTraceEvents <= 0) return;
+    in.nEvents = param.nTraceEvents;
+    in.achFile[0] = 0;
+    if (iStep >= 0) {
+	filename = BuildName(iStep,".trace.json");
+	strncpy(in.achFile,filename.c_str(),sizeof(in.achFile));
+	in.achFile[sizeof(in.achFile)-1] = 0;
+	}
+    mdl->RunService(PST_TRACE,sizeof(in),&in,&out);
+    if (iStep < 0) return;
+
+    /* Stitch the per-thread fragments together */
+    FILE *fp = fopen(filename.c_str(),"w");
+    if (fp==NULL) {
+	perror(filename.c_str());
+	return;
+	}
+    fprintf(fp,"{\"traceEvents\":[\n");
+    std::vector<char> buffer(1024*1024);
+    for(auto i=0; i<nThreads; ++i) {
+	auto fragment = filename + "." + std::to_string(i);
+	FILE *fpIn = fopen(fragment.c_str(),"r");
+	if (fpIn==NULL) continue;
+	size_t n;
+	while((n=fread(buffer.data(),1,buffer.size(),fpIn)) > 0) fwrite(buffer.data(),1,n,fp);
+	fclose(fpIn);
+	unlink(fragment.c_str());
+	}
+    fprintf(fp,"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"step %d\"}}\n]}\n",iStep);
+    fclose(fp);
+
+    printf("Phase self time per thread (s) for step %d:\n",iStep);
+    printf("%12s %10s %10s %10s %12s\n","phase","avg","min","max","calls");
+    for(auto i=0; i<MDL_PHASE_COUNT; ++i) {
+	if (out.nCalls[i] == 0) continue;
+	printf("%12s %10.4f %10.4f %10.4f %12" PRIu64 "\n",mdlPhaseName(i),
+	    out.dSum[i]/out.nThreads,out.dMin[i],out.dMax[i],out.nCalls[i]);
+	}
+    }
+
+/*
+** Cache statistics for each cache ID (CID_COUNT entries) summed over all
+** threads since the last reset. Returns the number of threads.
+*/
+int MSR::CacheStats(mdlCacheStats *stats,int bReset,uint64_t *pnRequestLines,uint64_t *pnRequestMessages) {
+    ServiceCacheStats::input in;
+    ServiceCacheStats::output out;
+    in.bReset = bReset;
+    mdl->RunService(PST_CACHESTATS,sizeof(in),&in,&out);
+    std::copy(out.stats,out.stats+CID_COUNT,stats);
+    if (pnRequestLines) *pnRequestLines = out.nRequestLines;
+    if (pnRequestMessages) *pnRequestMessages = out.nRequestMessages;
+    return out.nThreads;
+    }
+
+// Latency (microseconds) below which the given fraction of remote requests completed
+static double cacheLatency(const mdlCacheStats &s,double dFrac) {
+    uint64_t nSum = 0;
+    for(auto i=0; i<MDL_CACHE_LATENCY_BINS; ++i) {
+	nSum += s.nLatency[i];
+	if (nSum >= dFrac*s.nRemote) return 2 << i;
+	}
+    return 2 << (MDL_CACHE_LATENCY_BINS-1);
+    }
+
+void MSR::PrintCacheStats(int iStep) {
+    mdlCacheStats stats[CID_COUNT];
+    if (!bVDetails) return;
+    uint64_t nRequestLines, nRequestMessages;
+    int nThreads = CacheStats(stats,1,&nRequestLines,&nRequestMessages);
+    printf("Cache statistics for step %d (ARC list sizes per thread):\n",iStep);
+    printf("%10s %12s %7s %12s %7s %10s %12s %8s %8s %8s %8s %8s %8s\n","cache","accesses","miss %",
+	"remote","pf %","MB","evicted","T1","T2","B1","B2","p50 us","p90 us");
+    for(auto cid=0; cid<CID_COUNT; ++cid) {
+	const auto &s = stats[cid];
+	if (s.nAccess == 0) continue;
+	printf("%10s %12" PRIu64 " %7.3f %12" PRIu64 " %7.2f %10.1f %12" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64,
+	    ServiceCacheStats::name(cid),s.nAccess,100.0*s.nMiss/s.nAccess,s.nRemote,
+	    s.nRemote ? 100.0*s.nPrefetchHit/s.nRemote : 0.0,s.nBytesFetched/1048576.0,s.nEvict,
+	    s.nT1/nThreads,s.nT2/nThreads,s.nB1/nThreads,s.nB2/nThreads);
+	if (s.nRemote) printf(" %8.0f %8.0f\n",cacheLatency(s,0.5),cacheLatency(s,0.9));
+	else printf(" %8s %8s\n","-","-");
+	}
+    if (nRequestMessages) printf("Remote cache requests: %" PRIu64 " lines in %" PRIu64 " messages (%.2f lines per message)\n",
+	nRequestLines,nRequestMessages,1.0*nRequestLines/nRequestMessages);
+    }
+
 void msrPrintStat(STAT *ps,char const *pszPrefix,int p) {
     double dSum = ps->dSum;
     double dMax = ps->dMax;
@@ -2508,6 +2803,13 @@ uint8_t MSR::Gravity(uint8_t uRungLo, uint8_t uRungHi,int iRoot1,int iRoot2,
     in.bEwald = bEwald;
     in.dEwCut = param.dEwCut;
     in.dEwhCut = param.dEwhCut;
+    in.nEwaldGrid = param.nEwaldGrid;
+    in.dEwaldGridTol = param.dEwaldGridTol;
+    if (param.nGridPM > 0) {
+	in.dPMSplit = param.dPMSmooth * param.dxPeriod / param.nGridPM;
+	in.dPMCut = param.dPMCut * in.dPMSplit;
+	}
+    else in.dPMSplit = in.dPMCut = 0.0;
 
     // Parameters related to timestepping
     in.ts.iTimeStepCrit = iTimeStepCrit;
@@ -2523,6 +2825,7 @@ uint8_t MSR::Gravity(uint8_t uRungLo, uint8_t uRungHi,int iRoot1,int iRoot2,
     in.ts.dEta = param.dEta;
     in.ts.dPreFacRhoLoc = param.dPreFacRhoLoc;
     in.ts.bGravStep = bGravStep;
+    in.ts.bPotential = LogInterval() > 0;
     in.ts.uRungLo = uRungLo;
     in.ts.uRungHi = uRungHi;
     in.ts.uMaxRung = param.iMaxRung;
@@ -3042,10 +3345,42 @@ void MSR::UpdateRung(uint8_t uRung) {
     }
 
 
+/*
+** Comoving distance (in box lengths) of the light cone surface at time dTime.
+*/
+double MSR::LightConeRadius(double dTime) {
+    return dLightSpeedSim(param.dBoxSize) * csmComoveKickFac(csm,dTime,(csmExp2Time(csm,1.0) - dTime));
+    }
+
+/*
+** The HEALPix map shells from achLightConeShells, "rInner rOuter nside,...",
+** numbered in the order given.
+*/
+std::vector<HEALPIXSHELLSPEC> MSR::LightConeShells() {
+    std::vector<HEALPIXSHELLSPEC> shells;
+    const char *p = param.achLightConeShells;
+    while (*p) {
+	HEALPIXSHELLSPEC s;
+	int n;
+	if (sscanf(p," %lf %lf %d %n",&s.rInner,&s.rOuter,&s.nSide,&n) != 3 || s.rOuter <= s.rInner || s.nSide <= 0) {
+	    fprintf(stderr,"ERROR: invalid light cone shell specification: %s\n",p);
+	    abort();
+	    }
+	s.iShell = shells.size();
+	shells.push_back(s);
+	p += n;
+	if (*p == ',') ++p;
+	}
+    return shells;
+    }
+
 /*
 ** Open the healpix output file, and also the particles files if requested.
+** Only the map shells that the light cone crosses during this step, dTime
+** to dTime+dDelta, need to be resident. Without shells, a single map is
+** accumulated and written every step.
 */
-void MSR::LightConeOpen(int iStep) {
+void MSR::LightConeOpen(int iStep,double dTime,double dDelta) {
     if (param.bLightCone) {
 	struct inLightConeOpen lc;
 	if (param.bLightConeParticles ) {
@@ -3053,20 +3388,45 @@ void MSR::LightConeOpen(int iStep) {
 	    strcpy(lc.achOutFile,filename.c_str());
 	    }
 	else lc.achOutFile[0] = 0;
-	lc.nSideHealpix = param.nSideHealpix;
+	lc.nHealpixShells = 0;
+	if (param.achLightConeShells[0]) {
+	    double rStart = LightConeRadius(dTime);
+	    double rEnd = LightConeRadius(dTime+dDelta);
+	    for (auto &s : LightConeShells()) {
+		if (s.rOuter <= rEnd || s.rInner > rStart) continue;
+		if (lc.nHealpixShells == MAX_HEALPIX_SHELLS) {
+		    fprintf(stderr,"ERROR: more than %d light cone shells in one step\n",MAX_HEALPIX_SHELLS);
+		    abort();
+		    }
+		lc.healpixShells[lc.nHealpixShells++] = s;
+		}
+	    }
+	else if (param.nSideHealpix) {
+	    HEALPIXSHELLSPEC &s = lc.healpixShells[lc.nHealpixShells++];
+	    s.iShell = -1;
+	    s.nSide = param.nSideHealpix;
+	    s.rInner = 0.0;
+	    s.rOuter = HUGE_VAL;
+	    }
+	lc.nSideShard = param.nSideLightConeShard;
+	lc.dShellWidth = param.dLightConeShellWidth;
+	lc.dQuantum = param.dLightConeQuantum;
 	pstLightConeOpen(pst,&lc,sizeof(lc),NULL,0);
 	}
     }
 
 
 /*
-** Close the files for this step.
+** Close the files for this step, and write the map shells that the light
+** cone has now left (all of them if this is the final step).
 */
-void MSR::LightConeClose(int iStep) {
+void MSR::LightConeClose(int iStep,double dTime,int bFinal) {
     if (param.bLightCone) {
 	struct inLightConeClose lc;
 	auto filename = BuildName(iStep);
 	strcpy(lc.achOutFile,filename.c_str());
+	strcpy(lc.achShellFile,filename.c_str());
+	lc.rComplete = bFinal ? -HUGE_VAL : LightConeRadius(dTime);
 	pstLightConeClose(pst,&lc,sizeof(lc),NULL,0);
 	}
     }
@@ -3236,8 +3596,8 @@ int MSR::NewTopStepKDK(
 	** gravity is called since it will advance the particles in the light cone as part of the
 	** opening kick! We also need to open
 	*/
-	LightConeClose(iStep);
-	if (bKickOpen) LightConeOpen(iStep+1);
+	LightConeClose(iStep,dTime,iStep>=nSteps);
+	if (bKickOpen) LightConeOpen(iStep+1,dTime,dDelta);
 
 	/* Compute the grids of linear species at main timesteps, before gravity is called */
 	if (csm->val.classData.bClass && strlen(param.achLinearSpecies) && param.nGridLin){
@@ -3248,6 +3608,7 @@ int MSR::NewTopStepKDK(
 	    LinearKick(dTime,dDelta,1,bKickOpen);
 	    GridDeleteFFT();
 	    }
+	if (param.nGridPM > 0) PMKick(dTime,dDelta,1,bKickOpen);
 
 	if (param.bFindGroups) NewFof(dTime);
 	}
@@ -3261,6 +3622,7 @@ int MSR::NewTopStepKDK(
     if (!uRung && param.bFindGroups) {
 	GroupStats();
 	HopWrite(BuildName(iStep,".fofstats").c_str());
+	if (param.bMergerTree) MergerWrite(BuildName(iStep,".mergers").c_str());
 	}
 
     if (uRung && uRung < *puRungMax) bDualTree = NewTopStepKDK(dTime,dDelta,dTheta,nSteps,bDualTree,uRung+1,pdStep,puRungMax,pbDoCheckpoint,pbDoOutput,pbNeedKickOpen);
@@ -3601,6 +3963,85 @@ void MSR::HopWrite(const char *fname) {
 
     }
 
+void MSR::SubhaloWrite(const char *fname) {
+    double sec,dsec;
+
+    if (param.bVStep)
+	printf("Writing subhalo hierarchy to %s\n", fname );
+    sec = MSR::Time();
+    struct inOutput out;
+    out.eOutputType = OUT_SUBHALO;
+    out.iPartner = -1;
+    out.nPartner = -1;
+    out.iProcessor = 0;
+    out.nProcessor = param.bParaWrite==0?1:(param.nParaWrite<=1 ? nThreads:param.nParaWrite);
+    strcpy(out.achOutFile,fname);
+    pstOutput(pst,&out,sizeof(out),NULL,0);
+    dsec = MSR::Time() - sec;
+    if (param.bVStep)
+	printf("Written subhalos, Wallclock: %f secs\n",dsec);
+    }
+
+/*
+** Merger trees: see group/mergertree.cxx.
+*/
+void MSR::MergerHarvest() {
+    uint64_t nTracers;
+    pstMergerHarvest(pst,NULL,0,&nTracers,sizeof(nTracers));
+    if (param.bVStep && nTracers)
+	printf("Collected %" PRIu64 " merger tree tracers\n",nTracers);
+    }
+
+void MSR::MergerLink() {
+    double sec,dsec;
+    uint64_t nEdges, nTotalGroups;
+    int i;
+
+    sec = MSR::Time();
+    std::unique_ptr<uint64_t[]> nLocalGroups {new uint64_t[nThreads]};
+    pstMergerCounts(pst,NULL,0,nLocalGroups.get(),nThreads*sizeof(uint64_t));
+    int nIn = sizeof(struct inMergerLink) + nThreads*sizeof(uint64_t);
+    std::unique_ptr<char[]> buffer {new char[nIn]};
+    auto in = reinterpret_cast<struct inMergerLink *>(buffer.get());
+    auto iGroupOffset = reinterpret_cast<uint64_t *>(in+1);
+    in->nTracers = param.nMergerTracers;
+    for (i=0,nTotalGroups=0;i<nThreads;++i) {
+	iGroupOffset[i] = nTotalGroups;
+	nTotalGroups += nLocalGroups[i];
+	}
+    pstMergerLink(pst,in,nIn,&nEdges,sizeof(nEdges));
+    dsec = MSR::Time() - sec;
+    if (param.bVStep)
+	printf("Merger tree: %" PRIu64 " edges to %" PRIu64 " groups, Wallclock: %f secs\n",
+	    nEdges,nTotalGroups,dsec);
+    }
+
+void MSR::MergerTag() {
+    uint64_t nTagged;
+    pstMergerTag(pst,NULL,0,&nTagged,sizeof(nTagged));
+    if (param.bVStep)
+	printf("Tagged %" PRIu64 " merger tree tracers\n",nTagged);
+    }
+
+void MSR::MergerWrite(const char *fname) {
+    double sec,dsec;
+
+    if (param.bVStep)
+	printf("Writing merger tree edges to %s\n", fname );
+    sec = MSR::Time();
+    struct inOutput out;
+    out.eOutputType = OUT_MERGER_EDGE;
+    out.iPartner = -1;
+    out.nPartner = -1;
+    out.iProcessor = 0;
+    out.nProcessor = param.bParaWrite==0?1:(param.nParaWrite<=1 ? nThreads:param.nParaWrite);
+    strcpy(out.achOutFile,fname);
+    pstOutput(pst,&out,sizeof(out),NULL,0);
+    dsec = MSR::Time() - sec;
+    if (param.bVStep)
+	printf("Written merger tree edges, Wallclock: %f secs\n",dsec);
+    }
+
 void MSR::Hop(double dTime, double dDelta) {
     struct inSmooth in;
     struct inHopLink h;
@@ -3613,9 +4054,12 @@ void MSR::Hop(double dTime, double dDelta) {
 
     ssec = MSR::Time();
 
+    if (param.bMergerTree && !param.bFindGroups) MergerHarvest();
+
     h.nSmooth    = in.nSmooth = 80;
     h.bPeriodic  = in.bPeriodic = param.bPeriodic;
     h.bSymmetric = in.bSymmetric = 0;
+    in.bNeighborCache = 0;
     h.dHopTau    = param.dHopTau<0 ? param.dHopTau : param.dHopTau;
     h.smf.a      = in.smf.a = dTime;
     h.smf.dTau2  = in.smf.dTau2 = 0.0;
@@ -3675,6 +4119,25 @@ void MSR::Hop(double dTime, double dDelta) {
     if (param.bVStep)
 	printf("Removed groups with fewer than %d particles, %" PRIu64 " remain\n",
 	    inFinish.nMinGroupSize, nGroups);
+    if (param.bHopSubhalos) {
+	struct inHopSubhalos inSub;
+	struct outHopSubhalos outSub;
+	inSub.dTime = dTime;
+	inSub.dTheta = param.dTheta;
+	inSub.bPeriodic = param.bPeriodic;
+	inSub.fPeriod[0] = param.dxPeriod;
+	inSub.fPeriod[1] = param.dyPeriod;
+	inSub.fPeriod[2] = param.dzPeriod;
+	inSub.nNeighbors = param.nHopSubNeighbors;
+	inSub.nMinMembers = param.nMinMembers;
+	sec = MSR::Time();
+	pstHopSubhalos(pst,&inSub,sizeof(inSub),&outSub,sizeof(outSub));
+	dsec = MSR::Time() - sec;
+	if (param.bVStep)
+	    printf("Subhalo hierarchy complete in %f secs, %" PRIu64 " bound subhalos\n",dsec,outSub.nSubhalos);
+	if (outSub.nSkipped && param.bVWarnings)
+	    printf("WARNING: %" PRIu64 " groups span several domains and have no subhalo hierarchy\n",outSub.nSkipped);
+	}
 #if 0
     if (param.bVStep)
 	printf("Unbinding\n");
@@ -3737,7 +4200,9 @@ void MSR::Hop(double dTime, double dDelta) {
 	inGroupStats.rEnvironment[0] /= param.dBoxSize;
 	inGroupStats.rEnvironment[1] /= param.dBoxSize;
 	}
+    if (param.bMergerTree && !param.bFindGroups) MergerLink();
     pstGroupStats(pst,&inGroupStats,sizeof(inGroupStats),NULL,0);
+    if (param.bMergerTree && !param.bFindGroups) MergerTag();
 
     dsec = MSR::Time() - ssec;
     if (param.bVStep)
@@ -3745,7 +4210,7 @@ void MSR::Hop(double dTime, double dDelta) {
     }
 
 
-void MSR::NewFof(double dTime) {
+uint64_t MSR::NewFof(double dTime) {
     struct inNewFof in;
     struct outFofPhases out;
     struct inFofFinishUp inFinish;
@@ -3764,6 +4229,7 @@ void MSR::NewFof(double dTime) {
     if (param.bVStep) {
 	printf("Running FoF with fixed linking length %g\n", param.dTau );
 	}
+    if (param.bMergerTree) MergerHarvest();
 
     sec = MSR::Time();
     pstNewFof(pst,&in,sizeof(in),NULL,0);
@@ -3793,6 +4259,7 @@ void MSR::NewFof(double dTime) {
     dsec = MSR::Time() - ssec;
     if (param.bVStep)
 	printf("FoF complete, Wallclock: %f secs\n",dsec);
+    return nGroups;
     }
 
 
@@ -3813,7 +4280,9 @@ void MSR::GroupStats() {
 	inGroupStats.rEnvironment[0] /= param.dBoxSize;
 	inGroupStats.rEnvironment[1] /= param.dBoxSize;
 	}
+    if (param.bMergerTree) MergerLink();
     pstGroupStats(pst,&inGroupStats,sizeof(inGroupStats),NULL,0);
+    if (param.bMergerTree) MergerTag();
     dsec = MSR::Time() - sec;
     if (param.bVStep)
 	printf("Group statistics complete, Wallclock: %f secs\n\n",dsec);
@@ -3829,6 +4298,7 @@ void MSR::Relaxation(double dTime,double deltaT,int iSmoothType,int bSymmetric)
     in.bPeriodic = param.bPeriodic;
     in.bSymmetric = bSymmetric;
     in.iSmoothType = iSmoothType;
+    in.bNeighborCache = 0;
     if (Comove()) {
 	in.smf.H = csmTime2Hub(csm,dTime);
 	in.smf.a = csmTime2Exp(csm,dTime);
@@ -4230,6 +4700,8 @@ void MSR::Output(int iStep, double dTime, double dDelta, int bCheckpoint) {
 	Reorder();
 	//OutArray(BuildName(iStep,".hopgrp").c_str(),OUT_GROUP_ARRAY);
 	HopWrite(BuildName(iStep,".hopstats").c_str());
+	if (param.bHopSubhalos) SubhaloWrite(BuildName(iStep,".subhalos").c_str());
+	if (param.bMergerTree && !param.bFindGroups) MergerWrite(BuildName(iStep,".mergers").c_str());
 	}
 
     if (param.bDoAccOutput) {
@@ -4715,6 +5187,7 @@ void MSR::LinearKick(double dTime, double dDelta, int bKickClose, int bKickOpen)
     printf("Applying Linear Kick...\n");
     sec = MSR::Time();
     in.dtOpen = in.dtClose = 0.0;
+    in.bAccel = 0;
     if (csm->val.bComove) {
 	if (bKickClose) in.dtClose = csmComoveKickFac(csm,dTime-dt,dt);
 	if (bKickOpen) in.dtOpen = csmComoveKickFac(csm,dTime,dt);
@@ -4727,6 +5200,50 @@ void MSR::LinearKick(double dTime, double dDelta, int bKickClose, int bKickOpen)
     dsec = MSR::Time() - sec;
     printf("Linear Kick Applied, Wallclock: %f secs\n\n",dsec);
     }
+
+/*
+** TreePM: put the long-range force from the particle mesh on the grid where
+** LinearKick() finds it. Gravity() supplies the complementary short-range force
+** from the tree.
+*/
+void MSR::SetPMGrid() {
+    const int iAssignment = 4; /* pkdLinearKick interpolates with this order */
+    struct inSetPMGrid in;
+
+    printf("Computing the long-range force with nGridPM = %d\n",param.nGridPM);
+    GridCreateFFT(param.nGridPM);
+    AssignMass(iAssignment,0,0.0);
+    in.dSplit = param.dPMSmooth * param.dxPeriod / param.nGridPM;
+    in.iAssignment = iAssignment;
+    pstSetPMGrid(pst, &in, sizeof(in), NULL, 0);
+    }
+
+/* TreePM: kick with the long-range force */
+void MSR::PMKick(double dTime, double dDelta, int bKickClose, int bKickOpen) {
+    double sec, dsec;
+
+    sec = MSR::Time();
+    SetPMGrid();
+    LinearKick(dTime,dDelta,bKickClose,bKickOpen);
+    GridDeleteFFT();
+    dsec = MSR::Time() - sec;
+    printf("Long-range force applied, Wallclock: %f secs\n\n",dsec);
+    }
+
+/* TreePM: add the long-range force to the accelerations (for analysis) */
+void MSR::PMAccel() {
+    struct inLinearKick in;
+    double sec, dsec;
+
+    sec = MSR::Time();
+    SetPMGrid();
+    in.dtOpen = in.dtClose = 0.0;
+    in.bAccel = 1;
+    pstLinearKick(pst, &in, sizeof(in), NULL, 0);
+    GridDeleteFFT();
+    dsec = MSR::Time() - sec;
+    printf("Long-range force added to the accelerations, Wallclock: %f secs\n\n",dsec);
+    }
 #endif
 
 int MSR::GetParticles(int nIn, uint64_t *ID, struct outGetParticles *out) {
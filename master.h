@@ -53,6 +53,9 @@ public:
     int ValidateParameters();
     void Hostname();
     void MemStatus();
+    void Trace(int iStep);
+    int CacheStats(mdlCacheStats *stats,int bReset,uint64_t *pnRequestLines=nullptr,uint64_t *pnRequestMessages=nullptr);
+    void PrintCacheStats(int iStep);
     int GetLock();
     double LoadOrGenerateIC();
     void Simulate(double dTime,double dDelta,int iStartStep,int nSteps);
@@ -95,14 +98,22 @@ public:
     uint8_t Gravity(uint8_t uRungLo, uint8_t uRungHi,int iRoot1,int iRoot2,
     	double dTime,double dDelta,double dStep,double dTheta,
     	int bKickClose,int bKickOpen,int bEwald,int bGravStep,int nPartRhoLoc,int iTimeStepCrit,int nGroup);
+#ifdef MDL_FFTW
+    void PMAccel();
+#endif
 
     // Analysis
     void Smooth(double dTime,double dDelta,int iSmoothType,int bSymmetric,int nSmooth);
     void ReSmooth(double dTime,double dDelta,int iSmoothType,int bSymmetric);
-    void NewFof(double exp);
+    uint64_t NewFof(double exp);
     void Hop(double dTime,double dDelta);
     void GroupStats();
     void HopWrite(const char *fname);
+    void SubhaloWrite(const char *fname);
+    void MergerHarvest();
+    void MergerLink();
+    void MergerTag();
+    void MergerWrite(const char *fname);
     void MeasurePk(int iAssignment,int bInterlace,int nGrid,double a,int nBins,uint64_t *nPk,float *fK,float *fPk,float *fPkAll);
     void AssignMass(int iAssignment=4,int iGrid=0,float fDelta=0.0f);
     void DensityContrast(int nGrid,bool k=true);
@@ -218,6 +229,8 @@ public:
     std::vector<uint64_t> nRung;
     int iRungDD, iRungDT;
     int iLastRungRT,iLastRungDD;
+    Bound bndKeys;	/* Box of the Peano-Hilbert keys (not periodic) */
+    bool bKeysValid;	/* bndKeys holds every particle and has splitters */
     uint64_t nActive;
     int nGroups;
     int nBins;
@@ -294,12 +307,16 @@ protected:
     int GetParticles(int nIn, uint64_t *ID, struct outGetParticles *out);
     void OutputOrbits(int iStep,double dTime);
     double TotalMass();
-    void LightConeOpen(int iStep);
-    void LightConeClose(int iStep);
+    double LightConeRadius(double dTime);
+    std::vector<HEALPIXSHELLSPEC> LightConeShells();
+    void LightConeOpen(int iStep,double dTime,double dDelta);
+    void LightConeClose(int iStep,double dTime,int bFinal);
     void LightConeVel();
 #ifdef MDL_FFTW
     void SetLinGrid(double dTime, double dDelta, int nGrid, int bKickClose, int bKickOpen);
     void LinearKick(double dTime, double dDelta, int bKickClose, int bKickOpen);
+    void SetPMGrid();
+    void PMKick(double dTime, double dDelta, int bKickClose, int bKickOpen);
 #endif
     void CalcEandL(int bFirst,double dTime,double *E,double *T,double *U,double *Eth,double *L,double *F,double *W);
     void Drift(double dTime,double dDelta,int iRoot);
@@ -327,6 +344,8 @@ protected:
     void writeParameters(const char *baseName,int iStep,int nSteps,double dTime,double dDelta);
     void OutASCII(const char *pszFile,int iType,int nDims,int iFileType);
     void DomainDecompOld(int iRung);
+    void DomainDecompHilbert(int iRung);
+    double WorkDefault();
 
     void SaveParameters();
     int CountRungs(uint64_t *nRungs);
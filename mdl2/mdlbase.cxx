@@ -37,6 +37,7 @@ using namespace mdl;
 #include <stdarg.h>
 #include <string.h>
 #include <numeric>
+#include <algorithm>
 
 /*****************************************************************************\
 * LegacyService
@@ -100,6 +101,8 @@ mdlBASE::mdlBASE(int argc,char **argv) {
     nCores = 1;
     iCore = 0;
     nTicks = 0;
+    nTraceEvents = 0;
+    TraceReset();
 
     /*
     ** Set default "maximums" for structures. These are NOT hard
@@ -361,3 +364,63 @@ double mdlBASE::TimeWaiting() const {
     }
 #endif
 
+/*
+* Timeline tracing
+*/
+const char *mdlPhaseName(int iPhase) {
+    static const char *names[MDL_PHASE_COUNT] = {
+	"walk", "P-P", "P-C", "Ewald", "cache wait", "cache flush", "domain"
+	};
+    return iPhase>=0 && iPhase<MDL_PHASE_COUNT ? names[iPhase] : "unknown";
+    }
+
+// A size of zero turns tracing off and releases the buffer
+void mdlBASE::TraceEnable(int nEvents) {
+    if (nEvents <= 0) std::vector<TraceEvent>().swap(traceRing);
+    else traceRing.resize(nEvents);
+    TraceReset();
+    }
+
+// Forget all events and totals; times are measured from here
+void mdlBASE::TraceReset() {
+    nTraceEvents = 0;
+    iTraceDepth = 0;
+    dTraceChild[0] = 0.0;
+    std::fill(dPhaseTime,dPhaseTime+MDL_PHASE_COUNT,0.0);
+    std::fill(nPhaseCount,nPhaseCount+MDL_PHASE_COUNT,0);
+    traceEpoch = std::chrono::steady_clock::now();
+    }
+
+double mdlBASE::TraceBegin() {
+    if (++iTraceDepth < MDL_TRACE_DEPTH) dTraceChild[iTraceDepth] = 0.0;
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - traceEpoch).count();
+    }
+
+// Phase totals are self time: time spent in nested phases is only counted there
+void mdlBASE::TraceEnd(int iPhase,double tBegin) {
+    double tEnd = std::chrono::duration<double>(std::chrono::steady_clock::now() - traceEpoch).count();
+    double dt = tEnd - tBegin;
+    assert(iTraceDepth>0);
+    if (iTraceDepth < MDL_TRACE_DEPTH) dPhaseTime[iPhase] += dt - dTraceChild[iTraceDepth];
+    else dPhaseTime[iPhase] += dt;
+    if (--iTraceDepth < MDL_TRACE_DEPTH) dTraceChild[iTraceDepth] += dt;
+    ++nPhaseCount[iPhase];
+    if (traceRing.empty()) return; // Turned off inside the scope
+    auto &e = traceRing[nTraceEvents++ % traceRing.size()];
+    e.tBegin = tBegin;
+    e.tEnd = tEnd;
+    e.iPhase = iPhase;
+    }
+
+// Chrome trace "complete" events (microseconds), one per line, each followed by a comma
+void mdlBASE::TraceWrite(FILE *fp) {
+    uint64_t nRing = traceRing.size();
+    uint64_t iFirst = nTraceEvents > nRing ? nTraceEvents - nRing : 0;
+    fprintf(fp,"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}},\n",
+	Proc(),Self(),Self());
+    for(auto i=iFirst; i<nTraceEvents; ++i) {
+	const auto &e = traceRing[i % nRing];
+	fprintf(fp,"{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+	    mdlPhaseName(e.iPhase),Proc(),Self(),e.tBegin*1e6,(e.tEnd-e.tBegin)*1e6);
+	}
+    }
@@ -43,11 +43,27 @@
 
 typedef int (fcnService_t)(void *p1, void *vin, int nIn, void *vout, int nOut);
 
+/*
+** Phases recorded by the timeline trace. See mdl::TraceScope.
+*/
+typedef enum {
+    MDL_PHASE_WALK,
+    MDL_PHASE_PP,
+    MDL_PHASE_PC,
+    MDL_PHASE_EWALD,
+    MDL_PHASE_CACHE_WAIT,
+    MDL_PHASE_CACHE_FLUSH,
+    MDL_PHASE_DOMAIN,
+    MDL_PHASE_COUNT
+    } MDL_PHASE;
+#define MDL_TRACE_DEPTH 16
+
 #ifdef __cplusplus
 #include "mdlbt.h"
 #include <vector>
 #include <string>
 #include <memory>
+#include <chrono>
 #include <initializer_list>
 #define MAX_NODE_NAME_LENGTH      256
 
@@ -164,6 +180,33 @@ public:
     double TimeSynchronizing() const;
     double TimeWaiting() const;
 
+    /*
+    ** Timeline tracing. Events go into a per-thread ring buffer (the oldest
+    ** are overwritten) and the self time of each phase is accumulated.
+    ** Until TraceEnable() is called the ring is empty and nothing is recorded.
+    */
+    struct TraceEvent {
+	double tBegin, tEnd;
+	int iPhase;
+	};
+protected:
+    std::vector<TraceEvent> traceRing;
+    uint64_t nTraceEvents;
+    int iTraceDepth;
+    double dTraceChild[MDL_TRACE_DEPTH];
+    double dPhaseTime[MDL_PHASE_COUNT];
+    uint64_t nPhaseCount[MDL_PHASE_COUNT];
+    std::chrono::steady_clock::time_point traceEpoch;
+public:
+    bool Tracing() const { return !traceRing.empty(); }
+    void TraceEnable(int nEvents);
+    void TraceReset();
+    double TraceBegin();
+    void TraceEnd(int iPhase,double tBegin);
+    double TracePhaseTime(int iPhase) const { return dPhaseTime[iPhase]; }
+    uint64_t TracePhaseCount(int iPhase) const { return nPhaseCount[iPhase]; }
+    void TraceWrite(FILE *fp);
+
     void mdl_vprintf(const char *format, va_list ap);
     void mdl_printf(const char *format, ...);
 
@@ -188,6 +231,21 @@ public:
     };
 int mdlBaseProcToThread(mdlBASE *base, int iProc);
 int mdlBaseThreadToProc(mdlBASE *base, int iThread);
+
+// Records the enclosing block as a phase on the timeline. When tracing is off
+// (or mdl is null) the cost is a single test.
+class TraceScope {
+    mdlBASE *mdl;
+    int iPhase;
+    double tBegin;
+public:
+    TraceScope(mdlBASE *mdl,int iPhase) : mdl(mdl && mdl->Tracing() ? mdl : nullptr), iPhase(iPhase) {
+	if (this->mdl) tBegin = this->mdl->TraceBegin();
+	}
+    ~TraceScope() { if (mdl) mdl->TraceEnd(iPhase,tBegin); }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+    };
 } // namespace mdl
 
 #endif
@@ -206,6 +264,7 @@ int mdlProcs(void *mdl);
 const char *mdlName(void *mdl);
 int mdlGetArgc(void *mdl);
 char **mdlGetArgv(void *mdl);
+const char *mdlPhaseName(int iPhase);
 
 
 void mdlDiag(void *mdl, char *psz);
@@ -55,6 +55,11 @@ public:
     virtual void release(void *vp) = 0;
     virtual void clear() = 0;
     virtual uint32_t key_size() = 0;
+    // True if the line holding this (simple key) element is cached with its data
+    virtual bool present(uint32_t uIndex, uint32_t uId) = 0;
+    // Lines evicted since the last call, and the current T1, T2, B1 and B2 sizes
+    virtual uint64_t take_evictions() = 0;
+    virtual void list_sizes(uint64_t nList[4]) const = 0;
     };
 
 namespace murmur {
@@ -274,6 +279,7 @@ private:
     uint32_t nLineMask = 0;
     uint32_t uLineSizeInWords = 0;
     uint32_t uDataSizeInBytes = 0;
+    uint64_t nEvict = 0;
 private:
     // If the entry is marked as dirty, then flush it (send it back to its owner)
     void flush(ENTRY &temp);
@@ -308,6 +314,12 @@ public:
     virtual void initialize(ARChelper *helper, uint32_t uCacheSizeInBytes,uint32_t uLineSizeInBytes,uint32_t nLineBits=0) override;
     virtual void clear() override; // Empty the cache. Evict/flush any dirty elements.
     virtual uint32_t key_size() override {return std::tuple_size<KEY>::value ? sizeof(KEY) : 0;}
+    virtual bool present(uint32_t uIndex, uint32_t uId) override;
+    virtual uint64_t take_evictions() override {auto n = nEvict; nEvict = 0; return n;}
+    virtual void list_sizes(uint64_t nList[4]) const override {
+	nList[0] = L[T1].size(); nList[1] = L[T2].size();
+	nList[2] = L[B1].size(); nList[3] = L[B2].size();
+	}
 
     // Decrements the lock count of an element. When the lock count is zero then it is eligible to be flushed.
     virtual void release(void *vp) override;
@@ -541,6 +553,7 @@ namespace hash {
 	auto data = cdb.data;
 	cdb.data = nullptr; /*GHOST*/
 	move(iTarget,item); // Target here will be B (B1 or B2)
+	++nEvict;
 	return data;
 	}
 
@@ -734,6 +747,18 @@ void *ARC<KEYS...>::inject(uint32_t uHash, uint32_t uId, const void *pKey) {
     return inject(uHash,uId,*static_cast<const KEY*>(pKey));
     }
 
+/*****************************************************************************\
+* ARC present
+\*****************************************************************************/
+
+template<typename... KEYS>
+bool ARC<KEYS...>::present(uint32_t uIndex, uint32_t uId) {
+    if (key_size()) return false;
+    uint32_t uLine = uIndex >> nLineBits;
+    auto pEntry = find_key(HashChains[hash::hash(uLine,uId)&uHashMask],uLine,uId);
+    return pEntry && get<CDB>(*pEntry).data != nullptr;
+    }
+
 /*****************************************************************************\
 * ARC fetch
 \*****************************************************************************/
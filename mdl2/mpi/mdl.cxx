@@ -128,6 +128,8 @@ public:
 // A list of cache tables is constructed when mdlClass is created. They are all set to NOCACHE.
 CACHE::CACHE(mdlClass * mdl,uint16_t iCID)
     : mdl(mdl), CacheRequest(iCID,mdl->Self()), iCID(iCID) {
+    clearStatistics();
+    total = mdlCacheStats();
     }
 
 // This opens a read-only cache. Called from a worker outside of MDL
@@ -327,8 +329,10 @@ void mpiClass::FinishCacheReceive(mdlMessageCacheReceive *message, const MPI_Sta
     assert(iCore>=0 && iCore<Cores());
 
     switch (ph->mid) {
+    case CacheMessageType::PREFETCH:
     case CacheMessageType::REQUEST: CacheReceiveRequest(count,ph); break;
     case CacheMessageType::FLUSH:   CacheReceiveFlush(count,ph);  break;
+    case CacheMessageType::PREFETCH_REPLY:
     case CacheMessageType::REPLY:   CacheReceiveReply(count,ph);  break;
     default:
 	assert(0);
@@ -371,7 +375,8 @@ void CACHE::initialize(uint32_t cacheSize,
     iLineSize = getLineElementCount()*iDataSize;
     OneLine.resize(iLineSize);
 
-    nAccess = nMiss = 0; // Clear statistics. Are these even used any more?
+    statistics(total); // Keep the totals from the last time this cache was open
+    clearStatistics();
 
     auto arc = arc_cache.get();
     if (!arc || typeid(*arc)!=typeid(ARC<>)) arc_cache.reset(new ARC<>());
@@ -388,7 +393,8 @@ void CACHE::initialize_advanced(uint32_t cacheSize,hash::GHASH *hash,int iDataSi
 
     nLineBits = 0;
     OneLine.resize(iDataSize);
-    nAccess = nMiss = 0; // Clear statistics. Are these even used any more?
+    statistics(total); // Keep the totals from the last time this cache was open
+    clearStatistics();
 
     // Clone the table if it is not the same type as what we have
     auto arc = hash_table->clone(arc_cache.get());
@@ -396,6 +402,37 @@ void CACHE::initialize_advanced(uint32_t cacheSize,hash::GHASH *hash,int iDataSi
     arc_cache->initialize(this,cacheSize,iLineSize,nLineBits);
     }
 
+void CACHE::clearStatistics() {
+    nAccess = nMiss = nRemote = nPrefetch = nPrefetchHit = nBytesFetched = nEvict = 0;
+    std::fill(nLatency,nLatency+MDL_CACHE_LATENCY_BINS,0);
+    std::fill(nList,nList+4,0);
+    }
+
+// Add the statistics of the current (or most recent) opening to "stats"
+void CACHE::statistics(mdlCacheStats &stats) {
+    if (arc_cache) nEvict += arc_cache->take_evictions();
+    stats.nAccess += nAccess;
+    stats.nMiss += nMiss;
+    stats.nRemote += nRemote;
+    stats.nPrefetch += nPrefetch;
+    stats.nPrefetchHit += nPrefetchHit;
+    stats.nBytesFetched += nBytesFetched;
+    stats.nEvict += nEvict;
+    stats.nT1 = std::max(stats.nT1,nList[0]);
+    stats.nT2 = std::max(stats.nT2,nList[1]);
+    stats.nB1 = std::max(stats.nB1,nList[2]);
+    stats.nB2 = std::max(stats.nB2,nList[3]);
+    for(auto i=0; i<MDL_CACHE_LATENCY_BINS; ++i) stats.nLatency[i] += nLatency[i];
+    }
+
+// The ARC lists are at their fullest just before we empty them
+void CACHE::clear() {
+    uint64_t n[4];
+    arc_cache->list_sizes(n);
+    for(auto i=0; i<4; ++i) nList[i] = std::max(nList[i],n[i]);
+    arc_cache->clear();
+    }
+
 // When we are finished using the cache, it is marked as complete. All elements should have been flushed by now.
 void CACHE::close() {
     // Keep the arc cache for performance reasonses: arc_cache.reset();
@@ -431,6 +468,13 @@ void *mdlFetch(MDL mdl,int cid,int iIndex,int id) {
     return static_cast<mdlClass *>(mdl)->Access(cid, iIndex, id, lock, modify, virt);
     }
 
+/* Starts fetching an element that will be needed soon; a hint only */
+extern "C"
+void mdlPrefetch(MDL cmdl,int cid,int iIndex,int id) {
+    mdlClass *mdl = static_cast<mdlClass *>(cmdl);
+    mdl->cache[cid]->prefetch(iIndex,id);
+    }
+
 extern "C"
 const void *mdlKeyFetch(MDL mdl,int cid,uint32_t uHash, void *pKey,int lock,int modify,int virt) {
     return static_cast<mdlClass *>(mdl)->Access(cid, uHash, pKey, lock, modify, virt);
@@ -527,57 +571,186 @@ void * CACHE::invokeRequest(uint32_t uLine, uint32_t uId, uint32_t key_size, con
     if (bVirtual) data = nullptr;
     else if (uCore < mdl->Cores()) data = getLocalData(uLine,uId,key_size,pKey);
     else { // Only send a request if non-Virtual and remote
-	mdl->enqueue(CacheRequest.makeCacheRequest(getLineElementCount(), uId, uLine, key_size, pKey, OneLine.data()), mdl->queueCacheReply);
+	++nRemote;
+	tRequest = std::chrono::steady_clock::now();
+	if (key_size==0 && (prefetchHit = prefetchFind(uLine,uId))) ++nPrefetchHit; // Already requested
+	else mdl->enqueue(CacheRequest.makeCacheRequest(getLineElementCount(), uId, uLine, key_size, pKey, OneLine.data()), mdl->queueCacheReply);
 	data = nullptr;
 	}
     return data; // non-null means we located it locally
     }
 
+// Request a remote line now so that a later miss on it does not wait for the full round trip.
+// Only read-only caches with simple keys take part. Lines that are local to this node, already
+// cached or already requested are ignored, as are requests when too many are outstanding.
+void CACHE::prefetch(uint32_t uIndex, uint32_t uId) {
+    if (!isActive() || modify() || key_size()) return;
+    if (uId - mdl->mpi->Self() < uint32_t(mdl->Cores())) return;
+    if (arc_cache->present(uIndex,uId)) return;
+    uint32_t uLine = uIndex >> nLineBits;
+    while (!queuePrefetchReply.empty()) prefetchReceive(queuePrefetchReply.dequeue());
+    if (prefetchLines.empty()) {
+	for(auto i=0; i<MDL_CACHE_PREFETCH; ++i) prefetchLines.emplace_back(new PrefetchLine(iCID,mdl->Self()));
+	}
+    PrefetchLine *pFree = nullptr;
+    for(auto &pf : prefetchLines) {
+	if (pf->eState == PrefetchLine::FREE) { if (!pFree) pFree = pf.get(); }
+	else if (pf->uLine == uLine && pf->uId == uId) return;
+	}
+    if (!pFree) return;
+    pFree->eState = PrefetchLine::PENDING;
+    pFree->uLine = uLine;
+    pFree->uId = uId;
+    pFree->line.resize(iLineSize);
+    ++nPrefetch;
+    mdl->enqueue(pFree->request.makeCacheRequest(getLineElementCount(),uId,uLine,0,nullptr,pFree->line.data(),
+	CacheMessageType::PREFETCH),queuePrefetchReply);
+    }
+
+CACHE::PrefetchLine *CACHE::prefetchFind(uint32_t uLine, uint32_t uId) {
+    for(auto &pf : prefetchLines) {
+	if (pf->eState != PrefetchLine::FREE && pf->uLine == uLine && pf->uId == uId) return pf.get();
+	}
+    return nullptr;
+    }
+
+// A prefetch reply has been returned by the MPI thread
+void CACHE::prefetchReceive(basicMessage &M) {
+    for(auto &pf : prefetchLines) {
+	if (&pf->request == &M) {
+	    assert(pf->eState == PrefetchLine::PENDING);
+	    pf->eState = PrefetchLine::READY;
+	    return;
+	    }
+	}
+    assert(0);
+    }
+
+void CACHE::prefetchWait(PrefetchLine *pf) {
+    while (pf->eState == PrefetchLine::PENDING) prefetchReceive(mdl->waitQueue(queuePrefetchReply));
+    }
+
+// The MPI thread must be finished with every request before the remote caches can close
+void CACHE::prefetchDrain() {
+    for(auto &pf : prefetchLines) {
+	prefetchWait(pf.get());
+	pf->eState = PrefetchLine::FREE;
+	}
+    }
+
 // The MPI thread sends this to the remote node. This will not be returned until the reply has been received.
 void mpiClass::MessageCacheRequest(mdlMessageCacheRequest *message) {
     int iCoreFrom = message->header.idFrom - Self();
-    assert(CacheRequestMessages[iCoreFrom]==nullptr);
-    CacheRequestMessages[iCoreFrom] = message;
+    if (message->header.mid == CacheMessageType::PREFETCH) CachePrefetchMessages[iCoreFrom].push_back(message);
+    else {
+	assert(CacheRequestMessages[iCoreFrom]==nullptr);
+	CacheRequestMessages[iCoreFrom] = message;
+	}
     assert(message->pLine);
-    iProc = ThreadToProc(message->header.idTo);
-    MPI_Isend(&message->header,sizeof(message->header)+message->key_size,MPI_BYTE,iProc,MDL_TAG_CACHECOM, commMDL,newRequest(message));
+    int iRankTo = ThreadToProc(message->header.idTo);
+    int nSize = sizeof(message->header) + message->key_size;
+    auto pRequests = cacheRequestsByRank[iRankTo];
+    if (pRequests && !pRequests->canBuffer(nSize)) { // Full: send what we have
+	cacheRequestsByRank[iRankTo] = nullptr;
+	pRequests->action(this);
+	pRequests = nullptr;
+	}
+    if (!pRequests) {
+	if (freeCacheRequests.empty()) pRequests = new mdlMessageCacheRequests(MDL_REQUEST_DATA_SIZE);
+	else { pRequests=freeCacheRequests.front(); freeCacheRequests.pop_front(); }
+	pRequests->emptyBuffer();
+	pRequests->setRankTo(iRankTo);
+	if (cacheRequestRanks.empty()) tCacheRequests = std::chrono::steady_clock::now();
+	cacheRequestRanks.push_back(iRankTo);
+	cacheRequestsByRank[iRankTo] = pRequests;
+	}
+    pRequests->addBuffer(message->key_size,&message->header);
+    ++nCacheLinesRequested;
+    // When every core waits for a line nothing more can join the batches, so don't wait out the window
+    if (std::all_of(CacheRequestMessages.begin(),CacheRequestMessages.end(),[](mdlMessageCacheRequest *M){return M!=nullptr;}))
+	flushCacheRequests(true);
+    }
+
+// Send all batches of cache requests if the oldest has waited at least iCacheWindow (or now with bForce)
+void mpiClass::flushCacheRequests(bool bForce) {
+    if (cacheRequestRanks.empty()) return;
+    if (!bForce && std::chrono::steady_clock::now() - tCacheRequests < std::chrono::microseconds(iCacheWindow.load()))
+	return;
+    for(auto iRank : cacheRequestRanks) {
+	auto pRequests = cacheRequestsByRank[iRank];
+	if (pRequests) { // Might have already been sent because it was full
+	    cacheRequestsByRank[iRank] = nullptr;
+	    pRequests->action(this);
+	    }
+	}
+    cacheRequestRanks.clear();
+    }
+
+void mpiClass::MessageCacheRequests(mdlMessageCacheRequests *pRequests) {
+    ++nCacheRequestsSent;
+    MPI_Isend(pRequests->getBuffer(),pRequests->getCount(),MPI_BYTE,pRequests->getRankTo(),
+	MDL_TAG_CACHECOM,commMDL,newRequest(pRequests));
+    }
+
+void mpiClass::FinishCacheRequests(mdlMessageCacheRequests *pRequests) {
+    freeCacheRequests.push_front(pRequests);
+    }
+
+void mpiClass::CacheRequestStatistics(uint64_t *nLines,uint64_t *nMessages,bool bReset) {
+    *nLines = bReset ? nCacheLinesRequested.exchange(0) : nCacheLinesRequested.load();
+    *nMessages = bReset ? nCacheRequestsSent.exchange(0) : nCacheRequestsSent.load();
     }
 
 // On the remote node, the message is received, and a response is constructed with the data
 // pulled directly from thread's cache. This is read-only, so is safe. It is forbidden in MDL
 // to remotely "read" part of an element that is also being modified. Results are "unpredictable".
 // Instead, one is expected to initialize such data via the "init" function.
+// The message can hold several requests (see MessageCacheRequest); their replies share messages too.
 void mpiClass::CacheReceiveRequest(int count, const CacheHeader *ph) {
-    assert( count >= sizeof(CacheHeader) );
-    auto key_size = count - sizeof(CacheHeader);
-    int iCore = ph->idTo - Self();
-    assert(iCore>=0 && iCore<Cores());
-    int iRankFrom = ThreadToProc(ph->idFrom); /* Can use iRankFrom */
-    mdlMessageCacheReply *reply;
-    if (freeCacheReplies.empty()) reply = new mdlMessageCacheReply(iReplyBufSize);
-    else { reply=freeCacheReplies.front(); freeCacheReplies.pop_front(); }
-    reply->emptyBuffer();
-    reply->setRankTo(iRankFrom);
-    reply->addBuffer(ph->cid,Self(),ph->idFrom,ph->iLine);
-    auto c = pmdl[iCore]->cache[ph->cid].get();
-    auto pack_size = c->cache_helper->pack_size();
-    assert(pack_size <= MDL_CACHE_DATA_SIZE);
-    if (key_size) { // ADVANCED KEY
-	assert(c->hash_table);
-	const void *data = c->hash_table->lookup(ph->iLine,ph+1);
-	if (data) c->cache_helper->pack(reply->getBuffer(pack_size),data);
-	}
-    else { // SIMPLE KEY
-	int s = ph->iLine << c->nLineBits;
-	int n = s + c->getLineElementCount();
-	for(auto i=s; i<n; i++ ) {
-	    auto p = c->ReadLock(i);
-	    char *t = (i<c->nData) ? static_cast<char *>(p) : NULL;
-	    c->cache_helper->pack(reply->getBuffer(pack_size),t);
-	    c->ReadUnlock(p);
+    mdlMessageCacheReply *reply = nullptr;
+    while(count>0) {
+	assert( count >= sizeof(CacheHeader) );
+	int iCore = ph->idTo - Self();
+	assert(iCore>=0 && iCore<Cores());
+	auto c = pmdl[iCore]->cache[ph->cid].get();
+	auto key_size = c->key_size();
+	auto pack_size = c->cache_helper->pack_size();
+	assert(pack_size <= MDL_CACHE_DATA_SIZE);
+	uint32_t iLineSize = c->getLineElementCount() * pack_size;
+	if (reply && !reply->canBuffer(sizeof(CacheHeader) + iLineSize)) {
+	    reply->action(this); // MessageCacheReply()
+	    reply = nullptr;
+	    }
+	if (!reply) {
+	    if (freeCacheReplies.empty()) reply = new mdlMessageCacheReply(iReplyBufSize);
+	    else { reply=freeCacheReplies.front(); freeCacheReplies.pop_front(); }
+	    reply->emptyBuffer();
+	    reply->setRankTo(ThreadToProc(ph->idFrom));
+	    }
+	// A prefetch reply is matched to its request by the owning thread and line
+	reply->setMessageType(ph->mid==CacheMessageType::PREFETCH ? CacheMessageType::PREFETCH_REPLY : CacheMessageType::REPLY);
+	if (key_size) { // ADVANCED KEY
+	    assert(c->hash_table);
+	    const void *data = c->hash_table->lookup(ph->iLine,ph+1);
+	    reply->addBuffer(ph->cid,ph->idTo,ph->idFrom,ph->iLine,data ? 1 : 0);
+	    if (data) c->cache_helper->pack(reply->getBuffer(pack_size),data);
+	    }
+	else { // SIMPLE KEY
+	    reply->addBuffer(ph->cid,ph->idTo,ph->idFrom,ph->iLine);
+	    int s = ph->iLine << c->nLineBits;
+	    int n = s + c->getLineElementCount();
+	    for(auto i=s; i<n; i++ ) {
+		auto p = c->ReadLock(i);
+		char *t = (i<c->nData) ? static_cast<char *>(p) : NULL;
+		c->cache_helper->pack(reply->getBuffer(pack_size),t);
+		c->ReadUnlock(p);
+		}
 	    }
+	count -= sizeof(CacheHeader) + key_size;
+	ph = reinterpret_cast<const CacheHeader *>(reinterpret_cast<const char *>(ph+1) + key_size);
 	}
-    reply->action(this); // MessageCacheReply()
+    assert(count==0);
+    if (reply) reply->action(this); // MessageCacheReply()
     }
 
 // The reply message is sent back to the origin node, and added to the MPI request tracker.
@@ -594,31 +767,55 @@ void mpiClass::FinishCacheReply(mdlMessageCacheReply *pFlush) {
 
 // On the requesting node, the data is copied back to the request, and the message
 // is queued back to the requesting thread. It will continue with the result.
+// Each reply has a line of data unless nItems is zero (an advanced key that was not found).
 void mpiClass::CacheReceiveReply(int count, const CacheHeader *ph) {
-    int iCore = ph->idTo - Self();
-    assert(iCore>=0 && iCore<Cores());
-    auto c = pmdl[iCore]->cache[ph->cid].get();
-    auto pack_size = c->cache_helper->pack_size();
-    assert(pack_size <= MDL_CACHE_DATA_SIZE);
-    int iLineSize = c->getLineElementCount() * pack_size;
-    assert( count == sizeof(CacheHeader) + iLineSize || count == sizeof(CacheHeader));
-    if (CacheRequestMessages[iCore]) { // This better be true (unless we implement prefetch)
-	mdlMessageCacheRequest *pRequest = CacheRequestMessages[iCore];
-	CacheRequestMessages[iCore] = NULL;
-	assert(pRequest->pLine);
-	if (count == sizeof(CacheHeader) + iLineSize) {
+    while(count>0) {
+	assert( count >= sizeof(CacheHeader) );
+	int iCore = ph->idTo - Self();
+	assert(iCore>=0 && iCore<Cores());
+	auto c = pmdl[iCore]->cache[ph->cid].get();
+	auto pack_size = c->cache_helper->pack_size();
+	assert(pack_size <= MDL_CACHE_DATA_SIZE);
+	int iLineSize = ph->nItems ? c->getLineElementCount() * pack_size : 0;
+	assert( count >= sizeof(CacheHeader) + iLineSize );
+	mdlMessageCacheRequest *pRequest = nullptr;
+	if (ph->mid == CacheMessageType::PREFETCH_REPLY) { // Prefetches can complete in any order
+	    auto &pending = CachePrefetchMessages[iCore];
+	    auto i = std::find_if(pending.begin(),pending.end(),[ph](mdlMessageCacheRequest *M)
+		{return M->header.cid==ph->cid && M->header.idTo==ph->idFrom && M->header.iLine==ph->iLine;});
+	    assert(i!=pending.end());
+	    if (i!=pending.end()) { pRequest = *i; *i = pending.back(); pending.pop_back(); }
+	    }
+	else {
+	    pRequest = CacheRequestMessages[iCore]; // This better be set
+	    CacheRequestMessages[iCore] = NULL;
+	    }
+	if (pRequest) {
+	    assert(pRequest->pLine);
 	    pRequest->header.nItems = ph->nItems;
-	    memcpy(pRequest->pLine,ph+1,iLineSize);
+	    if (iLineSize) memcpy(pRequest->pLine,ph+1,iLineSize);
+	    pRequest->sendBack();
 	    }
-	else pRequest->header.nItems = 0;
-	pRequest->sendBack();
+	count -= sizeof(CacheHeader) + iLineSize;
+	ph = reinterpret_cast<const CacheHeader *>(reinterpret_cast<const char *>(ph+1) + iLineSize);
 	}
+    assert(count==0);
     }
 
 // Later when we have found an empty cache element, this is called to wait for the result
 // and to copy it into the buffer area.
 void * CACHE::finishRequest(uint32_t uLine, uint32_t uId, uint32_t size, const void *pKey, bool bVirtual, void *dst, const void *src) {
+    // Only remote requests are traced; local misses are far too frequent and short
+    bool bRemote = !bVirtual && uId - mdl->mpi->Self() >= uint32_t(mdl->Cores());
+    TraceScope trace(bRemote ? mdl : nullptr,MDL_PHASE_CACHE_WAIT);
     auto success = mdl->finishCacheRequest(iCID,uLine,uId,size,pKey,bVirtual,dst,src);
+    if (bRemote) {
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tRequest).count();
+	int iBin = 0;
+	while (us > 1 && iBin < MDL_CACHE_LATENCY_BINS-1) { us >>= 1; ++iBin; }
+	++nLatency[iBin];
+	if (success) nBytesFetched += getLineElementCount() * cache_helper->pack_size();
+	}
     mdl->TimeAddWaiting();
     return success;
     }
@@ -659,15 +856,29 @@ void *mdlClass::finishCacheRequest(int cid,uint32_t uLine, uint32_t uId, uint32_
 		}
 	    }
 	}
-    // Here we wait for the reply, and copy the data into the ARC cache
+    // Here we wait for the reply (or the prefetch), and copy the data into the ARC cache
     else {
 	assert(!src);
-	mdlMessageCacheRequest &M = dynamic_cast<mdlMessageCacheRequest&>(waitQueue(queueCacheReply));
-	if (M.header.nItems==0) return nullptr;
+	const char *pLine;
+	int nItems;
+	auto pf = c->prefetchHit;
+	if (pf) {
+	    c->prefetchHit = nullptr;
+	    c->prefetchWait(pf);
+	    pf->eState = CACHE::PrefetchLine::FREE; // Unpacked below before anyone can reuse it
+	    nItems = pf->request.header.nItems;
+	    pLine = pf->line.data();
+	    }
+	else {
+	    mdlMessageCacheRequest &M = dynamic_cast<mdlMessageCacheRequest&>(waitQueue(queueCacheReply));
+	    nItems = M.header.nItems;
+	    pLine = c->OneLine.data();
+	    }
+	if (nItems==0) return nullptr;
 	auto nLine = c->getLineElementCount();
 	auto pData = static_cast<char *>(data);
 	for(auto i=0; i<nLine; ++i) {
-	    c->cache_helper->unpack(&pData[i*c->iDataSize],&c->OneLine[i*pack_size],pKey);
+	    c->cache_helper->unpack(&pData[i*c->iDataSize],&pLine[i*pack_size],pKey);
 	    }
 	}
 
@@ -895,9 +1106,11 @@ void mdlClass::CacheBarrier(int cid) {
 extern "C" void mdlFlushCache(MDL mdl,int cid) { static_cast<mdlClass *>(mdl)->FlushCache(cid); }
 void mdlClass::FlushCache(int cid) {
     auto c = cache[cid].get();
+    TraceScope trace(this,MDL_PHASE_CACHE_FLUSH);
 
     TimeAddComputing();
     wqAccepting = 1;
+    c->prefetchDrain();
     c->clear();
     flush_core_buffer();
     ThreadBarrier();
@@ -972,7 +1185,8 @@ void mpiClass::MessageCacheClose(mdlMessageCacheClose *message) {
 \*****************************************************************************/
 
 mpiClass::mpiClass(int (*fcnMaster)(MDL,void *),void * (*fcnWorkerInit)(MDL),void (*fcnWorkerDone)(MDL,void *),int argc, char **argv)
-    : mdlClass(this,fcnMaster,fcnWorkerInit,fcnWorkerDone,argc,argv) {
+    : mdlClass(this,fcnMaster,fcnWorkerInit,fcnWorkerDone,argc,argv),
+      iCacheWindow(0), nCacheLinesRequested(0), nCacheRequestsSent(0) {
     }
 
 mpiClass::~mpiClass() {
@@ -1109,25 +1323,234 @@ void mpiClass::MessageGridShare(mdlMessageGridShare *share) {
     MPI_Allgather(&share->grid->nSlab,sizeof(*share->grid->rn),MPI_BYTE,
 	share->grid->rn,sizeof(*share->grid->rn),MPI_BYTE,
 	commMDL);
+    MPI_Allgather(&share->grid->sPencil,sizeof(*share->grid->ps),MPI_BYTE,
+	share->grid->ps,sizeof(*share->grid->ps),MPI_BYTE,
+	commMDL);
+    MPI_Allgather(&share->grid->nPencil,sizeof(*share->grid->pn),MPI_BYTE,
+	share->grid->pn,sizeof(*share->grid->pn),MPI_BYTE,
+	commMDL);
     share->sendBack();
     }
 
+/*
+** Pencil decomposition of a real to complex transform. The processors form a
+** grid of nCol rows, each with nRow processors sharing the same z slabs.
+**   r-space: x complete (a1), y split over the row, z split over the column.
+**   k-space: kx split over the row, ky split over the column, kz complete,
+**            stored transposed (x,z,y) just like the FFTW slab transform.
+** A forward transform is an r2c along x, a transpose within the row and an
+** FFT along y, then a transpose within the column and an FFT along z.
+** All transposes are done with MPI_Alltoallv on the row/column communicators.
+*/
+struct mdlPencilFFT {
+    int n1, n2, n3, n1k;
+    int nRow, nCol;   // Processors in a row (same z slabs) and in a column
+    int iRow, iCol;   // Our position in the row and in the column
+    std::vector<ptrdiff_t> sy, ny, skx, nkx; // Split over the row
+    std::vector<ptrdiff_t> sz, nz, sky, nky; // Split over the column
+    ptrdiff_t nLocal; // Complex elements needed by any stage
+    MPI_Comm commRow, commCol;
+    MPI_Datatype mpiComplex;
+    std::vector<int> cntRowK, dspRowK, cntRowY, dspRowY; // Row transpose
+    std::vector<int> cntColY, dspColY, cntColZ, dspColZ; // Column transpose
+    FFTW3(complex) *scratch;
+    FFTW3(plan) r2c, c2r, fy, by, fz, bz;
+    };
+
+static void pencilSplit(int n,int p,std::vector<ptrdiff_t> &s,std::vector<ptrdiff_t> &c) {
+    s.resize(p);
+    c.resize(p);
+    for(auto i=0; i<p; ++i) {
+	s[i] = 1l * n * i / p;
+	c[i] = 1l * n * (i+1) / p - s[i];
+	}
+    }
+
+// Calculate the geometry of the pencils on processor "iProc"
+static void pencilLayout(mdlPencilFFT *pencil,int n1,int n2,int n3,int nRow,int nProcs,int iProc) {
+    pencil->n1 = n1;
+    pencil->n2 = n2;
+    pencil->n3 = n3;
+    pencil->n1k = n1/2 + 1;
+    pencil->nRow = nRow;
+    pencil->nCol = nProcs / nRow;
+    pencil->iRow = iProc % nRow;
+    pencil->iCol = iProc / nRow;
+    assert(pencil->nRow * pencil->nCol == nProcs);
+    assert(pencil->nRow <= n2 && pencil->nRow <= pencil->n1k);
+    assert(pencil->nCol <= n2 && pencil->nCol <= n3);
+    pencilSplit(n2,pencil->nRow,pencil->sy,pencil->ny);
+    pencilSplit(pencil->n1k,pencil->nRow,pencil->skx,pencil->nkx);
+    pencilSplit(n3,pencil->nCol,pencil->sz,pencil->nz);
+    pencilSplit(n2,pencil->nCol,pencil->sky,pencil->nky);
+    auto ny = pencil->ny[pencil->iRow], nkx = pencil->nkx[pencil->iRow];
+    auto nz = pencil->nz[pencil->iCol], nky = pencil->nky[pencil->iCol];
+    pencil->nLocal = std::max(std::max(pencil->n1k*ny*nz,nkx*n2*nz),nkx*n3*nky);
+    }
+
+static mdlPencilFFT *pencilCreate(MPI_Comm comm,int n1,int n2,int n3,int nRow,int bMeasure) {
+    int nProcs, iProc;
+    MPI_Comm_size(comm,&nProcs);
+    MPI_Comm_rank(comm,&iProc);
+    auto pencil = new mdlPencilFFT;
+    pencilLayout(pencil,n1,n2,n3,nRow,nProcs,iProc);
+    MPI_Comm_split(comm,pencil->iCol,pencil->iRow,&pencil->commRow);
+    MPI_Comm_split(comm,pencil->iRow,pencil->iCol,&pencil->commCol);
+    MPI_Type_contiguous(sizeof(FFTW3(complex)),MPI_BYTE,&pencil->mpiComplex);
+    MPI_Type_commit(&pencil->mpiComplex);
+
+    auto n1k = pencil->n1k;
+    auto ny = pencil->ny[pencil->iRow], nkx = pencil->nkx[pencil->iRow];
+    auto nz = pencil->nz[pencil->iCol], nky = pencil->nky[pencil->iCol];
+    pencil->cntRowK.resize(pencil->nRow); pencil->dspRowK.resize(pencil->nRow);
+    pencil->cntRowY.resize(pencil->nRow); pencil->dspRowY.resize(pencil->nRow);
+    for(auto q=0; q<pencil->nRow; ++q) {
+	pencil->cntRowK[q] = ny * nz * pencil->nkx[q]; // Our y, their kx
+	pencil->dspRowK[q] = ny * nz * pencil->skx[q];
+	pencil->cntRowY[q] = pencil->ny[q] * nz * nkx; // Their y, our kx
+	pencil->dspRowY[q] = pencil->sy[q] * nz * nkx;
+	}
+    pencil->cntColY.resize(pencil->nCol); pencil->dspColY.resize(pencil->nCol);
+    pencil->cntColZ.resize(pencil->nCol); pencil->dspColZ.resize(pencil->nCol);
+    for(auto p=0; p<pencil->nCol; ++p) {
+	pencil->cntColY[p] = pencil->nky[p] * nz * nkx; // Their ky, our z
+	pencil->dspColY[p] = pencil->sky[p] * nz * nkx;
+	pencil->cntColZ[p] = nky * pencil->nz[p] * nkx; // Our ky, their z
+	pencil->dspColZ[p] = nky * pencil->sz[p] * nkx;
+	}
+
+    // The plans are in-place on the scratch buffer and executed on the grid.
+    // Grids are often at an offset from an allocation so we cannot assume SIMD alignment.
+    auto s = pencil->scratch = FFTW3(alloc_complex)(std::max(pencil->nLocal,ptrdiff_t(1)));
+    auto r = reinterpret_cast<FFTW3(real) *>(s);
+    unsigned flags = FFTW_UNALIGNED | (bMeasure ? FFTW_MEASURE : FFTW_ESTIMATE);
+    pencil->r2c = pencil->c2r = pencil->fy = pencil->by = pencil->fz = pencil->bz = NULL;
+    if (ny && nz) {
+	pencil->r2c = FFTW3(plan_many_dft_r2c)(1,&n1,ny*nz,r,NULL,1,2*n1k,s,NULL,1,n1k,flags);
+	pencil->c2r = FFTW3(plan_many_dft_c2r)(1,&n1,ny*nz,s,NULL,1,n1k,r,NULL,1,2*n1k,flags);
+	}
+    if (nkx && nz) {
+	pencil->fy = FFTW3(plan_many_dft)(1,&n2,nz*nkx,s,NULL,nz*nkx,1,s,NULL,nz*nkx,1,FFTW_FORWARD,flags);
+	pencil->by = FFTW3(plan_many_dft)(1,&n2,nz*nkx,s,NULL,nz*nkx,1,s,NULL,nz*nkx,1,FFTW_BACKWARD,flags);
+	}
+    if (nkx && nky) {
+	FFTW3(iodim) dim = {n3,int(nkx),int(nkx)};
+	FFTW3(iodim) howmany[2] = {{int(nkx),1,1},{int(nky),int(n3*nkx),int(n3*nkx)}};
+	pencil->fz = FFTW3(plan_guru_dft)(1,&dim,2,howmany,s,s,FFTW_FORWARD,flags);
+	pencil->bz = FFTW3(plan_guru_dft)(1,&dim,2,howmany,s,s,FFTW_BACKWARD,flags);
+	}
+    return pencil;
+    }
+
+static void pencilDestroy(mdlPencilFFT *pencil) {
+    for(auto plan : {pencil->r2c,pencil->c2r,pencil->fy,pencil->by,pencil->fz,pencil->bz})
+	if (plan) FFTW3(destroy_plan)(plan);
+    FFTW3(free)(pencil->scratch);
+    MPI_Type_free(&pencil->mpiComplex);
+    MPI_Comm_free(&pencil->commRow);
+    MPI_Comm_free(&pencil->commCol);
+    delete pencil;
+    }
+
+static void pencilR2C(mdlPencilFFT *pencil,FFTW3(real) *data) {
+    auto c = reinterpret_cast<FFTW3(complex) *>(data);
+    auto s = pencil->scratch;
+    auto n1k = pencil->n1k, n3 = pencil->n3;
+    auto ny = pencil->ny[pencil->iRow], nkx = pencil->nkx[pencil->iRow];
+    auto nz = pencil->nz[pencil->iCol], nky = pencil->nky[pencil->iCol];
+
+    if (pencil->r2c) FFTW3(execute_dft_r2c)(pencil->r2c,data,c);
+    // [z][y][kx] -> [y][z][kx] with kx sent to its pencil in the row
+    for(auto q=0; q<pencil->nRow; ++q) {
+	auto skx = pencil->skx[q], nq = pencil->nkx[q];
+	auto out = s + pencil->dspRowK[q];
+	for(auto y=0; y<ny; ++y)
+	    for(auto z=0; z<nz; ++z)
+		memcpy(out + (y*nz+z)*nq, c + (z*ny+y)*n1k + skx, nq*sizeof(*s));
+	}
+    MPI_Alltoallv(s,pencil->cntRowK.data(),pencil->dspRowK.data(),pencil->mpiComplex,
+	c,pencil->cntRowY.data(),pencil->dspRowY.data(),pencil->mpiComplex,pencil->commRow);
+    if (pencil->fy) FFTW3(execute_dft)(pencil->fy,c,c);
+    // [ky][z][kx] -> [ky][z][kx] with ky sent to its slab in the column, then z made contiguous
+    MPI_Alltoallv(c,pencil->cntColY.data(),pencil->dspColY.data(),pencil->mpiComplex,
+	s,pencil->cntColZ.data(),pencil->dspColZ.data(),pencil->mpiComplex,pencil->commCol);
+    for(auto p=0; p<pencil->nCol; ++p) {
+	auto sz = pencil->sz[p], np = pencil->nz[p];
+	auto in = s + pencil->dspColZ[p];
+	for(auto ky=0; ky<nky; ++ky)
+	    memcpy(c + (ky*n3+sz)*nkx, in + ky*np*nkx, np*nkx*sizeof(*s));
+	}
+    if (pencil->fz) FFTW3(execute_dft)(pencil->fz,c,c);
+    }
+
+static void pencilC2R(mdlPencilFFT *pencil,FFTW3(complex) *kdata) {
+    auto c = kdata;
+    auto s = pencil->scratch;
+    auto n1k = pencil->n1k, n3 = pencil->n3;
+    auto ny = pencil->ny[pencil->iRow], nkx = pencil->nkx[pencil->iRow];
+    auto nz = pencil->nz[pencil->iCol], nky = pencil->nky[pencil->iCol];
+
+    if (pencil->bz) FFTW3(execute_dft)(pencil->bz,c,c);
+    for(auto p=0; p<pencil->nCol; ++p) {
+	auto sz = pencil->sz[p], np = pencil->nz[p];
+	auto out = s + pencil->dspColZ[p];
+	for(auto ky=0; ky<nky; ++ky)
+	    memcpy(out + ky*np*nkx, c + (ky*n3+sz)*nkx, np*nkx*sizeof(*s));
+	}
+    MPI_Alltoallv(s,pencil->cntColZ.data(),pencil->dspColZ.data(),pencil->mpiComplex,
+	c,pencil->cntColY.data(),pencil->dspColY.data(),pencil->mpiComplex,pencil->commCol);
+    if (pencil->by) FFTW3(execute_dft)(pencil->by,c,c);
+    MPI_Alltoallv(c,pencil->cntRowY.data(),pencil->dspRowY.data(),pencil->mpiComplex,
+	s,pencil->cntRowK.data(),pencil->dspRowK.data(),pencil->mpiComplex,pencil->commRow);
+    for(auto q=0; q<pencil->nRow; ++q) {
+	auto skx = pencil->skx[q], nq = pencil->nkx[q];
+	auto in = s + pencil->dspRowK[q];
+	for(auto y=0; y<ny; ++y)
+	    for(auto z=0; z<nz; ++z)
+		memcpy(c + (z*ny+y)*n1k + skx, in + (y*nz+z)*nq, nq*sizeof(*s));
+	}
+    if (pencil->c2r) FFTW3(execute_dft_c2r)(pencil->c2r,c,reinterpret_cast<FFTW3(real) *>(c));
+    }
+
+// Called on the MPI thread (or the core that is also the MPI thread)
+static void executeR2C(MDLFFT fft,FFTW3(real) *data,FFTW3(complex) *kdata) {
+    if (fft->pencil) pencilR2C(fft->pencil,data);
+    else FFTW3(execute_dft_r2c)(fft->fplan,data,kdata);
+    }
+static void executeC2R(MDLFFT fft,FFTW3(real) *data,FFTW3(complex) *kdata) {
+    if (fft->pencil) pencilC2R(fft->pencil,kdata);
+    else FFTW3(execute_dft_c2r)(fft->iplan,kdata,data);
+    }
+
 // MPI thread: initiate a real to complex transform
 void mpiClass::MessageDFT_R2C(mdlMessageDFT_R2C *message) {
-    FFTW3(execute_dft_r2c)(message->fft->fplan,message->data,message->kdata);
+    executeR2C(message->fft,message->data,message->kdata);
     pthreadBarrierWait();
     }
 
 // MPI thread: initiate a complex to real transform
 void mpiClass::MessageDFT_C2R(mdlMessageDFT_C2R *message) {
-    FFTW3(execute_dft_c2r)(message->fft->iplan,message->kdata,message->data);
+    executeC2R(message->fft,message->data,message->kdata);
     pthreadBarrierWait();
     }
 
 void mpiClass::MessageFFT_Sizes(mdlMessageFFT_Sizes *sizes) {
-    sizes->nLocal = 2*FFTW3(mpi_local_size_3d_transposed)
-	(sizes->n3,sizes->n2,sizes->n1/2+1,commMDL,
-	&sizes->nz,&sizes->sz,&sizes->ny,&sizes->sy);
+    if (nFFTPencils > 1) {
+	mdlPencilFFT pencil;
+	pencilLayout(&pencil,sizes->n1,sizes->n2,sizes->n3,nFFTPencils,Procs(),Proc());
+	sizes->nLocal = 2*pencil.nLocal;
+	sizes->sz = pencil.sz[pencil.iCol]; sizes->nz = pencil.nz[pencil.iCol];
+	sizes->sy = pencil.sky[pencil.iCol]; sizes->ny = pencil.nky[pencil.iCol];
+	sizes->syr = pencil.sy[pencil.iRow]; sizes->nyr = pencil.ny[pencil.iRow];
+	sizes->sxk = pencil.skx[pencil.iRow]; sizes->nxk = pencil.nkx[pencil.iRow];
+	}
+    else {
+	sizes->nLocal = 2*FFTW3(mpi_local_size_3d_transposed)
+	    (sizes->n3,sizes->n2,sizes->n1/2+1,commMDL,
+	    &sizes->nz,&sizes->sz,&sizes->ny,&sizes->sy);
+	sizes->syr = 0; sizes->nyr = sizes->n2;
+	sizes->sxk = 0; sizes->nxk = sizes->n1/2+1;
+	}
     sizes->sendBack();
     }
 
@@ -1135,23 +1558,46 @@ void mpiClass::MessageFFT_Plans(mdlMessageFFT_Plans *plans) {
     auto result = fft_plans.emplace(fft_plan_key(plans->n1,plans->n2,plans->n3),fft_plan_information());
     auto &info = result.first->second;
     if (result.second) { // Just inserted: we need to create the plan!
-	info.nLocal = 2*FFTW3(mpi_local_size_3d_transposed)
-	    (plans->n3,plans->n2,plans->n1/2+1,commMDL,
-	    &info.nz,&info.sz,&info.ny,&info.sy);
-	info.fplan = FFTW3(mpi_plan_dft_r2c_3d)(
-	    plans->n3,plans->n2,plans->n1,plans->data,plans->kdata,
-	    commMDL,FFTW_MPI_TRANSPOSED_OUT | (plans->data==NULL?FFTW_ESTIMATE:FFTW_MEASURE) );
-	info.iplan = FFTW3(mpi_plan_dft_c2r_3d)(
-	    plans->n3,plans->n2,plans->n1,plans->kdata,plans->data,
-	    commMDL,FFTW_MPI_TRANSPOSED_IN  | (plans->kdata==NULL?FFTW_ESTIMATE:FFTW_MEASURE) );
+	if (nFFTPencils > 1) {
+	    info.pencil = pencilCreate(commMDL,plans->n1,plans->n2,plans->n3,nFFTPencils,plans->data!=NULL);
+	    info.nLocal = 2*info.pencil->nLocal;
+	    info.nz = info.pencil->nz[info.pencil->iCol];
+	    info.sz = info.pencil->sz[info.pencil->iCol];
+	    info.ny = info.pencil->nky[info.pencil->iCol];
+	    info.sy = info.pencil->sky[info.pencil->iCol];
+	    info.fplan = info.iplan = NULL;
+	    }
+	else {
+	    info.pencil = nullptr;
+	    info.nLocal = 2*FFTW3(mpi_local_size_3d_transposed)
+		(plans->n3,plans->n2,plans->n1/2+1,commMDL,
+		&info.nz,&info.sz,&info.ny,&info.sy);
+	    info.fplan = FFTW3(mpi_plan_dft_r2c_3d)(
+		plans->n3,plans->n2,plans->n1,plans->data,plans->kdata,
+		commMDL,FFTW_MPI_TRANSPOSED_OUT | (plans->data==NULL?FFTW_ESTIMATE:FFTW_MEASURE) );
+	    info.iplan = FFTW3(mpi_plan_dft_c2r_3d)(
+		plans->n3,plans->n2,plans->n1,plans->kdata,plans->data,
+		commMDL,FFTW_MPI_TRANSPOSED_IN  | (plans->kdata==NULL?FFTW_ESTIMATE:FFTW_MEASURE) );
+	    }
         }
     plans->nLocal = info.nLocal;
     plans->nz = info.nz;
     plans->sz = info.sz;
     plans->ny = info.ny;
     plans->sy = info.sy;
+    if (info.pencil) {
+	plans->syr = info.pencil->sy[info.pencil->iRow];
+	plans->nyr = info.pencil->ny[info.pencil->iRow];
+	plans->sxk = info.pencil->skx[info.pencil->iRow];
+	plans->nxk = info.pencil->nkx[info.pencil->iRow];
+	}
+    else {
+	plans->syr = 0; plans->nyr = plans->n2;
+	plans->sxk = 0; plans->nxk = plans->n1/2+1;
+	}
     plans->fplan = info.fplan;
     plans->iplan = info.iplan;
+    plans->pencil = info.pencil;
     plans->sendBack();
     }
 
@@ -1312,6 +1758,7 @@ int mpiClass::checkMPI() {
     cuda.initiate();
 #endif
     processMessages();
+    flushCacheRequests(false); // Send batched cache requests that have waited long enough
     finishRequests(); // Check for non-block MPI requests (send, receive, barrier, etc.)
     return nActiveCores;
     }
@@ -1361,6 +1808,7 @@ int mpiClass::Launch(int (*fcnMaster)(MDL,void *),void * (*fcnWorkerInit)(MDL),v
     */
     bDiag = 0;
     bDedicated = -1;
+    nFFTPencils = 0;
     if(argv) {
 	for (argc = 0; argv[argc]; argc++) {}
 	;
@@ -1380,6 +1828,9 @@ int mpiClass::Launch(int (*fcnMaster)(MDL,void *),void * (*fcnWorkerInit)(MDL),v
 	    else if (!strcmp(argv[i], "+sharedmpi")) {
 		bDedicated = 2;
 		}
+	    else if (!strcmp(argv[i], "-fftpencils")) {
+		if (argv[++i]) nFFTPencils = atoi(argv[i]);
+		}
 	    else if (!strcmp(argv[i], "+d") && !bDiag) {
 		p = getenv("MDL_DIAGNOSTIC");
 		if (!p) p = getenv("HOME");
@@ -1493,7 +1944,7 @@ int mpiClass::Launch(int (*fcnMaster)(MDL,void *),void * (*fcnWorkerInit)(MDL),v
 
     assert(sizeof(CacheHeader) == 16); /* Well, should be a multiple of 8 at least. */
     nOpenCaches = 0;
-    iReplyBufSize = sizeof(CacheHeader) + MDL_CACHE_DATA_SIZE;
+    iReplyBufSize = MDL_FLUSH_DATA_SIZE; // Replies to a batch of requests share a message
     iCacheBufSize = sizeof(CacheHeader) + MDL_FLUSH_DATA_SIZE;
     while(listCacheReceive.size()<25) listCacheReceive.push_back(new mdlMessageCacheReceive(iCacheBufSize));
 
@@ -1502,6 +1953,7 @@ int mpiClass::Launch(int (*fcnMaster)(MDL,void *),void * (*fcnWorkerInit)(MDL),v
     else if (n < 64) n = 64;
 
     flushBuffersByRank.resize(Procs(),flushHeadBusy.end()); // For flushing to remote processes/nodes
+    cacheRequestsByRank.resize(Procs(),nullptr); // For batching cache requests
     flushBuffersByCore.resize(Cores(),NULL); // For flushing to threads on this processor
 
     for(i=0; i<2*Cores(); ++i) {
@@ -1519,6 +1971,7 @@ int mpiClass::Launch(int (*fcnMaster)(MDL,void *),void * (*fcnWorkerInit)(MDL),v
     SendReceiveStatuses.resize(Cores()*2);
     SendReceiveIndices.resize(Cores()*2);
     CacheRequestMessages.resize(Cores()); // Each core can have ONE request
+    CachePrefetchMessages.resize(Cores()); // ... and any number of prefetches
 #ifndef NDEBUG
     nRequestsCreated = nRequestsReaped = 0;
 #endif
@@ -1604,6 +2057,8 @@ int mpiClass::Launch(int (*fcnMaster)(MDL,void *),void * (*fcnWorkerInit)(MDL),v
     // Deallocate cache reply buffers
     for (auto pReply : freeCacheReplies) { delete pReply; }
     freeCacheReplies.clear();
+    for (auto pRequests : freeCacheRequests) { delete pRequests; }
+    freeCacheRequests.clear();
     while(listCacheReceive.size()) {
 	delete listCacheReceive.back();
 	listCacheReceive.pop_back();
@@ -1616,8 +2071,11 @@ int mpiClass::Launch(int (*fcnMaster)(MDL,void *),void * (*fcnWorkerInit)(MDL),v
     // Cleanup for FFTW
     for(auto &plan : fft_plans) {
 	auto &info = plan.second;
-	FFTW3(destroy_plan)(info.fplan);
-	FFTW3(destroy_plan)(info.iplan);
+	if (info.pencil) pencilDestroy(info.pencil);
+	else {
+	    FFTW3(destroy_plan)(info.fplan);
+	    FFTW3(destroy_plan)(info.iplan);
+	    }
 	}
     fft_plans.clear();
     if (Cores()>1) FFTW3(cleanup_threads)();
@@ -1674,16 +2132,48 @@ void mdlClass::bookkeeping() {
     combine_all_incoming();
     }
 
+/*
+** Pick a random victim on this node and try to take its oldest work package.
+** We only steal when we are idle (wqAccepting) so a thread still walking is
+** never delayed by somebody else's interaction lists. If we can run tasks
+** then we take one of those when the victim has no work package.
+*/
+MDLwqNode *mdlClass::StealWork() {
+    MDLwqNode *work;
+    int i, iVictim, nCores = Cores();
+
+    if (Core()<0 || nCores<2) return NULL;
+    for(i=0; i<nCores-1; ++i) {
+	wqSeed ^= wqSeed << 13;
+	wqSeed ^= wqSeed >> 17;
+	wqSeed ^= wqSeed << 5;
+	iVictim = wqSeed % (nCores-1);
+	if (iVictim >= Core()) ++iVictim;
+	if ((work = pmdl[iVictim]->wq.steal())) return work;
+	if (wqTaskCtx && (work = pmdl[iVictim]->wqTask.steal())) return work;
+	}
+    return NULL;
+    }
+
 /* Do one piece of work. Return 0 if there was no work. */
 int mdlClass::DoSomeWork() {
     MDLwqNode *work;
     int rc = 0;
     CacheCheck();
-    if (!OPA_Queue_is_empty(&wq)) {
-	/* Grab a work package, and perform it */
-	OPA_Queue_dequeue(&wq, work, MDLwqNode, hdr);
-	OPA_decr_int(&wqCurSize);
-	while ( (*work->doFcn)(work->ctx) != 0 ) {
+    work = wq.pop();
+    if (work==NULL && wqTaskCtx) work = wqTask.pop();
+    if (work==NULL && (wqAccepting || wqTaskCtx)) work = StealWork();
+    if (work) {
+	/* Perform the work package */
+	TraceScope trace(this,work->iPhase);
+	if (work->doTask) {
+	    /* A task uses our context while it runs, so it can't start another */
+	    auto ctx = wqTaskCtx;
+	    wqTaskCtx = NULL;
+	    (*work->doTask)(work->ctx,ctx);
+	    wqTaskCtx = ctx;
+	    }
+	else while ( (*work->doFcn)(work->ctx) != 0 ) {
 	    CacheCheck();
 	    }
 	rc = 1;
@@ -1697,15 +2187,28 @@ int mdlClass::DoSomeWork() {
 	(*work->doneFcn)(work->ctx);
 	work->ctx = NULL;
 	work->doFcn = NULL;
+	work->doTask = NULL;
 	work->doneFcn = NULL;
 	OPA_Queue_enqueue(&wqFree, work, MDLwqNode, hdr);
+	--wqOutstanding;
 	}
     return rc;
     }
 
+/*
+** Finish our own work and wait for any that was stolen to come back. While
+** we wait we are idle, so we help other threads with their tails.
+*/
 extern "C" void mdlCompleteAllWork(MDL mdl) { static_cast<mdlClass *>(mdl)->CompleteAllWork(); }
 void mdlClass::CompleteAllWork() {
+    auto bAccepting = wqAccepting;
     while(DoSomeWork()) {}
+    wqAccepting = 1;
+    while(wqOutstanding) {
+	bookkeeping();
+	if (DoSomeWork() == 0) yield();
+	}
+    wqAccepting = bAccepting;
 #ifdef USE_CL
     while(CL_flushDone(clCtx)) {}
 #endif
@@ -1852,9 +2355,10 @@ void mdlClass::init(bool bDiag) {
     ** from other threads if we are idle.
     */
     wqMaxSize = 0;
+    wqOutstanding = 0;
     wqAccepting = 0;
-    wqLastHelper = 0;
-    OPA_store_int(&wqCurSize,0);
+    wqSeed = uint32_t(reinterpret_cast<uintptr_t>(this) >> 6) | 1; // Any non-zero start will do
+    wqTaskCtx = NULL;
 
     /*
     ** Set default "maximums" for structures. These are NOT hard
@@ -2260,6 +2764,18 @@ void mdlSetCacheSize(MDL cmdl,int cacheSize) {
     mdl->cacheSize = cacheSize;
     }
 
+// How long the MPI thread may hold a cache request to batch it with others for the same rank
+void mdlSetCacheWindow(MDL cmdl,int usec) {
+    mdlClass *mdl = static_cast<mdlClass *>(cmdl);
+    if (mdl->Core()==0) mdl->mpi->SetCacheWindow(usec);
+    }
+
+// Lines requested from, and messages sent to, other ranks by this rank
+void mdlCacheRequestStatistics(MDL cmdl,uint64_t *nLines,uint64_t *nMessages,int bReset) {
+    mdlClass *mdl = static_cast<mdlClass *>(cmdl);
+    mdl->mpi->CacheRequestStatistics(nLines,nMessages,bReset);
+    }
+
 extern "C" void mdlCacheCheck(MDL mdl) { static_cast<mdlClass *>(mdl)->CacheCheck(); }
 void mdlClass::CacheCheck() {
     checkMPI(); // Only does something on the MPI thread
@@ -2287,6 +2803,18 @@ double mdlNumAccess(MDL cmdl,int cid) {
     }
 
 
+// Statistics accumulated since the last reset, including a cache that is open now
+void mdlCacheStatistics(MDL cmdl,int cid,mdlCacheStats *stats,int bReset) {
+    mdlClass *mdl = static_cast<mdlClass *>(cmdl);
+    auto c = mdl->cache[cid].get();
+    *stats = c->total;
+    c->statistics(*stats);
+    if (bReset) {
+	c->total = mdlCacheStats();
+	c->clearStatistics();
+	}
+    }
+
 double mdlMissRatio(MDL cmdl,int cid) {
     mdlClass *mdl = static_cast<mdlClass *>(cmdl);
     auto c = mdl->cache[cid].get();
@@ -2318,19 +2846,30 @@ void mdlGridInitialize(MDL cmdl,MDLGRID *pgrid,int n1,int n2,int n3,int a1) {
 
     /* This will be shared later (see mdlGridShare) */
     grid->id = CAST(uint32_t *,malloc(sizeof(*grid->id)*(grid->n3)));    assert(grid->id!=NULL);
+    grid->pid = CAST(uint32_t *,calloc(a1>n2?a1:n2,sizeof(*grid->pid))); assert(grid->pid!=NULL);
     grid->rs = CAST(uint32_t *,mdlMalloc(cmdl,sizeof(*grid->rs)*mdl->Procs())); assert(grid->rs!=NULL);
     grid->rn = CAST(uint32_t *,mdlMalloc(cmdl,sizeof(*grid->rn)*mdl->Procs())); assert(grid->rn!=NULL);
+    grid->ps = CAST(uint32_t *,mdlMalloc(cmdl,sizeof(*grid->ps)*mdl->Procs())); assert(grid->ps!=NULL);
+    grid->pn = CAST(uint32_t *,mdlMalloc(cmdl,sizeof(*grid->pn)*mdl->Procs())); assert(grid->pn!=NULL);
 
     /* The following need to be set to appropriate values still. */
     grid->sSlab = grid->nSlab = 0;
     grid->nLocal = 0;
+
+    /* By default we have complete slabs (all of dimension 2) */
+    grid->iPencil = 1;
+    grid->sPencil = 0;
+    grid->nPencil = n2;
     }
 
 void mdlGridFinish(MDL cmdl, MDLGRID grid) {
     //mdlClass *mdl = static_cast<mdlClass *>(cmdl);
     if (grid->rs) free(grid->rs);
     if (grid->rn) free(grid->rn);
+    if (grid->ps) free(grid->ps);
+    if (grid->pn) free(grid->pn);
     if (grid->id) free(grid->id);
+    if (grid->pid) free(grid->pid);
     free(grid);
     }
 
@@ -2343,21 +2882,39 @@ void mdlGridSetLocal(MDL cmdl,MDLGRID grid,int s, int n, uint64_t nLocal) {
     grid->nLocal = nLocal;
     }
 
+void mdlGridSetPencil(MDL cmdl,MDLGRID grid,int iDim,int s, int n) {
+    uint32_t nDim = iDim==0 ? grid->n1 : grid->n2;
+    assert( iDim==0 || iDim==1 );
+    assert( s>=0 && ((uint32_t)s<nDim || n==0));
+    assert( n>=0 && (uint32_t)(s+n)<=nDim);
+    grid->iPencil = iDim;
+    grid->sPencil = s;
+    grid->nPencil = n;
+    }
+
 /*
 ** Share the local GRID information with other processors by,
-**   - finding the starting slab and number of slabs on each processor
-**   - building a mapping from slab to processor id.
+**   - finding the starting slab/pencil and number of slabs/pencils on each processor
+**   - building a mapping from slab to the first processor id, and from
+**     pencil to the processor offset within the slab.
 */
 extern "C" void mdlGridShare(MDL cmdl,MDLGRID grid) {return static_cast<mdlClass *>(cmdl)->GridShare(grid); }
 void mdlClass::GridShare(MDLGRID grid) {
     int i, id;
+    uint32_t nDim = grid->iPencil==0 ? grid->n1 : grid->n2;
 
     enqueueAndWait(mdlMessageGridShare(grid));
 
     /* Calculate on which processor each slab can be found. */
     for(id=0; id<Procs(); id++ ) {
+	if (grid->ps[id]) continue; /* Not the first processor for these slabs */
 	for( i=grid->rs[id]; i<grid->rs[id]+grid->rn[id]; i++ ) grid->id[i] = id;
 	}
+    /* With pencils, find which processor has each pencil relative to the first. */
+    for(id=0; id<Procs(); id++ ) {
+	if (grid->rn[id]==0 || grid->pn[id]==nDim) continue;
+	for( i=grid->ps[id]; i<grid->ps[id]+grid->pn[id]; i++ ) grid->pid[i] = id - grid->id[grid->rs[id]];
+	}
     }
 
 /*
@@ -2366,13 +2923,15 @@ void mdlClass::GridShare(MDLGRID grid) {
 void mdlGridCoordFirstLast(MDL cmdl,MDLGRID grid,mdlGridCoord *f,mdlGridCoord *l,int bCacheAlign) {
     mdlClass *mdl = static_cast<mdlClass *>(cmdl);
     uint64_t nPerCore, nThisCore;
-    uint64_t nLocal = (uint64_t)(grid->a1) * grid->n2 * grid->nSlab;
+    uint64_t nLocal = mdlGridLocalCount(grid);
+    uint64_t nRow = mdlGridRowLength(grid);
+    uint64_t nRows = mdlGridRows(grid);
 
-    /* Number on each core with multiples of "a1" elments (complete pencils). */
+    /* Number on each core with multiples of "nRow" elments (complete pencils). */
     /* This needs to change to be complete MDL "cache lines" at some point. */
     uint64_t nAlign;
     if (bCacheAlign) nAlign = 1 << (int)(log2(MDL_CACHE_DATA_SIZE / sizeof(float)));
-    else nAlign = grid->a1;
+    else nAlign = nRow;
 
     /*nPerCore = nLocal / mdlCores(mdl) + nAlign - 1;*/
     nPerCore = (nLocal-1) / mdlCores(mdl) + nAlign;
@@ -2389,18 +2948,22 @@ void mdlGridCoordFirstLast(MDL cmdl,MDLGRID grid,mdlGridCoord *f,mdlGridCoord *l
     l->II = f->II + nThisCore;
     f->i = 0;
     l->i = nThisCore;
-    f->z = f->II/(grid->a1*grid->n2);
-    f->y = f->II/grid->a1 - f->z * grid->n2;
-    f->x = f->II - grid->a1 * (f->z*grid->n2 + f->y);
+    f->z = f->II/(nRow*nRows);
+    f->y = f->II/nRow - f->z * nRows;
+    f->x = f->II - nRow * (f->z*nRows + f->y);
     assert(bCacheAlign || f->x == 0); // MDL depends on this at the moment
     f->z += grid->sSlab;
+    if (grid->iPencil==0) f->x += grid->sPencil;
+    else f->y += grid->sPencil;
     f->grid = grid;
 
-    l->z = l->II/(grid->a1*grid->n2);
-    l->y = l->II/grid->a1 - l->z * grid->n2;
-    l->x = l->II - grid->a1 * (l->z*grid->n2 + l->y);
+    l->z = l->II/(nRow*nRows);
+    l->y = l->II/nRow - l->z * nRows;
+    l->x = l->II - nRow * (l->z*nRows + l->y);
     assert(bCacheAlign || l->x == 0); // MDL depends on this at the moment
     l->z += grid->sSlab;
+    if (grid->iPencil==0) l->x += grid->sPencil;
+    else l->y += grid->sPencil;
     l->grid = grid;
     }
 
@@ -2445,6 +3008,7 @@ MDLFFT mdlClass::FFTNodeInitialize(int n1,int n2,int n3,int bMeasure,FFTW3(real)
 
     fft->fplan = plans.fplan;
     fft->iplan = plans.iplan;
+    fft->pencil = plans.pencil;
 
     /*
     ** Dimensions of k-space and r-space grid.  Note transposed order.
@@ -2455,6 +3019,8 @@ MDLFFT mdlClass::FFTNodeInitialize(int n1,int n2,int n3,int bMeasure,FFTW3(real)
     mdlGridInitialize(this,&fft->kgrid,n1/2+1,n3,n2,n1/2+1);
     mdlGridSetLocal(this,fft->rgrid,plans.sz,plans.nz,plans.nLocal);
     mdlGridSetLocal(this,fft->kgrid,plans.sy,plans.ny,plans.nLocal/2);
+    mdlGridSetPencil(this,fft->rgrid,1,plans.syr,plans.nyr);
+    mdlGridSetPencil(this,fft->kgrid,0,plans.sxk,plans.nxk);
     mdlGridShare(this,fft->rgrid);
     mdlGridShare(this,fft->kgrid);
     return fft;
@@ -2499,7 +3065,7 @@ void mdlClass::FFT( MDLFFT fft, FFTW3(real) *data ) {
     //fftTrans trans;
     ThreadBarrier();
     if (Core() == iCoreMPI) {
-	FFTW3(execute_dft_r2c)(fft->fplan,data,(FFTW3(complex) *)(data));
+	executeR2C(fft,data,(FFTW3(complex) *)(data));
 	}
     else if (Core() == 0) {
 	// NOTE: we do not receive a "reply" to this message, rather the synchronization
@@ -2515,7 +3081,7 @@ void mdlIFFT( MDL cmdl, MDLFFT fft, FFTW3(complex) *kdata ) { static_cast<mdlCla
 void mdlClass::IFFT( MDLFFT fft, FFTW3(complex) *kdata ) {
     ThreadBarrier();
     if (Core() == iCoreMPI) {
-	FFTW3(execute_dft_c2r)(fft->iplan,kdata,(FFTW3(real) *)(kdata));
+	executeC2R(fft,(FFTW3(real) *)(kdata),kdata);
 	}
     else if (Core() == 0) {
 	// NOTE: we do not receive a "reply" to this message, rather the synchronization
@@ -2559,6 +3125,7 @@ void mdlSetWorkQueueSize(MDL cmdl,int wqMaxSize,int cudaSize) {
 	    work->iCoreOwner = mdl->Core();
 	    work->ctx = NULL;
 	    work->doFcn = NULL;
+	    work->doTask = NULL;
 	    work->doneFcn = NULL;
 	    OPA_Queue_enqueue(&mdl->wqFree, work, MDLwqNode, hdr);
 	    }
@@ -2573,51 +3140,86 @@ void mdlSetWorkQueueSize(MDL cmdl,int wqMaxSize,int cudaSize) {
 	    }
 	--mdl->wqMaxSize;
 	} 
+    /* Every node we own can be waiting on our deque at the same time */
+    mdl->wq.reserve(mdl->wqMaxSize * mdl->Cores());
+    mdl->wqTask.reserve(mdl->Cores());
     }
 
 void mdlAddWork(MDL cmdl, void *ctx,
     int (*initWork)(void *ctx,void *vwork),
     int (*checkWork)(void *ctx,void *vwork),
     mdlWorkFunction doWork,
-    mdlWorkFunction doneWork) {
+    mdlWorkFunction doneWork,
+    int iPhase) {
     mdlClass *mdl = static_cast<mdlClass *>(cmdl);
-    mdlClass *Qmdl = NULL;
     MDLwqNode *work;
-    int i;
 
-    /* Obviously, we can only queue work if we have a free queue element */
+    /*
+    ** Obviously, we can only queue work if we have a free queue element.
+    ** It goes on our own deque; idle threads will steal it from there.
+    */
     if (!OPA_Queue_is_empty(&mdl->wqFree)) {
-	/* We have some room, so save work for later */
-	if (OPA_load_int(&mdl->wqCurSize) < mdl->wqMaxSize) Qmdl = mdl;
-	/* See if anyone else is accepting work */
-	else {
-	    i = mdl->wqLastHelper;
-	    do {
-		mdlClass * rMDL = mdl->pmdl[i];
-		if (rMDL->wqAccepting && OPA_load_int(&rMDL->wqCurSize)<rMDL->wqMaxSize) {
-		    Qmdl = rMDL;
-		    mdl->wqLastHelper = i;
-		    break;
-		    }
-		if (++i == mdl->Cores()) i = 0;
-		} while(i!=mdl->wqLastHelper);
-	    }
-	if (Qmdl) {
-	    OPA_Queue_dequeue(&mdl->wqFree, work, MDLwqNode, hdr);
-	    work->ctx = ctx;
-	    work->doFcn = doWork;
-	    work->doneFcn = doneWork;
-	    OPA_incr_int(&Qmdl->wqCurSize);
-	    OPA_Queue_enqueue(&Qmdl->wq, work, MDLwqNode, hdr);
+	OPA_Queue_dequeue(&mdl->wqFree, work, MDLwqNode, hdr);
+	work->ctx = ctx;
+	work->doFcn = doWork;
+	work->doneFcn = doneWork;
+	work->iPhase = iPhase;
+	if (mdl->wq.push(work)) {
+	    ++mdl->wqOutstanding;
 	    return;
 	    }
+	work->ctx = NULL;
+	work->doFcn = NULL;
+	work->doneFcn = NULL;
+	OPA_Queue_enqueue(&mdl->wqFree, work, MDLwqNode, hdr);
 	}
 
     /* Just handle it ourselves */
+    TraceScope trace(mdl,iPhase);
     while( doWork(ctx) != 0 ) {}
     doneWork(ctx);
     }
 
+/*
+** A task is work that adds more work when it runs, like walking part of a
+** tree. It runs on whichever thread takes it, with that thread's task context
+** (see mdlSetTaskContext), and is sent back to us for doneTask. A task is
+** never run here and now: if we return 0 it was not queued (no free node, or
+** every other thread already has one to steal) and the caller does it itself.
+*/
+int mdlAddTask(MDL cmdl, void *ctx,
+    mdlTaskFunction doTask,
+    mdlWorkFunction doneTask,
+    int iPhase) {
+    mdlClass *mdl = static_cast<mdlClass *>(cmdl);
+    MDLwqNode *work;
+
+    if (mdl->wqTask.size() >= mdl->Cores()-1 || OPA_Queue_is_empty(&mdl->wqFree)) return 0;
+    OPA_Queue_dequeue(&mdl->wqFree, work, MDLwqNode, hdr);
+    work->ctx = ctx;
+    work->doTask = doTask;
+    work->doneFcn = doneTask;
+    work->iPhase = iPhase;
+    if (mdl->wqTask.push(work)) {
+	++mdl->wqOutstanding;
+	return 1;
+	}
+    work->ctx = NULL;
+    work->doTask = NULL;
+    work->doneFcn = NULL;
+    OPA_Queue_enqueue(&mdl->wqFree, work, MDLwqNode, hdr);
+    return 0;
+    }
+
+/*
+** With a task context (non-NULL) we run tasks, ours and stolen ones, whenever
+** we wait; we also steal work packages as if we were idle. Only set it when
+** the context is not in use by this thread, and clear it before reusing it.
+*/
+void mdlSetTaskContext(MDL cmdl, void *ctx) {
+    static_cast<mdlClass *>(cmdl)->wqTaskCtx = ctx;
+    }
+
 int mdlProcToThread(MDL cmdl, int iProc) {
     return static_cast<mdlClass *>(cmdl)->ProcToThread(iProc);
     }
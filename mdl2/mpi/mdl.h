@@ -37,7 +37,10 @@
 #include "mdlcuda.h"
 #endif
 #include "rwlock.h"
+#include "workdeque.h"
 #include <memory>
+#include <atomic>
+#include <chrono>
 #include <tuple>
 #include <vector>
 #include <list>
@@ -63,6 +66,26 @@
 #define MDL_TAG_MAX             8
 
 typedef int (*mdlWorkFunction)(void *ctx);
+typedef int (*mdlTaskFunction)(void *ctx,void *vThread);
+
+/*
+** Cache statistics for one cache ID. Latency bin i counts remote round
+** trips of [2^i,2^(i+1)) microseconds (bin 0 also holds anything faster,
+** the last bin anything slower). The ARC list sizes are the largest seen.
+** A remote miss is a prefetch hit if its line had already been prefetched.
+*/
+#define MDL_CACHE_LATENCY_BINS 16
+typedef struct {
+    uint64_t nAccess;
+    uint64_t nMiss;
+    uint64_t nRemote;
+    uint64_t nPrefetch;
+    uint64_t nPrefetchHit;
+    uint64_t nBytesFetched;
+    uint64_t nEvict;
+    uint64_t nT1, nT2, nB1, nB2;
+    uint64_t nLatency[MDL_CACHE_LATENCY_BINS];
+    } mdlCacheStats;
 typedef int (*mdlPack)(void *,int *,size_t,void*);
 
 typedef void * MDL;
@@ -80,7 +103,9 @@ typedef struct mdl_wq_node {
     int iCoreOwner;
     void *ctx;
     mdlWorkFunction doFcn;
+    mdlTaskFunction doTask; /* Instead of doFcn for a task (see mdlAddTask) */
     mdlWorkFunction doneFcn;
+    int iPhase; /* MDL_PHASE for the timeline trace */
     } MDLwqNode;
 
 // typedef struct cacheHeaderNew {
@@ -92,6 +117,7 @@ typedef struct mdl_wq_node {
 //     } CacheHeadernew;
 
 #define MDL_CACHE_DATA_SIZE (512)
+#define MDL_CACHE_PREFETCH  (32)  /* Prefetched lines outstanding per cache */
 
 //*****************************************************************************
 
@@ -148,12 +174,30 @@ public:
 	{return arc_cache->fetch(uIndex,uId,bLock,bModify,bVirtual);}
     void *fetch(uint32_t uHash, void *pKey, int bLock,int bModify,bool bVirtual);
     void release(void *p) {return arc_cache->release(p);}
-    void clear() {arc_cache->clear();}
+    void clear();
+    void prefetch(uint32_t uIndex, uint32_t uId);
 protected:
     static void *getArrayElement(void *vData,int i,int iDataSize);
 protected:
     class mdlClass * const mdl; // MDL is needed for cache operations
     mdlMessageCacheRequest CacheRequest;
+
+    // Read-only, simple key caches can have remote lines requested in advance.
+    // The request stays outstanding until a miss consumes it, or the cache is flushed.
+    struct PrefetchLine {
+	enum {FREE, PENDING, READY} eState = FREE;
+	uint32_t uLine, uId;
+	mdlMessageCacheRequest request;
+	std::vector<char> line;
+	PrefetchLine(uint16_t iCID,int32_t idFrom) : request(iCID,idFrom) {}
+	};
+    std::vector<std::unique_ptr<PrefetchLine>> prefetchLines;
+    mdlMessageQueue queuePrefetchReply;
+    PrefetchLine *prefetchHit = nullptr; // Consumed by finishRequest
+    PrefetchLine *prefetchFind(uint32_t uLine, uint32_t uId);
+    void prefetchReceive(basicMessage &M);
+    void prefetchWait(PrefetchLine *pf);
+    void prefetchDrain();
 public:
     void initialize(uint32_t cacheSize,
 	void * (*getElt)(void *pData,int i,int iDataSize),
@@ -181,6 +225,17 @@ public:
      */
     uint64_t nAccess;
     uint64_t nMiss;
+    uint64_t nRemote;
+    uint64_t nPrefetch;
+    uint64_t nPrefetchHit;
+    uint64_t nBytesFetched;
+    uint64_t nEvict;
+    uint64_t nLatency[MDL_CACHE_LATENCY_BINS];
+    uint64_t nList[4]; // Largest T1, T2, B1, B2
+    std::chrono::steady_clock::time_point tRequest; // Outstanding remote request
+    mdlCacheStats total; // Accumulated over previous openings
+    void statistics(mdlCacheStats &stats);
+    void clearStatistics();
 public:
     explicit CACHE(mdlClass * mdl,uint16_t iCID);
     virtual ~CACHE() = default;
@@ -220,13 +275,15 @@ public:
     int cacheSize;
 
     /* Work Queues */
-    mdlMessageQueue wq;     /* Work for us to do */
+    WorkDeque<MDLwqNode> wq; /* Our work: we pop the bottom, idle threads steal the top */
     mdlMessageQueue wqDone; /* Completed work from other threads */
     mdlMessageQueue wqFree; /* Free work queue nodes */
     int wqMaxSize;
+    int wqOutstanding;      /* Our work nodes not yet back on wqFree */
     uint16_t wqAccepting;
-    uint16_t wqLastHelper;
-    OPA_int_t wqCurSize;
+    uint32_t wqSeed;        /* Victim selection when stealing */
+    WorkDeque<MDLwqNode> wqTask; /* Our tasks: these add work when they run */
+    void *wqTaskCtx;        /* Set when we can run tasks (see mdlSetTaskContext) */
     /*
      ** Services stuff!
      */
@@ -274,6 +331,7 @@ protected:
     void combine_all_incoming();
 
     int DoSomeWork();
+    MDLwqNode *StealWork();
     void bookkeeping();
     void *finishCacheRequest(int cid,uint32_t uLine, uint32_t uId, uint32_t size, const void *pKey, bool bVirtual, void *dst, const void *src);
   
@@ -358,6 +416,7 @@ protected:
 #endif
     mdlMessageQueue queueMPInew;     // Queue of work sent to MPI task
     std::vector<mdlMessageCacheRequest*> CacheRequestMessages;
+    std::vector<std::vector<mdlMessageCacheRequest*>> CachePrefetchMessages;
 
     // Used to buffer incoming flush requests before sending them to each core
     mdlMessageQueue localFlushBuffers;
@@ -388,11 +447,22 @@ protected:
     std::vector<mdlMessageCacheReceive *> listCacheReceive;
     std::list<mdlMessageCacheReply *> freeCacheReplies;
 
+    // Cache requests to the same rank are held for up to iCacheWindow and then sent together
+    std::list<mdlMessageCacheRequests *> freeCacheRequests;
+    std::vector<mdlMessageCacheRequests *> cacheRequestsByRank;
+    std::vector<int> cacheRequestRanks; // Ranks that (may) have requests waiting
+    std::chrono::steady_clock::time_point tCacheRequests; // When the oldest was queued
+    std::atomic<int> iCacheWindow; // microseconds
+    std::atomic<uint64_t> nCacheLinesRequested, nCacheRequestsSent;
+    void flushCacheRequests(bool bForce);
+
     // Cached FFTW plans
     struct fft_plan_information {
 	ptrdiff_t nz, sz, ny, sy, nLocal;
 	FFTW3(plan) fplan, iplan;
+	struct mdlPencilFFT *pencil;
 	};
+    int nFFTPencils; // Processors sharing each slab in a pencil decomposition (<=1 for slabs)
     typedef std::tuple<ptrdiff_t,ptrdiff_t,ptrdiff_t> fft_plan_key; 
     std::map<fft_plan_key,fft_plan_information> fft_plans;
 
@@ -411,6 +481,9 @@ protected:
     friend class mdlMessageCacheReply;
     void MessageCacheReply(mdlMessageCacheReply *message);
     void FinishCacheReply(mdlMessageCacheReply *message);
+    friend class mdlMessageCacheRequests;
+    void MessageCacheRequests(mdlMessageCacheRequests *message);
+    void FinishCacheRequests(mdlMessageCacheRequests *message);
     friend class mdlMessageCacheReceive;
     void MessageCacheReceive(mdlMessageCacheReceive *message);
     void FinishCacheReceive(mdlMessageCacheReceive *message, const MPI_Status &status);
@@ -463,6 +536,8 @@ public:
     	     int argc=0, char **argv=0);
     virtual ~mpiClass();
     int Launch(int (*fcnMaster)(MDL,void *),void * (*fcnWorkerInit)(MDL),void (*fcnWorkerDone)(MDL,void *));
+    void SetCacheWindow(int usec) { iCacheWindow = usec; }
+    void CacheRequestStatistics(uint64_t *nLines,uint64_t *nMessages,bool bReset);
     void KillAll(int signo);
 #ifdef USE_CUDA
     void enqueue(const cudaMessage &M, basicQueue &replyTo);
@@ -505,14 +580,38 @@ static inline int mdlGridCoordCompare(const mdlGridCoord *a,const mdlGridCoord *
     return a->x==b->x && a->y==b->y && a->z==b->z; 
     }
 
+/*
+** Local storage is a slab of rows. With the slab decomposition a row is the
+** full dimension 1 (a1 elements) and a slab has all n2 rows; a pencil
+** decomposition splits either dimension 1 or dimension 2.
+*/
+static inline uint32_t mdlGridRowLength(MDLGRID grid) {
+    return grid->iPencil==0 ? grid->nPencil : grid->a1;
+    }
+static inline uint32_t mdlGridRows(MDLGRID grid) {
+    return grid->iPencil==1 ? grid->nPencil : grid->n2;
+    }
+static inline uint64_t mdlGridLocalCount(MDLGRID grid) {
+    return (uint64_t)mdlGridRowLength(grid) * mdlGridRows(grid) * grid->nSlab;
+    }
+
 static inline mdlGridCoord *mdlGridCoordIncrement(mdlGridCoord *a) {
     ++a->i;
     ++a->II;
-    if ( ++a->x == a->grid->n1 ) {
+    if (a->grid->iPencil==0) {
+	if ( ++a->x == a->grid->sPencil + a->grid->nPencil ) {
+	    a->x = a->grid->sPencil;
+	    if ( ++a->y == a->grid->n2 ) {
+		a->y = 0;
+		++a->z;
+		}
+	    }
+	}
+    else if ( ++a->x == a->grid->n1 ) {
 	a->i += a->grid->a1 - a->grid->n1;
 	a->x = 0;
-	if ( ++a->y == a->grid->n2 ) {
-	    a->y = 0;
+	if ( ++a->y == a->grid->sPencil + a->grid->nPencil ) {
+	    a->y = a->grid->sPencil;
 	    ++a->z;
 	    }
 	}
@@ -535,6 +634,11 @@ void mdlGridFinish(MDL mdl, MDLGRID grid);
 */
 void mdlGridSetLocal(MDL mdl,MDLGRID grid,int s, int n, uint64_t nLocal);
 /*
+** Sets the pencils (part of dimension iDim within the slabs) on this processor.
+** By default a grid has all of dimension 2, which is the slab decomposition.
+*/
+void mdlGridSetPencil(MDL mdl,MDLGRID grid,int iDim,int s, int n);
+/*
 ** Share the local geometry between processors.
 */
 void mdlGridShare(MDL mdl,MDLGRID grid);
@@ -546,19 +650,28 @@ void mdlGridShare(MDL mdl,MDLGRID grid);
 void *mdlGridMalloc(MDL mdl,MDLGRID grid,int nEntrySize);
 void mdlGridFree( MDL mdl, MDLGRID grid, void *p );
 /*
-** This gives the processor on which the given slab can be found.
+** This gives the processor on which the given slab and pencil can be found.
 */
-static inline int mdlGridId(MDL mdl,MDLGRID grid, uint32_t x, uint32_t y, uint32_t z) {
+static inline int mdlGridProc(MDLGRID grid, uint32_t x, uint32_t y, uint32_t z) {
     assert(z<grid->n3);
-    return mdlProcToThread(mdl,grid->id[z]);
+    return grid->id[z] + grid->pid[grid->iPencil==0 ? x : y];
+    }
+static inline int mdlGridId(MDL mdl,MDLGRID grid, uint32_t x, uint32_t y, uint32_t z) {
+    return mdlProcToThread(mdl,mdlGridProc(grid,x,y,z));
     }
 /*
 ** This returns the index into the array on the appropriate processor.
 */
 static inline int mdlGridIdx(MDL mdl,MDLGRID grid, uint32_t x, uint32_t y, uint32_t z) {
     assert(x<=grid->a1 && y<grid->n2 && z<grid->n3);
-    z -= grid->rs[grid->id[z]]; /* Make "z" zero based for its processor */
-    return x + grid->a1*(y + grid->n2*z); /* Local index */
+    int id = mdlGridProc(grid,x,y,z);
+    z -= grid->rs[id]; /* Make "z" zero based for its processor */
+    if (grid->iPencil==0) {
+	x -= grid->ps[id];
+	return x + grid->pn[id]*(y + grid->n2*z); /* Local index */
+	}
+    y -= grid->ps[id];
+    return x + grid->a1*(y + grid->pn[id]*z); /* Local index */
     }
 
 /*
@@ -628,6 +741,9 @@ void mdlReleaseWrite(MDL mdl,int cid,void *p);
  */
 double mdlNumAccess(MDL,int);
 double mdlMissRatio(MDL,int);
+void mdlCacheStatistics(MDL,int,mdlCacheStats *,int bReset);
+void mdlCacheRequestStatistics(MDL,uint64_t *nLines,uint64_t *nMessages,int bReset);
+void mdlSetCacheWindow(MDL,int usec);
 
 void mdlSetWorkQueueSize(MDL,int,int);
 void mdlSetCudaBufferSize(MDL,int,int);
@@ -636,7 +752,13 @@ void mdlAddWork(MDL mdl, void *ctx,
     int (*initWork)(void *ctx,void *vwork),
     int (*checkWork)(void *ctx,void *vwork),
     mdlWorkFunction doWork,
-    mdlWorkFunction doneWork);
+    mdlWorkFunction doneWork,
+    int iPhase);
+int mdlAddTask(MDL mdl, void *ctx,
+    mdlTaskFunction doTask,
+    mdlWorkFunction doneTask,
+    int iPhase);
+void mdlSetTaskContext(MDL mdl, void *ctx);
 
 void mdlTimeReset(MDL mdl);
 double mdlTimeComputing(MDL mdl);
@@ -9,10 +9,15 @@ typedef struct mdlGridContext {
     uint32_t n1,n2,n3;     /* Real dimensions */
     uint32_t a1;           /* Actual size of dimension 1 */
     uint32_t sSlab, nSlab; /* Start and number of slabs */
+    uint32_t iPencil;      /* Dimension (0 or 1) that is split into pencils */
+    uint32_t sPencil, nPencil; /* Start and number of pencils along iPencil */
     uint64_t nLocal;       /* Number of local elements */
     uint32_t *rs;  /* Starting slab for each processor */
     uint32_t *rn;  /* Number of slabs on each processor */
-    uint32_t *id;  /* Which processor has this slab */
+    uint32_t *ps;  /* Starting pencil for each processor */
+    uint32_t *pn;  /* Number of pencils on each processor */
+    uint32_t *id;  /* First processor with this slab */
+    uint32_t *pid; /* Offset from id[] of the processor with this pencil */
     } * MDLGRID;
 
 typedef struct {
@@ -36,6 +41,7 @@ typedef struct mdlFFTContext {
     MDLGRID rgrid;
     MDLGRID kgrid;
     FFTW3(plan) fplan, iplan;
+    struct mdlPencilFFT *pencil; /* NULL for the FFTW slab decomposition */
     } * MDLFFT;
 #endif
 #endif
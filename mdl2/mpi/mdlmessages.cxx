@@ -67,6 +67,7 @@ void mdlMessageBarrierMPI::action(class mpiClass *mpi)  { mpi->MessageBarrierMPI
 void mdlMessageFlushFromCore::action(class mpiClass *mpi){ mpi->MessageFlushFromCore(this); }
 void mdlMessageFlushToRank::action(class mpiClass *mpi) { mpi->MessageFlushToRank(this); }
 void mdlMessageCacheReply::action(class mpiClass *mpi)  { mpi->MessageCacheReply(this); }
+void mdlMessageCacheRequests::action(class mpiClass *mpi){ mpi->MessageCacheRequests(this); }
 void mdlMessageCacheReceive::action(class mpiClass *mpi){ mpi->MessageCacheReceive(this); }
 void mdlMessageCacheOpen::action(class mpiClass *mpi)   { mpi->MessageCacheOpen(this); }
 void mdlMessageCacheClose::action(class mpiClass *mpi)  { mpi->MessageCacheClose(this); }
@@ -97,6 +98,9 @@ void mdlMessageFlushToRank::finish(class mpiClass *mpi, const MPI_Status &status
 void mdlMessageCacheReply::finish(class mpiClass *mpi, const MPI_Status &status) {
     mpi->FinishCacheReply(this);
     }
+void mdlMessageCacheRequests::finish(class mpiClass *mpi, const MPI_Status &status) {
+    mpi->FinishCacheRequests(this);
+    }
 void mdlMessageCacheReceive::finish(class mpiClass *mpi, const MPI_Status &status) {
     mpi->FinishCacheReceive(this,status);
     }
@@ -110,7 +114,7 @@ mdlMessageDFT_C2R::mdlMessageDFT_C2R(MDLFFT fft, FFTW3(real) *data, FFTW3(comple
 mdlMessageFFT_Sizes::mdlMessageFFT_Sizes(int n1, int n2, int n3)
     : n1(n1), n2(n2), n3(n3) {}
 mdlMessageFFT_Plans::mdlMessageFFT_Plans(int n1, int n2, int n3,FFTW3(real) *data,FFTW3(complex) *kdata)
-    : mdlMessageFFT_Sizes(n1,n2,n3), data(data), kdata(kdata) {}
+    : mdlMessageFFT_Sizes(n1,n2,n3), data(data), kdata(kdata), pencil(nullptr) {}
 mdlMessageAlltoallv::mdlMessageAlltoallv(int dataSize,void *sbuff,int *scount,int *sdisps,void *rbuff,int *rcount,int *rdisps)
     : dataSize(dataSize), sbuff(sbuff), rbuff(rbuff), scount(scount), sdisps(sdisps), rcount(rcount), rdisps(rdisps) {}
 mdlMessageBufferedMPI::mdlMessageBufferedMPI(void *buf, int count, MPI_Datatype datatype, int target, int tag)
@@ -167,9 +171,11 @@ mdlMessageCacheRequest::mdlMessageCacheRequest(uint8_t cid, int32_t idFrom, uint
     header.iLine = iLine;
     }
 
-mdlMessageCacheRequest & mdlMessageCacheRequest::makeCacheRequest(uint16_t nItems, int32_t idTo, int32_t iLine, uint32_t size, const void *pKey, void *pLine) {
+mdlMessageCacheRequest & mdlMessageCacheRequest::makeCacheRequest(uint16_t nItems, int32_t idTo, int32_t iLine, uint32_t size, const void *pKey, void *pLine,
+    CacheMessageType mid) {
     static_assert(offsetof(mdlCacheRequestData, header) + sizeof(header) == offsetof(mdlCacheRequestData, key), 
     	"The header and key are not adjacent in memory. This shouldn't happen.");
+    header.mid   = mid;
     header.nItems= nItems;
     header.idTo  =  idTo;
     header.iLine = iLine;
@@ -185,8 +191,7 @@ mdlMessageCacheRequest & mdlMessageCacheRequest::makeCacheRequest(uint16_t nItem
 
 // Normally, when an MPI request finishes, we send it back to the requesting thread. The process is
 // different for cache requests. We do nothing because the result is actually sent back, not the request.
-// You would think that the "request" MPI send would complete before the response message is received,
-// but this is NOT ALWAYS THE CASE. Care must be take if new/delete is used on this type of message.
+// The MPI thread copies the request into a mdlMessageCacheRequests batch, which is what is actually sent.
 void mdlMessageCacheRequest::finish(class mpiClass *mdl, const MPI_Status &status) {}
 
 } // namespace mdl
\ No newline at end of file
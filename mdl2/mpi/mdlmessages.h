@@ -12,9 +12,12 @@ enum class CacheMessageType : uint8_t {
     REQUEST = 1,
     REPLY = 2,
     FLUSH = 3,
+    PREFETCH = 4,       // A REQUEST that may complete out of order
+    PREFETCH_REPLY = 5,
     };
 
 #define MDL_FLUSH_DATA_SIZE	32000
+#define MDL_REQUEST_DATA_SIZE	4096
 #define MDL_MAX_KEY_SIZE 128
 
 struct ServiceHeader {
@@ -48,6 +51,7 @@ public:
     bool isEmpty() {return nBuffer==0;}
     void emptyBuffer() {nBuffer=0;}
     void setRankTo(uint32_t iRank) { iRankTo=iRank; }
+    void setMessageType(CacheMessageType mid) { this->mid=mid; }
     bool canBuffer(int nSize) { return nBuffer+nSize+sizeof(ServiceHeader) <= Buffer.size(); }
     void*getBuffer(int nSize);
     bool addBuffer(int nSize, const void *pData);
@@ -143,6 +147,7 @@ protected: // Input fields
     int n1,n2,n3;
 protected: // Output fields
     ptrdiff_t nz, sz, ny, sy, nLocal;
+    ptrdiff_t nyr, syr, nxk, sxk; // Pencils: r-space y and k-space x
 public:
     virtual void action(class mpiClass *mdl);
     explicit mdlMessageFFT_Sizes(int n1, int n2, int n3);
@@ -156,6 +161,7 @@ protected: // Input fields
     FFTW3(complex) *kdata;
 protected: // Output fields
     FFTW3(plan) fplan, iplan;
+    struct mdlPencilFFT *pencil;
 public:
     virtual void action(class mpiClass *mdl);
     explicit mdlMessageFFT_Plans(int n1, int n2, int n3,FFTW3(real) *data=0,FFTW3(complex) *kdata=0);
@@ -180,7 +186,18 @@ public:
     virtual void finish(class mpiClass *mdl, const MPI_Status &status);
     };
 
-// Send a small reply message with a single cache line
+// Requests for cache lines owned by one rank, sent together
+class mdlMessageCacheRequests : public mdlMessageMPI, public FlushBuffer {
+protected:
+    friend class mdlClass;
+    friend class mpiClass;
+public:
+    mdlMessageCacheRequests(uint32_t nSize) : FlushBuffer(nSize,CacheMessageType::REQUEST) {}
+    virtual void action(class mpiClass *mdl);
+    virtual void finish(class mpiClass *mdl, const MPI_Status &status);
+    };
+
+// Send a reply message with one or more cache lines
 class mdlMessageCacheReply : public mdlMessageMPI, public FlushBuffer {
 protected:
     friend class mdlClass;
@@ -308,6 +325,7 @@ class mdlMessageCacheRequest : public mdlMessageBufferedMPI, protected mdlCacheR
 protected:
     friend class mdlClass;
     friend class mpiClass;
+    friend class CACHE;
     void *pLine = nullptr;
     uint32_t key_size = 0;
 public:
@@ -315,7 +333,8 @@ public:
     virtual void finish(class mpiClass *mdl, const MPI_Status &status);
     explicit mdlMessageCacheRequest(uint8_t cid, int32_t idFrom);
     explicit mdlMessageCacheRequest(uint8_t cid, int32_t idFrom, uint16_t nItems, int32_t idTo, int32_t iLine, void *pLine);
-    mdlMessageCacheRequest & makeCacheRequest(uint16_t nItems, int32_t idTo, int32_t iLine, uint32_t size, const void *pKey, void *pLine);
+    mdlMessageCacheRequest & makeCacheRequest(uint16_t nItems, int32_t idTo, int32_t iLine, uint32_t size, const void *pKey, void *pLine,
+	CacheMessageType mid=CacheMessageType::REQUEST);
     };
 } // namespace mdl
 #endif
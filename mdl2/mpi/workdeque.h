@@ -0,0 +1,107 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKDEQUE_HINCLUDED
+#define WORKDEQUE_HINCLUDED
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cassert>
+
+namespace mdl {
+
+// A fixed capacity, lock-free work stealing deque (Chase & Lev, 2005 with the
+// C11 memory ordering of Le et al., 2013). The owning thread pushes and pops
+// at the bottom; any other thread may steal the oldest entry from the top.
+// The capacity is fixed because the owner never has more work packages
+// outstanding than it has free work nodes; push() fails rather than growing.
+template<typename T>
+class WorkDeque {
+protected:
+    std::unique_ptr<std::atomic<T *>[]> buffer;
+    std::int64_t mask;
+    alignas(64) std::atomic<std::int64_t> top;
+    alignas(64) std::atomic<std::int64_t> bottom;
+public:
+    WorkDeque() : mask(-1), top(0), bottom(0) {}
+
+    // Set the capacity (rounded up to a power of two). Only call when empty.
+    void reserve(std::int64_t n) {
+	assert(empty());
+	std::int64_t nSize = 1;
+	while (nSize < n) nSize <<= 1;
+	if (nSize == mask+1) return;
+	buffer.reset(new std::atomic<T *>[nSize]);
+	for (auto i=0; i<nSize; ++i) buffer[i].store(nullptr,std::memory_order_relaxed);
+	mask = nSize - 1;
+	top.store(0); bottom.store(0);
+	}
+    std::int64_t capacity() const { return mask+1; }
+
+    // An estimate only: the value may be stale when other threads are stealing.
+    std::int64_t size() const {
+	auto b = bottom.load(std::memory_order_relaxed);
+	auto t = top.load(std::memory_order_relaxed);
+	return b > t ? b - t : 0;
+	}
+    bool empty() const { return size() == 0; }
+
+    // Owner only
+    bool push(T *item) {
+	auto b = bottom.load(std::memory_order_relaxed);
+	auto t = top.load(std::memory_order_acquire);
+	if (b - t > mask) return false;
+	buffer[b & mask].store(item,std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b+1,std::memory_order_relaxed);
+	return true;
+	}
+
+    // Owner only: most recently pushed entry (still warm in our cache)
+    T *pop() {
+	auto b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b,std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	auto t = top.load(std::memory_order_relaxed);
+	T *item = nullptr;
+	if (t <= b) {
+	    item = buffer[b & mask].load(std::memory_order_relaxed);
+	    if (t == b) { // Last entry: race any thieves for it
+		if (!top.compare_exchange_strong(t,t+1,std::memory_order_seq_cst,std::memory_order_relaxed))
+		    item = nullptr;
+		bottom.store(b+1,std::memory_order_relaxed);
+		}
+	    }
+	else bottom.store(b+1,std::memory_order_relaxed);
+	return item;
+	}
+
+    // Any thread: oldest entry, or nullptr if empty or we lost a race
+    T *steal() {
+	auto t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	auto b = bottom.load(std::memory_order_acquire);
+	if (t >= b) return nullptr;
+	T *item = buffer[t & mask].load(std::memory_order_relaxed);
+	if (!top.compare_exchange_strong(t,t+1,std::memory_order_seq_cst,std::memory_order_relaxed))
+	    return nullptr;
+	return item;
+	}
+    };
+
+} // namespace mdl
+#endif
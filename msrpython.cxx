@@ -25,6 +25,7 @@
 #include "m_parse.h"
 
 #include "master.h"
+#include "core/cachestats.h"
 #include "csmpython.h"
 
 #define MASTER_MODULE_NAME "MASTER"
@@ -729,6 +730,9 @@ ppy_msr_Gravity(MSRINSTANCE *self, PyObject *args, PyObject *kwobj) {
 
     uint8_t uRungMax = msr->Gravity(iRungLo,iRungHi,iRoot1,iRoot2,dTime,dDelta,dStep,dTheta,bKickClose,bKickOpen,bEwald,
 	msr->param.bGravStep, msr->param.nPartRhoLoc, msr->param.iTimeStepCrit, msr->param.nGroup);
+#ifdef MDL_FFTW
+    if (msr->param.nGridPM > 0) msr->PMAccel();
+#endif
     return Py_BuildValue("i", uRungMax);
     }
 
@@ -754,6 +758,50 @@ ppy_msr_Smooth(MSRINSTANCE *self, PyObject *args, PyObject *kwobj) {
     Py_RETURN_NONE;
     }
 
+/********** Algorithms: Friends of friends **********/
+
+static PyObject *
+ppy_msr_Fof(MSRINSTANCE *self, PyObject *args, PyObject *kwobj) {
+    flush_std_files();
+    static char const *kwlist[]={"time",NULL};
+    double dTime = 0.0;
+
+    if ( !PyArg_ParseTupleAndKeywords(
+	     args, kwobj, "|d:Fof", const_cast<char **>(kwlist),
+	     &dTime ) )
+	return NULL;
+    return PyLong_FromUnsignedLongLong(self->msr->NewFof(dTime));
+    }
+
+static PyObject *
+ppy_msr_Hop(MSRINSTANCE *self, PyObject *args, PyObject *kwobj) {
+    flush_std_files();
+    static char const *kwlist[]={"time","delta",NULL};
+    double dTime = 0.0;
+    double dDelta = 0.0;
+
+    if ( !PyArg_ParseTupleAndKeywords(
+	     args, kwobj, "|dd:Hop", const_cast<char **>(kwlist),
+	     &dTime, &dDelta ) )
+	return NULL;
+    self->msr->Hop(dTime,dDelta);
+    Py_RETURN_NONE;
+    }
+
+static PyObject *
+ppy_msr_SubhaloWrite(MSRINSTANCE *self, PyObject *args, PyObject *kwobj) {
+    flush_std_files();
+    static char const *kwlist[]={"name",NULL};
+    const char *fname;
+
+    if ( !PyArg_ParseTupleAndKeywords(
+	     args, kwobj, "s:SubhaloWrite", const_cast<char **>(kwlist),
+	     &fname ) )
+	return NULL;
+    self->msr->SubhaloWrite(fname);
+    Py_RETURN_NONE;
+    }
+
 /********** Analysis: grid management **********/
 
 static PyObject *
@@ -1060,6 +1108,40 @@ ppy_msr_MarkBlackholes(MSRINSTANCE *self, PyObject *args, PyObject *kwobj) {
     return Py_BuildValue("L",n);
     }
 
+/********** Diagnostics: Cache statistics **********/
+
+static PyObject *
+ppy_msr_cache_stats(MSRINSTANCE *self, PyObject *args, PyObject *kwobj) {
+    flush_std_files();
+    static char const *kwlist[]={"reset",NULL};
+    int bReset = 0;
+    if ( !PyArg_ParseTupleAndKeywords(
+	     args, kwobj, "|p:cache_stats", const_cast<char **>(kwlist),
+	     &bReset ) )
+	return NULL;
+    mdlCacheStats stats[CID_COUNT];
+    int nThreads = self->msr->CacheStats(stats,bReset);
+    auto dict = PyDict_New();
+    for(auto cid=0; cid<CID_COUNT; ++cid) {
+	const auto &s = stats[cid];
+	if (s.nAccess == 0) continue;
+	auto latency = PyList_New(MDL_CACHE_LATENCY_BINS);
+	for(auto i=0; i<MDL_CACHE_LATENCY_BINS; ++i)
+	    PyList_SET_ITEM(latency,i,PyLong_FromUnsignedLongLong(s.nLatency[i]));
+	auto value = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:d,s:d,s:d,s:d,s:N}",
+	    "access",(unsigned long long)s.nAccess,"miss",(unsigned long long)s.nMiss,
+	    "remote",(unsigned long long)s.nRemote,
+	    "prefetch",(unsigned long long)s.nPrefetch,"prefetch_hit",(unsigned long long)s.nPrefetchHit,
+	    "bytes",(unsigned long long)s.nBytesFetched,
+	    "evicted",(unsigned long long)s.nEvict,
+	    "T1",1.0*s.nT1/nThreads,"T2",1.0*s.nT2/nThreads,"B1",1.0*s.nB1/nThreads,"B2",1.0*s.nB2/nThreads,
+	    "latency",latency);
+	PyDict_SetItemString(dict,ServiceCacheStats::name(cid),value);
+	Py_DECREF(value);
+	}
+    return dict;
+    }
+
 /********** Analysis: Retrieve the values for all particles (DANGER! not memory friendly) **********/
 
 #ifdef USE_NUMPY
@@ -1085,7 +1167,7 @@ ppy_msr_GetArray(MSRINSTANCE *self, PyObject *args, PyObject *kwobj) {
 	case oAcceleration: N[1]=3; break;
 	case oVelocity:     N[1]=3; break;
 	case oPotential:    break;
-	case oGroup:                 typenum = NPY_UINT32; iUnitSize = sizeof(uint32_t); break;
+	case oGroup:                 typenum = NPY_UINT64; iUnitSize = sizeof(uint64_t); break;
 	case oMass:         break;
 	case oSoft:         break;
 	case oDensity:      break;
@@ -1174,9 +1256,15 @@ static PyMethodDef msr_methods[] = {
      "Reorders the particles by iOrder"},
 
     {"Gravity", (PyCFunction)ppy_msr_Gravity, METH_VARARGS|METH_KEYWORDS,
-     "Calculate gravity"},
+     "Calculate gravity (with nGridPM the accelerations include the long-range force)"},
     {"Smooth", (PyCFunction)ppy_msr_Smooth, METH_VARARGS|METH_KEYWORDS,
      "Smooth"},
+    {"Fof", (PyCFunction)ppy_msr_Fof, METH_VARARGS|METH_KEYWORDS,
+     "Friends of friends groups with linking length dTau, returns the number of groups"},
+    {"Hop", (PyCFunction)ppy_msr_Hop, METH_VARARGS|METH_KEYWORDS,
+     "Grasshopper groups, and their subhalo hierarchy with bHopSubhalos"},
+    {"SubhaloWrite", (PyCFunction)ppy_msr_SubhaloWrite, METH_VARARGS|METH_KEYWORDS,
+     "Write the subhalo hierarchy found by Hop"},
 
     {"grid_prepare", (PyCFunction)ppy_msr_grid_prepare, METH_VARARGS|METH_KEYWORDS,
      "Prepare for grid operations"},
@@ -1213,6 +1301,8 @@ static PyMethodDef msr_methods[] = {
      "Mark particles in a cylinder"},
     {"MarkBlackholes", (PyCFunction)ppy_msr_MarkBlackholes, METH_VARARGS|METH_KEYWORDS,
      "Marks all blackholes"},
+    {"cache_stats", (PyCFunction)ppy_msr_cache_stats, METH_VARARGS|METH_KEYWORDS,
+     "Cache statistics by cache name; latency is a histogram of remote round trips in powers of two microseconds"},
 #ifdef USE_NUMPY
     {"GetArray", (PyCFunction)ppy_msr_GetArray, METH_VARARGS|METH_KEYWORDS,
      "Get a complete array of the given value"},
@@ -39,6 +39,8 @@ struct parameters {
     int nParaWrite;
     int bStandard;
     int iCompress;
+    int iCheckpointCompress;
+    int nTraceEvents;
     int bHDF5;
     int bDoublePos;
     int bDoubleVel;
@@ -69,6 +71,7 @@ struct parameters {
     int nSteps;
     int nSteps10;
     int nSmooth;
+    int bSmoothCache;
     int iMaxRung;
     int bDualTree;
     int nTreeBitsLo;
@@ -82,6 +85,7 @@ struct parameters {
     int bDoPotOutput;
     int iCacheSize;
     int iWorkQueueSize;
+    int iCacheWindow;
     int iCUDAQueueSize;
     int bAddDelete;
     int bLightCone;
@@ -89,6 +93,9 @@ struct parameters {
     int bInFileLC;
     double dRedshiftLCP;
     int nSideHealpix;
+    int nSideLightConeShard;
+    double dLightConeShellWidth;
+    double dLightConeQuantum;
     /* BEGIN Gas Parameters */
     int bDoGas;
     int bGasAdiabatic;
@@ -148,6 +155,11 @@ struct parameters {
     double dDelta;
     double dEwCut;
     double dEwhCut;
+    int nEwaldGrid;
+    double dEwaldGridTol;
+    int nGridPM;
+    double dPMSmooth;
+    double dPMCut;
     double dTheta;
     double dTheta2;
     double dTheta20;
@@ -170,10 +182,14 @@ struct parameters {
     char achClassFilename[256];
     char achLinearSpecies[256];
     char achPowerSpecies[256];
+    char achLightConeShells[256];
     double dFracDualTree;
     double dFracNoDomainDecomp;
     double dFracNoDomainRootFind;
     double dFracNoDomainDimChoice;
+    int bDomainWork;
+    int bDomainHilbert;
+    double dDomainTolerance;
     /*
     ** Additional parameters for group finding.
     */
@@ -181,6 +197,10 @@ struct parameters {
     int bFindHopGroups;
     int	nMinMembers;
     double dHopTau;
+    int bHopSubhalos;
+    int nHopSubNeighbors;
+    int bMergerTree;
+    int nMergerTracers;
     double dTau;
     int	bTraceRelaxation;
     /*
@@ -224,6 +244,7 @@ struct parameters {
     int bMemSoft;
     int bMemRelaxation;
     int bMemVelSmooth;
+    int bMemSoA;
     int bMemPsMetric;
     int bMemNodeMoment;
     int bMemNodeAcceleration;
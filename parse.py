@@ -52,6 +52,9 @@ def parse():
     add_flag(gparm,'fndd',default=0.1,dest='dFracNoDomainDecomp',type=float,help='Fraction of Active Particles for no DD')
     add_flag(gparm,'fndrf',default=0.1,dest='dFracNoDomainRootFind',type=float,help='Fraction of Active Particles for no DD root finding')
     add_flag(gparm,'fnddc',default=0.1,dest='dFracNoDomainDimChoice',type=float,help='Fraction of Active Particles for no DD dimension choice')
+    add_bool(gparm,'ddwork',default=False,dest='bDomainWork',help='balance domains by the measured gravity work of each particle')
+    add_bool(gparm,'ddhilbert',default=False,dest='bDomainHilbert',help='decompose domains along the Peano-Hilbert curve')
+    add_flag(gparm,'ddtol',default=0.02,dest='dDomainTolerance',type=float,help='Peano-Hilbert splitters only move once a domain is this far out of balance')
 
     aparm = parser.add_argument_group('Analysis')
     add_flag(aparm,'npk',default=None,dest='nBinsPk',type=int, help='Number of log bins for P(k)')
@@ -61,6 +64,10 @@ def parse():
     add_bool(aparm,'groupfinder',default=False,dest='bFindGroups',help='enable group finder')
     add_bool(aparm,'hop',default=False,dest='bFindHopGroups',help='enable phase-space group finder')
     add_flag(aparm,'hoptau',default=-4.0,dest='dHopTau',type=float, help='linking length for Gasshopper (negative for multiples of softening)')
+    add_bool(aparm,'hopsub',default=False,dest='bHopSubhalos',help='find the subhalo hierarchy of Grasshopper groups')
+    add_flag(aparm,'nhopsubngb',default=20,dest='nHopSubNeighbors',type=int, help='neighbours used to find density peaks of subhalos')
+    add_bool(aparm,'mergertree',default=False,dest='bMergerTree',help='link groups to their progenitors at the previous group finding step')
+    add_flag(aparm,'nmergertracers',default=10,dest='nMergerTracers',type=int, help='most bound particles tracked per group for the merger tree')
     add_flag(aparm,'nMinMembers',default=10, dest='nMinMembers',type=int, help='minimum number of group members')
     add_flag(aparm,'tau',default=0.164,dest='dTau',type=float,help='linking length for FOF in units of mean particle separation')
     add_flag(aparm,'dEnv0',default=-1.0,dest='dEnvironment0',type=float, help='first radius for density environment about a group')
@@ -70,6 +77,10 @@ def parse():
     add_flag(aparm,'zdel',default=0,dest='dDeltakRedshift',type=float, help='starting redshift to output delta(k) field')
     add_flag(aparm,'healpix',default=8192,dest='nSideHealpix',type=int, help='Number per side of the healpix map')
     add_bool(aparm,'lcp',default=False,dest='bLightConeParticles',help='output light cone particles')
+    add_flag(aparm,'lcshard',default=0,dest='nSideLightConeShard',type=int, help='write light cone particles in blocks by HEALPix pixel of this nside, with an index (0 = plain stream)')
+    add_flag(aparm,'lcshell',default=0.0,dest='dLightConeShellWidth',type=float, help='radial width in box lengths of light cone particle blocks (0 = one shell)')
+    add_flag(aparm,'lcquantum',default=1e-6,dest='dLightConeQuantum',type=float, help='position resolution in box lengths of light cone particle blocks')
+    add_flag(aparm,'lcshells',default='',dest='achLightConeShells', help='HEALPix map shells as "rInner rOuter nside,..." in box lengths (empty = one map per step)')
 
     ioparm = parser.add_argument_group('I/O Parameters')
     add_flag(ioparm,'I', dest='achInFile', help='input file name')
@@ -100,6 +111,8 @@ def parse():
     add_bool(ioparm,'rungdestout',default=False,dest='bDoRungDestOutput',help='enable rung destination outputs')
     add_bool(ioparm,'std',default=True,dest='bStandard',help='output in standard TIPSY binary format')
     add_flag(ioparm,'compress',default=0, dest='iCompress',type=int, help='compression format, 0=none, 1=gzip, 2=bzip2')
+    add_flag(ioparm,'chkz',default=1, dest='iCheckpointCompress',type=int, help='checkpoint compression level, 0=none, 1-9=zlib')
+    add_flag(ioparm,'trace',default=0, dest='nTraceEvents',type=int, help='timeline events kept per thread and step, 0=no trace')
     add_flag(ioparm,'wall',default=0, dest='iWallRunTime',type=int, help='Maximum Wallclock time (in minutes) to run')
     add_flag(ioparm,'signal',default=0, dest='iSignalSeconds',type=int, help='Time (in seconds) that USR1 is sent before termination')
     add_bool(ioparm,'rtrace',default=False,dest='bTraceRelaxation',help='enable relaxation tracing')
@@ -144,6 +157,11 @@ def parse():
     add_flag(periodp,'Lz',default=1.0, dest='dzPeriod', type=float, help='periodic box length in z-dimension')
     add_flag(periodp,'ew',default=2.6, dest='dEwCut', type=float, help='dEwCut')
     add_flag(periodp,'ewh',default=2.8, dest='dEwhCut', type=float, help='dEwhCut')
+    add_flag(periodp,'ewgrid',default=0, dest='nEwaldGrid', type=int, help='interpolate the Ewald correction from a table with this many cells per box length (0 = exact sum)')
+    add_flag(periodp,'ewgridtol',default=1e-4, dest='dEwaldGridTol', type=float, help='largest error of the Ewald table relative to M/L^2 before the exact sum is used')
+    add_flag(periodp,'pmgrid',default=0, dest='nGridPM', type=int, help='TreePM: grid size of the long-range force, replacing Ewald (0 = disabled)')
+    add_flag(periodp,'pms',default=1.25, dest='dPMSmooth', type=float, help='TreePM: force split scale r_s in PM grid cells')
+    add_flag(periodp,'pmcut',default=4.5, dest='dPMCut', type=float, help='TreePM: cutoff of the short-range tree force in units of r_s')
 
     #     /* IC Generation */
     cosmop = parser.add_argument_group('Cosmology')
@@ -195,6 +213,7 @@ def parse():
     add_bool(memory,'Ms',default=False,dest='bMemSoft', help='Particles have individual softening')
     add_bool(memory,'Mr',default=False,dest='bMemRelaxation', help='Particles have relaxation')
     add_bool(memory,'Mvs',default=False,dest='bMemVelSmooth', help='Particles support velocity smoothing')
+    add_bool(memory,'soa',default=False,dest='bMemSoA', help='Velocity, acceleration and potential are stored in separate arrays')
     add_bool(memory,'MNm',default=False,dest='bMemNodeMoment', help='Tree nodes support multipole moments')
     add_bool(memory,'MNa',default=False,dest='bMemNodeAcceleration', help='Tree nodes support acceleration (for bGravStep)')
     add_bool(memory,'MNv',default=False,dest='bMemNodeVelocity', help='Tree nodes support velocity (for iTimeStepCrit = 1)')
@@ -205,6 +224,7 @@ def parse():
     # /* Gas Parameters */
     gas = parser.add_argument_group('Gas Parameters')
     add_flag(gas,'s',default=64, dest='nSmooth',type=int, help='number of particles to smooth over')
+    add_bool(gas,'smcache',default=False,dest='bSmoothCache',help='keep neighbor lists for consecutive smooths with the same nSmooth')
     add_bool(gas,'gas',default=False,dest='bDoGas',help='calculate gas/do not calculate gas')
     add_bool(gas,'GasAdiabatic',default=True,dest='bGasAdiabatic',help='Gas is Adiabatic')
     add_bool(gas,'GasIsothermal',default=False,dest='bGasIsothermal',help='Gas is Isothermal')
@@ -248,6 +268,7 @@ def parse():
     add_bool(debugp,'nograv',default=False,dest='bNoGrav', help='enable gravity calulation for testing')
     add_bool(debugp,'dedicated',default=False,dest='bDedicatedMPI', help='enable dedicated MPI thread')
     add_bool(debugp,'sharedmpi',default=False,dest='bSharedMPI', help='enable extra dedicated MPI thread')
+    add_flag(debugp,'fftpencils',default=0,dest='nFFTPencils',type=int, help='processors sharing each slab in a pencil FFT decomposition (0=slabs)')
     add_bool(debugp,'overwrite',default=False,dest='bOverwrite', help='enable overwrite safety lock')
     add_bool(debugp,'vwarnings',default=True,dest='bVWarnings', help='enable warnings')
     add_bool(debugp,'vstart',default=True,dest='bVStart', help='enable verbose start')
@@ -257,6 +278,7 @@ def parse():
     add_flag(debugp,'nd',default=5,dest='nDigits', type=int,help='number of digits to use in output filenames')
     add_flag(debugp,'cs',default=0, dest='iCacheSize',type=int, help='size of the MDL cache (0=default)')
     add_flag(debugp,'wqs',default=0, dest='iWorkQueueSize',type=int, help='size of the MDL work queue')
+    add_flag(debugp,'cw',default=0, dest='iCacheWindow',type=int, help='microseconds to hold remote cache requests for batching')
     add_flag(debugp,'cqs',default=8, dest='iCUDAQueueSize',type=int, help='size of the CUDA work queue')
 
     parser.add_argument('script',nargs='?',default=None,help='File containing parameters or analysis script')
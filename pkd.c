@@ -71,6 +71,7 @@
 #include "io/outtype.h"
 #include "cosmo.h"
 #include "core/healpix.h"
+#include "group/group.h"
 
 #ifdef _MSC_VER
 #define FILE_PROTECTION (_S_IREAD | _S_IWRITE)
@@ -220,6 +221,39 @@ static void firstTouch(uint64_t n,char *p) {
 	}
     }
 
+/*
+** Allocate one node-wide array for a structure-of-arrays field; each thread
+** receives nElements of the given size.
+*/
+static void *allocSoaField(PKD pkd,uint64_t nElements,size_t iSize) {
+    uint64_t nBytesPerThread = nElements * iSize;
+    char *pData;
+    if (mdlCore(pkd->mdl)==0) {
+#ifdef _MSC_VER
+	pData = _aligned_malloc(nBytesPerThread * mdlCores(pkd->mdl),64);
+#else
+	void *vData;
+	if (posix_memalign(&vData,64,nBytesPerThread * mdlCores(pkd->mdl))) pData = NULL;
+	else pData = vData;
+#endif
+	mdlassert(pkd->mdl,pData != NULL);
+	}
+    else pData = NULL; // Ignored by mdlSetArray()
+    pData = mdlSetArray(pkd->mdl,nElements,iSize,pData);
+    firstTouch(nBytesPerThread,pData);
+    return pData;
+    }
+
+static void freeSoaField(PKD pkd,void *pData) {
+    if (pData && mdlCore(pkd->mdl)==0) {
+#ifdef _MSC_VER
+	_aligned_free(pData);
+#else
+	free(pData);
+#endif
+	}
+    }
+
 /* Greatest common divisor */
 static int gcd ( int a, int b ) {
     while ( a != 0 ) {
@@ -285,7 +319,7 @@ static void initLightConeOffsets(PKD pkd) {
 void pkdInitialize(
     PKD *ppkd,MDL mdl,int nStore,uint64_t nMinTotalStore,uint64_t nMinEphemeral,uint32_t nEphemeralBytes,
     int nTreeBitsLo, int nTreeBitsHi,
-    int iCacheSize,int iWorkQueueSize,int iCUDAQueueSize,double *fPeriod,uint64_t nDark,uint64_t nGas,uint64_t nStar,
+    int iCacheSize,int iWorkQueueSize,int iCacheWindow,int iCUDAQueueSize,double *fPeriod,uint64_t nDark,uint64_t nGas,uint64_t nStar,
     uint64_t mMemoryModel, int bLightCone, int bLightConeParticles) {
     PKD pkd;
     PARTICLE *p;
@@ -339,6 +373,11 @@ void pkdInitialize(
     */
     pkd->bNoParticleOrder = (mMemoryModel&PKD_MODEL_UNORDERED) ? 1 : 0;
     pkd->bIntegerPosition = (mMemoryModel&PKD_MODEL_INTEGER_POS) ? 1 : 0;
+    pkd->bSoA = (mMemoryModel&PKD_MODEL_SOA) ? 1 : 0;
+    pkd->nSoaBytes = 0;
+    pkd->pSoaVel = NULL;
+    pkd->pSoaAccel = NULL;
+    pkd->pSoaPot = NULL;
 
     if ( pkd->bNoParticleOrder )
 	pkd->iParticleSize = sizeof(UPARTICLE);
@@ -354,6 +393,20 @@ void pkdInitialize(
     else
 	pkd->oFieldOffset[oParticleID] = 0;
 
+    /*
+    ** With the SoA model the hot fields are not part of the particle; they
+    ** are allocated below as separate arrays.
+    */
+    uint64_t mSoaModel = 0;
+    if (pkd->bSoA) {
+	assert(mMemoryModel & PKD_MODEL_VELOCITY);
+	mSoaModel = mMemoryModel & (PKD_MODEL_VELOCITY|PKD_MODEL_ACCELERATION|PKD_MODEL_POTENTIAL);
+	mMemoryModel &= ~mSoaModel;
+	pkd->nSoaBytes = 3*sizeof(vel_t);
+	if ( mSoaModel & PKD_MODEL_ACCELERATION ) pkd->nSoaBytes += 3*sizeof(float);
+	if ( mSoaModel & PKD_MODEL_POTENTIAL ) pkd->nSoaBytes += sizeof(float);
+	}
+
     pkd->oFieldOffset[oVelocity] = 0;
     if ( mMemoryModel & PKD_MODEL_VELOCITY ) {
 	if (sizeof(vel_t) == sizeof(double)) {
@@ -407,6 +460,14 @@ void pkdInitialize(
 	pkd->oFieldOffset[oDensity] = pkdParticleAddFloat(pkd,1);
     else pkd->oFieldOffset[oDensity] = 0;
 
+    if ( mMemoryModel & PKD_MODEL_WORK )
+	pkd->oFieldOffset[oWork] = pkdParticleAddFloat(pkd,1);
+    else pkd->oFieldOffset[oWork] = 0;
+
+    if ( mMemoryModel & PKD_MODEL_MERGER )
+	pkd->oFieldOffset[oMergerTag] = pkdParticleAddInt32(pkd,1);
+    else pkd->oFieldOffset[oMergerTag] = 0;
+
     pkd->oFieldOffset[oGroup] = 0;
     if ( (mMemoryModel & PKD_MODEL_GROUPS) && !pkd->bNoParticleOrder) {
 	pkd->oFieldOffset[oGroup] = pkdParticleAddInt32(pkd,1);
@@ -418,6 +479,10 @@ void pkdInitialize(
 	}
     else pkd->oFieldOffset[oPotential] = 0;
 
+    if ( mSoaModel & PKD_MODEL_VELOCITY )     pkd->oFieldOffset[oVelocity] = PKD_FIELD_SOA;
+    if ( mSoaModel & PKD_MODEL_ACCELERATION ) pkd->oFieldOffset[oAcceleration] = PKD_FIELD_SOA;
+    if ( mSoaModel & PKD_MODEL_POTENTIAL )    pkd->oFieldOffset[oPotential] = PKD_FIELD_SOA;
+
     /*
     ** Tree node memory models
     */
@@ -548,6 +613,19 @@ void pkdInitialize(
     pkd->pStorePRIVATE = (PARTICLE *)pParticles;
     pkd->pLite = pEphemeral;
     /*
+    ** The structure-of-arrays fields use the same per-thread stride (nStore+1)
+    ** as the particle store so that pkdSoaIndex() works for any particle on
+    ** this node, including those reached through the cache of another thread.
+    ** nStore was chosen above so that the store needs no page rounding.
+    */
+    assert(nBytesPerThread == (nStore+1)*pkdParticleSize(pkd));
+    if ( mSoaModel & PKD_MODEL_VELOCITY )
+	pkd->pSoaVel = allocSoaField(pkd,nStore+1,3*sizeof(vel_t));
+    if ( mSoaModel & PKD_MODEL_ACCELERATION )
+	pkd->pSoaAccel = allocSoaField(pkd,nStore+1,3*sizeof(float));
+    if ( mSoaModel & PKD_MODEL_POTENTIAL )
+	pkd->pSoaPot = allocSoaField(pkd,nStore+1,sizeof(float));
+    /*
     ** Now we setup the node storage for the tree.  This storage is no longer
     ** continguous as the MDL now supports non-contiguous arrays.  We allocate
     ** a single "tile" for the tree.  If this is not sufficient, then additional
@@ -579,7 +657,7 @@ void pkdInitialize(
     ** this now because the outside world can no longer know the size of a
     ** particle a priori.
     */
-    pkd->pTempPRIVATE = malloc(pkdParticleSize(pkd));
+    pkd->pTempPRIVATE = malloc(pkdParticleSize(pkd) + pkd->nSoaBytes);
     mdlassert(mdl,pkd->pTempPRIVATE != NULL);
     /*
     ** Initialize light cone offsets.
@@ -600,14 +678,16 @@ void pkdInitialize(
 	else pkd->pLightCone = v;
 #endif
 	mdlassert(mdl,pkd->pLightCone != NULL);
-	io_init(&pkd->afiLightCone,8,2*1024*1024,IO_AIO|IO_LIBAIO);
+	io_init(&pkd->afiLightCone,8,2*1024*1024,IO_AIO|IO_LIBAIO|IO_URING);
 	}
     else {
 	pkd->afiLightCone.nBuffers = 0;
 	pkd->pLightCone = NULL;
 	}
     pkd->afiLightCone.fd = -1;
-    pkd->pHealpixData = NULL;
+    lcShardInitialize(&pkd->lcShard);
+    pkd->nHealpixShells = 0;
+    pkd->nnCache.nSmooth = 0;
 
 #ifdef MDL_CACHE_SIZE
     if ( iCacheSize > 0 ) mdlSetCacheSize(pkd->mdl,iCacheSize);
@@ -619,6 +699,7 @@ void pkdInitialize(
     mdlSetCudaBufferSize(pkd->mdl,PP_CUDA_MEMORY_LIMIT,PP_CUDA_MEMORY_LIMIT);
 #endif
     mdlSetWorkQueueSize(pkd->mdl,iWorkQueueSize,iCUDAQueueSize);
+    mdlSetCacheWindow(pkd->mdl,iCacheWindow);
     /*
     ** Initialize neighbor list pointer to NULL if present.
     */
@@ -643,10 +724,15 @@ void pkdInitialize(
     pkd->fSoftFix = -1.0;
     pkd->fSoftFac = 1.0;
     pkd->fSoftMax = HUGE_VALF;
+    pkd->fiPMSplit = 0.0;
+    pkd->fPMCut2 = 0.0;
     /*
     ** Ewald stuff!
     */
     pkd->ew.nMaxEwhLoop = 0;
+    pkd->ewg.pTable = NULL;
+    pkd->ewg.nGrid = pkd->ewg.nNodes = 0;
+    pkd->ewg.bValid = pkd->ewg.bWarned = 0;
     *ppkd = pkd;
     /*
     ** Tree walk stuff.
@@ -680,6 +766,12 @@ void pkdInitialize(
     pkd->hopGroups = NULL;
     pkd->hopRootIndex = NULL;
     pkd->hopRoots = NULL;
+    pkd->subhaloTable = NULL;
+    pkd->nSubhalos = 0;
+    pkd->mergerHarvest = pkd->mergerSelect = NULL;
+    pkd->mergerEdges = NULL;
+    pkd->nMergerHarvest = pkd->nMergerSelect = pkd->nMergerEdges = 0;
+    pkd->bMergerTagged = 0;
     assert(pkdNodeSize(pkd) > 0);
     }
 
@@ -727,8 +819,13 @@ void pkdFinish(PKD pkd) {
 	SIMD_free(pkd->ewt.hCfac.f);
 	SIMD_free(pkd->ewt.hSfac.f);
 	}
+    if (pkd->ewg.pTable) mdlFreeArray(pkd->mdl,pkd->ewg.pTable);
 
     free(pkd->pClass);
+    free(pkd->subhaloTable);
+    free(pkd->mergerHarvest);
+    free(pkd->mergerSelect);
+    free(pkd->mergerEdges);
     /*
     ** Free any neighbor lists that were left hanging around.
     */
@@ -751,6 +848,9 @@ void pkdFinish(PKD pkd) {
 	mdlFree(pkd->mdl, pkd->pStorePRIVATE);
 #endif
     }
+    freeSoaField(pkd,pkd->pSoaVel);
+    freeSoaField(pkd,pkd->pSoaAccel);
+    freeSoaField(pkd,pkd->pSoaPot);
     free(pkd->pTempPRIVATE);
     if (pkd->pLightCone) {
 #ifdef _MSC_VER
@@ -759,8 +859,9 @@ void pkdFinish(PKD pkd) {
 	free(pkd->pLightCone);
 #endif
         }
-    if (pkd->pHealpixData) free(pkd->pHealpixData);
+    for (i=0; i<pkd->nHealpixShells; ++i) free(pkd->healpixShells[i].pData);
     io_free(&pkd->afiLightCone);
+    lcShardFinish(&pkd->lcShard);
     if (pkd->csm) { csmFinish(pkd->csm); pkd->csm = NULL; }
     SIMD_free(pkd);
     }
@@ -896,6 +997,8 @@ void pkdReadFIO(PKD pkd,FIO fio,uint64_t iFirst,int nLocal,double dvFac, double
 	if (!pkd->bNoParticleOrder) p->uNewRung = 0;
 	p->bMarked = 1;
 	pkdSetDensity(pkd,p,0.0);
+	pkdSetWork(pkd,p,0.0);
+	pkdSetMergerTag(pkd,p,0);
 	if (pkd->oFieldOffset[oBall]) pkdSetBall(pkd,p,0.0);
 	/*
 	** Clear the accelerations so that the timestepping calculations do not
@@ -1188,15 +1291,60 @@ uint64_t hilbert3d(float x,float y,float z) {
     return s;
     }
 
+/*
+** Sum the measured work of the local particles and count those that have one.
+*/
+void pkdMeasuredWork(PKD pkd,double *pfWork,uint64_t *pnMeasured) {
+    double fWork = 0.0;
+    uint64_t nMeasured = 0;
+    int i;
+    if (pkd->oFieldOffset[oWork]) {
+	for (i=0;i<pkdLocal(pkd);++i) {
+	    float w = pkdWork(pkd,pkdParticle(pkd,i));
+	    if (w > 0.0f) { fWork += w; ++nMeasured; }
+	    }
+	}
+    *pfWork = fWork;
+    *pnMeasured = nMeasured;
+    }
+
+/*
+** Calculate the lower weight and upper weight BETWEEN the particles
+** iFrom to iTo, split at iPart. With PKD_MODEL_WORK this is the gravity
+** work measured at the last force calculation; particles without a
+** measurement (before the first one, or new particles) weigh fWorkDefault,
+** which is fixed for the whole decomposition so the weight is monotonic
+** in the split.
+*/
+static void pkdRangeWeight(PKD pkd,int iFrom,int iTo,int iPart,double fWorkDefault,double *pfLower,double *pfUpper) {
+    if (pkd->oFieldOffset[oWork]) {
+	double fWork, fLower = 0.0, fUpper = 0.0;
+	int i;
+	for (i=iFrom;i<=iTo;++i) {
+	    fWork = pkdWork(pkd,pkdParticle(pkd,i));
+	    if (!(fWork > 0.0)) fWork = fWorkDefault;
+	    if (i < iPart) fLower += fWork;
+	    else fUpper += fWork;
+	    }
+	*pfLower = fLower;
+	*pfUpper = fUpper;
+	}
+    else {
+	*pfLower = iPart - iFrom;
+	*pfUpper = iTo - iPart + 1;
+	}
+    }
+
 /*
 ** Partition particles between iFrom and iTo into those < fSplit and
 ** those >= to fSplit.  Find number and weight in each partition.
 */
-int pkdWeight(PKD pkd,int d,double fSplit,int iSplitSide,int iFrom,int iTo,
+int pkdWeight(PKD pkd,int d,double fSplit,int iSplitSide,int iFrom,int iTo,double fWorkDefault,
 	      int *pnLow,int *pnHigh,double *pfLow,double *pfHigh) {
     int iPart;
     double fLower,fUpper;
 
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
     /*
     ** First partition the memory about fSplit for particles iFrom to iTo.
     */
@@ -1210,12 +1358,7 @@ int pkdWeight(PKD pkd,int d,double fSplit,int iSplitSide,int iFrom,int iTo,
 	*pnLow = iPart;
 	*pnHigh = pkdLocal(pkd)-iPart;
 	}
-    /*
-    ** Calculate the lower weight and upper weight BETWEEN the particles
-    ** iFrom to iTo!
-    */
-    fLower = iPart - iFrom;
-    fUpper = iTo - iPart + 1;
+    pkdRangeWeight(pkd,iFrom,iTo,iPart,fWorkDefault,&fLower,&fUpper);
     if (iSplitSide) {
 	*pfLow = fUpper;
 	*pfHigh = fLower;
@@ -1235,6 +1378,7 @@ int pkdWeightWrap(PKD pkd,int d,double fSplit,double fSplit2,int iSplitSide,
 		  int iFrom,int iTo,int *pnLow,int *pnHigh) {
     int iPart;
 
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
     /*
     ** First partition the memory about fSplit for particles iFrom to iTo.
     */
@@ -1256,6 +1400,7 @@ int pkdOrdWeight(PKD pkd,uint64_t iOrdSplit,int iSplitSide,int iFrom,int iTo,
 		 int *pnLow,int *pnHigh) {
     int iPart;
 
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
     /*
     ** First partition the memory about fSplit for particles iFrom to iTo.
     */
@@ -1272,6 +1417,38 @@ int pkdOrdWeight(PKD pkd,uint64_t iOrdSplit,int iSplitSide,int iFrom,int iTo,
     return(iPart);
     }
 
+/*
+** Partition particles between iFrom and iTo about the Peano-Hilbert key
+** iKeySplit (keys of the box bnd). Find number and weight in each partition.
+*/
+int pkdKeyWeight(PKD pkd,const BND *bnd,uint64_t iKeySplit,int iSplitSide,int iFrom,int iTo,double fWorkDefault,
+		 int *pnLow,int *pnHigh,double *pfLow,double *pfHigh) {
+    int iPart;
+    double fLower,fUpper;
+
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
+    if (iSplitSide) {
+	iPart = pkdLowerKeyPart(pkd,bnd,iKeySplit,iFrom,iTo);
+	*pnLow = pkdLocal(pkd)-iPart;
+	*pnHigh = iPart;
+	}
+    else {
+	iPart = pkdUpperKeyPart(pkd,bnd,iKeySplit,iFrom,iTo);
+	*pnLow = iPart;
+	*pnHigh = pkdLocal(pkd)-iPart;
+	}
+    pkdRangeWeight(pkd,iFrom,iTo,iPart,fWorkDefault,&fLower,&fUpper);
+    if (iSplitSide) {
+	*pfLow = fUpper;
+	*pfHigh = fLower;
+	}
+    else {
+	*pfLow = fLower;
+	*pfHigh = fUpper;
+	}
+    return(iPart);
+    }
+
 
 int pkdLowerPart(PKD pkd,int d,double fSplit,int i,int j) {
     PARTICLE *pi, *pj;
@@ -1364,11 +1541,51 @@ int pkdUpperOrdPart(PKD pkd,uint64_t nOrdSplit,int i,int j) {
     return(i);
     }
 
+/*
+** Peano-Hilbert key of a particle, with the box bnd mapped onto the
+** range [1,2) that hilbert3d requires. Positions outside are clamped.
+*/
+uint64_t pkdHilbertKey(PKD pkd,PARTICLE *p,const BND *bnd) {
+    float r[3];
+    int j;
+    for (j=0;j<3;++j) {
+	double w = 2.0*bnd->fMax[j];
+	r[j] = w > 0.0 ? 1.0 + (pkdPos(pkd,p,j) - bnd->fCenter[j] + bnd->fMax[j]) / w : 1.0;
+	if (!(r[j] >= 1.0f)) r[j] = 1.0f;
+	else if (r[j] >= 2.0f) r[j] = 0x1.fffffep0f;
+	}
+    return hilbert3d(r[0],r[1],r[2]);
+    }
+
+int pkdLowerKeyPart(PKD pkd,const BND *bnd,uint64_t iKeySplit,int i,int j) {
+    PARTICLE *pi, *pj;
+    pi = pkdParticle(pkd,i);
+    pj = pkdParticle(pkd,j);
+    PARTITION(pi<pj,pi<=pj,
+	       pi=pkdParticle(pkd,++i),pj=pkdParticle(pkd,--j),
+	       pkdSwapParticle(pkd,pi,pj),
+	       pkdHilbertKey(pkd,pi,bnd) >= iKeySplit,pkdHilbertKey(pkd,pj,bnd) < iKeySplit);
+    return(i);
+    }
+
+
+int pkdUpperKeyPart(PKD pkd,const BND *bnd,uint64_t iKeySplit,int i,int j) {
+    PARTICLE *pi, *pj;
+    pi = pkdParticle(pkd,i);
+    pj = pkdParticle(pkd,j);
+    PARTITION(pi<pj,pi<=pj,
+	       pi=pkdParticle(pkd,++i),pj=pkdParticle(pkd,--j),
+	       pkdSwapParticle(pkd,pi,pj),
+	       pkdHilbertKey(pkd,pi,bnd) < iKeySplit,pkdHilbertKey(pkd,pj,bnd) >= iKeySplit);
+    return(i);
+    }
+
 
 int pkdActiveOrder(PKD pkd) {
     int i=0;
     int j=pkdLocal(pkd)-1;
     PARTICLE *pi, *pj;
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
     pi = pkdParticle(pkd,i);
     pj = pkdParticle(pkd,j);
     PARTITION(pi<pj,pi<=pj,
@@ -1384,6 +1601,7 @@ int pkdColRejects(PKD pkd,int nSplit) {
 
     mdlassert(pkd->mdl,pkd->nRejects == 0);
 
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
     pkd->nRejects = pkdLocal(pkd) - nSplit;
     iRejects = pkdFreeStore(pkd) - pkd->nRejects;
     /*
@@ -1398,16 +1616,41 @@ int pkdColRejects(PKD pkd,int nSplit) {
     }
 
 
+/*
+** With PKD_MODEL_SOA the separate fields must follow the particles. The swap
+** is a byte stream, so swapping each field array with the same buffer and
+** outgoing element counts places the fields into the same slots as the
+** particles. Both partners make the same sequence of calls.
+*/
+static void swapSoaFields(PKD pkd,int idSwap,int iBuf,size_t nBuf,size_t nOut,size_t nSnd,size_t nRcv) {
+    struct { char *pData; size_t iSize; } field[3] = {
+	{(char *)pkd->pSoaVel,   3*sizeof(vel_t)},
+	{(char *)pkd->pSoaAccel, 3*sizeof(float)},
+	{(char *)pkd->pSoaPot,   sizeof(float)} };
+    size_t nSndBytes,nRcvBytes;
+    int i;
+    for(i=0; i<3; ++i) {
+	if (field[i].pData == NULL) continue;
+	mdlSwap(pkd->mdl,idSwap,nBuf*field[i].iSize,field[i].pData + iBuf*field[i].iSize,
+		nOut*field[i].iSize,&nSndBytes,&nRcvBytes);
+	mdlassert(pkd->mdl,nSndBytes == nSnd*field[i].iSize);
+	mdlassert(pkd->mdl,nRcvBytes == nRcv*field[i].iSize);
+	}
+    }
+
 int pkdSwapRejects(PKD pkd,int idSwap) {
     size_t nBuf;
     size_t nOutBytes,nSndBytes,nRcvBytes;
 
     if (idSwap != -1) {
+	pkd->nnCache.nSmooth = 0; /* Particles are reordered */
 	nBuf = (pkdSwapSpace(pkd))*pkdParticleSize(pkd);
 	nOutBytes = pkd->nRejects*pkdParticleSize(pkd);
 	mdlassert(pkd->mdl,pkdLocal(pkd) + pkd->nRejects <= pkdFreeStore(pkd));
 	mdlSwap(pkd->mdl,idSwap,nBuf,pkdParticle(pkd,pkdLocal(pkd)),
 		nOutBytes,&nSndBytes,&nRcvBytes);
+	if (pkd->bSoA) swapSoaFields(pkd,idSwap,pkdLocal(pkd),pkdSwapSpace(pkd),pkd->nRejects,
+		nSndBytes/pkdParticleSize(pkd),nRcvBytes/pkdParticleSize(pkd));
 	pkd->nLocal += nRcvBytes/pkdParticleSize(pkd);
 	pkd->nRejects -= nSndBytes/pkdParticleSize(pkd);
 	}
@@ -1420,6 +1663,7 @@ void pkdSwapAll(PKD pkd, int idSwap) {
     int i;
     int iBuf;
 
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
     /*
     ** Move particles to High memory.
     */
@@ -1430,6 +1674,8 @@ void pkdSwapAll(PKD pkd, int idSwap) {
     nOutBytes = pkdLocal(pkd)*pkdParticleSize(pkd);
     mdlSwap(pkd->mdl,idSwap,nBuf,pkdParticleBase(pkd), nOutBytes,
 	    &nSndBytes, &nRcvBytes);
+    if (pkd->bSoA) swapSoaFields(pkd,idSwap,0,pkdFreeStore(pkd),pkdLocal(pkd),
+	    nSndBytes/pkdParticleSize(pkd),nRcvBytes/pkdParticleSize(pkd));
     mdlassert(pkd->mdl,nSndBytes/pkdParticleSize(pkd) == pkdLocal(pkd));
     pkd->nLocal = nRcvBytes/pkdParticleSize(pkd);
     }
@@ -1475,6 +1721,13 @@ int pkdColOrdRejects(PKD pkd,uint64_t nOrdSplit,int iSplitSide) {
     return pkdColRejects(pkd,nSplit);
     }
 
+int pkdColKeyRejects(PKD pkd,const BND *bnd,uint64_t iKeySplit,int iSplitSide) {
+    int nSplit;
+    if (iSplitSide) nSplit = pkdLowerKeyPart(pkd,bnd,iKeySplit,0,pkdLocal(pkd)-1);
+    else nSplit = pkdUpperKeyPart(pkd,bnd,iKeySplit,0,pkdLocal(pkd)-1);
+    return pkdColRejects(pkd,nSplit);
+    }
+
 //static int cmpParticles(const void *pva,const void *pvb) {
 //    PARTICLE *pa = (PARTICLE *)pva;
 //    PARTICLE *pb = (PARTICLE *)pvb;
@@ -1484,6 +1737,7 @@ int pkdColOrdRejects(PKD pkd,uint64_t nOrdSplit,int iSplitSide) {
 void pkdLocalOrder(PKD pkd,uint64_t iMinOrder, uint64_t iMaxOrder) {
     int i;
     assert(pkd->nLocal == iMaxOrder - iMinOrder + 1);
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
     for (i=0;i<pkd->nLocal;++i) {
 	PARTICLE *p1 = pkdParticle(pkd,i);
 	assert(p1->iOrder >= iMinOrder && p1->iOrder <= iMaxOrder);
@@ -1495,47 +1749,6 @@ void pkdLocalOrder(PKD pkd,uint64_t iMinOrder, uint64_t iMaxOrder) {
     /* Above replaces: qsort(pkdParticleBase(pkd),pkdLocal(pkd),pkdParticleSize(pkd),cmpParticles); */
     }
 
-#define MAX_IO_BUFFER_SIZE (8*1024*1024)
-
-void pkdCheckpoint(PKD pkd,const char *fname) {
-    asyncFileInfo info;
-    size_t nFileSize;
-    int fd;
-    io_init(&info, IO_MAX_ASYNC_COUNT, 0, IO_AIO|IO_LIBAIO);
-    fd = io_create(&info, fname);
-    if (fd<0) { perror(fname); abort(); }
-    nFileSize = pkdParticleSize(pkd) * pkd->nLocal;
-    char *pBuffer = (char *)pkdParticleBase(pkd);
-    while(nFileSize) {
-        size_t count = nFileSize > MAX_IO_BUFFER_SIZE ? MAX_IO_BUFFER_SIZE : nFileSize;
-        io_write(&info, pBuffer, count);
-        pBuffer += count;
-        nFileSize -= count;
-        }
-    io_close(&info);
-    }
-
-void pkdRestore(PKD pkd,const char *fname) {
-    asyncFileInfo info;
-    size_t nFileSize;
-    int fd;
-    io_init(&info, IO_MAX_ASYNC_COUNT, 0, IO_AIO|IO_LIBAIO);
-    fd = io_open(&info, fname);
-    if (fd<0) { perror(fname); abort(); }
-    struct stat s;
-    if ( fstat(fd,&s) != 0 ) { perror(fname); abort(); }
-    nFileSize = s.st_size;
-    pkd->nLocal = nFileSize / pkdParticleSize(pkd);
-    char *pBuffer = (char *)pkdParticleBase(pkd);
-    while(nFileSize) {
-        size_t count = nFileSize > MAX_IO_BUFFER_SIZE ? MAX_IO_BUFFER_SIZE : nFileSize;
-        io_read(&info, pBuffer, count);
-        pBuffer += count;
-        nFileSize -= count;
-        }
-    io_close(&info);
-    }
-
 /*****************************************************************************\
 * Write particles received from another node
 \*****************************************************************************/
@@ -1710,6 +1923,18 @@ char *pkdPackArray(PKD pkd,int iSize,void *vBuff,int *piIndex,int n,int field,in
 	    V[1] = v[1] * dvFac;
 	    V[2] = v[2] * dvFac;
 	    }
+	else if (field==oAcceleration) {
+	    memcpy(pBuff,pkdAccel(pkd,p),iUnitSize);
+	    }
+	else if (field==oPotential) {
+	    memcpy(pBuff,pkdPot(pkd,p),iUnitSize);
+	    }
+	else if (field==oGroup && pkd->ga != NULL) {
+	    /* Local group ids differ between domains: send the group name */
+	    uint64_t *G = (uint64_t *)pBuff;
+	    int gid = pkdGetGroup(pkd,p);
+	    *G = gid ? (uint64_t)pkd->ga[gid].id.iPid << 32 | pkd->ga[gid].id.iIndex : 0;
+	    }
 	else {
             const char *src = (const char *)pkdField(p,oOffset);
 	    memcpy(pBuff,src,iUnitSize);
@@ -1797,7 +2022,8 @@ void pkdGravAll(PKD pkd,
     struct pkdKickParameters *kick,struct pkdLightconeParameters *lc,struct pkdTimestepParameters *ts,
     double dTime,int nReps,int bPeriodic,
     int bEwald,int nGroup,int iRoot1, int iRoot2,
-    double fEwCut,double fEwhCut,double dThetaMin,
+    double fEwCut,double fEwhCut,int nEwaldGrid,double dEwaldGridTol,double dThetaMin,
+    double dPMSplit,double dPMCut,
     uint64_t *pnActive,
     double *pdPart,double *pdPartNumAccess,double *pdPartMissRatio,
     double *pdCell,double *pdCellNumAccess,double *pdCellMissRatio,
@@ -1827,9 +2053,14 @@ void pkdGravAll(PKD pkd,
     ** Set up Ewald tables and stuff.
     */
     if (bPeriodic && bEwald) {
-	pkdEwaldInit(pkd,nReps,fEwCut,fEwhCut);	/* ignored in Flop count! */
+	pkdEwaldInit(pkd,nReps,fEwCut,fEwhCut,nEwaldGrid,dEwaldGridTol);	/* ignored in Flop count! */
 	}
     /*
+    ** With TreePM the tree only computes the short-range force (see walk2.cxx).
+    */
+    pkd->fiPMSplit = dPMSplit > 0.0 ? 0.5 / dPMSplit : 0.0;
+    pkd->fPMCut2 = dPMCut * dPMCut;
+    /*
     ** Start particle caching space (cell cache already active).
     */
     mdlROcache(pkd->mdl,CID_PARTICLE,NULL,pkdParticleBase(pkd),pkdParticleSize(pkd),
@@ -1910,8 +2141,13 @@ void pkdCalcEandL(PKD pkd,double *T,double *U,double *Eth,double *L,double *F,do
     }
 
 static void flushLightCone(PKD pkd) {
-    size_t count = pkd->nLightCone * sizeof(LIGHTCONEP);
-    io_write(&pkd->afiLightCone,pkd->pLightCone,count);
+    if (pkd->lcShard.nSide) {
+	lcShardWrite(&pkd->lcShard,&pkd->afiLightCone,pkd->pLightCone,pkd->nLightCone);
+	}
+    else {
+	size_t count = pkd->nLightCone * sizeof(LIGHTCONEP);
+	io_write(&pkd->afiLightCone,pkd->pLightCone,count);
+	}
     pkd->nLightCone = 0;
     }
 
@@ -1936,54 +2172,109 @@ static void combHealpix(void *vctx, void *v1, const void *v2) {
     m1->fPotential += m2->fPotential;
     }
 
-void pkdLightConeClose(PKD pkd,const char *healpixname) {
-    int i;
+/* The CID_HEALPIX elements are the resident shells one after the other */
+static void *getHealpixElement(void *vpkd,int i,int iDataSize) {
+    PKD pkd = vpkd;
+    int k;
+    for (k=0; k<pkd->nHealpixShells; ++k) {
+	HEALPIXSHELL *s = &pkd->healpixShells[k];
+	if (i < s->iLocal + s->nPerDomain) return s->pData + (i - s->iLocal);
+	}
+    assert(0);
+    return NULL;
+    }
+
+static void writeHealpixShell(PKD pkd,HEALPIXSHELL *s,const char *name) {
     size_t nWrite;
+    int64_t i;
+    int fd = open(name,O_CREAT|O_WRONLY|O_TRUNC,FILE_PROTECTION);
+    if (fd<0) { perror(name); abort(); }
+    for(i=0; i<s->nPerDomain; ++i) {
+	uint64_t sum = s->pData[i].nGrouped;
+	sum += s->pData[i].nUngrouped;
+	if (sum) s->pData[i].fPotential /= sum;
+	}
+    nWrite = s->nPerDomain * sizeof(*s->pData);
+    if (write(fd,s->pData,nWrite) != nWrite) {
+	perror("Wrong size writing Healpix");
+	}
+    close(fd);
+    }
+
+/*
+** Write and release the per step map (to healpixname) and any shells that
+** the light cone has now passed completely, i.e., those with rInner >= rComplete
+** (to shellname.hpsNNNN.id).
+*/
+void pkdLightConeClose(PKD pkd,const char *healpixname,const char *shellname,double rComplete) {
+    int i,j;
     if (pkd->afiLightCone.fd > 0) {
 	flushLightCone(pkd);
 	io_close(&pkd->afiLightCone);
+	lcShardClose(&pkd->lcShard);
 	}
-    if (pkd->nSideHealpix) {
-	assert(healpixname && healpixname[0]);
+    if (pkd->nHealpixShells) {
 	mdlFinishCache(pkd->mdl,CID_HEALPIX);
-	int fd = open(healpixname,O_CREAT|O_WRONLY|O_TRUNC,FILE_PROTECTION);
-	if (fd<0) { perror(healpixname); abort(); }
-	for(i=0; i<pkd->nHealpixPerDomain; ++i) {
-	    uint64_t sum = pkd->pHealpixData[i].nGrouped;
-	    sum += pkd->pHealpixData[i].nUngrouped;
-	    if (sum) pkd->pHealpixData[i].fPotential /= sum;
-	    }
-	nWrite = pkd->nHealpixPerDomain * sizeof(*pkd->pHealpixData);
-	if (write(fd,pkd->pHealpixData,nWrite) != nWrite) {
-	    perror("Wrong size writing Healpix");
+	for (i=0; i<pkd->nHealpixShells; ) {
+	    HEALPIXSHELL *s = &pkd->healpixShells[i];
+	    char achName[PATH_MAX];
+	    if (s->spec.iShell < 0) {
+		assert(healpixname && healpixname[0]);
+		strcpy(achName,healpixname);
+		}
+	    else {
+		if (s->spec.rInner < rComplete) { ++i; continue; }
+		snprintf(achName,sizeof(achName),"%s.hps%04d.%d",shellname,s->spec.iShell,mdlSelf(pkd->mdl));
+		}
+	    writeHealpixShell(pkd,s,achName);
+	    free(s->pData);
+	    for (j=i+1; j<pkd->nHealpixShells; ++j) pkd->healpixShells[j-1] = pkd->healpixShells[j];
+	    --pkd->nHealpixShells;
 	    }
-	close(fd);
 	}
     }
 
-void pkdLightConeOpen(PKD pkd,const char *fname,int nSideHealpix) {
-    int i;
+/*
+** If nSideShard is set then the particles are written in HEALPix and
+** radial shell ordered blocks with an index (see io/lcshard.h).
+*/
+void pkdLightConeOpen(PKD pkd,const char *fname,int nHealpixShells,const HEALPIXSHELLSPEC *healpixShells,
+    const char *indexname,int nSideShard,double dShellWidth,double dQuantum) {
+    int64_t i,iLocal;
+    int j,k;
     if (fname[0]) {
 	if (io_create(&pkd->afiLightCone,fname) < 0) { perror(fname); abort(); }
+	if (nSideShard) lcShardOpen(&pkd->lcShard,indexname,nSideShard,dShellWidth,dQuantum);
 	}
     else pkd->afiLightCone.fd = -1;
 
-    pkd->nSideHealpix = nSideHealpix;
-    if (pkd->nSideHealpix) {
-	pkd->nHealpixPerDomain = ( nside2npix64(pkd->nSideHealpix) + mdlThreads(pkd->mdl) - 1) / mdlThreads(pkd->mdl);
-	pkd->nHealpixPerDomain = (pkd->nHealpixPerDomain+15) & ~15;
-	if (pkd->pHealpixData==NULL) {
-	    pkd->pHealpixData = malloc(pkd->nHealpixPerDomain * sizeof(*pkd->pHealpixData));
-	    assert(pkd->pHealpixData!=NULL);
+    /*
+    ** Shells that are already resident keep accumulating; new ones start empty.
+    */
+    for (j=0; j<nHealpixShells; ++j) {
+	for (k=0; k<pkd->nHealpixShells && pkd->healpixShells[k].spec.iShell != healpixShells[j].iShell; ++k) {}
+	if (k < pkd->nHealpixShells) continue;
+	assert(pkd->nHealpixShells < MAX_HEALPIX_SHELLS);
+	HEALPIXSHELL *s = &pkd->healpixShells[pkd->nHealpixShells++];
+	s->spec = healpixShells[j];
+	s->nPerDomain = ( nside2npix64(s->spec.nSide) + mdlThreads(pkd->mdl) - 1) / mdlThreads(pkd->mdl);
+	s->nPerDomain = (s->nPerDomain+15) & ~15;
+	s->pData = malloc(s->nPerDomain * sizeof(*s->pData));
+	assert(s->pData!=NULL);
+	for (i=0; i<s->nPerDomain; ++i) {
+	    s->pData[i].nGrouped = 0;
+	    s->pData[i].nUngrouped = 0;
+	    s->pData[i].fPotential = 0;
 	    }
-	for (i=0; i<pkd->nHealpixPerDomain; ++i) {
-	    pkd->pHealpixData[i].nGrouped = 0;
-	    pkd->pHealpixData[i].nUngrouped = 0;
-	    pkd->pHealpixData[i].fPotential = 0;
+	}
+    if (pkd->nHealpixShells) {
+	for (k=0,iLocal=0; k<pkd->nHealpixShells; ++k) {
+	    pkd->healpixShells[k].iLocal = iLocal;
+	    iLocal += pkd->healpixShells[k].nPerDomain;
 	    }
-	mdlCOcache(pkd->mdl,CID_HEALPIX,NULL,
-	    pkd->pHealpixData,sizeof(*pkd->pHealpixData),
-	    pkd->nHealpixPerDomain,pkd,initHealpix,combHealpix);
+	assert(iLocal <= INT_MAX);
+	mdlCOcache(pkd->mdl,CID_HEALPIX,getHealpixElement,
+	    pkd,sizeof(healpixData),iLocal,pkd,initHealpix,combHealpix);
 	}
     }
 
@@ -2002,27 +2293,86 @@ void addToLightCone(PKD pkd,double *r,float fPot,PARTICLE *p,int bParticleOutput
 #endif
 	if (++pkd->nLightCone == pkd->nLightConeMax) flushLightCone(pkd);
 	}
-    if (pkd->nSideHealpix) {
-	int64_t iPixel = vec2pix_ring64(pkd->nSideHealpix, r);
-	assert(iPixel >= 0);
-	int id  = iPixel / pkd->nHealpixPerDomain;
-	int idx = iPixel - id*pkd->nHealpixPerDomain;
-	assert(id<mdlThreads(pkd->mdl));
-	assert(idx < pkd->nHealpixPerDomain);
-	healpixData *m = mdlVirtualFetch(pkd->mdl,CID_HEALPIX,idx,id);
-	if (pkdGetGroup(pkd,p)) {
-	    if (m->nGrouped < 0xffffffffu) ++m->nGrouped; /* Increment with saturate */
+    if (pkd->nHealpixShells) {
+	double mr = sqrt(r[0]*r[0] + r[1]*r[1] + r[2]*r[2]);
+	int k;
+	for (k=0; k<pkd->nHealpixShells; ++k) {
+	    const HEALPIXSHELL *s = &pkd->healpixShells[k];
+	    if (mr < s->spec.rInner || mr >= s->spec.rOuter) continue;
+	    int64_t iPixel = vec2pix_ring64(s->spec.nSide, r);
+	    assert(iPixel >= 0);
+	    int id  = iPixel / s->nPerDomain;
+	    int idx = iPixel - id*s->nPerDomain;
+	    assert(id<mdlThreads(pkd->mdl));
+	    assert(idx < s->nPerDomain);
+	    healpixData *m = mdlVirtualFetch(pkd->mdl,CID_HEALPIX,s->iLocal + idx,id);
+	    if (pkdGetGroup(pkd,p)) {
+		if (m->nGrouped < 0xffffffffu) ++m->nGrouped; /* Increment with saturate */
+		}
+	    else {
+		if (m->nUngrouped < 0xffffffffu) ++m->nUngrouped; /* Increment with saturate */
+		}
+	    m->fPotential += fPot;
 	    }
-	else {
-	    if (m->nUngrouped < 0xffffffffu) ++m->nUngrouped; /* Increment with saturate */
+	}
+    }
+
+/*
+** Select the replicas that a group of particles (usually a bucket) can
+** reach during this light cone drift. rLo and rHi bound the positions
+** (wrapped to the unit cell) swept by all of the particles during their
+** drift, and dKickDelta is the largest lookback interval among them. A
+** replica is kept only if some point of the swept box lies between the
+** light surface at the start and at the end of the drift. This is done
+** once per bucket, so the per-particle test usually sees 0 or 1 replicas
+** instead of all 184.
+*/
+void pkdLightConeReplicas(PKD pkd,LCREPLICAS *rep,const double *rLo,const double *rHi,
+			double dLookbackFac,double dKickDelta,double dBoxSize) {
+    const double dLightSpeed = dLightSpeedSim(dBoxSize);
+    const double fEps = 1e-9;
+    double lo[3],hi[3];
+    double R0,R1;
+    int i,j;
+
+    R0 = dLightSpeed*dLookbackFac + fEps;
+    R1 = dLightSpeed*(dLookbackFac - dKickDelta) - fEps;
+    for (j=0;j<3;++j) {
+	lo[j] = rLo[j] - fEps;
+	hi[j] = rHi[j] + fEps;
+	/* Particles leaving the unit cell reappear on the other side */
+	if (lo[j] < -0.5 || hi[j] > 0.5) {
+	    lo[j] = -0.5;
+	    hi[j] = 0.5;
+	    }
+	}
+    rep->nBox = 0;
+    for (i=0;i<184;++i) {
+	double off[3] = {pkd->lcOffset0[i],pkd->lcOffset1[i],pkd->lcOffset2[i]};
+	double min2 = 0.0, max2 = 0.0;
+	for (j=0;j<3;++j) {
+	    double a = lo[j] + off[j];
+	    double b = hi[j] + off[j];
+	    if (a > 0.0) min2 += a*a;
+	    else if (b < 0.0) min2 += b*b;
+	    max2 += (a*a > b*b) ? a*a : b*b;
 	    }
-	m->fPotential += fPot;
+	if (min2 > R0*R0) continue;
+	if (R1 > 0.0 && max2 < R1*R1) continue;
+	rep->lcOffset0[rep->nBox] = off[0];
+	rep->lcOffset1[rep->nBox] = off[1];
+	rep->lcOffset2[rep->nBox] = off[2];
+	++rep->nBox;
+	}
+    /* Pad for the SIMD version with a replica far outside any light surface */
+    for (i=rep->nBox;i&7;++i) {
+	rep->lcOffset0[i] = rep->lcOffset1[i] = rep->lcOffset2[i] = 1e10;
 	}
     }
 
 #ifndef USE_SIMD_LC
 #define NBOX 184
-void pkdProcessLightCone(PKD pkd,PARTICLE *p,float fPot,double dLookbackFac,double dLookbackFacLCP,double dDriftDelta,double dKickDelta,double dBoxSize,int bLightConeParticles) {
+void pkdProcessLightCone(PKD pkd,PARTICLE *p,float fPot,double dLookbackFac,double dLookbackFacLCP,double dDriftDelta,double dKickDelta,double dBoxSize,int bLightConeParticles,const LCREPLICAS *rep) {
     const double dLightSpeed = dLightSpeedSim(dBoxSize);
     const double mrLCP = dLightSpeed*dLookbackFacLCP;
     double vrx0[NBOX],vry0[NBOX],vrz0[NBOX];
@@ -2039,30 +2389,13 @@ void pkdProcessLightCone(PKD pkd,PARTICLE *p,float fPot,double dLookbackFac,doub
 	} isect[4], temp;
     
     /*
-    ** Check all 184 by default.
+    ** Only the part of the light cone inside the outer layer of replicas
+    ** can be produced. The replicas to check were chosen for the bucket.
     */
-    nBox = NBOX;
+    nBox = rep->nBox;
     xStart = (dLookbackFac*dLightSpeed - 3.0)/(dKickDelta*dLightSpeed);
     if (xStart > 1) return;
-    else if (xStart < 0) {
-	xStart = (dLookbackFac*dLightSpeed - 2.0)/(dKickDelta*dLightSpeed);
-	if (xStart >= 0) xStart = 0;
-	else {
-	    /*
-	    ** Check only 64!
-	    */
-	    nBox = 64;
-	    xStart = (dLookbackFac*dLightSpeed - 1.0)/(dKickDelta*dLightSpeed);
-	    if (xStart >= 0) xStart = 0;
-	    else {
-		/*
-		** Check only 8!
-		*/
-		nBox = 8;
-		xStart = 0;
-		}
-	    }
-	}
+    else if (xStart < 0) xStart = 0;
 
     v = pkdVel(pkd,p);
     pkdGetPos1(pkd,p,r0);
@@ -2120,12 +2453,12 @@ void pkdProcessLightCone(PKD pkd,PARTICLE *p,float fPot,double dLookbackFac,doub
 	    }
 	for (j=0;j<3;++j) r1[j] = r0[j] + dt*v[j];
 	for(iOct=0; iOct<nBox; ++iOct) {
-	    vrx0[iOct] = pkd->lcOffset0[iOct] + r0[0];
-	    vry0[iOct] = pkd->lcOffset1[iOct] + r0[1];
-	    vrz0[iOct] = pkd->lcOffset2[iOct] + r0[2];
-	    vrx1[iOct] = pkd->lcOffset0[iOct] + r1[0];
-	    vry1[iOct] = pkd->lcOffset1[iOct] + r1[1];
-	    vrz1[iOct] = pkd->lcOffset2[iOct] + r1[2];
+	    vrx0[iOct] = rep->lcOffset0[iOct] + r0[0];
+	    vry0[iOct] = rep->lcOffset1[iOct] + r0[1];
+	    vrz0[iOct] = rep->lcOffset2[iOct] + r0[2];
+	    vrx1[iOct] = rep->lcOffset0[iOct] + r1[0];
+	    vry1[iOct] = rep->lcOffset1[iOct] + r1[1];
+	    vrz1[iOct] = rep->lcOffset2[iOct] + r1[2];
 	    mr0[iOct] = sqrt(vrx0[iOct]*vrx0[iOct] + vry0[iOct]*vry0[iOct] + vrz0[iOct]*vrz0[iOct]);
 	    mr1[iOct] = sqrt(vrx1[iOct]*vrx1[iOct] + vry1[iOct]*vry1[iOct] + vrz1[iOct]*vrz1[iOct]);
 	    x[iOct] = (dLightSpeed*dlbt - mr0[iOct])/(dLightSpeed*dtApprox - mr0[iOct] + mr1[iOct]);
@@ -2170,6 +2503,7 @@ void pkdDrift(PKD pkd,int iRoot,double dTime,double dDelta,double dDeltaVPred,do
     double rfinal[3],r0[3],dMin[3],dMax[3];
     int pLower, pUpper;
 
+    pkd->nnCache.nSmooth = 0;
     if (iRoot>=0) {
 	KDN *pRoot = pkdTreeNode(pkd,iRoot);
 	pLower = pRoot->pLower;
@@ -2215,7 +2549,7 @@ void pkdDrift(PKD pkd,int iRoot,double dTime,double dDelta,double dDeltaVPred,do
     else {
 	for (i=pLower;i<=pUpper;++i) {
 	    p = pkdParticle(pkd,i);
-	    v = pkdVel(pkd,p);
+	    v = pkd->bSoA ? pkd->pSoaVel + 3*i : pkdVel(pkd,p);
 	    pkdGetPos1(pkd,p,r0);
 	    for (j=0;j<3;++j) {
 		pkdSetPos(pkd,p,j,rfinal[j] = r0[j] + dDelta*v[j]);
@@ -2329,6 +2663,27 @@ void pkdKick(PKD pkd,double dTime,double dDelta,int bDoGas,double dDeltaVPred,do
 		}
 	    }
 	}
+    else if (pkd->bSoA) {
+	/*
+	** Separate arrays: when every rung is kicked this is a pure streaming
+	** loop over velocity and acceleration; otherwise only the rung is
+	** read from the particle.
+	*/
+	n = pkdLocal(pkd);
+	v = pkd->pSoaVel;
+	a = pkd->pSoaAccel;
+	if (uRungLo==0 && uRungHi>=MAX_RUNG) {
+	    for (i=0;i<3*n;++i) v[i] += a[i]*dDelta;
+	    }
+	else {
+	    for (i=0;i<n;++i) {
+		p = pkdParticle(pkd,i);
+		if (pkdIsRungRange(p,uRungLo,uRungHi)) {
+		    for (j=0;j<3;++j) v[3*i+j] += a[3*i+j]*dDelta;
+		    }
+		}
+	    }
+	}
     else {
 	n = pkdLocal(pkd);
 	for (i=0;i<n;++i) {
@@ -2693,6 +3048,7 @@ void pkdColNParts(PKD pkd, int *pnNew, int *nDeltaGas, int *nDeltaDark,
     int newnLocal;
     PARTICLE *p;
 
+    pkd->nnCache.nSmooth = 0; /* Particles are reordered */
     nNew = 0;
     ndGas = 0;
     ndDark = 0;
@@ -33,6 +33,7 @@
 #endif
 #include "basetype.h"
 #include "io/iomodule.h"
+#include "io/lcshard.h"
 #include "core/bound.h"
 
 #ifdef __cplusplus
@@ -83,6 +84,7 @@ static inline int64_t d2u64(double d) {
 #define CID_PNG         2
 #define CID_SADDLE_BUF  3
 #define CID_TREE_ROOT   3
+#define CID_COUNT       12 /* One more than the largest CID above */
 
 /*
 ** This is useful for debugging the very-active force calculation.
@@ -111,6 +113,9 @@ static inline int64_t d2u64(double d) {
 #define PKD_MODEL_PARTICLE_ID  (1<<13) /* Particles have a unique ID */
 #define PKD_MODEL_UNORDERED    (1<<14) /* Particles do not have an order */
 #define PKD_MODEL_INTEGER_POS  (1<<15) /* Particles do not have an order */
+#define PKD_MODEL_SOA          (1<<16) /* Velocity, acceleration & potential in separate arrays */
+#define PKD_MODEL_WORK         (1<<17) /* Measured gravity work for domain decomposition */
+#define PKD_MODEL_MERGER       (1<<18) /* Merger tree tracer tags */
 
 #define PKD_MODEL_NODE_MOMENT  (1<<24) /* Include moment in the tree */
 #define PKD_MODEL_NODE_ACCEL   (1<<25) /* mean accel on cell (for grav step) */
@@ -191,6 +196,18 @@ typedef struct partLightCone {
 #endif
     } LIGHTCONEP;
 
+/*
+** The periodic replicas (lower corner offsets, as in pkd->lcOffset) that a
+** group of particles can reach during one light cone drift. Entries past
+** nBox are padded out to a multiple of 8 with replicas that are never hit.
+*/
+typedef struct lcReplicas {
+    int nBox;
+    double lcOffset0[184];
+    double lcOffset1[184];
+    double lcOffset2[184];
+    } LCREPLICAS;
+
 /*
 ** General partition macro
 ** LT,LE: Compare less-than/less-than or equal
@@ -389,6 +406,23 @@ typedef struct {
     } ewaldSIMD;
 #endif
 
+/*
+** Tabulated Ewald correction. The potential and acceleration are stored
+** together (4 floats per node) on a grid of nGrid cells per box length
+** plus one extra node below and two above for the tricubic stencil.
+** The table is shared by all threads of a process.
+*/
+struct EwaldGrid {
+    float *pTable;
+    int nGrid;
+    int nNodes;       /* Allocated nodes, split equally between threads */
+    int bValid;       /* Passed the check against the exact sum */
+    int bWarned;
+    double dLower[3]; /* Offset from ew.r of node 1 */
+    double fInvCell;
+    double dError;    /* Largest sampled error relative to M/L^2 */
+    };
+
 /*
 ** This is the temporary group table used when Grasshopping.
 ** We eventually contruct a proper table.
@@ -439,6 +473,41 @@ typedef struct {
     float rHalf;
     } TinyGroupTable;
 
+/*
+** A bound substructure of a HOP group. iParent is the index of the enclosing
+** subhalo among those with the same iPid, or -1 for the outermost level.
+*/
+typedef struct {
+    int32_t iPid;
+    int32_t iGroup;
+    int32_t iParent;
+    int32_t iLevel;
+    int32_t nBound;     /* Including the members of nested subhalos */
+    int32_t nOwn;       /* Not in any nested subhalo */
+    float fMass;
+    float minPot;
+    float rPot[3];
+    float rcom[3];
+    float vcom[3];
+    } SUBHALO;
+
+/*
+** Merger tree bookkeeping. A tracer is a most bound particle of a group kept
+** by particle ID with the catalog index of its group, i.e., the position of
+** the group in the .fofstats/.hopstats output.
+*/
+typedef struct {
+    uint64_t iID;
+    int64_t iGroup;
+    } MERGERTRACER;
+
+typedef struct {
+    int64_t iProgenitor;    /* Catalog index at the previous group finding step */
+    int64_t iDescendant;    /* Catalog index at this step */
+    int32_t nShared;        /* Tracers of the progenitor found in the descendant */
+    int32_t nDescendant;    /* Members of the descendant */
+    } MERGEREDGE;
+
 //typedef struct {
 //    } SmallGroupTable;
 
@@ -567,6 +636,26 @@ typedef struct {
     float fPotential;
     } healpixData;
 
+/*
+** A comoving distance shell of the HEALPix light cone maps. A shell stays
+** resident (each thread holding nPerDomain of its pixels) from the first
+** step that the light cone enters it until the step it leaves, and is then
+** written. iShell is -1 for the map of all distances written every step.
+*/
+#define MAX_HEALPIX_SHELLS 16
+typedef struct {
+    int iShell;
+    int nSide;
+    double rInner, rOuter;
+    } HEALPIXSHELLSPEC;
+
+typedef struct {
+    HEALPIXSHELLSPEC spec;
+    int64_t nPerDomain;
+    int64_t iLocal;     /* Offset of this shell in the CID_HEALPIX elements */
+    healpixData *pData;
+    } HEALPIXSHELL;
+
 enum PKD_FIELD {
     oPosition,
     oVelocity, /* Three vel_t */
@@ -583,9 +672,12 @@ enum PKD_FIELD {
     oVelSmooth,
     oRungDest, /* Destination processor for each rung */
     oParticleID,
+    oWork, /* One float */
+    oMergerTag, /* One int32 */
 
     MAX_PKD_FIELD
     };
+#define PKD_FIELD_SOA (-1) /* Field is present but lives in a separate array */
 
 typedef struct pkdContext {
     MDL mdl;
@@ -626,9 +718,9 @@ typedef struct pkdContext {
     asyncFileInfo afiLightCone;
     LIGHTCONEP *pLightCone;
     int nLightCone, nLightConeMax;
-    int64_t nHealpixPerDomain;
-    int64_t nSideHealpix;
-    healpixData *pHealpixData;
+    LCSHARD lcShard;
+    int nHealpixShells;
+    HEALPIXSHELL healpixShells[MAX_HEALPIX_SHELLS];
 
     PARTCLASS *pClass;
     float fSoftFix;
@@ -643,6 +735,17 @@ typedef struct pkdContext {
     int bNoParticleOrder;
     int bIntegerPosition;
     int oFieldOffset[MAX_PKD_FIELD];
+    /*
+    ** Structure-of-arrays memory model (PKD_MODEL_SOA). The velocity, acceleration
+    ** and potential live in node-wide arrays that have the same per-thread stride
+    ** as the particle store, so the slot of any on-node particle indexes them.
+    ** The corresponding oFieldOffset[] entries are set to PKD_FIELD_SOA.
+    */
+    int bSoA;
+    uint32_t nSoaBytes; /* per-particle */
+    vel_t *pSoaVel;
+    float *pSoaAccel;
+    float *pSoaPot;
 
     /*
     ** Advanced memory models - Tree Nodes
@@ -674,6 +777,12 @@ typedef struct pkdContext {
     ** Opening angle table for mass weighting.
     */
     float fiCritTheta;
+    /*
+    ** TreePM force split: 1/(2r_s) and the squared cutoff radius of the
+    ** short-range force, or zero if the tree computes the full force.
+    */
+    float fiPMSplit;
+    float fPMCut2;
     /* Potential Energy for when potential is not in the particle */
     double dEnergyU;
     /* also put kinetic energy here to calculate it on the fly */
@@ -696,6 +805,18 @@ typedef struct pkdContext {
 #ifdef USE_SIMD_EWALD
     ewaldSIMD es;
 #endif
+    struct EwaldGrid ewg;
+    /*
+    ** Neighbor lists left in the ephemeral area by smSmooth for reuse by the
+    ** next smooth with the same nSmooth (nSmooth is 0 if there are none).
+    ** They are invalidated by a drift and by anything that reorders particles
+    ** (tree build, domain decomposition, group and local ordering).
+    */
+    struct {
+	int nSmooth;
+	int bPeriodic;
+	uint64_t uChecksum;
+	} nnCache;
 
     struct psGroupTable psGroupTable;
 
@@ -714,6 +835,13 @@ typedef struct pkdContext {
     int *hopRootIndex;
     int hopSavedRoots;
     remoteID *hopRoots;
+    SUBHALO *subhaloTable;
+    int nSubhalos;
+    MERGERTRACER *mergerHarvest; /* Tracers of the previous step, sorted by iID */
+    MERGERTRACER *mergerSelect;  /* New tracers, sorted by iID */
+    MERGEREDGE *mergerEdges;
+    int nMergerHarvest, nMergerSelect, nMergerEdges;
+    int bMergerTagged;
 
     struct saddle_point_list saddle_points;
     int nRm;
@@ -957,7 +1085,7 @@ static inline size_t pkdParticleSize( PKD pkd ) {
     return pkd->iParticleSize;
     }
 static inline size_t pkdParticleMemory(PKD pkd) {
-    return (pkd->iParticleSize + pkd->nEphemeralBytes) * (pkd->nStore+1);
+    return (pkd->iParticleSize + pkd->nSoaBytes + pkd->nEphemeralBytes) * (pkd->nStore+1);
     }
 static inline PARTICLE *pkdParticleGet( PKD pkd, void *pBase, int i ) {
     char *v = (char *)pBase;
@@ -967,14 +1095,50 @@ static inline PARTICLE *pkdParticleGet( PKD pkd, void *pBase, int i ) {
 static inline PARTICLE *pkdParticle( PKD pkd, int i ) {
     return pkdParticleGet(pkd,pkd->pStorePRIVATE,i);
     }
+/*
+** With PKD_MODEL_SOA the slot of a particle in the (node-wide) store is the
+** index into the separate field arrays. Only particles that live on this node
+** have a slot; cached copies of remote particles do not carry these fields.
+*/
+static inline ptrdiff_t pkdSoaIndex( PKD pkd, const PARTICLE *p ) {
+    return ((const char *)p - (const char *)pkd->pStorePRIVATE) / (ptrdiff_t)pkd->iParticleSize;
+    }
+/* Gather or scatter the separate fields of particle slot i to or from a buffer */
+static inline void pkdSoaSave( PKD pkd, ptrdiff_t i, char *pBuffer ) {
+    memcpy(pBuffer,pkd->pSoaVel+3*i,3*sizeof(vel_t));
+    pBuffer += 3*sizeof(vel_t);
+    if (pkd->pSoaAccel) {
+	memcpy(pBuffer,pkd->pSoaAccel+3*i,3*sizeof(float));
+	pBuffer += 3*sizeof(float);
+	}
+    if (pkd->pSoaPot) memcpy(pBuffer,pkd->pSoaPot+i,sizeof(float));
+    }
+static inline void pkdSoaLoad( PKD pkd, ptrdiff_t i, const char *pBuffer ) {
+    memcpy(pkd->pSoaVel+3*i,pBuffer,3*sizeof(vel_t));
+    pBuffer += 3*sizeof(vel_t);
+    if (pkd->pSoaAccel) {
+	memcpy(pkd->pSoaAccel+3*i,pBuffer,3*sizeof(float));
+	pBuffer += 3*sizeof(float);
+	}
+    if (pkd->pSoaPot) memcpy(pkd->pSoaPot+i,pBuffer,sizeof(float));
+    }
+
 static inline void pkdSaveParticle(PKD pkd, PARTICLE *a) {
     memcpy(pkd->pTempPRIVATE,a,pkdParticleSize(pkd));
+    if (pkd->bSoA) pkdSoaSave(pkd,pkdSoaIndex(pkd,a),(char *)pkd->pTempPRIVATE + pkdParticleSize(pkd));
     }
 static inline void pkdLoadParticle(PKD pkd, PARTICLE *a) {
     memcpy(a,pkd->pTempPRIVATE,pkdParticleSize(pkd));
+    if (pkd->bSoA) pkdSoaLoad(pkd,pkdSoaIndex(pkd,a),(char *)pkd->pTempPRIVATE + pkdParticleSize(pkd));
     }
 static inline void pkdCopyParticle(PKD pkd, PARTICLE *a, PARTICLE *b) {
     memcpy(a,b,pkdParticleSize(pkd));
+    if (pkd->bSoA) {
+	ptrdiff_t ia = pkdSoaIndex(pkd,a), ib = pkdSoaIndex(pkd,b);
+	memcpy(pkd->pSoaVel+3*ia,pkd->pSoaVel+3*ib,3*sizeof(vel_t));
+	if (pkd->pSoaAccel) memcpy(pkd->pSoaAccel+3*ia,pkd->pSoaAccel+3*ib,3*sizeof(float));
+	if (pkd->pSoaPot) pkd->pSoaPot[ia] = pkd->pSoaPot[ib];
+	}
     }
 static inline void pkdSwapParticle(PKD pkd, PARTICLE *a, PARTICLE *b) {
     pkdSaveParticle(pkd,a);
@@ -1023,6 +1187,23 @@ static inline void pkdSetDensity( PKD pkd, PARTICLE *p, float fDensity ) {
     if (pkd->oFieldOffset[oDensity]) *CAST(float *, pkdField(p,pkd->oFieldOffset[oDensity])) = fDensity;
     }
 
+static inline float pkdWork( PKD pkd, const PARTICLE *p ) {
+    assert(pkd->oFieldOffset[oWork]);
+    return * CAST(const float *, pkdFieldRO(p,pkd->oFieldOffset[oWork]));
+    }
+static inline void pkdSetWork( PKD pkd, PARTICLE *p, float fWork ) {
+    if (pkd->oFieldOffset[oWork]) *CAST(float *, pkdField(p,pkd->oFieldOffset[oWork])) = fWork;
+    }
+
+/* Merger tree tag: catalog index of the group a tracer was chosen for, plus one */
+static inline int32_t pkdGetMergerTag( PKD pkd, const PARTICLE *p ) {
+    assert(pkd->oFieldOffset[oMergerTag]);
+    return * CAST(const int32_t *, pkdFieldRO(p,pkd->oFieldOffset[oMergerTag]));
+    }
+static inline void pkdSetMergerTag( PKD pkd, PARTICLE *p, int32_t iTag ) {
+    if (pkd->oFieldOffset[oMergerTag]) *CAST(int32_t *, pkdField(p,pkd->oFieldOffset[oMergerTag])) = iTag;
+    }
+
 static inline float pkdBall( PKD pkd, PARTICLE *p ) {
     assert(pkd->oFieldOffset[oBall]);
     return *CAST(float *, pkdField(p,pkd->oFieldOffset[oBall]));
@@ -1091,15 +1272,19 @@ static inline __m256d pkdGetPos(PKD pkd,PARTICLE *p) {
 #endif
 
 static inline vel_t *pkdVel( PKD pkd, PARTICLE *p ) {
+    if (pkd->bSoA) return pkd->pSoaVel + 3*pkdSoaIndex(pkd,p);
     return CAST(vel_t *,pkdField(p,pkd->oFieldOffset[oVelocity]));
     }
 static inline float *pkdAccel( PKD pkd, PARTICLE *p ) {
+    if (pkd->bSoA) return pkd->pSoaAccel + 3*pkdSoaIndex(pkd,p);
     return CAST(float *,pkdField(p,pkd->oFieldOffset[oAcceleration]));
     }
 static inline const float *pkdAccelRO( PKD pkd, const PARTICLE *p ) {
+    if (pkd->bSoA) return pkd->pSoaAccel + 3*pkdSoaIndex(pkd,p);
     return CAST(const float *,pkdFieldRO(p,pkd->oFieldOffset[oAcceleration]));
     }
 static inline float *pkdPot( PKD pkd, PARTICLE *p ) {
+    if (pkd->bSoA) return pkd->pSoaPot ? pkd->pSoaPot + pkdSoaIndex(pkd,p) : NULL;
     return pkd->oFieldOffset[oPotential] ? CAST(float *,pkdField(p,pkd->oFieldOffset[oPotential])) : NULL;
     }
 static inline uint16_t *pkdRungDest( PKD pkd, PARTICLE *p ) {
@@ -1190,7 +1375,7 @@ void pkdTreeBuildByGroup(PKD pkd, int nBucket, int nGroup);
 void pkdInitialize(
     PKD *ppkd,MDL mdl,int nStore,uint64_t nMinTotalStore,uint64_t nMinEphemeral,uint32_t nEphemeralBytes,
     int nTreeBitsLo, int nTreeBitsHi,
-    int iCacheSize,int iWorkQueueSize,int iCUDAQueueSize,double *fPeriod,uint64_t nDark,uint64_t nGas,uint64_t nStar,
+    int iCacheSize,int iWorkQueueSize,int iCacheWindow,int iCUDAQueueSize,double *fPeriod,uint64_t nDark,uint64_t nGas,uint64_t nStar,
     uint64_t mMemoryModel, int bLightCone, int bLightConeParticles);
 void pkdFinish(PKD);
 size_t pkdClCount(PKD pkd);
@@ -1205,7 +1390,8 @@ void pkdSetCrit(PKD pkd,double dCrit);
 void pkdCalcBound(PKD,BND *);
 void pkdEnforcePeriodic(PKD,BND *);
 void pkdPhysicalSoft(PKD pkd,double dSoftMax,double dFac,int bSoftMaxMul);
-int pkdWeight(PKD,int,double,int,int,int,int *,int *,double *,double *);
+int pkdWeight(PKD,int,double,int,int,int,double,int *,int *,double *,double *);
+void pkdMeasuredWork(PKD pkd,double *pfWork,uint64_t *pnMeasured);
 void pkdCountVA(PKD,int,double,int *,int *);
 double pkdTotalMass(PKD pkd);
 int pkdLowerPart(PKD,int,double,int,int);
@@ -1228,7 +1414,12 @@ int pkdOrbRootFind(
 void pkdOrbUpdateRung(PKD pkd);
 /*#define PEANO_HILBERT_KEY_MAX 0x3ffffffffffull*/ /* 2d */
 #define PEANO_HILBERT_KEY_MAX 0x7fffffffffffffffull /* 3d */
-void pkdPeanoHilbertDecomp(PKD pkd, int nRungs, int iMethod);
+uint64_t pkdHilbertKey(PKD pkd,PARTICLE *p,const BND *bnd);
+int pkdLowerKeyPart(PKD,const BND *,uint64_t,int,int);
+int pkdUpperKeyPart(PKD,const BND *,uint64_t,int,int);
+int pkdKeyWeight(PKD pkd,const BND *bnd,uint64_t iKeySplit,int iSplitSide,int iFrom,int iTo,double fWorkDefault,
+		 int *pnLow,int *pnHigh,double *pfLow,double *pfHigh);
+int pkdColKeyRejects(PKD,const BND *,uint64_t,int);
 void pkdRungOrder(PKD pkd, int iRung, total_t *nMoved);
 int pkdColRejects(PKD,int);
 int pkdColRejects_Old(PKD,int,double,double,int);
@@ -1242,8 +1433,9 @@ int pkdInactive(PKD);
 
 int pkdColOrdRejects(PKD,uint64_t,int);
 void pkdLocalOrder(PKD,uint64_t iMinOrder,uint64_t iMaxOrder);
-void pkdCheckpoint(PKD pkd,const char *fname);
-void pkdRestore(PKD pkd,const char *fname);
+void pkdCheckpoint(PKD pkd,const char *fname,int iCompress);
+uint64_t pkdCheckpointCount(PKD pkd,const char *fname);
+void pkdRestore(PKD pkd,const char *fname,uint64_t iBegin,uint64_t iEnd);
 uint32_t pkdWriteFIO(PKD pkd,FIO fio,double dvFac,double dTuFac,BND *bnd);
 void pkdWriteFromNode(PKD pkd,int iNode, FIO fio,double dvFac,double dTuFac,BND *bnd);
 void pkdWriteViaNode(PKD pkd, int iNode);
@@ -1254,16 +1446,21 @@ void pkdGravAll(PKD pkd,
     struct pkdKickParameters *kick,struct pkdLightconeParameters *lc,struct pkdTimestepParameters *ts,
     double dTime,int nReps,int bPeriodic,
     int bEwald,int nGroup,int iRoot1, int iRoot2,
-    double fEwCut,double fEwhCut,double dThetaMin,
+    double fEwCut,double fEwhCut,int nEwaldGrid,double dEwaldGridTol,double dThetaMin,
+    double dPMSplit,double dPMCut,
     uint64_t *pnActive,
     double *pdPart,double *pdPartNumAccess,double *pdPartMissRatio,
     double *pdCell,double *pdCellNumAccess,double *pdCellMissRatio,
     double *pdFlop,uint64_t *pnRung);
 void pkdCalcEandL(PKD pkd,double *T,double *U,double *Eth,double *L,double *F,double *W);
+void pkdLightConeReplicas(PKD pkd,LCREPLICAS *rep,const double *rLo,const double *rHi,
+			double dLookbackFac,double dKickDelta,double dBoxSize);
 void pkdProcessLightCone(PKD pkd,PARTICLE *p,float fPot,double dLookbackFac,double dLookbackFacLCP,
-			double dDriftDelta,double dKickDelta,double dBoxSize,int bLightConeParticles);
-void pkdGravEvalPP(PINFOIN *pPart, int nBlocks, int nInLast, ILP_BLK *blk,  PINFOOUT *pOut );
-void pkdGravEvalPC(PINFOIN *pPart, int nBlocks, int nInLast, ILC_BLK *blk,  PINFOOUT *pOut );
+			double dDriftDelta,double dKickDelta,double dBoxSize,int bLightConeParticles,
+			const LCREPLICAS *rep);
+void pkdGravEvalPP(PINFOIN *pPart, int nBlocks, int nInLast, ILP_BLK *blk,  PINFOOUT *pOut,
+    int bGravStep, int bPotential, float fFourh2, float fiSplit );
+void pkdGravEvalPC(PINFOIN *pPart, int nBlocks, int nInLast, ILC_BLK *blk,  PINFOOUT *pOut, float fiSplit );
 void pkdDrift(PKD pkd,int iRoot,double dTime,double dDelta,double,double,int bDoGas);
 void pkdKickKDKOpen(PKD pkd,double dTime,double dDelta,uint8_t uRungLo,uint8_t uRungHi);
 void pkdKickKDKClose(PKD pkd,double dTime,double dDelta,uint8_t uRungLo,uint8_t uRungHi);
@@ -1375,6 +1572,7 @@ void pkdInterlace(PKD pkd, int iGridTarget, int iGridSource);
 float getLinAcc(PKD pkd, MDLFFT fft,int cid, double r[3]);
 void pkdSetLinGrid(PKD pkd,double a0, double a, double a1, double dBSize, int nGrid, int iSeed,
     int bFixed, float fPhase);
+void pkdSetPMGrid(PKD pkd, double dSplit, int iAssignment);
 void pkdMeasureLinPk(PKD pkd, int nGrid, double dA, double dBoxSize,
                 int nBins,  int iSeed, int bFixed, float fPhase, 
                 double *fK, double *fPower, uint64_t *nPower);
@@ -1384,8 +1582,9 @@ void pkdMeasureLinPk(PKD pkd, int nGrid, double dA, double dBoxSize,
 #endif
 void pkdOutPsGroup(PKD pkd,char *pszFileName,int iType);
 
-void pkdLightConeOpen(PKD pkd, const char *fname,int nSideHealpix);
-void pkdLightConeClose(PKD pkd, const char *healpixname);
+void pkdLightConeOpen(PKD pkd, const char *fname,int nHealpixShells,const HEALPIXSHELLSPEC *healpixShells,
+    const char *indexname,int nSideShard,double dShellWidth,double dQuantum);
+void pkdLightConeClose(PKD pkd, const char *healpixname,const char *shellname,double rComplete);
 void pkdLightCone(PKD pkd,uint8_t uRungLo,uint8_t uRungHi,
     double dLookbackFac,double dLookbackFacLCP,
     double *dtLCDrift,double *dtLCKick);
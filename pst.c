@@ -50,6 +50,8 @@
 #include "smooth/smooth.h"
 #include "group/hop.h"
 #include "group/fof.h"
+#include "group/subhalo.h"
+#include "group/mergertree.h"
 #include "group/group.h"
 #include "group/groupstats.h"
 
@@ -99,6 +101,16 @@ void pstAddServices(PST pst,MDL mdl) {
 	          sizeof(struct inHopGravity),0);
     mdlAddService(mdl,PST_HOP_UNBIND,pst,(fcnService_t*)pstHopUnbind,
 	          sizeof(struct inHopUnbind),sizeof(struct outHopUnbind));
+    mdlAddService(mdl,PST_HOP_SUBHALOS,pst,(fcnService_t*)pstHopSubhalos,
+	          sizeof(struct inHopSubhalos),sizeof(struct outHopSubhalos));
+    mdlAddService(mdl,PST_MERGER_HARVEST,pst,(fcnService_t*)pstMergerHarvest,
+	          0,sizeof(uint64_t));
+    mdlAddService(mdl,PST_MERGER_COUNTS,pst,(fcnService_t*)pstMergerCounts,
+	          0,nThreads*sizeof(uint64_t));
+    mdlAddService(mdl,PST_MERGER_LINK,pst,(fcnService_t*)pstMergerLink,
+	          sizeof(struct inMergerLink) + nThreads*sizeof(uint64_t),sizeof(uint64_t));
+    mdlAddService(mdl,PST_MERGER_TAG,pst,(fcnService_t*)pstMergerTag,
+	          0,sizeof(uint64_t));
     mdlAddService(mdl,PST_GROUP_RELOCATE,pst,(fcnService_t*)pstGroupRelocate,
 		  0,0);
     mdlAddService(mdl,PST_GROUP_STATS,pst,(fcnService_t*)pstGroupStats,
@@ -228,6 +240,8 @@ void pstAddServices(PST pst,MDL mdl) {
            sizeof(struct inLinearKick), 0);
     mdlAddService(mdl,PST_SETLINGRID, pst,(fcnService_t*)pstSetLinGrid,
            sizeof(struct inSetLinGrid), 0);
+    mdlAddService(mdl,PST_SETPMGRID, pst,(fcnService_t*)pstSetPMGrid,
+           sizeof(struct inSetPMGrid), 0);
     mdlAddService(mdl,PST_MEASURELINPK,pst,(fcnService_t*)pstMeasureLinPk,
 		  sizeof(struct inMeasureLinPk), sizeof(struct outMeasureLinPk));
 #endif
@@ -263,6 +277,7 @@ void pstInitialize(PST *ppst,MDL mdl,LCL *plcl) {
     pst->nLower = 0;
     pst->nUpper = 0;
     pst->iSplitDim = -1;
+    pst->iKeySplit = 0;		/* no Peano-Hilbert splitter yet */
     }
 
 
@@ -282,7 +297,7 @@ static void initializePStore(PKD *ppkd,MDL mdl,struct inInitializePStore *in) {
     pkdInitialize(
 	ppkd,mdl,in->nStore,in->nMinTotalStore,in->nMinEphemeral,in->nEphemeralBytes,
 	in->nTreeBitsLo,in->nTreeBitsHi,
-	in->iCacheSize,in->iWorkQueueSize,in->iCUDAQueueSize,in->fPeriod,
+	in->iCacheSize,in->iWorkQueueSize,in->iCacheWindow,in->iCUDAQueueSize,in->fPeriod,
 	in->nSpecies[FIO_SPECIES_DARK],in->nSpecies[FIO_SPECIES_SPH],in->nSpecies[FIO_SPECIES_STAR],
 	in->mMemoryModel,in->bLightCone,in->bLightConeParticles);
     }
@@ -572,8 +587,25 @@ int pstRestore(PST pst,void *vin,int nIn,void *vout,int nOut) {
     else {
 	PKD pkd = pst->plcl->pkd;
 	char achInFile[PST_FILENAME_SIZE];
-	makeName(achInFile,in->achInFile,mdlSelf(pkd->mdl),"chk.");
-	pkdRestore(pkd,achInFile);
+	int id = mdlSelf(pkd->mdl), nNew = mdlThreads(pkd->mdl), nOld = in->nCheckpointThreads;
+	pkd->nLocal = 0;
+	if (nOld >= nNew) {
+	    /* Each thread reads one or more whole files */
+	    int j, jBeg = (id*nOld + nNew-1) / nNew, jEnd = ((id+1)*nOld + nNew-1) / nNew;
+	    for(j=jBeg; j<jEnd; ++j) {
+		makeName(achInFile,in->achInFile,j,"chk.");
+		pkdRestore(pkd,achInFile,0,pkdCheckpointCount(pkd,achInFile));
+		}
+	    }
+	else {
+	    /* A group of threads shares a file, each reading a contiguous slice */
+	    int j = id*nOld / nNew;
+	    int kBeg = (j*nNew + nOld-1) / nOld, kEnd = ((j+1)*nNew + nOld-1) / nOld;
+	    int g = kEnd - kBeg;
+	    makeName(achInFile,in->achInFile,j,"chk.");
+	    uint64_t n = pkdCheckpointCount(pkd,achInFile);
+	    pkdRestore(pkd,achInFile,(id-kBeg)*n/g,(id-kBeg+1)*n/g);
+	    }
 	}
     return 0;
     }
@@ -605,7 +637,7 @@ int pstCheckpoint(PST pst,void *vin,int nIn,void *vout,int nOut) {
 	PKD pkd = pst->plcl->pkd;
 	char achOutFile[PST_FILENAME_SIZE];
 	makeName(achOutFile,in->achOutFile,mdlSelf(pkd->mdl),"chk.");
-	pkdCheckpoint(pkd,achOutFile);
+	pkdCheckpoint(pkd,achOutFile,in->iCompress);
 	}
     return 0;
     }
@@ -911,6 +943,95 @@ int pstHopUnbind(PST pst,void *vin,int nIn,void *vout,int nOut) {
     return sizeof(struct outHopUnbind);
     }
 
+int pstHopSubhalos(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    struct inHopSubhalos *in = (struct inHopSubhalos *)vin;
+    struct outHopSubhalos *out = (struct outHopSubhalos *)vout;
+    struct outHopSubhalos outUpper;
+
+    mdlassert(pst->mdl,nIn == sizeof(struct inHopSubhalos));
+    if (pst->nLeaves > 1) {
+        int rID = mdlReqService(pst->mdl,pst->idUpper,PST_HOP_SUBHALOS,vin,nIn);
+        pstHopSubhalos(pst->pstLower,vin,nIn,vout,nOut);
+        mdlGetReply(pst->mdl,rID,&outUpper,NULL);
+	out->nSubhalos += outUpper.nSubhalos;
+	out->nSkipped += outUpper.nSkipped;
+        }
+    else {
+	LCL *plcl = pst->plcl;
+        out->nSubhalos = pkdHopSubhalos(plcl->pkd,in->dTime,in->nNeighbors,in->nMinMembers,
+	    in->dTheta,in->bPeriodic,in->fPeriod,&out->nSkipped);
+        }
+    return sizeof(struct outHopSubhalos);
+    }
+
+int pstMergerHarvest(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    uint64_t *nTracers = (uint64_t *)vout;
+    uint64_t nTracersUpper;
+
+    if (pst->nLeaves > 1) {
+        int rID = mdlReqService(pst->mdl,pst->idUpper,PST_MERGER_HARVEST,vin,nIn);
+        pstMergerHarvest(pst->pstLower,vin,nIn,vout,nOut);
+        mdlGetReply(pst->mdl,rID,&nTracersUpper,NULL);
+	*nTracers += nTracersUpper;
+        }
+    else {
+	LCL *plcl = pst->plcl;
+        *nTracers = pkdMergerHarvest(plcl->pkd);
+        }
+    return sizeof(uint64_t);
+    }
+
+int pstMergerCounts(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    uint64_t *out = vout;
+    uint64_t *outUp = out + pst->idUpper-pst->idSelf;
+
+    if (pst->nLeaves > 1) {
+        int rID = mdlReqService(pst->mdl,pst->idUpper,PST_MERGER_COUNTS,vin,nIn);
+        pstMergerCounts(pst->pstLower,vin,nIn,vout,nOut);
+        mdlGetReply(pst->mdl,rID,outUp,NULL);
+        }
+    else {
+	LCL *plcl = pst->plcl;
+        *out = pkdMergerCountGroups(plcl->pkd);
+        }
+    return pst->nLeaves*sizeof(*out);
+    }
+
+int pstMergerLink(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    struct inMergerLink *in = vin;
+    uint64_t *nEdges = (uint64_t *)vout;
+    uint64_t nEdgesUpper;
+
+    if (pst->nLeaves > 1) {
+        int rID = mdlReqService(pst->mdl,pst->idUpper,PST_MERGER_LINK,vin,nIn);
+        pstMergerLink(pst->pstLower,vin,nIn,vout,nOut);
+        mdlGetReply(pst->mdl,rID,&nEdgesUpper,NULL);
+	*nEdges += nEdgesUpper;
+        }
+    else {
+	LCL *plcl = pst->plcl;
+        *nEdges = pkdMergerLink(plcl->pkd,(int)in->nTracers,(uint64_t *)(in+1));
+        }
+    return sizeof(uint64_t);
+    }
+
+int pstMergerTag(PST pst,void *vin,int nIn,void *vout,int nOut) {
+    uint64_t *nTagged = (uint64_t *)vout;
+    uint64_t nTaggedUpper;
+
+    if (pst->nLeaves > 1) {
+        int rID = mdlReqService(pst->mdl,pst->idUpper,PST_MERGER_TAG,vin,nIn);
+        pstMergerTag(pst->pstLower,vin,nIn,vout,nOut);
+        mdlGetReply(pst->mdl,rID,&nTaggedUpper,NULL);
+	*nTagged += nTaggedUpper;
+        }
+    else {
+	LCL *plcl = pst->plcl;
+        *nTagged = pkdMergerTag(plcl->pkd);
+        }
+    return sizeof(uint64_t);
+    }
+
 int pstGroupRelocate(PST pst,void *vin,int nIn,void *vout,int nOut) {
     if (pst->nLeaves > 1) {
         int rID = mdlReqService(pst->mdl,pst->idUpper,PST_GROUP_RELOCATE,NULL,0);
@@ -955,7 +1076,7 @@ int pstSmooth(PST pst,void *vin,int nIn,void *vout,int nOut) {
 
 	smInitialize(&smx,plcl->pkd,&in->smf,in->nSmooth,
 		     in->bPeriodic,in->bSymmetric,in->iSmoothType);
-	smSmooth(smx,&in->smf);
+	smSmooth(smx,&in->smf,in->bNeighborCache);
 	smFinish(smx,&in->smf);
 	}
     return 0;
@@ -1120,7 +1241,8 @@ int pstGravity(PST pst,void *vin,int nIn,void *vout,int nOut) {
 	PKD pkd = plcl->pkd;
 	pkdGravAll(pkd,&in->kick,&in->lc,&in->ts,
 	    in->dTime,in->nReps,in->bPeriodic,
-	    in->bEwald,in->nGroup,in->iRoot1,in->iRoot2,in->dEwCut,in->dEwhCut,in->dTheta,
+	    in->bEwald,in->nGroup,in->iRoot1,in->iRoot2,in->dEwCut,in->dEwhCut,in->nEwaldGrid,in->dEwaldGridTol,in->dTheta,
+	    in->dPMSplit,in->dPMCut,
 	    &outr->nActive,
 	    &outr->sPart.dSum,&outr->sPartNumAccess.dSum,&outr->sPartMissRatio.dSum,
 	    &outr->sCell.dSum,&outr->sCellNumAccess.dSum,&outr->sCellMissRatio.dSum,
@@ -2009,9 +2131,13 @@ int pstLightConeOpen(PST pst,void *vin,int nIn,void *vout,int nOut) {
     else {
 	PKD pkd = pst->plcl->pkd;
 	char achOutFile[PST_FILENAME_SIZE];
+	char achIndexFile[PST_FILENAME_SIZE];
 	if (in->achOutFile[0]) makeName(achOutFile,in->achOutFile,mdlSelf(pkd->mdl),"lcp.");
 	else achOutFile[0] = 0;
-        pkdLightConeOpen(pkd, achOutFile, in->nSideHealpix);
+	if (in->achOutFile[0] && in->nSideShard) makeName(achIndexFile,in->achOutFile,mdlSelf(pkd->mdl),"lci.");
+	else achIndexFile[0] = 0;
+        pkdLightConeOpen(pkd, achOutFile, in->nHealpixShells, in->healpixShells,
+	    achIndexFile, in->nSideShard, in->dShellWidth, in->dQuantum);
         }
     return 0;
 }
@@ -2029,7 +2155,7 @@ int pstLightConeClose(PST pst,void *vin,int nIn,void *vout,int nOut) {
 	char achOutFile[PST_FILENAME_SIZE];
 	if (in->achOutFile[0]) makeName(achOutFile,in->achOutFile,mdlSelf(pkd->mdl),"hpb.");
 	else achOutFile[0] = 0;
-        pkdLightConeClose(pst->plcl->pkd,achOutFile);
+        pkdLightConeClose(pst->plcl->pkd,achOutFile,in->achShellFile,in->rComplete);
         }
     return 0;
 }
@@ -42,6 +42,7 @@ typedef struct lclBlock {
     int iWtTo;
     int iPart;
     uint64_t iOrdSplit;
+    uint64_t iKeySplit;
     double fSplit;
     double fWtLow;
     double fWtHigh;
@@ -68,6 +69,7 @@ typedef struct pstContext {
     BND bnd;
     int iSplitDim;
     uint64_t iOrdSplit;
+    uint64_t iKeySplit;
     double fSplit;
     double fSplitInactive;
     uint64_t nTotal;
@@ -96,6 +98,10 @@ enum pst_service {
     PST_COLORDREJECTS,
     PST_DOMAINORDER,
     PST_LOCALORDER,
+    PST_HILBERTDECOMP,
+    PST_KEYWEIGHT,
+    PST_COLKEYREJECTS,
+    PST_MEASUREDWORK,
     PST_COMPRESSASCII,
     PST_SENDPARTICLES,
     PST_SENDARRAY,
@@ -175,6 +181,11 @@ enum pst_service {
     PST_HOP_TREE_BUILD,
     PST_HOP_GRAVITY,
     PST_HOP_UNBIND,
+    PST_HOP_SUBHALOS,
+    PST_MERGER_HARVEST,
+    PST_MERGER_COUNTS,
+    PST_MERGER_LINK,
+    PST_MERGER_TAG,
     PST_GROUP_RELOCATE,
     PST_GROUP_STATS,
     PST_GROUP_STATS1,
@@ -190,6 +201,8 @@ enum pst_service {
     PLT_MOVEIC,
     PST_HOSTNAME,
     PST_MEMSTATUS,
+    PST_TRACE,
+    PST_CACHESTATS,
     PST_GETCLASSES,
     PST_SETCLASSES,
     PST_SWAPCLASSES,
@@ -215,6 +228,7 @@ enum pst_service {
     PST_MEASURELINPK,
     PST_SETLINGRID,
     PST_LINEARKICK,
+    PST_SETPMGRID,
 #endif
     PST_ASSIGN_MASS,
     PST_DENSITY_CONTRAST,
@@ -253,6 +267,7 @@ struct inInitializePStore {
     int nTreeBitsHi;
     int iCacheSize;
     int iWorkQueueSize;
+    int iCacheWindow;
     int iCUDAQueueSize;
     int bLightCone;
     int bLightConeParticles;
@@ -296,6 +311,7 @@ int pstWriteASCII(PST,void *,int,void *,int);
 /* PST_RESTORE */
 struct inRestore {
     int nProcessors;
+    int nCheckpointThreads; /* Number of files (threads) that wrote the checkpoint */
     char achInFile[PST_FILENAME_SIZE];
     };
 int pstRestore(PST,void *,int,void *,int);
@@ -322,6 +338,7 @@ struct inWrite {
     int iLower, iUpper;
     int bHDF5;
     int mFlags;
+    int iCompress; /* PST_CHECKPOINT: zlib level, 0 for none */
     char achOutFile[PST_FILENAME_SIZE];
     };
 int pstWrite(PST,void *,int,void *,int);
@@ -432,6 +449,33 @@ struct outHopUnbind {
     };
 int pstHopUnbind(PST,void *,int,void *,int);
 
+/* PST_HOP_SUBHALOS */
+struct inHopSubhalos {
+    double dTime;
+    double dTheta;
+    double fPeriod[3];
+    int bPeriodic;
+    int nNeighbors;
+    int nMinMembers;
+    };
+struct outHopSubhalos {
+    uint64_t nSubhalos;
+    uint64_t nSkipped;	/* Groups that span several domains */
+    };
+int pstHopSubhalos(PST,void *,int,void *,int);
+
+/* PST_MERGER_HARVEST */
+int pstMergerHarvest(PST,void *,int,void *,int);
+/* PST_MERGER_COUNTS */
+int pstMergerCounts(PST,void *,int,void *,int);
+/* PST_MERGER_LINK: followed by the catalog offset of each thread (uint64_t) */
+struct inMergerLink {
+    int64_t nTracers;   /* 64 bits to keep the offsets aligned */
+    };
+int pstMergerLink(PST,void *,int,void *,int);
+/* PST_MERGER_TAG */
+int pstMergerTag(PST,void *,int,void *,int);
+
 /* PST_GROUP_RELOCATE */
 int pstGroupRelocate(PST,void *,int,void *,int);
 
@@ -471,6 +515,7 @@ struct inSmooth {
     int bPeriodic;
     int bSymmetric;
     int iSmoothType;
+    int bNeighborCache;
     SMF smf;
     };
 int pstSmooth(PST,void *,int,void *,int);
@@ -494,7 +539,11 @@ struct inGravity {
     double dTime;
     double dEwCut;
     double dEwhCut;
+    double dEwaldGridTol;
+    int nEwaldGrid;
     double dTheta;
+    double dPMSplit;	/* TreePM split scale r_s, or zero */
+    double dPMCut;	/* Cutoff radius of the short-range force */
     int nReps;
     int bPeriodic;
     int bEwald;
@@ -1006,6 +1055,7 @@ int pstBispectrumCalculate(PST pst,void *vin,int nIn,void *vout,int nOut);
 /* PST_LINEARKICK */
 struct inLinearKick {
     vel_t dtOpen, dtClose;
+    int bAccel;		/* Add the force to the acceleration instead */
 };
 int pstLinearKick(PST pst,void *vin,int nIn,void *vout,int nOut);
 /* PST_SETLINGRID */
@@ -1021,6 +1071,12 @@ struct inSetLinGrid {
     float fPhase;
     };
 int pstSetLinGrid(PST pst,void *vin,int nIn,void *vout,int nOut);
+/* PST_SETPMGRID */
+struct inSetPMGrid {
+    double dSplit;	/* Force split scale r_s */
+    int iAssignment;
+    };
+int pstSetPMGrid(PST pst,void *vin,int nIn,void *vout,int nOut);
 /* PST_MEASURELINPK */
 struct inMeasureLinPk {
     double dA;
@@ -1058,12 +1114,18 @@ struct inWriteSpeciesCounts {
 int pstSetWriteSpeciesCounts(PST,void *,int,void *,int);
 
 struct inLightConeOpen {
-    int nSideHealpix;
+    int nHealpixShells;
+    HEALPIXSHELLSPEC healpixShells[MAX_HEALPIX_SHELLS];
+    int nSideShard;
+    double dShellWidth;
+    double dQuantum;
     char achOutFile[PST_FILENAME_SIZE];
     };
 int pstLightConeOpen(PST pst,void *vin,int nIn,void *vout,int nOut);
 struct inLightConeClose {
+    double rComplete;
     char achOutFile[PST_FILENAME_SIZE];
+    char achShellFile[PST_FILENAME_SIZE];
     };
 int pstLightConeClose(PST pst,void *vin,int nIn,void *vout,int nOut);
 
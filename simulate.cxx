@@ -147,7 +147,7 @@ void MSR::Simulate(double dTime,double dDelta,int iStartStep,int nSteps) {
     if (DoGravity()) {
 	dDelta = SwitchDelta(dTime,dDelta,iStartStep,param.nSteps);
 	if (param.bNewKDK) {
-	    LightConeOpen(iStartStep + 1);
+	    LightConeOpen(iStartStep + 1,dTime,dDelta);
 	    bKickOpen = 1;
 	    }
 	else bKickOpen = 0;
@@ -161,6 +161,7 @@ void MSR::Simulate(double dTime,double dDelta,int iStartStep,int nSteps) {
 	    LinearKick(dTime,dDelta,bKickClose,bKickOpen);
 	    GridDeleteFFT();
         }
+	if (param.nGridPM > 0) PMKick(dTime,dDelta,bKickClose,bKickOpen);
 	uRungMax = Gravity(0,MAX_RUNG,ROOT,0,dTime,dDelta,iStartStep,dTheta,0,bKickOpen,
 	        param.bEwald,param.bGravStep,param.nPartRhoLoc,param.iTimeStepCrit,param.nGroup);
 	MemStatus();
@@ -194,6 +195,7 @@ void MSR::Simulate(double dTime,double dDelta,int iStartStep,int nSteps) {
 
     bKickOpen = 0;
     int iStop=0, bDoCheckpoint=0, bDoOutput=0;
+    Trace(-1);
     for (auto iStep=iStartStep+1;iStep<=nSteps&&!iStop;++iStep) {
 	dDelta = SwitchDelta(dTime,dDelta,iStep-1,param.nSteps);
 	dTheta = getTheta(dTime);
@@ -203,7 +205,7 @@ void MSR::Simulate(double dTime,double dDelta,int iStartStep,int nSteps) {
 	    double ddTime = dTime;
 	    if (bKickOpen) {
 		BuildTree(0);
-                LightConeOpen(iStep);  /* open the lightcone */
+                LightConeOpen(iStep,ddTime,dDelta);  /* open the lightcone */
 		uRungMax = Gravity(0,MAX_RUNG,ROOT,0,ddTime,dDelta,diStep,dTheta,0,1,
 		        param.bEwald,param.bGravStep,param.nPartRhoLoc,param.iTimeStepCrit,param.nGroup);
                 /* Set the grids of the linear species */
@@ -215,6 +217,7 @@ void MSR::Simulate(double dTime,double dDelta,int iStartStep,int nSteps) {
 		    LinearKick(dTime,dDelta,bKickClose,bKickOpen);
 		    GridDeleteFFT();
                     }
+		if (param.nGridPM > 0) PMKick(dTime,dDelta,bKickClose,bKickOpen);
 		bKickOpen = 0; /* clear the opening kicking flag */
 		}
 	    NewTopStepKDK(ddTime,dDelta,dTheta,nSteps,0,0,&diStep,&uRungMax,&bDoCheckpoint,&bDoOutput,&bKickOpen);
@@ -226,6 +229,8 @@ void MSR::Simulate(double dTime,double dDelta,int iStartStep,int nSteps) {
 	dTime += dDelta;
 	auto lSec = time(0) - lPrior;
 	MemStatus();
+	Trace(iStep);
+	PrintCacheStats(iStep);
 
 	OutputOrbits(iStep,dTime);
 
@@ -500,6 +505,38 @@ int MSR::ValidateParameters() {
 	               "       and/or the box size is not 1. Set bPeriodic=1 and dPeriod=1.\n");
 	}
 
+    /*
+    ** TreePM: the mesh supplies the periodic long-range force, so the tree
+    ** needs only the nearest images and no Ewald correction. The mesh kick
+    ** is applied on the top step, which only the new KDK scheme does.
+    */
+    if (param.nGridPM > 0) {
+	if (!param.bPeriodic || param.dyPeriod != param.dxPeriod || param.dzPeriod != param.dxPeriod) {
+	    puts("ERROR: nGridPM requires a periodic, cubic box");
+	    return 0;
+	    }
+	if (param.dPMCut * param.dPMSmooth >= 0.5 * param.nGridPM) {
+	    puts("ERROR: the TreePM cutoff dPMCut*dPMSmooth must be less than half of nGridPM");
+	    return 0;
+	    }
+	if (!prmSpecified(prm,"bNewKDK")) param.bNewKDK = 1;
+	else if (!param.bNewKDK) {
+	    puts("ERROR: bNewKDK must not be zero when nGridPM is enabled!");
+	    return 0;
+	    }
+	if (param.bFindHopGroups) {
+	    puts("ERROR: bFindHopGroups needs the full potential, but with nGridPM the potential is the short-range part only");
+	    return 0;
+	    }
+	if (param.bEwald && prmSpecified(prm,"bEwald") && param.bVWarnings)
+	    fprintf(stderr,"WARNING: bEwald is ignored, the long-range force comes from nGridPM\n");
+	param.bEwald = 0;
+#ifndef MDL_FFTW
+	puts("ERROR: nGridPM requires pkdgrav3 to be built with FFTW");
+	return 0;
+#endif
+	}
+
     if (!prmSpecified(prm,"dTheta20")) param.dTheta20 = param.dTheta;
     if (!prmSpecified(prm,"dTheta2")) param.dTheta2 = param.dTheta20;
 
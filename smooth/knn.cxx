@@ -0,0 +1,333 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#else
+#include "pkd_config.h"
+#endif
+#include <math.h>
+#include <assert.h>
+#include <algorithm>
+#include <vector>
+#include "smooth.h"
+#include "core/simd.h"
+
+/*
+** Grouped k-nearest-neighbour search.
+**
+** A group of nearby target particles (a small cell of the local tree) shares
+** one walk of the tree, which collects every particle within a radius R of
+** the group's bounding box. The k nearest are then selected for each target
+** from this candidate list with SIMD distance evaluation and a bounded max
+** heap that only sees the (few) candidates closer than its current worst.
+** A target whose k-th neighbour is farther than R may be missing neighbours
+** outside the candidate region, so it is retried with a larger R, and
+** finally handed to the one particle at a time priority queue search.
+*/
+
+#define KNN_MAX_TRIES 3
+
+struct smKnnContext {
+    /* Candidates: position relative to the group centre (padded to the SIMD width) */
+    std::vector<float> x, y, z;
+    /* Candidates: position including any periodic replica offset, and origin */
+    std::vector<double> r;
+    std::vector<int> iIndex, iPid;
+    /* The bounded heap, and the neighbour list handed to the smooth function */
+    std::vector<float> hd2;
+    std::vector<int> hi;
+    std::vector<NN> nnList;
+    std::vector<int> todo;
+    };
+
+static KDN *getCell(PKD pkd, int iCell, int id) {
+    if (id==pkd->idSelf) return pkdTreeNode(pkd,iCell);
+    return (KDN *)mdlFetch(pkd->mdl,CID_CELL,iCell,id);
+    }
+
+/*
+** Replace the largest entry of the heap and restore the heap property.
+*/
+static inline void heapReplaceTop(float *d2,int *iCand,int n,float d,int i) {
+    int j = 0;
+    for (;;) {
+	int c = 2*j + 1;
+	if (c >= n) break;
+	if (c+1 < n && d2[c+1] > d2[c]) ++c;
+	if (d2[c] <= d) break;
+	d2[j] = d2[c];
+	iCand[j] = iCand[c];
+	j = c;
+	}
+    d2[j] = d;
+    iCand[j] = i;
+    }
+
+static inline void addCandidate(smKnnContext *knn,const double *c,const double *p_r,const double *shift,int iIndex,int iPid) {
+    double r[3];
+    for (int j=0; j<3; ++j) r[j] = p_r[j] + shift[j];
+    knn->x.push_back(r[0] - c[0]);
+    knn->y.push_back(r[1] - c[1]);
+    knn->z.push_back(r[2] - c[2]);
+    knn->r.insert(knn->r.end(),r,r+3);
+    knn->iIndex.push_back(iIndex);
+    knn->iPid.push_back(iPid);
+    }
+
+/*
+** Collect all particles within R of the box c +/- h (and its periodic images).
+*/
+static void gatherCandidates(SMX smx,const double *c,const double *h,double R) {
+    PKD pkd = smx->pkd;
+    MDL mdl = pkd->mdl;
+    smKnnContext *knn = smx->knn;
+    struct smContext::stStack *S = smx->ST;
+    int iStart[3], iEnd[3], ix, iy, iz, j;
+    const double R2 = R*R;
+
+    knn->x.clear(); knn->y.clear(); knn->z.clear();
+    knn->r.clear(); knn->iIndex.clear(); knn->iPid.clear();
+    for (j=0; j<3; ++j) {
+	if (smx->bPeriodic) {
+	    iStart[j] = d2i(floor((c[j] - h[j] - R)/pkd->fPeriod[j] + 0.5));
+	    iEnd[j] = d2i(floor((c[j] + h[j] + R)/pkd->fPeriod[j] + 0.5));
+	    }
+	else iStart[j] = iEnd[j] = 0;
+	}
+    for (ix=iStart[0]; ix<=iEnd[0]; ++ix) {
+	for (iy=iStart[1]; iy<=iEnd[1]; ++iy) {
+	    for (iz=iStart[2]; iz<=iEnd[2]; ++iz) {
+		double shift[3] = {ix*pkd->fPeriod[0],iy*pkd->fPeriod[1],iz*pkd->fPeriod[2]};
+		double rc[3] = {c[0]-shift[0],c[1]-shift[1],c[2]-shift[2]};
+		int sp = 0, id, iCell;
+		KDN *kdn = getCell(pkd,iCell=pkd->iTopTree[ROOT],id=pkd->idSelf);
+		for (;;) {
+		    BND bnd = pkdNodeGetBnd(pkd,kdn);
+		    double min2 = 0;
+		    for (j=0; j<3; ++j) {
+			double d = fabs(bnd.fCenter[j] - rc[j]) - bnd.fMax[j] - h[j];
+			if (d > 0) min2 += d*d;
+			}
+		    if (min2 <= R2) {
+			if (kdn->iLower) {
+			    int idUpper,iUpper;
+			    pkdGetChildCells(kdn,id,id,iCell,idUpper,iUpper);
+			    kdn = getCell(pkd,iCell,id);
+			    S[sp].id = idUpper;
+			    S[sp].iCell = iUpper;
+			    S[sp].min = 0.0;
+			    ++sp;
+			    continue;
+			    }
+			for (int pj=kdn->pLower; pj<=kdn->pUpper; ++pj) {
+			    PARTICLE *p = id==pkd->idSelf ? pkdParticle(pkd,pj)
+				: (PARTICLE *)mdlFetch(mdl,CID_PARTICLE,pj,id);
+			    double p_r[3];
+			    pkdGetPos1(pkd,p,p_r);
+			    double d2 = 0;
+			    for (j=0; j<3; ++j) {
+				double d = fabs(p_r[j] - rc[j]) - h[j];
+				if (d > 0) d2 += d*d;
+				}
+			    if (d2 <= R2) addCandidate(knn,c,p_r,shift,pj,id);
+			    }
+			}
+		    if (sp) {
+			--sp;
+			id = S[sp].id;
+			iCell = S[sp].iCell;
+			kdn = getCell(pkd,iCell,id);
+			}
+		    else break;
+		    }
+		}
+	    }
+	}
+    /* Pad so whole vectors can be loaded; the padding is never a neighbour */
+    while (knn->x.size() % fvec::width()) {
+	knn->x.push_back(1e10f);
+	knn->y.push_back(1e10f);
+	knn->z.push_back(1e10f);
+	}
+    }
+
+/*
+** Select the nSmooth nearest candidates to t (relative to the group centre).
+** Returns 0 if fewer than nSmooth lie within sqrt(fMax2).
+*/
+static int selectNearest(smKnnContext *knn,int nSmooth,const float *t,float fMax2) {
+    float *d2 = knn->hd2.data();
+    int *iCand = knn->hi.data();
+    const int nCand = knn->x.size();
+    const fvec tx(t[0]), ty(t[1]), tz(t[2]);
+    fvec::array_t vd2;
+    float fWorst = fMax2;
+    int i, j;
+
+    for (i=0; i<nSmooth; ++i) { d2[i] = fMax2; iCand[i] = -1; }
+    for (i=0; i<nCand; i+=fvec::width()) {
+	fvec dx = tx - fvec(&knn->x[i]);
+	fvec dy = ty - fvec(&knn->y[i]);
+	fvec dz = tz - fvec(&knn->z[i]);
+	fvec r2 = dx*dx + dy*dy + dz*dz;
+	fmask m = r2 < fvec(fWorst);
+	if (testz(m)) continue;
+	int bits = movemask(m);
+	r2.store(vd2);
+	for (j=0; bits; ++j, bits >>= 1) {
+	    if ((bits&1) && vd2[j] < fWorst) {
+		heapReplaceTop(d2,iCand,nSmooth,vd2[j],i+j);
+		fWorst = d2[0];
+		}
+	    }
+	}
+    return iCand[0] >= 0;
+    }
+
+/*
+** Keep the neighbors of particle pi for the next smooth (see smSmooth).
+*/
+static inline void recordNeighbors(SMX smx,int pi,const NN *nnList) {
+    LIST *pList = smx->pNeighborCache + 1ul*pi*smx->nSmooth;
+    for (int i=0; i<smx->nSmooth; ++i) {
+	pList[i].iIndex = nnList[i].iIndex;
+	pList[i].iPid = nnList[i].iPid;
+	}
+    }
+
+/*
+** Run the smooth function for target p over the selected candidates.
+*/
+static float smoothTarget(SMX smx,SMF *smf,int pi) {
+    PKD pkd = smx->pkd;
+    PARTICLE *p = pkdParticle(pkd,pi);
+    smKnnContext *knn = smx->knn;
+    NN *nnList = knn->nnList.data();
+    double p_r[3], fBall2 = 0.0;
+    int i;
+
+    pkdGetPos1(pkd,p,p_r);
+    for (i=0; i<smx->nSmooth; ++i) {
+	int c = knn->hi[i];
+	const double *r = &knn->r[3*c];
+	NN *nn = &nnList[i];
+	nn->iIndex = knn->iIndex[c];
+	nn->iPid = knn->iPid[c];
+	if (nn->iPid == pkd->idSelf) nn->pPart = pkdParticle(pkd,nn->iIndex);
+	else nn->pPart = (PARTICLE *)mdlAcquire(pkd->mdl,CID_PARTICLE,nn->iIndex,nn->iPid);
+	nn->dx = p_r[0] - r[0];
+	nn->dy = p_r[1] - r[1];
+	nn->dz = p_r[2] - r[2];
+	nn->fDist2 = nn->dx*nn->dx + nn->dy*nn->dy + nn->dz*nn->dz;
+	if (nn->fDist2 > fBall2) fBall2 = nn->fDist2;
+	}
+    float fBall = sqrt(fBall2);
+    if (smx->pNeighborCache) recordNeighbors(smx,pi,nnList);
+    smx->fcnSmooth(p,fBall,smx->nSmooth,nnList,smf);
+    for (i=0; i<smx->nSmooth; ++i) {
+	if (nnList[i].iPid != pkd->idSelf) mdlRelease(pkd->mdl,CID_PARTICLE,nnList[i].pPart);
+	}
+    return fBall;
+    }
+
+extern "C" void smKnnFinish(SMX smx) {
+    delete smx->knn;
+    smx->knn = NULL;
+    }
+
+/*
+** Smooth the local particles pLower to pUpper (a cell of the local tree)
+** and set their ball radius.
+*/
+extern "C" void smSmoothGroup(SMX smx,SMF *smf,int pLower,int pUpper) {
+    PKD pkd = smx->pkd;
+    const int nSmooth = smx->nSmooth;
+    double rMin[3], rMax[3], c[3], h[3], R = 0.0;
+    int i, j, iTry, nTodo;
+
+    if (smx->knn == NULL) smx->knn = new smKnnContext;
+    smKnnContext *knn = smx->knn;
+    knn->hd2.resize(nSmooth);
+    knn->hi.resize(nSmooth);
+    knn->nnList.resize(nSmooth);
+    knn->todo.clear();
+    for (i=pLower; i<=pUpper; ++i) knn->todo.push_back(i);
+
+    for (iTry=0; iTry<KNN_MAX_TRIES && !knn->todo.empty(); ++iTry) {
+	for (j=0; j<3; ++j) { rMin[j] = HUGE_VAL; rMax[j] = -HUGE_VAL; }
+	for (auto pi : knn->todo) {
+	    double p_r[3];
+	    pkdGetPos1(pkd,pkdParticle(pkd,pi),p_r);
+	    for (j=0; j<3; ++j) {
+		rMin[j] = std::min(rMin[j],p_r[j]);
+		rMax[j] = std::max(rMax[j],p_r[j]);
+		}
+	    }
+	for (j=0; j<3; ++j) {
+	    c[j] = 0.5*(rMax[j] + rMin[j]);
+	    h[j] = 0.5*(rMax[j] - rMin[j]);
+	    }
+	/*
+	** First guess: the radius that holds nSmooth particles at the mean
+	** density of the group, or of this domain for a degenerate group.
+	*/
+	if (iTry == 0) {
+	    double hMax = std::max(h[0],std::max(h[1],h[2]));
+	    double V, n;
+	    if (hMax > 0 && knn->todo.size() > 1) {
+		V = 1.0;
+		for (j=0; j<3; ++j) V *= 2.0*std::max(h[j],0.1*hMax);
+		n = knn->todo.size();
+		}
+	    else {
+		BND bnd = pkdNodeGetBnd(pkd,pkdTreeNode(pkd,ROOT));
+		V = 8.0*bnd.fMax[0]*bnd.fMax[1]*bnd.fMax[2];
+		n = pkd->nLocal;
+		}
+	    R = 1.25 * cbrt(3.0*nSmooth*V/(4.0*M_PI*n));
+	    }
+	else R *= 2.0;
+	/* A periodic image must never be closer than the particle itself */
+	if (smx->bPeriodic) {
+	    for (j=0; j<3; ++j) if (2.0*(R + h[j]) >= pkd->fPeriod[j]) break;
+	    if (j < 3) break;
+	    }
+
+	gatherCandidates(smx,c,h,R);
+	if ((int)knn->iIndex.size() < nSmooth) continue;
+	for (i=nTodo=0; i<(int)knn->todo.size(); ++i) {
+	    PARTICLE *p = pkdParticle(pkd,knn->todo[i]);
+	    double p_r[3];
+	    float t[3];
+	    pkdGetPos1(pkd,p,p_r);
+	    for (j=0; j<3; ++j) t[j] = p_r[j] - c[j];
+	    if (selectNearest(knn,nSmooth,t,(float)(R*R)*(1.0f - 1e-5f)))
+		pkdSetBall(pkd,p,smoothTarget(smx,smf,knn->todo[i]));
+	    else knn->todo[nTodo++] = knn->todo[i];
+	    }
+	knn->todo.resize(nTodo);
+	}
+    /*
+    ** Whatever remains is done the old way.
+    */
+    for (auto pi : knn->todo) {
+	PARTICLE *p = pkdParticle(pkd,pi);
+	pkdSetBall(pkd,p,smSmoothSingle(smx,smf,p,ROOT,0));
+	if (smx->pNeighborCache) recordNeighbors(smx,pi,smx->pq);
+	}
+    }
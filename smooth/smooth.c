@@ -234,6 +234,8 @@ static int smInitializeBasic(SMX *psmx,PKD pkd,SMF *smf,int nSmooth,int bPeriodi
     smx->pSentinel = malloc(pkdParticleSize(pkd));
     assert(smx->pSentinel != NULL);
     smx->pkd = pkd;
+    smx->knn = NULL;
+    smx->pNeighborCache = NULL;
     if (smf != NULL) smf->pkd = pkd;
     smx->nSmooth = nSmooth;
     smx->bPeriodic = bPeriodic;
@@ -527,6 +529,7 @@ void smFinish(SMX smx,SMF *smf) {
     /*
     ** Free up context storage.
     */
+    smKnnFinish(smx);
     free(smx->S);
     free(smx->ST);
     free(smx->pq);
@@ -764,10 +767,79 @@ float smSmoothSingle(SMX smx,SMF *smf,PARTICLE *p,int iRoot1, int iRoot2) {
     return fBall;
     }
 
-void smSmooth(SMX smx,SMF *smf) {
+static uint64_t smNeighborChecksum(const LIST *pList,uint64_t n) {
+    uint64_t i, h = 14695981039346656037ull;
+    for (i=0;i<n;++i) {
+	h = (h ^ pList[i].iIndex) * 1099511628211ull;
+	h = (h ^ pList[i].iPid) * 1099511628211ull;
+	}
+    return h;
+    }
+
+/*
+** Smooth using the neighbor lists recorded by the previous smSmooth.
+** Distances are recomputed, as positions may have been updated in place.
+*/
+static void smSmoothNeighborCache(SMX smx,SMF *smf) {
     PKD pkd = smx->pkd;
     PARTICLE *p;
-    int pi;
+    double p_r[3],q_r[3],fBall2;
+    int pi,i,j;
+
+    if (smx->nnListMax < smx->nSmooth) {
+	smx->nnListMax = smx->nSmooth;
+	smx->nnList = realloc(smx->nnList,smx->nnListMax*sizeof(NN));
+	assert(smx->nnList != NULL);
+	}
+    for (pi=0;pi<pkd->nLocal;++pi) {
+	const LIST *pList = smx->pNeighborCache + 1ul*pi*smx->nSmooth;
+	NN *nnList = smx->nnList;
+	p = pkdParticle(pkd,pi);
+	pkdGetPos1(pkd,p,p_r);
+	fBall2 = 0.0;
+	for (i=0;i<smx->nSmooth;++i) {
+	    NN *nn = &nnList[i];
+	    nn->iIndex = pList[i].iIndex;
+	    nn->iPid = pList[i].iPid;
+	    if (nn->iPid != pkd->idSelf) nn->pPart = mdlAcquire(pkd->mdl,CID_PARTICLE,nn->iIndex,nn->iPid);
+	    else if (nn->iIndex == pkd->nLocal) nn->pPart = smx->pSentinel;
+	    else nn->pPart = pkdParticle(pkd,nn->iIndex);
+	    pkdGetPos1(pkd,nn->pPart,q_r);
+	    for (j=0;j<3;++j) {
+		q_r[j] = p_r[j] - q_r[j];
+		if (smx->bPeriodic) {
+		    if (q_r[j] > 0.5*pkd->fPeriod[j]) q_r[j] -= pkd->fPeriod[j];
+		    else if (q_r[j] < -0.5*pkd->fPeriod[j]) q_r[j] += pkd->fPeriod[j];
+		    }
+		}
+	    nn->dx = q_r[0];
+	    nn->dy = q_r[1];
+	    nn->dz = q_r[2];
+	    nn->fDist2 = q_r[0]*q_r[0] + q_r[1]*q_r[1] + q_r[2]*q_r[2];
+	    if (nn->fDist2 > fBall2) fBall2 = nn->fDist2;
+	    }
+	smx->fcnSmooth(p,sqrt(fBall2),smx->nSmooth,nnList,smf);
+	pkdSetBall(pkd,p,sqrt(fBall2));
+	for (i=0;i<smx->nSmooth;++i) {
+	    if (nnList[i].iPid != pkd->idSelf) mdlRelease(pkd->mdl,CID_PARTICLE,nnList[i].pPart);
+	    }
+	mdlCacheCheck(pkd->mdl);
+	}
+    }
+
+/*
+** With bNeighborCache the neighbor lists are kept in the ephemeral area
+** (if they fit) and a following smooth with the same nSmooth iterates over
+** them instead of searching the tree again.
+*/
+void smSmooth(SMX smx,SMF *smf,int bNeighborCache) {
+    PKD pkd = smx->pkd;
+    PARTICLE *p;
+    KDN *kdn;
+    int *S = smx->S;
+    int sp = 0;
+    int pi,iCell;
+    uint64_t nList = 1ul*pkd->nLocal*smx->nSmooth;
 
     /*
     ** Initialize the bInactive flags for all local particles.
@@ -776,17 +848,44 @@ void smSmooth(SMX smx,SMF *smf) {
 	p = pkdParticle(pkd,pi);
 	p->bMarked = 1;
     }
-    smSmoothInitialize(smx);
     smf->pfDensity = NULL;
-    for (pi=0;pi<pkd->nLocal;++pi) {
-	p = pkdParticle(pkd,pi);
-	pkdSetBall(pkd,p,smSmoothSingle(smx,smf,p,ROOT,0));
+    smx->pNeighborCache = NULL;
+    smSmoothInitialize(smx);
+    if (bNeighborCache && nList*sizeof(LIST) <= 1ul*(pkd->nStore+1)*pkd->nEphemeralBytes) {
+	smx->pNeighborCache = (LIST *)pkd->pLite;
+	if (pkd->nnCache.nSmooth == smx->nSmooth && pkd->nnCache.bPeriodic == smx->bPeriodic
+	    && pkd->nnCache.uChecksum == smNeighborChecksum(smx->pNeighborCache,nList)) {
+	    smSmoothNeighborCache(smx,smf);
+	    smSmoothFinish(smx);
+	    return;
+	    }
+	}
+    pkd->nnCache.nSmooth = 0;
+    /*
+    ** Nearby particles share a neighbor search: descend the local tree
+    ** to cells of at most SM_GROUP_SIZE particles.
+    */
+    kdn = pkdTreeNode(pkd,iCell = ROOT);
+    while (1) {
+	if (kdn->iLower && kdn->pUpper - kdn->pLower + 1 > SM_GROUP_SIZE) {
+	    kdn = pkdTreeNode(pkd,iCell = kdn->iLower);
+	    S[sp++] = iCell+1;
+	    continue;
+	    }
+	smSmoothGroup(smx,smf,kdn->pLower,kdn->pUpper);
 	/*
 	** Call mdlCacheCheck to make sure we are making progress!
 	*/
 	mdlCacheCheck(pkd->mdl);
+	if (sp) kdn = pkdTreeNode(pkd,iCell = S[--sp]);
+	else break;
     }
     smSmoothFinish(smx);
+    if (smx->pNeighborCache) {
+	pkd->nnCache.nSmooth = smx->nSmooth;
+	pkd->nnCache.bPeriodic = smx->bPeriodic;
+	pkd->nnCache.uChecksum = smNeighborChecksum(smx->pNeighborCache,nList);
+	}
 }
 
 
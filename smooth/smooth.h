@@ -23,6 +23,7 @@
 #include "smoothfcn.h"
 
 #define NNLIST_INCREMENT	200		/* number of extra neighbor elements added to nnList */
+#define SM_GROUP_SIZE		32		/* maximum number of targets sharing one neighbor search */
 
 
 struct hashElement {
@@ -90,6 +91,15 @@ typedef struct smContext {
     uint32_t iHead;
     uint32_t iTail;
     int  *Fifo;
+    /*
+    ** Candidate and heap storage for the grouped neighbor search (knn.cxx).
+    */
+    struct smKnnContext *knn;
+    /*
+    ** When not NULL, smSmooth records each particle's nSmooth neighbors here
+    ** (in the ephemeral area) so the next smooth can reuse them.
+    */
+    LIST *pNeighborCache;
     } * SMX;
 
 
@@ -104,7 +114,9 @@ void smFinish(SMX,SMF *);
 void smSmoothInitialize(SMX smx);
 void smSmoothFinish(SMX smx);
 float smSmoothSingle(SMX smx,SMF *smf,PARTICLE *p,int iRoot1, int iRoot2);
-void smSmooth(SMX,SMF *);
+void smSmooth(SMX,SMF *,int bNeighborCache);
+void smSmoothGroup(SMX smx,SMF *smf,int pLower,int pUpper);
+void smKnnFinish(SMX smx);
 void smReSmoothSingle(SMX smx,SMF *smf,PARTICLE *p,double fBall);
 void smReSmooth(SMX,SMF *);
 
@@ -85,6 +85,7 @@ enum services {
     TEST_FLUSH_AFTER_READ,
     TEST_ADVANCED_RO,
     TEST_ADVANCED_FLUSH,
+    TEST_BATCH,
     };
 } // namespace worker
 
@@ -237,6 +238,69 @@ namespace ro {
 	}
     } // namespace test_ro
 
+namespace batch {
+    constexpr int SERVICE = worker::TEST_BATCH;
+    constexpr int nBatch = 256; // Elements prefetched before they are read
+    typedef std::array<std::uint64_t,3> RESULT; // Bad values, lines requested, messages sent
+
+    // Remote lines requested together (here by prefetching) must share messages
+    int test(worker::Context *ctx,void *vin,int nIn,void *vout,int nOut) {
+	auto out = reinterpret_cast<RESULT*>(vout);
+	RESULT result;
+	if (ctx->getLeaves() > 1) {
+            int rID = mdlReqService(ctx->getMDL(),ctx->getUpper(),SERVICE,NULL,0);
+            test(ctx->getLower(),vin,nIn,vout,nOut);
+            mdlGetReply(ctx->getMDL(),rID,&result,&nOut);
+	    for(auto i=0; i<result.size(); ++i) (*out)[i] += result[i];
+            }
+	else {
+	    auto mdl = ctx->getMDL();
+	    int idSelf = mdlSelf(mdl);
+	    int nData = cacheSize;
+	    auto pData = new std::uint64_t[nData];
+	    for(auto i=0; i<nData; ++i) pData[i] = ((1UL*idSelf)<<33) + 10 + i;
+	    mdlSetCacheWindow(mdl,1000);
+	    mdlROcache(mdl,0,NULL,pData,sizeof(pData[0]),nData);
+	    std::uint64_t nLines, nMessages;
+	    if (mdlCore(mdl)==0) mdlCacheRequestStatistics(mdl,&nLines,&nMessages,1);
+
+	    result.fill(0);
+	    for(auto iProc=0; iProc<mdlThreads(mdl); ++iProc) {
+		if (mdlThreadToProc(mdl,iProc) == mdlProc(mdl)) continue;
+		for(auto i=0; i<nData; i+=nBatch) {
+		    for(auto j=i; j<i+nBatch; ++j) mdlPrefetch(mdl,0,j,iProc);
+		    for(auto j=i; j<i+nBatch; ++j) {
+			auto pRemote = reinterpret_cast<std::uint64_t*>(mdlAcquire(mdl,0,j,iProc));
+			if (*pRemote != ((1UL*iProc)<<33) + 10 + j) ++result[0];
+			mdlRelease(mdl,0,pRemote);
+			}
+		    }
+		}
+	    mdlFinishCache(mdl,0);
+	    if (mdlCore(mdl)==0) {
+		mdlCacheRequestStatistics(mdl,&nLines,&nMessages,1);
+		result[1] = nLines;
+		result[2] = nMessages;
+		}
+	    mdlSetCacheWindow(mdl,0);
+	    delete[] pData;
+	    *out = result;
+            }
+
+	return sizeof(*out);
+	}
+    TEST_F(CacheTest, CacheRequestsAreBatched) {
+	auto ctx = reinterpret_cast<worker::Context*>(mdlWORKER());
+	RESULT result;
+	test::batch::test(ctx,NULL,0,&result,sizeof(result));
+	EXPECT_EQ(result[0],0);
+	if (mdlProcs(ctx->getMDL()) > 1) { // Only other ranks are sent requests
+	    EXPECT_GT(result[1],0);
+	    EXPECT_LT(result[2],result[1]);
+	    }
+	}
+    } // namespace batch
+
 namespace flush {
     static void initFlush(void *vctx, void *g) {
 	//auto ctx = reinterpret_cast<worker::Context*>(vctx);
@@ -542,6 +606,7 @@ void *worker_init(MDL mdl) {
     mdlAddService(mdl,worker::SET_ADD,ctx,(fcnService_t*)SetAdd::serviceSetAdd, sizeof(SetAdd::inSetAdd),0);
     mdlAddService(mdl,test::hash::SERVICE,ctx,(fcnService_t*)test::hash::test, 0,sizeof(std::uint64_t));
     mdlAddService(mdl,test::ro::SERVICE,ctx,(fcnService_t*)test::ro::test,0,sizeof(std::uint64_t));
+    mdlAddService(mdl,test::batch::SERVICE,ctx,(fcnService_t*)test::batch::test,0,sizeof(test::batch::RESULT));
     mdlAddService(mdl,test::flush::SERVICE,ctx,(fcnService_t*)test::flush::test, 0,sizeof(std::uint64_t));
     mdlAddService(mdl,test::flush::after_read::SERVICE,ctx,(fcnService_t*)test::flush::after_read::test,0,sizeof(std::uint64_t));
     mdlAddService(mdl,test::advanced::ro::SERVICE,ctx,(fcnService_t*)test::advanced::ro::test,0,sizeof(std::uint64_t));
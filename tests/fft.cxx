@@ -0,0 +1,169 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gtest/gtest.h"
+#include "mdl.h"
+
+#include <assert.h>
+#include <cmath>
+#include <array>
+#include <vector>
+
+// The MDL grid FFT: a forward transform of a single mode must give exactly
+// that mode, and a forward and inverse transform must return the grid times
+// the number of cells. Run it with "-fftpencils N" (and several ranks) to
+// test the pencil decomposition as well as the slab one.
+namespace {
+
+constexpr int nGrid = 32;
+constexpr int mode[3] = {1,2,3};    // kx, ky, kz of the plane wave
+constexpr double fTolerance = 1e-4; // Relative; the grid may be single precision
+
+namespace worker {
+enum services {
+    STOP,
+    TEST_FFT,
+    };
+
+struct Context {
+    MDL mdl;
+    };
+} // namespace worker
+
+typedef std::array<uint64_t,3> RESULT; // Bad values: forward mode, mode round trip, random round trip
+
+#ifdef MDL_FFTW
+// A reproducible value in [-1,1) for each cell
+double noise(int x,int y,int z) {
+    uint64_t h = ((uint64_t(z)*nGrid + y)*nGrid + x + 1) * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 29; h *= 0xBF58476D1CE4E5B9ull; h ^= h >> 32;
+    return (h >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+    }
+
+double wave(int x,int y,int z) {
+    return cos(2*M_PI*(mode[0]*x + mode[1]*y + mode[2]*z) / nGrid);
+    }
+
+// Fill the grid, then count the cells that differ from it after the round trip
+template<typename F>
+uint64_t roundTrip(MDL mdl,MDLFFT fft,FFTW3(real) *node,F f,uint64_t *pnBadMode=nullptr) {
+    const double N3 = 1.0 * nGrid * nGrid * nGrid;
+    mdlGridCoord first, last, index;
+    uint64_t nBad = 0;
+
+    mdlGridCoordFirstLast(mdl,fft->rgrid,&first,&last,0);
+    auto data = static_cast<FFTW3(real) *>(mdlSetArray(mdl,last.i,sizeof(FFTW3(real)),node));
+    for( index=first; !mdlGridCoordCompare(&index,&last); mdlGridCoordIncrement(&index) )
+	data[index.i] = f(index.x,index.y,index.z);
+
+    mdlFFT(mdl,fft,node);
+    if (pnBadMode) {
+	/* Remember, the grid is now transposed to x,z,y (from x,y,z) */
+	mdlGridCoordFirstLast(mdl,fft->kgrid,&first,&last,0);
+	auto kdata = static_cast<FFTW3(complex) *>(mdlSetArray(mdl,last.i,sizeof(FFTW3(complex)),node));
+	for( index=first; !mdlGridCoordCompare(&index,&last); mdlGridCoordIncrement(&index) ) {
+	    bool bMode = index.x==mode[0] && index.z==mode[1] && index.y==mode[2];
+	    double re = bMode ? 0.5*N3 : 0.0;
+	    if (std::fabs(kdata[index.i][0]-re) > fTolerance*N3 || std::fabs(kdata[index.i][1]) > fTolerance*N3) ++*pnBadMode;
+	    }
+	}
+    mdlIFFT(mdl,fft,reinterpret_cast<FFTW3(complex) *>(node));
+
+    mdlGridCoordFirstLast(mdl,fft->rgrid,&first,&last,0);
+    data = static_cast<FFTW3(real) *>(mdlSetArray(mdl,last.i,sizeof(FFTW3(real)),node));
+    for( index=first; !mdlGridCoordCompare(&index,&last); mdlGridCoordIncrement(&index) )
+	if (std::fabs(data[index.i]/N3 - f(index.x,index.y,index.z)) > fTolerance) ++nBad;
+    return nBad;
+    }
+#endif
+
+// Every thread takes part in the transforms; each checks its part of the grid.
+int serviceFFT(worker::Context *ctx,void *vin,int nIn,void *vout,int nOut) {
+    auto out = static_cast<RESULT *>(vout);
+    auto mdl = ctx->mdl;
+    out->fill(0);
+#ifdef MDL_FFTW
+    auto fft = mdlFFTInitialize(mdl,nGrid,nGrid,nGrid,0,NULL);
+    auto node = mdlFFTMalloc(mdl,fft);
+    node = static_cast<FFTW3(real) *>(mdlSetArray(mdl,0,0,node)); /* The whole node grid on every core */
+    (*out)[1] = roundTrip(mdl,fft,node,wave,&(*out)[0]);
+    (*out)[2] = roundTrip(mdl,fft,node,noise);
+    mdlThreadBarrier(mdl);
+    if (mdlCore(mdl)==0) mdlFFTFree(mdl,fft,node);
+    mdlFFTFinish(mdl,fft);
+#endif
+    return sizeof(*out);
+    }
+
+class FFTTest : public ::testing::Test {};
+
+TEST_F(FFTTest, TransformsAreExact) {
+#ifndef MDL_FFTW
+    GTEST_SKIP() << "MDL was built without FFTW";
+#endif
+    auto ctx = reinterpret_cast<worker::Context*>(mdlWORKER());
+    auto mdl = ctx->mdl;
+    int nThreads = mdlThreads(mdl);
+    std::vector<int> rID(nThreads);
+    RESULT total, result;
+    int nOut;
+
+    for (auto id=1; id<nThreads; ++id) rID[id] = mdlReqService(mdl,id,worker::TEST_FFT,NULL,0);
+    serviceFFT(ctx,NULL,0,&total,sizeof(total));
+    for (auto id=1; id<nThreads; ++id) {
+	mdlGetReply(mdl,rID[id],&result,&nOut);
+	for (auto i=0; i<total.size(); ++i) total[i] += result[i];
+	}
+    EXPECT_EQ(total[0],0);
+    EXPECT_EQ(total[1],0);
+    EXPECT_EQ(total[2],0);
+    }
+
+/*
+** This function is called at the very start by every thread.
+** It returns the "worker context"; in this case the ctx.
+*/
+void *worker_init(MDL mdl) {
+    auto ctx = new worker::Context{mdl};
+    mdlAddService(mdl,worker::TEST_FFT,ctx,(fcnService_t*)serviceFFT,0,sizeof(RESULT));
+    return ctx;
+    }
+
+/*
+** This function is called at the very end for every thread.
+** It needs to destroy the worker context (ctx).
+*/
+void worker_done(MDL mdl, void *vctx) {
+    auto ctx = reinterpret_cast<worker::Context*>(vctx);
+    delete ctx;
+    }
+
+}  // namespace
+
+/*
+** This is invoked for the "master" process after the worker has been setup.
+*/
+int master(MDL mdl,void *vctx) {
+    int argc = mdlGetArgc(mdl);
+    char **argv = mdlGetArgv(mdl);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+    }
+
+int main(int argc,char **argv) {
+    return mdlLaunch(argc,argv,master,worker_init,worker_done);
+    }
@@ -0,0 +1,65 @@
+from __future__ import division
+from collections import deque
+import numpy as np
+import unittest
+import xmlrunner
+from scipy.spatial import cKDTree
+from MASTER import MSR
+from CSM import CSM
+
+oPosition = 0
+oGroup = 4
+
+def fifoFof(r,tau,nMinMembers):
+    """The original fifo linker: grow each group from a seed particle, one
+    neighbour search per member, in a periodic unit box."""
+    tree = cKDTree(np.mod(r+0.5,1.0),boxsize=1.0)
+    group = np.zeros(len(r),dtype=np.int64)
+    iGroup = 0
+    for i in range(len(r)):
+        if group[i]: continue
+        iGroup += 1
+        group[i] = iGroup
+        fifo = deque([i])
+        while fifo:
+            j = fifo.popleft()
+            for k in tree.query_ball_point(tree.data[j],tau):
+                if not group[k]:
+                    group[k] = iGroup
+                    fifo.append(k)
+    n = np.bincount(group)
+    group[n[group] < nMinMembers] = 0
+    return group
+
+class TestFofFifo(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.csm = CSM(dOmega0=0.32,dLambda=0.68,dSigma8=0.83,ns=0.96)
+        cls.msr = MSR()
+        cls.tau = 0.2/32
+        cls.nMinMembers = 10
+        cls.msr.setParameters(bFindGroups=True,iFofInterval=1,dTau=cls.tau,nMinMembers=cls.nMinMembers)
+        cls.time = cls.msr.GenerateIC(cls.csm,z=0,L=100,grid=32,seed=43857)
+
+    def testFofCatalogue(self):
+        self.msr.DomainDecomp()
+        self.msr.BuildTree()
+        nGroups = self.msr.Fof(time=self.time)
+        r = self.msr.GetArray(field=oPosition,time=self.time)
+        gid = self.msr.GetArray(field=oGroup,time=self.time).ravel()
+        ref = fifoFof(r,self.tau,self.nMinMembers)
+        nRef = len(np.unique(ref[ref>0]))
+        print('groups',nGroups,'reference',nRef)
+        self.assertGreater(nRef,0)
+        self.assertEqual(nGroups,nRef)
+        np.testing.assert_array_equal(gid>0,ref>0)
+        # The group field is the global name of the group, so the membership
+        # must be the same partition: each pair is unique in both directions.
+        pairs = np.unique(np.stack((gid[gid>0],ref[ref>0])),axis=1)
+        self.assertEqual(pairs.shape[1],nGroups)
+        self.assertEqual(len(np.unique(pairs[0])),nGroups)
+        self.assertEqual(len(np.unique(pairs[1])),nGroups)
+
+if __name__ == '__main__':
+    print('Running test')
+    unittest.main(verbosity=2,testRunner=xmlrunner.XMLTestRunner(output='test-reports'))
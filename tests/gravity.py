@@ -74,6 +74,60 @@ class TestGravityB0Periodic(unittest.TestCase):
         print('rms',rms)
         self.assertLess(rms,target_rms)
 
+@ddt
+@unittest.skipIf(not os.path.isfile('b0-final.std'), "missing b0-final.std")
+@unittest.skipIf(not os.path.isfile('b0-final-p0.10-asym-k1.acc.npy'), "missing b0-final-p0.10-asym-k1.acc.npy")
+class TestGravityB0PeriodicPM(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.csm = CSM(dOmega0=0.32,dLambda=0.68,dSigma8=0.83,ns=0.96)
+        cls.msr = MSR()
+        cls.time = cls.msr.Load('b0-final.std')
+        cls.a = np.load('b0-final-p0.10-asym-k1.acc.npy')
+        cls.maga = np.linalg.norm(cls.a,axis=1)
+
+    # The mesh adds an error of its own, so the targets are those of Ewald
+    # relaxed by the mesh error at this grid size.
+    @data([0.70,0.003],[0.55,0.002],)
+    @unpack
+    def testGravityPeriodicPM(self,theta,target_rms):
+        self.msr.setParameters(bPeriodic=True,bEwald=False,nReplicas=1,nGridPM=64,bEpsAccStep=True)
+        self.msr.DomainDecomp()
+        self.msr.BuildTree()
+        self.msr.Gravity(time=self.time,theta=theta,ewald=False)
+        self.msr.Reorder()
+        a=self.msr.GetArray(field=2,time=self.time)
+        relerr = np.linalg.norm(a-self.a,axis=1) / self.maga
+        rms = np.std(relerr)
+        print('rms',rms)
+        self.assertLess(rms,target_rms)
+
+class TestGravitySoA(unittest.TestCase):
+    @classmethod
+    def acceleration(cls,msr,time):
+        msr.setParameters(bPeriodic=False,bEwald=False,nReplicas=None)
+        msr.DomainDecomp()
+        msr.BuildTree()
+        msr.Gravity(time=time,theta=0.7)
+        msr.Reorder()
+        return msr.GetArray(field=2,time=time)
+
+    @classmethod
+    def setUpClass(cls):
+        cls.csm = CSM(dOmega0=0.32,dLambda=0.68,dSigma8=0.83,ns=0.96)
+        msr = MSR()
+        time = msr.GenerateIC(cls.csm,z=1,L=100,grid=32,seed=43857)
+        cls.a0 = cls.acceleration(msr,time)
+        cls.msr = MSR()
+        cls.msr.setParameters(bMemSoA=True,bParaWrite=True) # SoA needs parallel writing
+        cls.time = cls.msr.GenerateIC(cls.csm,z=1,L=100,grid=32,seed=43857)
+
+    def testGravitySoA(self):
+        # The acceleration is read back from its separate array
+        a = self.acceleration(self.msr,self.time)
+        self.assertGreater(np.min(np.linalg.norm(self.a0,axis=1)),0.0)
+        np.testing.assert_allclose(a,self.a0,rtol=1e-5,atol=1e-6*np.max(np.abs(self.a0)))
+
 # @ddt
 # class TestGravityB1Final(unittest.TestCase):
 #     @classmethod
@@ -0,0 +1,54 @@
+from __future__ import division
+import numpy as np
+import unittest
+import xmlrunner
+from MASTER import MSR
+from CSM import CSM
+
+SMX_DENSITY = 1
+oDensity = 7
+oParticleID = 14
+
+class TestSmoothNeighborCache(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.csm = CSM(dOmega0=0.32,dLambda=0.68,dSigma8=0.83,ns=0.96)
+        cls.msr = MSR()
+        cls.msr.setParameters(bSmoothCache=True,nSmooth=32)
+        cls.time = cls.msr.GenerateIC(cls.csm,z=49,L=100,grid=32,seed=43857)
+
+    def density(self):
+        iOrder = self.msr.GetArray(field=oParticleID,time=self.time)
+        rho = self.msr.GetArray(field=oDensity,time=self.time)
+        return rho[np.argsort(iOrder.ravel())]
+
+    def fresh(self):
+        self.msr.setParameters(bSmoothCache=False)
+        self.msr.Smooth(SMX_DENSITY,time=self.time)
+        self.msr.setParameters(bSmoothCache=True)
+        return self.density()
+
+    def testCachedSmooth(self):
+        self.msr.DomainDecomp()
+        self.msr.BuildTree()
+        self.msr.Smooth(SMX_DENSITY,time=self.time) # search and record
+        first = self.density()
+        self.msr.Smooth(SMX_DENSITY,time=self.time) # from the cache
+        cached = self.density()
+        np.testing.assert_allclose(cached,first,rtol=1e-6)
+        np.testing.assert_allclose(cached,self.fresh(),rtol=1e-6)
+
+    def testCacheAfterReorder(self):
+        self.msr.DomainDecomp()
+        self.msr.BuildTree()
+        self.msr.Smooth(SMX_DENSITY,time=self.time)
+        self.msr.Reorder()
+        self.msr.DomainDecomp()
+        self.msr.BuildTree()
+        self.msr.Smooth(SMX_DENSITY,time=self.time) # cache must be invalid
+        cached = self.density()
+        np.testing.assert_allclose(cached,self.fresh(),rtol=1e-6)
+
+if __name__ == '__main__':
+    print('Running test')
+    unittest.main(verbosity=2,testRunner=xmlrunner.XMLTestRunner(output='test-reports'))
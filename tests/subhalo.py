@@ -0,0 +1,54 @@
+from __future__ import division
+import os
+import numpy as np
+import unittest
+import xmlrunner
+from MASTER import MSR
+from CSM import CSM
+
+# The SUBHALO structure of pkd.h
+subhaloType = np.dtype([('iPid','<i4'),('iGroup','<i4'),('iParent','<i4'),('iLevel','<i4'),
+                        ('nBound','<i4'),('nOwn','<i4'),('fMass','<f4'),('minPot','<f4'),
+                        ('rPot','<f4',3),('rcom','<f4',3),('vcom','<f4',3)])
+
+class TestSubhaloHierarchy(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.csm = CSM(dOmega0=0.32,dLambda=0.68,dSigma8=0.83,ns=0.96)
+        cls.msr = MSR()
+        cls.msr.setParameters(bFindHopGroups=True,bHopSubhalos=True,nMinMembers=10)
+        cls.time = cls.msr.GenerateIC(cls.csm,z=0,L=100,grid=32,seed=43857)
+
+    def testHierarchy(self):
+        self.msr.DomainDecomp()
+        self.msr.BuildTree()
+        self.msr.Hop(time=self.time)
+        self.msr.SubhaloWrite('subhalo.subhalos')
+        s = np.fromfile('subhalo.subhalos.0',dtype=subhaloType)
+        os.remove('subhalo.subhalos.0')
+        print('subhalos',len(s),'levels',np.bincount(s['iLevel']))
+        self.assertGreater(len(s),0)
+        # The parent is an index among the subhalos of the same domain, and
+        # those are written together.
+        iPid,iFirst = np.unique(s['iPid'],return_index=True)
+        iBase = iFirst[np.searchsorted(iPid,s['iPid'])]
+        bTop = s['iParent'] < 0
+        np.testing.assert_array_equal(bTop,s['iLevel']==0)
+        iParent = iBase[~bTop] + s['iParent'][~bTop]
+        p = s[iParent]
+        c = s[~bTop]
+        np.testing.assert_array_equal(p['iPid'],c['iPid'])
+        np.testing.assert_array_equal(p['iGroup'],c['iGroup'])
+        np.testing.assert_array_equal(p['iLevel'],c['iLevel']-1)
+        # Depth first order: a parent comes before its children
+        self.assertTrue(np.all(iParent < np.flatnonzero(~bTop)))
+        # Members belong to one subhalo only, and a subhalo that owns none
+        # must have at least two children or it would duplicate its child.
+        nChildren = np.bincount(iParent,minlength=len(s))
+        self.assertTrue(np.all((s['nOwn'] > 0) | (nChildren > 1)))
+        self.assertTrue(np.all(s['nOwn'] <= s['nBound']))
+        self.assertTrue(np.all(s['nBound'] >= 10))
+
+if __name__ == '__main__':
+    print('Running test')
+    unittest.main(verbosity=2,testRunner=xmlrunner.XMLTestRunner(output='test-reports'))
@@ -0,0 +1,180 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gtest/gtest.h"
+#include "mdl.h"
+
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+// The MDL scheduler: tasks queued by one thread (like the bucket groups of a
+// gravity walk) are run by idle threads that wait with a task context, the
+// work they add is done by (or stolen from) the thread that ran them, and
+// each task comes back to its owner for completion.
+namespace {
+
+constexpr int nTasks = 2000;
+constexpr int nWork = 3;
+
+namespace worker {
+enum services {
+    STOP,
+    TEST_TASKS,
+    };
+
+// This is the task context: a thread only runs tasks while it has one.
+struct Context {
+    MDL mdl;
+    int nRun;
+    };
+} // namespace worker
+
+struct Task {
+    int iOwner;                 // Core that queued the task
+    std::atomic<int> nRun;      // Times the task was run (must be one)
+    std::atomic<int> iCoreRun;  // Core that ran it
+    std::atomic<int> nWorkDone; // Work packages it added that are done
+    std::atomic<int> nDone;     // Times it came back (must be one)
+    std::atomic<int> bDoneOnOwner;
+    };
+std::vector<Task> tasks(nTasks);
+
+int doWork(void *vtask) {
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::microseconds(20)) {}
+    return 0;
+    }
+
+int doneWork(void *vtask) {
+    ++static_cast<Task *>(vtask)->nWorkDone;
+    return 0;
+    }
+
+int doTask(void *vtask,void *vThread) {
+    auto task = static_cast<Task *>(vtask);
+    auto ctx = static_cast<worker::Context *>(vThread);
+    ++task->nRun;
+    ++ctx->nRun;
+    task->iCoreRun = mdlCore(ctx->mdl);
+    // The work goes on the deque of the thread running the task
+    for (auto i=0; i<nWork; ++i) mdlAddWork(ctx->mdl,task,NULL,NULL,doWork,doneWork,0);
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::microseconds(100)) {}
+    return 0;
+    }
+
+int doneTask(void *vtask) {
+    auto task = static_cast<Task *>(vtask);
+    ++task->nDone;
+    auto ctx = static_cast<worker::Context *>(mdlWORKER());
+    task->bDoneOnOwner = mdlCore(ctx->mdl) == task->iOwner;
+    return 0;
+    }
+
+// Core zero queues all of the tasks, running those it can't queue itself.
+// Every thread then helps until all threads arrive, as the gravity walk does.
+int serviceTasks(worker::Context *ctx,void *vin,int nIn,void *vout,int nOut) {
+    auto pnRun = reinterpret_cast<int*>(vout);
+    auto mdl = ctx->mdl;
+    ctx->nRun = 0;
+    if (mdlSelf(mdl) == 0) {
+	for (auto &task : tasks) {
+	    task.iOwner = mdlCore(mdl);
+	    if (!mdlAddTask(mdl,&task,doTask,doneTask,0)) {
+		doTask(&task,ctx);
+		doneTask(&task);
+		}
+	    }
+	mdlSetTaskContext(mdl,ctx);
+	mdlCompleteAllWork(mdl);
+	}
+    mdlSetTaskContext(mdl,ctx);
+    mdlThreadBarrier(mdl);
+    mdlSetTaskContext(mdl,NULL);
+    mdlCompleteAllWork(mdl);
+    *pnRun = ctx->nRun;
+    return sizeof(*pnRun);
+    }
+
+class TaskTest : public ::testing::Test {};
+
+TEST_F(TaskTest, IdleThreadsStealTasks) {
+    auto ctx = reinterpret_cast<worker::Context*>(mdlWORKER());
+    auto mdl = ctx->mdl;
+    int nThreads = mdlThreads(mdl);
+    std::vector<int> rID(nThreads), nRun(nThreads);
+    int nOut;
+
+    for (auto &task : tasks) {
+	task.nRun = task.nWorkDone = task.nDone = task.bDoneOnOwner = 0;
+	task.iCoreRun = -1;
+	}
+    for (auto id=1; id<nThreads; ++id) rID[id] = mdlReqService(mdl,id,worker::TEST_TASKS,NULL,0);
+    serviceTasks(ctx,NULL,0,&nRun[0],sizeof(nRun[0]));
+    for (auto id=1; id<nThreads; ++id) mdlGetReply(mdl,rID[id],&nRun[id],&nOut);
+
+    int nStolen = 0, nTotal = 0;
+    for (auto &task : tasks) {
+	EXPECT_EQ(task.nRun,1);
+	EXPECT_EQ(task.nWorkDone,nWork);
+	EXPECT_EQ(task.nDone,1);
+	EXPECT_TRUE(task.bDoneOnOwner);
+	if (task.iCoreRun != task.iOwner) ++nStolen;
+	}
+    for (auto id=0; id<nThreads; ++id) nTotal += nRun[id];
+    EXPECT_EQ(nTotal,nTasks);
+    if (mdlCores(mdl) > 1) EXPECT_GT(nStolen,0);
+    else EXPECT_EQ(nStolen,0);
+    }
+
+/*
+** This function is called at the very start by every thread.
+** It returns the "worker context"; in this case the ctx.
+*/
+void *worker_init(MDL mdl) {
+    auto ctx = new worker::Context{mdl,0};
+    mdlSetWorkQueueSize(mdl,64,0);
+    mdlAddService(mdl,worker::TEST_TASKS,ctx,(fcnService_t*)serviceTasks,0,sizeof(int));
+    return ctx;
+    }
+
+/*
+** This function is called at the very end for every thread.
+** It needs to destroy the worker context (ctx).
+*/
+void worker_done(MDL mdl, void *vctx) {
+    auto ctx = reinterpret_cast<worker::Context*>(vctx);
+    delete ctx;
+    }
+
+}  // namespace
+
+/*
+** This is invoked for the "master" process after the worker has been setup.
+*/
+int master(MDL mdl,void *vctx) {
+    int argc = mdlGetArgc(mdl);
+    char **argv = mdlGetArgv(mdl);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+    }
+
+int main(int argc,char **argv) {
+    return mdlLaunch(argc,argv,master,worker_init,worker_done);
+    }
@@ -0,0 +1,73 @@
+/*  This file is part of PKDGRAV3 (http://www.pkdgrav.org/).
+ *  Copyright (c) 2001-2018 Joachim Stadel & Douglas Potter
+ *
+ *  PKDGRAV3 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PKDGRAV3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PKDGRAV3.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gtest/gtest.h"
+#include "workdeque.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+TEST(WorkDeque, OwnerIsLIFOThiefIsFIFO) {
+    int items[4];
+    mdl::WorkDeque<int> wq;
+    wq.reserve(3); // Rounded up to 4
+    EXPECT_EQ(wq.capacity(),4);
+    for (auto &i : items) EXPECT_TRUE(wq.push(&i));
+    EXPECT_FALSE(wq.push(items));
+    EXPECT_EQ(wq.size(),4);
+    EXPECT_EQ(wq.steal(),items+0);
+    EXPECT_EQ(wq.pop(),  items+3);
+    EXPECT_EQ(wq.steal(),items+1);
+    EXPECT_EQ(wq.pop(),  items+2);
+    EXPECT_EQ(wq.pop(),  nullptr);
+    EXPECT_EQ(wq.steal(),nullptr);
+    EXPECT_TRUE(wq.empty());
+    }
+
+// Every item pushed by the owner must be taken exactly once, by the owner or a thief.
+TEST(WorkDeque, ConcurrentSteal) {
+    constexpr int nItems = 200000;
+    constexpr int nThieves = 3;
+    std::vector<std::atomic<int>> taken(nItems);
+    std::vector<int> items(nItems);
+    for (auto i=0; i<nItems; ++i) { items[i] = i; taken[i] = 0; }
+    mdl::WorkDeque<int> wq;
+    wq.reserve(64);
+    std::atomic<bool> bDone(false);
+
+    std::vector<std::thread> thieves;
+    for (auto t=0; t<nThieves; ++t) thieves.emplace_back([&] {
+	while (!bDone || !wq.empty()) {
+	    if (auto p = wq.steal()) ++taken[*p];
+	    }
+	});
+    for (auto i=0; i<nItems; ++i) {
+	while (!wq.push(&items[i])) {
+	    if (auto p = wq.pop()) ++taken[*p];
+	    }
+	if ((i&7)==0) if (auto p = wq.pop()) ++taken[*p];
+	}
+    while (auto p = wq.pop()) ++taken[*p];
+    bDone = true;
+    for (auto &t : thieves) t.join();
+    for (auto i=0; i<nItems; ++i) EXPECT_EQ(taken[i],1) << "item " << i;
+    }
+
+} // namespace